@@ -0,0 +1,95 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_command_ring.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+
+#include "cpc_command_ring.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+_Static_assert((CPC_COMMAND_RING_SIZE & (CPC_COMMAND_RING_SIZE - 1)) == 0,
+               "CPC_COMMAND_RING_SIZE must be a power of two");
+
+#define RING_MASK (CPC_COMMAND_RING_SIZE - 1)
+
+static cpc_command_entry_t entries[CPC_COMMAND_RING_SIZE];
+
+// Free running counters, entries[head & RING_MASK] is the oldest entry.
+// Release stores publish the entry (tail) or its slot (head) to the other
+// side, which loads the counter with acquire before touching entries[].
+static atomic_uint head;
+static atomic_uint tail;
+
+// Producer only
+static uint8_t high_water;
+
+bool cpc_command_ring_full(void){
+  unsigned int t = atomic_load_explicit(&tail, memory_order_relaxed);
+
+  return t - atomic_load_explicit(&head, memory_order_acquire) == CPC_COMMAND_RING_SIZE;
+}
+
+bool cpc_command_ring_push(uint8_t *data, uint16_t size){
+  unsigned int t = atomic_load_explicit(&tail, memory_order_relaxed);
+  unsigned int used = t - atomic_load_explicit(&head, memory_order_acquire);
+
+  if (used == CPC_COMMAND_RING_SIZE) {
+    return false;
+  }
+  entries[t & RING_MASK].data = data;
+  entries[t & RING_MASK].size = size;
+  atomic_store_explicit(&tail, t + 1, memory_order_release);
+  if (used + 1 > high_water) {
+    high_water = (uint8_t) (used + 1);
+  }
+  return true;
+}
+
+cpc_command_entry_t *cpc_command_ring_peek(void){
+  unsigned int h = atomic_load_explicit(&head, memory_order_relaxed);
+
+  if (h == atomic_load_explicit(&tail, memory_order_acquire)) {
+    return NULL;
+  }
+  return &entries[h & RING_MASK];
+}
+
+void cpc_command_ring_pop(void){
+  unsigned int h = atomic_load_explicit(&head, memory_order_relaxed);
+
+  if (h != atomic_load_explicit(&tail, memory_order_acquire)) {
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+  }
+}
+
+void cpc_command_ring_get_stats(cpc_command_ring_stats_t *stats){
+  stats->count = (uint8_t) (atomic_load_explicit(&tail, memory_order_acquire)
+                            - atomic_load_explicit(&head, memory_order_acquire));
+  stats->high_water = high_water;
+}
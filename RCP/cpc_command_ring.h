@@ -0,0 +1,73 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_command_ring.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+
+#ifndef CPC_COMMAND_RING_H_
+#define CPC_COMMAND_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Commands read from CPC and not yet run, a power of two
+#ifndef CPC_COMMAND_RING_SIZE
+#define CPC_COMMAND_RING_SIZE 4
+#endif
+
+typedef struct {
+  uint8_t *data; // CPC receive buffer, freed once the command has run
+  uint16_t size;
+} cpc_command_entry_t;
+
+typedef struct {
+  uint8_t count;      // entries currently queued
+  uint8_t high_water; // most entries ever queued at once
+} cpc_command_ring_stats_t;
+
+/*
+ * Single producer, single consumer queue of received commands, without
+ * locks or critical sections: the producer only writes the tail index and
+ * the consumer only the head index. The producer is whoever reads frames
+ * from CPC (the receive callback, or the command task after it freed an
+ * entry; cpc_custom.c makes sure only one of them does at a time), the
+ * consumer is the command task.
+ */
+
+// Producer. Returns false if the ring is full. O(1).
+bool cpc_command_ring_push(uint8_t *data, uint16_t size);
+bool cpc_command_ring_full(void);
+
+// Consumer. peek returns the oldest entry, or NULL if the ring is empty;
+// it stays queued until pop. O(1).
+cpc_command_entry_t *cpc_command_ring_peek(void);
+void cpc_command_ring_pop(void);
+
+void cpc_command_ring_get_stats(cpc_command_ring_stats_t *stats);
+
+#endif /* CPC_COMMAND_RING_H_ */
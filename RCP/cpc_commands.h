@@ -32,19 +32,353 @@
 #ifndef CPC_COMMANDS_H_
 #define CPC_COMMANDS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include "cpc_frame.h"
+
+/*
+ * Command table, shared by the RCP and the host. Each entry is
+ *
+ *   X(NAME, opcode, request_len, reply_max, retry, handler, option, help)
+ *
+ * NAME        enum CustCpcCommand value CPC_COMMAND_<NAME>
+ * request_len exact length of the arguments after the frame header, or
+ *             CPC_ARGS_VARIABLE if the handler checks it. On the host
+ *             command line, a length of 1 to 4 is one little endian integer.
+ * reply_max   largest reply payload (some replies depend on the chip)
+ * retry       CPC_RETRY_SAFE if running the command twice has the same
+ *             effect as running it once, so the host may send it again
+ *             when the link was lost before the reply came, else
+ *             CPC_RETRY_NEVER
+ * handler     RCP handler, cmd_<handler>() in cpc_custom.c
+ * option      host command line option and script command name
+ * help        host help text, lines separated by \n. NULL for commands
+ *             only used through the host library.
+ *
+ * The RCP answers a command it cannot run (unknown opcode, wrong argument
+ * length) with an empty reply carrying the reason in the frame status. The
+ * reply payload of a command that ran is its own result, laid out as
+ * described with the command.
+ *
+ * Opcodes are sent over the link and must never be reused.
+ */
+#define CPC_ARGS_VARIABLE 0xFF
+#define CPC_RETRY_NEVER 0
+#define CPC_RETRY_SAFE 1
+
+/*
+ * USERDATA page access. Data moves in chunks of up to
+ * CPC_USERDATA_CHUNK_MAX bytes, each protected by cpc_crc32(). Writes are
+ * staged in RAM on the RCP and only reach flash on USERDATA_COMMIT, with
+ * at most one page erase. All integers are little endian.
+ *
+ * USERDATA_READ    args: offset u16, length u16
+ *                  reply: status u8, data, crc32 of data u32 (data and crc
+ *                  only if status is CPC_USERDATA_OK)
+ * USERDATA_STAGE   args: offset u16, data, crc32 of data u32
+ *                  reply: status u8
+ * USERDATA_COMMIT  reply: status u8, erased u8, crc32 of the page u32
+ * USERDATA_ABORT   discards staged data. reply: status u8
+ *
+ * USERDATA_PROVISION writes a list of tokens in one command: the page is
+ * snapshotted, the tokens merged in and the page committed as above, so
+ * words not in the list are kept. Nothing is written unless every token
+ * is inside the page and the list CRC matches.
+ *                  args: { offset u16, length u8, value } per token,
+ *                  crc32 of the list u32
+ *                  reply: as USERDATA_COMMIT
+ *
+ * USERDATA_COMMIT and USERDATA_PROVISION run in steps on the RCP, so CPC
+ * keeps running during the flash work. Before their reply, the RCP sends
+ * progress frames (CPC_FRAME_FLAG_PROGRESS, see cpc_frame.h) with the
+ * bytes of the page handled so far.
+ */
+#define CPC_USERDATA_CHUNK_MAX 128
+
+// Largest USERDATA_PROVISION argument list, so that the frame fits the
+// secondary's default 256 byte receive buffer
+#define CPC_PROVISION_ARGS_MAX 240
+
+enum CpcUserdataStatus {
+  CPC_USERDATA_OK = 0,
+  CPC_USERDATA_BAD_RANGE,     // offset/length outside the page
+  CPC_USERDATA_BAD_CRC,       // chunk corrupted on the link
+  CPC_USERDATA_FLASH_ERROR,   // erase or write failed
+  CPC_USERDATA_VERIFY_FAILED  // flash differs from the staged data after commit
+};
+
+/*
+ * Events are frames the RCP sends without a request, with
+ * CPC_FRAME_FLAG_EVENT set. Their opcode has CPC_EVENT_FLAG set so it
+ * never matches a command, and their seq counts the events sent, so the
+ * host can tell if one was lost.
+ */
+#define CPC_EVENT_FLAG 0x80
+
+/*
+ * CTUNE calibration. The RCP steps the CTUNE value with the CW tone on and
+ * reports each step with a CPC_EVENT_CTUNE_STEP event, so the host and the
+ * frequency instrument stay in lockstep without a round trip per step.
+ * Only one sweep or search runs at a time. All integers are little endian.
+ *
+ * CTUNE_SWEEP      args: start u16, stop u16, step u16, dwell_ms u16
+ *                  Holds each value start, start + step, ... <= stop for
+ *                  dwell_ms, then restores the CTUNE value it found.
+ * CTUNE_SEARCH     args: low u16, high u16
+ *                  Binary search: holds the middle of the range until
+ *                  CTUNE_FEEDBACK, then halves the range. Ends when the host
+ *                  accepts a value or the range is empty, leaving the last
+ *                  value tested set.
+ * CTUNE_FEEDBACK   args: frequency error sign s8. > 0: frequency too high,
+ *                  CTUNE goes up (more load capacitance lowers it); < 0: too
+ *                  low, CTUNE goes down; 0: accept the current value.
+ * CTUNE_STOP       aborts, restoring the CTUNE value found at the start.
+ *                  All reply: status u8 (enum CpcCtuneSweepStatus)
+ *
+ * CPC_EVENT_CTUNE_STEP payload: kind u8 (enum CpcCtuneStepKind), step
+ * index u16, ctune u16, RAIL status u8, RCP time in ms u32
+ */
+#define CPC_EVENT_CTUNE_STEP (CPC_EVENT_FLAG | 1)
+#define CPC_CTUNE_STEP_EVENT_SIZE 10
+
+enum CpcCtuneSweepStatus {
+  CPC_CTUNE_SWEEP_OK = 0,
+  CPC_CTUNE_SWEEP_BAD_ARGS,  // empty range or zero step/dwell
+  CPC_CTUNE_SWEEP_BUSY,      // a sweep or search is already running
+  CPC_CTUNE_SWEEP_IDLE       // feedback or stop without a running search/sweep
+};
+
+/*
+ * Transmit tests. All integers are little endian, powers in deci-dBm.
+ *
+ * TONE_START       args: none, for DEFAULT_802154_CH, the current power and
+ *                  a CW tone, or channel u16, power s16, stream mode u8
+ *                  (RAIL_StreamMode_t). The power set before the tone is
+ *                  restored by TONE_STOP.
+ *                  reply: RAIL status u8, RAIL_STATUS_INVALID_STATE while a
+ *                  tone plan or CTUNE sweep runs
+ * TONE_STOP        args: none
+ *                  Stops the tone, a tone plan or a CTUNE sweep or search.
+ *                  reply: RAIL status u8
+ * TONE_PLAN        args: up to CPC_TONE_PLAN_MAX entries of channel u16,
+ *                  power s16, stream mode u8, duration_ms u16
+ *                  Plays the entries in order, each for its duration, then
+ *                  stops the tone and restores the power. TONE_STOP aborts.
+ *                  reply: status u8 (enum CpcCtuneSweepStatus)
+ *
+ * CPC_TONE_POWER_UNCHANGED as a power keeps the current one.
+ *
+ * CPC_EVENT_TONE_STEP payload: kind u8 (enum CpcCtuneStepKind), entry
+ * index u8, channel u16, power s16, stream mode u8, RAIL status u8, RCP
+ * time in ms u32
+ */
+#define CPC_TONE_ARGS_SIZE 5
+#define CPC_TONE_PLAN_ENTRY_SIZE 7
+#define CPC_TONE_PLAN_MAX 32
+#define CPC_TONE_POWER_UNCHANGED INT16_MIN
+#define CPC_EVENT_TONE_STEP (CPC_EVENT_FLAG | 2)
+#define CPC_TONE_STEP_EVENT_SIZE 12
+
+enum CpcCtuneStepKind {
+  CPC_CTUNE_STEP = 0,        // new value set and tone running
+  CPC_CTUNE_STEP_DONE,       // finished, ctune is the value left set
+  CPC_CTUNE_STEP_ABORTED,    // CTUNE_STOP, TONE_STOP or host disconnect
+  CPC_CTUNE_STEP_ERROR       // RAIL refused the value or the tone, see status
+};
+
+/*
+ * Inventory.
+ *
+ * GET_DEVICE_INFO  args: none
+ *                  reply: customer version u32, SE version u32, bootloader
+ *                  version u32, app properties version u32, CTUNE token
+ *                  u16, current CTUNE u16, chip family u32
+ *                  (SYSTEM_PartFamily_TypeDef), unique ID u64
+ *                  The versions, family and unique ID are read once after
+ *                  boot, the CTUNE values on every request.
+ */
+#define CPC_DEVICE_INFO_SIZE 32
+
+/*
+ * Runtime statistics, counted by the RCP since boot. All counters are u32
+ * and wrap, so the host takes differences modulo 2^32. Handler time is
+ * counted in core clock cycles (Cortex-M DWT cycle counter) and wraps
+ * after 2^32 cycles of handler time per opcode, under a minute at 80 MHz.
+ *
+ * GET_STATS        args: first opcode u8
+ *                  reply: uptime in ms u32, core clock in Hz u32, commands
+ *                  run u32 (rejected ones included), rejected u32 (unknown
+ *                  opcode, bad length or version), writes refused u32
+ *                  (sl_cpc_write() errors), write failures u32 (write
+ *                  completions with an error), reconnects u32 (host
+ *                  disconnects reported to cpc_error_cb), reply pool
+ *                  acquire failures u32, reply pool high water u8, command
+ *                  ring high water u8, next opcode u8, entry count u8, then
+ *                  an entry per opcode >= first that has run: opcode u8,
+ *                  commands completed u32, handler cycles u32
+ *                  At most CPC_STATS_ENTRIES_MAX entries fit a reply; next
+ *                  opcode is where the following request starts, or 0 once
+ *                  all were sent.
+ */
+#define CPC_STATS_HEADER_SIZE 36
+#define CPC_STATS_ENTRY_SIZE 9
+#define CPC_STATS_ENTRIES_MAX 10
+
+/*
+ * RCP trace. The RCP writes fixed-size binary records into a RAM ring
+ * (cpc_trace.h) and never formats them; TRACE_DRAIN moves them to the
+ * host, which rebuilds the timeline. A record is CPC_TRACE_RECORD_SIZE
+ * bytes: time u32 (core clock cycles, DWT cycle counter), event id u8,
+ * then its arguments a u8, b u16, c u32.
+ *
+ * TRACE_DRAIN      args: none
+ *                  reply: core clock in Hz u32, records lost u32 (written
+ *                  over before they were drained, since the previous
+ *                  drain), records left u16, record count u8, then up to
+ *                  CPC_TRACE_DRAIN_MAX records, oldest first. Drained
+ *                  records are removed from the ring.
+ *
+ * Trace events are listed once:
+ *
+ *   X(NAME, id, level, args, format)
+ *
+ * NAME   CPC_TRACE_<NAME> event id, written with CPC_TRACE(NAME, a, b, c)
+ * level  ERROR, INFO or DEBUG: the record is only compiled in when the
+ *        RCP's CPC_TRACE_LEVEL is at least CPC_TRACE_LEVEL_<level>
+ * args   which of a, b and c the host passes to format, in that order
+ * format host printf format of the message
+ *
+ * Event ids are read by the host and must never be reused.
+ */
+#define CPC_TRACE_RECORD_SIZE 12
+#define CPC_TRACE_DRAIN_HEADER_SIZE 11
+#define CPC_TRACE_DRAIN_MAX 10
+
+#define CPC_TRACE_LEVEL_OFF 0
+#define CPC_TRACE_LEVEL_ERROR 1
+#define CPC_TRACE_LEVEL_INFO 2
+#define CPC_TRACE_LEVEL_DEBUG 3
+
+#define CPC_TRACE_EVENT_TABLE(X) \
+  X(COMMAND_RX, 1, INFO, "abc", "command 0x%02x seq %u received, %u bytes") \
+  X(COMMAND_DONE, 2, INFO, "abc", "command 0x%02x done, %u reply bytes, %u handler cycles") \
+  X(COMMAND_STEP, 3, DEBUG, "abc", "command 0x%02x step, %u bytes done, %u handler cycles") \
+  X(COMMAND_REJECTED, 4, ERROR, "abc", "command 0x%02x rejected with frame status %u, %u argument bytes") \
+  X(FRAME_DROPPED, 5, ERROR, "bc", "frame of version %u dropped, %u bytes") \
+  X(DRIVER_STATUS, 6, INFO, "ac", "command 0x%02x driver status 0x%x") \
+  X(READ_FAILED, 7, ERROR, "c", "sl_cpc_read failed, status 0x%x") \
+  X(WRITE_REFUSED, 8, ERROR, "abc", "write of 0x%02x refused, %u bytes, status 0x%x") \
+  X(WRITE_FAILED, 9, ERROR, "c", "write completed with status 0x%x") \
+  X(WRITE_DONE, 10, DEBUG, "", "write completed") \
+  X(NO_REPLY_SLOT, 11, DEBUG, "", "no free reply slot, command waits") \
+  X(EVENT_SENT, 12, DEBUG, "abc", "event 0x%02x seq %u sent, %u bytes") \
+  X(ENDPOINT_SETUP_FAILED, 13, ERROR, "bc", "endpoint setup step %u failed, status 0x%x") \
+  X(CONNECTED, 14, INFO, "", "host connected") \
+  X(ENDPOINT_ERROR, 15, INFO, "b", "endpoint error callback, sl_cpc_endpoint_state_t %u") \
+  X(ENDPOINT_FREED, 16, INFO, "b", "endpoint freed, %u reply buffers of dropped writes reclaimed") \
+  X(ENDPOINT_CLOSE_FAILED, 17, ERROR, "c", "endpoint close failed, status 0x%x") \
+  X(WRITE_STALE, 18, ERROR, "", "completion of a reclaimed write ignored")
+
+#define CPC_TRACE_ENUM(name, id, level, args, format) \
+  CPC_TRACE_##name = id, \
+  CPC_TRACE_##name##_LEVEL = CPC_TRACE_LEVEL_##level,
+
+enum CpcTraceEvent {
+  CPC_TRACE_EVENT_TABLE(CPC_TRACE_ENUM)
+};
+
+#define CPC_COMMAND_TABLE(X) \
+  X(GET_CUST_VERSION, 1, 0, 4, CPC_RETRY_SAFE, get_cust_version, "cust_version", \
+    "Returns 32-bit customer version defined in the RCP firmware application (CUSTOMER_VERSION).") \
+  X(GET_SE_VERSION, 2, 0, 4, CPC_RETRY_SAFE, get_se_version, "se_version", \
+    "Returns the Secure Element version on the series 2 device running the RCP firmware.") \
+  X(GET_CTUNE_TOKEN, 3, 0, 2, CPC_RETRY_SAFE, get_ctune_token, "get_ctune_token", \
+    "Reads the CTUNE manufacturing token stored in userdata flash on the RCP target. This is a 16-bit value and will\n" \
+    "be FF FF when not already flashed/programmed") \
+  X(SET_CTUNE_TOKEN, 4, 2, 4, CPC_RETRY_NEVER, set_ctune_token, "set_ctune_token", \
+    "Writes the CTUNE manufacturing token stored in userdata flash on the RCP target. Note that if the CTUNE\n" \
+    "manufacturing token is already written, this call will fail as the value can only be written if blank.") \
+  X(GET_CTUNE_VALUE, 5, 0, 2, CPC_RETRY_SAFE, get_ctune_value, "get_ctune_value", \
+    "Reads the CTUNE register value currently set in firmware running on the RCP target. This is a 16-bit value") \
+  X(SET_CTUNE_VALUE, 6, 2, 1, CPC_RETRY_SAFE, set_ctune_value, "set_ctune_value", \
+    "Sets the CTUNE register value in firmware running on the RCP target. This is a 16-bit value\n" \
+    "NOTE: The radio needs to be in idle mode for this command to succeeed") \
+  X(TONE_START, 7, CPC_ARGS_VARIABLE, 1, CPC_RETRY_NEVER, tone_start, "tone_start", \
+    "Enable a tone on the transmitter of the RCP. The optional <value> is <channel>,<power_dbm>[,<mode>], mode\n" \
+    "being cw (default), pn9, 10, cw_phasenoise, ramp or cw_shifted. Without it, a CW tone on channel 11 at 0 dBm.") \
+  X(TONE_STOP, 8, 0, 1, CPC_RETRY_SAFE, tone_stop, "tone_stop", \
+    "Disable the tone on the transmitter of the RCP, or abort a tone plan or CTUNE sweep, and restore the transmit power.") \
+  X(GPIO_WRITE, 9, 1, 2, CPC_RETRY_SAFE, gpio_write, "gpio_write", \
+    "Writes the value of the GPIO pins(s) as determined by the RCP firmware. In the example firmware,\n" \
+    "value=\"1\" turns on the LED on the BRD4181B and value=\"0\" turns it off.") \
+  X(ERASE_USERDATA_PAGE, 10, 0, 4, CPC_RETRY_NEVER, erase_userdata_page, "erase_userdata_page", \
+    "Erase the page on the RCP device containing the manfacturing tokens, including the CTUNE manufacturing token.\n" \
+    "This allows a previously written CTUNE manufacturing token to be written to a new value.\n" \
+    "WARNING - any other values stored in the userdata page will also be erased, so use caution") \
+  X(GET_BTL_VERSION, 11, 0, 4, CPC_RETRY_SAFE, get_btl_version, "btl_version", \
+    "Gets the bootloader version running on the RCP target.") \
+  X(GET_APP_PROPERTIES_VERSION, 12, 0, 4, CPC_RETRY_SAFE, get_app_properties_version, "app_properties_version", \
+    "Gets the app version from the Application_Properties_t struct of the RCP application.") \
+  X(USERDATA_READ, 13, 4, 1 + CPC_USERDATA_CHUNK_MAX + 4, CPC_RETRY_SAFE, userdata_read, "userdata_read_chunk", NULL) \
+  X(USERDATA_STAGE, 14, CPC_ARGS_VARIABLE, 1, CPC_RETRY_NEVER, userdata_stage, "userdata_stage_chunk", NULL) \
+  X(USERDATA_COMMIT, 15, 0, 6, CPC_RETRY_NEVER, userdata_commit, "userdata_commit", NULL) \
+  X(USERDATA_ABORT, 16, 0, 1, CPC_RETRY_SAFE, userdata_abort, "userdata_abort", NULL) \
+  X(USERDATA_PROVISION, 17, CPC_ARGS_VARIABLE, 6, CPC_RETRY_NEVER, userdata_provision, "provision", \
+    "Writes several tokens to the userdata page in one step, keeping every other value in the page. <value> is a\n" \
+    "list of <offset>=<value>[/<bytes>] (default 4 bytes, little endian), e.g. \"0x100=0xa5/2,0x104=0x12345678\".\n" \
+    "The page is only erased if needed and is verified after writing.") \
+  X(CTUNE_SWEEP, 18, 8, 1, CPC_RETRY_NEVER, ctune_sweep, "ctune_sweep", \
+    "Steps the CTUNE value with the CW tone on and prints a timestamped line per step. <value> is\n" \
+    "<start>,<stop>,<step>,<dwell_ms>. The CTUNE value found at the start is restored at the end.") \
+  X(CTUNE_SEARCH, 19, 4, 1, CPC_RETRY_NEVER, ctune_search, "ctune_search", \
+    "Binary search for the CTUNE value with the CW tone on. <value> is <low>,<high>. For each value tried, enter\n" \
+    "the sign of the measured frequency error on stdin (+: too high, -: too low, 0: accept). The value found is\n" \
+    "left set.") \
+  X(CTUNE_FEEDBACK, 20, 1, 1, CPC_RETRY_NEVER, ctune_feedback, "ctune_feedback", NULL) \
+  X(CTUNE_STOP, 21, 0, 1, CPC_RETRY_SAFE, ctune_stop, "ctune_stop", \
+    "Aborts a running CTUNE sweep or search and restores the CTUNE value.") \
+  X(TONE_PLAN, 22, CPC_ARGS_VARIABLE, 1, CPC_RETRY_NEVER, tone_plan, "tone_plan", \
+    "Plays a list of tones on the RCP and prints a timestamped line per tone. <value> is a list of\n" \
+    "<channel>:<power_dbm>:<duration_ms>[:<mode>], e.g. \"11:0:500,18:8.5:500:pn9,26:-10:500\" (up to 32 entries).") \
+  X(GET_DEVICE_INFO, 23, 0, CPC_DEVICE_INFO_SIZE, CPC_RETRY_SAFE, get_device_info, "device_info", \
+    "Returns the customer, SE, bootloader and app properties versions, the CTUNE token and value, the chip family\n" \
+    "and the unique ID of the RCP in one reply.") \
+  X(GET_STATS, 24, 1, CPC_STATS_HEADER_SIZE + CPC_STATS_ENTRIES_MAX * CPC_STATS_ENTRY_SIZE, CPC_RETRY_SAFE, get_stats, "stats", \
+    "Prints the RCP counters: commands and handler time per command, rejected commands, write errors, reconnects\n" \
+    "and queue high water marks. [<value>] is text (since boot, default), delta (since the previous stats of the\n" \
+    "run) or prometheus (text exposition format).") \
+  X(TRACE_DRAIN, 25, 0, CPC_TRACE_DRAIN_HEADER_SIZE + CPC_TRACE_DRAIN_MAX * CPC_TRACE_RECORD_SIZE, CPC_RETRY_NEVER, trace_drain, "trace", \
+    "Drains the trace buffer of the RCP and prints one line per record, with its time in microseconds since the\n" \
+    "first one.")
+
+#define CPC_COMMAND_ENUM(name, opcode, request_len, reply_max, retry, handler, option, help) \
+  CPC_COMMAND_##name = opcode,
+
 enum CustCpcCommand {
-  CPC_COMMAND_GET_CUST_VERSION=1,
-  CPC_COMMAND_GET_SE_VERSION,
-  CPC_COMMAND_GET_CTUNE_TOKEN,
-  CPC_COMMAND_SET_CTUNE_TOKEN,
-  CPC_COMMAND_GET_CTUNE_VALUE,
-  CPC_COMMAND_SET_CTUNE_VALUE,
-  CPC_COMMAND_TONE_START,
-  CPC_COMMAND_TONE_STOP,
-  CPC_COMMAND_GPIO_WRITE,
-  CPC_COMMAND_ERASE_USERDATA_PAGE,
-  CPC_COMMAND_GET_BTL_VERSION,
-  CPC_COMMAND_GET_APP_PROPERTIES_VERSION
+  CPC_COMMAND_TABLE(CPC_COMMAND_ENUM)
 };
 
+#define CPC_COMMAND_MAX_OPCODE(name, opcode, request_len, reply_max, retry, handler, option, help) \
+  CPC_COMMAND_LAST_##name = opcode,
+
+// Highest opcode in the table, opcodes must be listed in increasing order
+enum {
+  CPC_COMMAND_TABLE(CPC_COMMAND_MAX_OPCODE)
+  CPC_COMMAND_OPCODE_MAX_PLUS_ONE
+};
+#define CPC_COMMAND_OPCODE_MAX (CPC_COMMAND_OPCODE_MAX_PLUS_ONE - 1)
+
+// CRC-32 (IEEE 802.3), bitwise to keep the RCP code small. Pass 0 as crc
+// for the first block and the previous result to continue.
+static inline uint32_t cpc_crc32(uint32_t crc, const uint8_t *data, size_t len){
+  crc = ~crc;
+  while (len-- > 0) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
+
 #endif /* CPC_COMMANDS_H_ */
@@ -0,0 +1,228 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_ctune_sweep.c
+ * cpc_ctune_sweep.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include "cpc_ctune_sweep.h"
+#include "cpc_commands.h"
+#include "cpc_custom.h"
+#include "cpc_tone.h"
+#include <stdbool.h>
+#include "rail.h"
+#include "sl_sleeptimer.h"
+
+extern RAIL_Handle_t emPhyRailHandle;
+
+enum sweep_mode {
+  SWEEP_IDLE,
+  SWEEP_LINEAR,
+  SWEEP_SEARCH
+};
+
+static struct {
+  enum sweep_mode mode;
+  uint16_t ctune;           // value being held
+  uint16_t index;           // step number, from 0
+  uint16_t stop;            // linear sweep
+  uint16_t step;
+  uint16_t dwell_ms;
+  uint16_t low;             // search range still to try
+  uint16_t high;
+  uint32_t original_tune;   // restored unless a search finds a value
+  sl_sleeptimer_timer_handle_t timer;
+} sweep;
+
+// Set from the sleeptimer interrupt
+static volatile bool dwell_elapsed = false;
+
+// Step event waiting for a free reply buffer
+static bool event_pending = false;
+static uint8_t event[CPC_CTUNE_STEP_EVENT_SIZE];
+
+static uint32_t now_ms(void){
+  uint64_t ms = 0;
+
+  sl_sleeptimer_tick64_to_ms(sl_sleeptimer_get_tick_count64(), &ms);
+  return (uint32_t) ms;
+}
+
+static void queue_event(uint8_t kind, uint16_t ctune, uint8_t status){
+  uint32_t time = now_ms();
+
+  event[0] = kind;
+  event[1] = sweep.index & 0xff;
+  event[2] = sweep.index >> 8;
+  event[3] = ctune & 0xff;
+  event[4] = ctune >> 8;
+  event[5] = status;
+  for (int i = 0; i < 4; i++) {
+    event[6 + i] = (uint8_t) (time >> (8 * i));
+  }
+  event_pending = true;
+  cpc_custom_signal();
+}
+
+static void on_dwell(sl_sleeptimer_timer_handle_t *handle, void *data){
+  (void)handle;
+  (void)data;
+  dwell_elapsed = true;
+  cpc_custom_signal();
+}
+
+static void finish(uint8_t kind, uint8_t status){
+  RAIL_StopTxStream(emPhyRailHandle);
+  sl_sleeptimer_stop_timer(&sweep.timer);
+  if (kind == CPC_CTUNE_STEP_ERROR) {
+    queue_event(kind, sweep.ctune, status); // report the value RAIL refused
+  }
+  if ((kind != CPC_CTUNE_STEP_DONE) || (sweep.mode == SWEEP_LINEAR)) {
+    RAIL_SetTune(emPhyRailHandle, sweep.original_tune);
+    sweep.ctune = (uint16_t) sweep.original_tune;
+  }
+  if (kind != CPC_CTUNE_STEP_ERROR) {
+    queue_event(kind, sweep.ctune, status);
+  }
+  sweep.mode = SWEEP_IDLE;
+}
+
+// Sets ctune with the tone on and reports it
+static void hold(uint16_t ctune){
+  RAIL_Status_t status;
+
+  sweep.ctune = ctune;
+  // The tune can only change with the radio idle
+  RAIL_StopTxStream(emPhyRailHandle);
+  status = RAIL_SetTune(emPhyRailHandle, ctune);
+  if (status == RAIL_STATUS_NO_ERROR) {
+    status = RAIL_StartTxStream(emPhyRailHandle, DEFAULT_802154_CH, RAIL_STREAM_CARRIER_WAVE);
+  }
+  if (status != RAIL_STATUS_NO_ERROR) {
+    finish(CPC_CTUNE_STEP_ERROR, status);
+    return;
+  }
+  queue_event(CPC_CTUNE_STEP, ctune, status);
+  if (sweep.mode == SWEEP_LINEAR) {
+    dwell_elapsed = false;
+    sl_sleeptimer_start_timer_ms(&sweep.timer, sweep.dwell_ms, on_dwell, NULL, 0, 0);
+  }
+}
+
+uint8_t cpc_ctune_sweep_start(uint16_t start, uint16_t stop, uint16_t step, uint16_t dwell_ms){
+  if ((sweep.mode != SWEEP_IDLE) || cpc_tone_plan_running()) {
+    return CPC_CTUNE_SWEEP_BUSY;
+  }
+  if ((start > stop) || (step == 0) || (dwell_ms == 0)) {
+    return CPC_CTUNE_SWEEP_BAD_ARGS;
+  }
+  sweep.mode = SWEEP_LINEAR;
+  sweep.index = 0;
+  sweep.stop = stop;
+  sweep.step = step;
+  sweep.dwell_ms = dwell_ms;
+  sweep.original_tune = RAIL_GetTune(emPhyRailHandle);
+  hold(start);
+  return CPC_CTUNE_SWEEP_OK;
+}
+
+uint8_t cpc_ctune_search_start(uint16_t low, uint16_t high){
+  if ((sweep.mode != SWEEP_IDLE) || cpc_tone_plan_running()) {
+    return CPC_CTUNE_SWEEP_BUSY;
+  }
+  if (low > high) {
+    return CPC_CTUNE_SWEEP_BAD_ARGS;
+  }
+  sweep.mode = SWEEP_SEARCH;
+  sweep.index = 0;
+  sweep.low = low;
+  sweep.high = high;
+  sweep.original_tune = RAIL_GetTune(emPhyRailHandle);
+  hold(low + (high - low) / 2);
+  return CPC_CTUNE_SWEEP_OK;
+}
+
+uint8_t cpc_ctune_feedback(int8_t error){
+  if (sweep.mode != SWEEP_SEARCH) {
+    return CPC_CTUNE_SWEEP_IDLE;
+  }
+  if (error > 0) {
+    // Frequency too high: more load capacitance
+    if (sweep.ctune >= sweep.high) {
+      error = 0; // nothing left above
+    } else {
+      sweep.low = sweep.ctune + 1;
+    }
+  } else if (error < 0) {
+    if (sweep.ctune <= sweep.low) {
+      error = 0; // nothing left below
+    } else {
+      sweep.high = sweep.ctune - 1;
+    }
+  }
+  if (error == 0) {
+    finish(CPC_CTUNE_STEP_DONE, RAIL_STATUS_NO_ERROR);
+  } else {
+    sweep.index++;
+    hold(sweep.low + (sweep.high - sweep.low) / 2);
+  }
+  return CPC_CTUNE_SWEEP_OK;
+}
+
+uint8_t cpc_ctune_sweep_stop(void){
+  if (sweep.mode == SWEEP_IDLE) {
+    return CPC_CTUNE_SWEEP_IDLE;
+  }
+  finish(CPC_CTUNE_STEP_ABORTED, RAIL_STATUS_NO_ERROR);
+  return CPC_CTUNE_SWEEP_OK;
+}
+
+bool cpc_ctune_sweep_running(void){
+  return sweep.mode != SWEEP_IDLE;
+}
+
+void cpc_ctune_sweep_reset(void){
+  cpc_ctune_sweep_stop();
+  event_pending = false; // nobody left to tell
+}
+
+void cpc_ctune_sweep_process(void){
+  if (event_pending) {
+    if (!cpc_custom_send_event(CPC_EVENT_CTUNE_STEP, event, sizeof(event))) {
+      return; // retried on the next call, the sweep waits for it
+    }
+    event_pending = false;
+  }
+  if ((sweep.mode == SWEEP_LINEAR) && dwell_elapsed) {
+    dwell_elapsed = false;
+    if (sweep.stop - sweep.ctune < sweep.step) {
+      finish(CPC_CTUNE_STEP_DONE, RAIL_STATUS_NO_ERROR);
+    } else {
+      sweep.index++;
+      hold(sweep.ctune + sweep.step);
+    }
+  }
+}
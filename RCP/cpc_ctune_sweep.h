@@ -0,0 +1,60 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_ctune_sweep.h
+ * cpc_ctune_sweep.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_CTUNE_SWEEP_H_
+#define CPC_CTUNE_SWEEP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * CTUNE sweep and binary search engine. Steps are timed with a sleeptimer
+ * and reported with CPC_EVENT_CTUNE_STEP events sent from
+ * cpc_ctune_sweep_process(), which must be called from the RCP's polling
+ * loop. A step is not advanced until its event has been sent. Status
+ * values are enum CpcCtuneSweepStatus.
+ */
+
+uint8_t cpc_ctune_sweep_start(uint16_t start, uint16_t stop, uint16_t step, uint16_t dwell_ms);
+uint8_t cpc_ctune_search_start(uint16_t low, uint16_t high);
+uint8_t cpc_ctune_feedback(int8_t error);
+
+bool cpc_ctune_sweep_running(void);
+
+// Aborts a sweep or search and restores the CTUNE value found at its start
+uint8_t cpc_ctune_sweep_stop(void);
+
+// Same without an event, for when the host has gone away
+void cpc_ctune_sweep_reset(void);
+
+void cpc_ctune_sweep_process(void);
+
+#endif /* CPC_CTUNE_SWEEP_H_ */
@@ -31,8 +31,8 @@
 #include <cpc_custom.h>
 #include "cpc_commands.h"
 #include "sl_cpc.h"
+#include <stdatomic.h>
 #include <stdint.h>
-#include <stdio.h>
 #include "em_gpio.h"
 #include "rail_ieee802154.h"
 #include "rail.h"
@@ -40,15 +40,36 @@
 #include "btl_interface.h"
 #include "em_cmu.h"
 #include "em_msc.h"
+#include "em_system.h"
+#include "em_core.h"
+#include "em_device.h"
+#include "sl_sleeptimer.h"
+#include "cpc_reply_pool.h"
+#include "cpc_command_ring.h"
+#include "cpc_userdata.h"
+#include "cpc_ctune_sweep.h"
+#include "cpc_tone.h"
+#include "cpc_trace.h"
+#include "cpc_link.h"
 
 #if defined(SL_CATALOG_KERNEL_PRESENT)
+#include "FreeRTOS.h"
 #include "task.h"
-#endif
 
-#define SWODEBUG 1
+// Command task, sleeps until cpc_custom_signal() (can be overridden by
+// global compiler define)
+#ifndef CPC_CUSTOM_TASK_STACK_SIZE
+#define CPC_CUSTOM_TASK_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+#ifndef CPC_CUSTOM_TASK_PRIORITY
+#define CPC_CUSTOM_TASK_PRIORITY 1
+#endif
+#endif
 
-#define debug_print(...) \
-            do { if (SWODEBUG) printf(__VA_ARGS__); } while (0)
+// Delay before an event write CPC refused is tried again
+#ifndef CPC_CUSTOM_RETRY_MS
+#define CPC_CUSTOM_RETRY_MS 10
+#endif
 
 // Fetch CTUNE value from USERDATA page as a manufacturing token
 #define USERDATA_CTUNE_OFFSET  0x100
@@ -56,15 +77,23 @@
 #define MFG_CTUNE_VAL  (*((uint16_t *) (MFG_CTUNE_ADDR)))
 
 static sl_cpc_endpoint_handle_t custom_endpoint_handle;
-typedef enum {
-  CPC_ENDPOINT_CLOSED,
-  CPC_ENDPOINT_OPEN,
-  CPC_ENDPOINT_OPEN_WAIT_FOR_CONNECTION,
-  CPC_ENDPOINT_CONNECTED,
-  CPC_ENDPOINT_DISCONNECTED,
-} cpc_endpoint_status_t;
-
-static cpc_endpoint_status_t endpoint_status = CPC_ENDPOINT_CLOSED;
+// Endpoint connection, opened and reopened by the command task
+static cpc_link_t custom_link;
+// Commands announced by CPC, and those read into the command ring, see
+// fill_command_ring()
+static atomic_uint rx_announced;
+static atomic_uint rx_read;
+static atomic_flag rx_reading = ATOMIC_FLAG_INIT;
+// Reply slot of the command at the head of the ring, kept across the runs
+// of a command that is not finished
+static cpc_reply_slot_t *command_slot = NULL;
+// Set by cpc_custom_signal(), cleared when cpc_custom_process_action() runs
+static volatile bool work_pending = true;
+// Wakes the command task while the endpoint waits on CPC
+static sl_sleeptimer_timer_handle_t retry_timer;
+#if defined(SL_CATALOG_KERNEL_PRESENT)
+static TaskHandle_t custom_task_handle = NULL;
+#endif
 extern RAIL_Handle_t emPhyRailHandle;
 
 // 32-bit customer version (can be overridden global compiler define)
@@ -73,261 +102,713 @@ extern RAIL_Handle_t emPhyRailHandle;
 #endif
 const uint32_t customer_version = CUSTOMER_VERSION;
 
-#define DEFAULT_802154_CH 11 //default channel 11
-
 // Context for SE command(s)
 sl_se_command_context_t cmd_ctx;
 
-uint8_t* tx_ptr=NULL; // ptr for TX
+// GET_DEVICE_INFO fields that cannot change until the next reset, read on
+// the first request so that later ones skip the SE and bootloader calls
+static struct {
+  bool valid;
+  uint32_t se_version;
+  uint32_t btl_version;
+  uint32_t family;
+  uint64_t unique_id;
+} device_info;
+
+// GET_STATS counters. Each is written from one context only: the command
+// task, except write_failures (write completion), so plain increments are
+// enough. Reconnects are counted by the link.
+static struct {
+  uint32_t commands;
+  uint32_t rejected;
+  uint32_t write_refused;
+  uint32_t write_failures;
+  uint32_t completed[CPC_COMMAND_OPCODE_MAX + 1];
+  uint32_t cycles[CPC_COMMAND_OPCODE_MAX + 1];
+} stats;
 
-// Buffer management defines for FreeRTOS/bare metal
-#if defined(SL_CATALOG_KERNEL_PRESENT)
-#define MALLOC pvPortMalloc
-#define FREE   vPortFree
+/***************************************************************************//**
+ * Command handlers, one per entry of CPC_COMMAND_TABLE. Each gets exactly
+ * request_len argument bytes (any number for CPC_ARGS_VARIABLE), writes at
+ * most reply_max bytes to reply and returns the reply length (0 for no
+ * reply). A handler for slow flash work does it in steps: it writes its
+ * progress (done u16, total u16) to reply and returns CPC_REPLY_PENDING,
+ * and is called again with the same arguments on the next run of the
+ * command task, until it returns its reply.
+ ******************************************************************************/
+
+#define CPC_REPLY_PENDING 0xFF
+
+typedef uint8_t (*cpc_command_handler_t)(const uint8_t *args, uint16_t args_len, uint8_t *reply);
+
+typedef struct {
+  cpc_command_handler_t handler;
+  uint8_t request_len;
+  uint8_t reply_max;
+} cpc_command_desc_t;
+
+static uint8_t cmd_get_cust_version(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args;
+  (void)args_len;
+  cpc_put_u32(reply, customer_version);
+  return sizeof(customer_version);
+}
+
+static uint8_t cmd_get_se_version(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  sl_status_t slstatus;
+  uint32_t se_version;
+  (void)args;
+  (void)args_len;
+
+  slstatus = sl_se_get_se_version(&cmd_ctx, &se_version);
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_GET_SE_VERSION, 0, slstatus);
+  (void)slstatus;
+  cpc_put_u32(reply, se_version);
+  return sizeof(se_version);
+}
+
+static uint8_t cmd_get_ctune_token(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args;
+  (void)args_len;
+  cpc_put_u16(reply, MFG_CTUNE_VAL);
+  return sizeof(MFG_CTUNE_VAL);
+}
+
+static uint8_t cmd_set_ctune_token(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  uint32_t ctune_val=0u;
+  (void)args_len;
+
+  // received value is the lsb as uint_16
+  ctune_val = cpc_get_u16(&args[0]);
+  // ctune is lower 16-bits, upper 16-bits are all 0xffff
+  ctune_val = (ctune_val & 0x0000ffff) | 0xffff0000;
+#if defined (_SILICON_LABS_32B_SERIES_2_CONFIG_1)
+  // xG21 writes userdata with the SE
+  sl_status_t slstatus = sl_se_write_user_data(&cmd_ctx, USERDATA_CTUNE_OFFSET, &ctune_val, 4);
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_SET_CTUNE_TOKEN, 0, slstatus);
+  cpc_put_u16(reply, (uint16_t) slstatus); //lower two bytes of slstatus
+  return sizeof(uint16_t);
 #else
-#define MALLOC malloc
-#define FREE free
+  // use MSC write API to write userdata
+  MSC_Status_TypeDef msc_status;
+  CMU_ClockEnable(cmuClock_MSC, true);
+  MSC_Init();
+  msc_status = MSC_WriteWord((uint32_t *)MFG_CTUNE_ADDR,&ctune_val,sizeof(ctune_val));
+  MSC_Deinit();
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_SET_CTUNE_TOKEN, 0, msc_status);
+  cpc_put_u32(reply, (uint32_t) msc_status);
+  return sizeof(uint32_t);
 #endif
+}
 
-static void process_command(uint8_t *commandData, uint16_t size){
+static uint8_t cmd_get_ctune_value(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  uint32_t ctune_val;
+  (void)args;
+  (void)args_len;
+
+  ctune_val = (uint16_t) RAIL_GetTune(emPhyRailHandle);
+  cpc_put_u16(reply, (uint16_t) ctune_val); // return ctune_val as uint16_t
+  return sizeof(uint16_t);
+}
 
-  (void) size;
+static uint8_t cmd_set_ctune_value(const uint8_t *args, uint16_t args_len, uint8_t *reply){
   RAIL_Status_t rail_status;
-  sl_status_t slstatus=SL_STATUS_OK;
   uint32_t ctune_val=0u;
-  uint32_t se_version;
-  uint8_t transmit_len;
-  BootloaderInformation_t bootloaderInfo;
-  extern const ApplicationProperties_t sl_app_properties;
-  MSC_Status_TypeDef msc_status;
+  (void)args_len;
+
+  // received value is the lsb as uint_16
+  ctune_val = cpc_get_u16(&args[0]);
+  rail_status = RAIL_SetTune(emPhyRailHandle,ctune_val);
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_SET_CTUNE_VALUE, 0, rail_status);
+  memcpy(reply, &rail_status, sizeof(rail_status)); //copy rail_status
+  return sizeof(rail_status);
+}
 
-  EFM_ASSERT(tx_ptr == NULL); //don't overwrite previous buffer - shouldn't happen?
-  // TODO: check size?
+static uint8_t cmd_gpio_write(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  sl_status_t slstatus=SL_STATUS_OK;
+  (void)args_len;
 
-  switch ( commandData[0] ){
-    case CPC_COMMAND_GET_CUST_VERSION:
-      debug_print("Cmd received: CPC_COMMAND_GET_CUST_VERSION\r\n");
-      tx_ptr = MALLOC(sizeof(customer_version));
-      memcpy(tx_ptr,&customer_version,sizeof(customer_version));
-      transmit_len = sizeof(customer_version);
-      break;
+  // write a received value to GPIO(s)
+  GPIO_PinModeSet(gpioPortD, 2, gpioModePushPull, args[0]);
+  // return default status (SL_STATUS_OK)
+  cpc_put_u16(reply, (uint16_t) slstatus); //lower two bytes of slstatus
+  return sizeof(uint16_t);
+}
 
-    case CPC_COMMAND_GET_SE_VERSION:
-      debug_print("Cmd received: CPC_COMMAND_GET_SE_VERSION\r\n");
-      slstatus = sl_se_get_se_version(&cmd_ctx, &se_version);
-      debug_print("sl_se_get_se_version status 0x%lx\r\n", slstatus);
-      tx_ptr = MALLOC(sizeof(se_version));
-      memcpy(tx_ptr,&se_version,sizeof(se_version));
-      transmit_len = sizeof(se_version);
-      break;
+static uint8_t cmd_tone_start(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  RAIL_Status_t rail_status;
 
-    case CPC_COMMAND_GET_CTUNE_TOKEN:
-      debug_print("Cmd received: CPC_COMMAND_GET_CTUNE_TOKEN\r\n");
-      tx_ptr = MALLOC(sizeof(MFG_CTUNE_VAL));
-      memcpy(tx_ptr,&MFG_CTUNE_VAL,sizeof(MFG_CTUNE_VAL));
-      transmit_len = sizeof(MFG_CTUNE_VAL);
-      break;
+  if (args_len == 0) {
+    // CW stream on the default channel at the current power
+    rail_status = cpc_tone_start(DEFAULT_802154_CH, CPC_TONE_POWER_UNCHANGED, RAIL_STREAM_CARRIER_WAVE);
+  } else if (args_len == CPC_TONE_ARGS_SIZE) {
+    // channel, power and stream mode
+    rail_status = cpc_tone_start(cpc_get_u16(&args[0]), (int16_t) cpc_get_u16(&args[2]), args[4]);
+  } else {
+    rail_status = RAIL_STATUS_INVALID_PARAMETER;
+  }
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_TONE_START, 0, rail_status);
+  memcpy(reply, &rail_status, sizeof(rail_status)); //copy 1B rail_status
+  return sizeof(rail_status);
+}
+
+static uint8_t cmd_tone_stop(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  RAIL_Status_t rail_status;
+  (void)args;
+  (void)args_len;
+
+  // stop the stream or plan, restoring the transmit power
+  rail_status = cpc_tone_stop();
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_TONE_STOP, 0, rail_status);
+  memcpy(reply, &rail_status, sizeof(rail_status)); //copy 1B rail_status
+  return sizeof(rail_status);
+}
+
+static uint8_t cmd_erase_userdata_page(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args;
+  (void)args_len;
 
-    case CPC_COMMAND_SET_CTUNE_TOKEN:
-      debug_print("Cmd received: CPC_COMMAND_SET_CTUNE_TOKEN\r\n");
-#if SWODEBUG
-      printf("commandData[1] = 0x%x, commandData[2]= 0x%x\r\n", commandData[1], commandData[2]);
-#endif
-      // copy received data into lsb as uint_16
-      memcpy(&ctune_val, &commandData[1], sizeof(uint16_t));
-      // ctune is lower 16-bits, upper 16-bits are all 0xffff
-      ctune_val = (ctune_val & 0x0000ffff) | 0xffff0000;
-      debug_print("writing ctune token 0x%lx\r\n", ctune_val);
 #if defined (_SILICON_LABS_32B_SERIES_2_CONFIG_1)
-      // xG21 writes userdata with the SE
-      slstatus = sl_se_write_user_data(&cmd_ctx, USERDATA_CTUNE_OFFSET, &ctune_val, 4);
-      debug_print("sl_se_write_user_data status 0x%lx\r\n", slstatus);
-      tx_ptr = MALLOC(sizeof(uint16_t)); // two byte status reply
-      memcpy(tx_ptr, &slstatus, sizeof(uint16_t)); //copy lower two bytes of slstatus
-      transmit_len = sizeof(uint16_t);
+  // xG21 erases userdata with the SE
+  sl_status_t slstatus = sl_se_erase_user_data(&cmd_ctx);
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_ERASE_USERDATA_PAGE, 0, slstatus);
+  cpc_put_u16(reply, (uint16_t) slstatus); //lower two bytes of slstatus
+  return sizeof(uint16_t);
 #else
-      // use MSC write API to write userdata
-      CMU_ClockEnable(cmuClock_MSC, true);
-      MSC_Init();
-      msc_status = MSC_WriteWord((uint32_t *)MFG_CTUNE_ADDR,&ctune_val,sizeof(ctune_val));
-      MSC_Deinit();
-      debug_print("msc status 0x%x\r\n", msc_status);
-      tx_ptr = MALLOC(sizeof(msc_status)); // status reply
-      memcpy(tx_ptr, &msc_status, sizeof(msc_status)); //copy lower two bytes of msc_status
-      transmit_len = sizeof(msc_status);
+  // use MSC API to erase userdata
+  MSC_Status_TypeDef msc_status;
+  CMU_ClockEnable(cmuClock_MSC, true);
+  msc_status = MSC_ErasePage((uint32_t *)USERDATA_BASE);
+  CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_ERASE_USERDATA_PAGE, 0, msc_status);
+  cpc_put_u32(reply, (uint32_t) msc_status);
+  return sizeof(uint32_t);
 #endif
+}
 
-      break;
+static uint8_t cmd_get_btl_version(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  BootloaderInformation_t bootloaderInfo;
+  (void)args;
+  (void)args_len;
 
-    case CPC_COMMAND_GET_CTUNE_VALUE:
-      debug_print("Cmd received: CPC_COMMAND_GET_CTUNE_VALUE\r\n");
-      ctune_val = (uint16_t) RAIL_GetTune(emPhyRailHandle);
-      debug_print("RAIL_GetTune returned 0x%lx",ctune_val);
-      tx_ptr = MALLOC(sizeof(uint16_t)); // return ctune_val as uint16_t
-      memcpy(tx_ptr,&ctune_val,sizeof(uint16_t));
-      transmit_len = sizeof(uint16_t);
-      break;
+  // get version info from bootloader API
+  bootloader_getInfo(&bootloaderInfo);
+  cpc_put_u32(reply, bootloaderInfo.version);
+  return sizeof(uint32_t);
+}
 
-    case CPC_COMMAND_SET_CTUNE_VALUE:
-     debug_print("Cmd received: CPC_COMMAND_SET_CTUNE_VALUE\r\n");
-#if SWODEBUG
-     printf("commandData[1] = 0x%x, commandData[2]= 0x%x\r\n", commandData[1], commandData[2]);
-#endif
-     // copy received data into lsb as uint_16
-     memcpy(&ctune_val, &commandData[1], sizeof(uint16_t));
-     debug_print("writing ctune value 0x%lx\r\n", ctune_val);
-     rail_status = RAIL_SetTune(emPhyRailHandle,ctune_val);
-     debug_print("RAIL_SetTune 0x%x\r\n", rail_status);
-     tx_ptr = MALLOC(sizeof(rail_status)); // rail_status reply
-     memcpy(tx_ptr, &rail_status, sizeof(rail_status)); //copy rail_status
-     transmit_len = sizeof(rail_status);
-     break;
-
-    case CPC_COMMAND_GPIO_WRITE:
-      // write a received value to GPIO(s)
-      debug_print("Cmd received: CPC_COMMAND_GPIO_WRITE\r\n");
-      debug_print("gpio write value %d\r\n", commandData[1]);
-      GPIO_PinModeSet(gpioPortD, 2, gpioModePushPull, commandData[1]);
-      // return default status (SL_STATUS_OK)
-      tx_ptr = MALLOC(sizeof(uint16_t));
-      memcpy(tx_ptr, &slstatus, sizeof(uint16_t)); //copy lower two bytes of slstatus
-      transmit_len = sizeof(uint16_t);
-      break;
+static uint8_t cmd_get_app_properties_version(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  extern const ApplicationProperties_t sl_app_properties;
+  (void)args;
+  (void)args_len;
 
-    case CPC_COMMAND_TONE_START:
-      debug_print("Cmd received: CPC_COMMAND_TOME_START\r\n");
-      // start CW stream on specified channel
-      //TODO: read channel here
-      rail_status = RAIL_StartTxStream(emPhyRailHandle, DEFAULT_802154_CH, RAIL_STREAM_CARRIER_WAVE);
-      debug_print("RAIL_StartTxStream(), status=0x%x\r\n",rail_status);
-      tx_ptr = MALLOC(sizeof(rail_status)); // rail_status reply
-      memcpy(tx_ptr, &rail_status, sizeof(rail_status)); //copy 1B rail_status
-      transmit_len = sizeof(rail_status);
-      break;
+  // get version from Application_Properties_t (set in App Properties component)
+  cpc_put_u32(reply, sl_app_properties.app.version);
+  return sizeof(uint32_t);
+}
+
+static uint8_t cmd_get_device_info(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  extern const ApplicationProperties_t sl_app_properties;
+  BootloaderInformation_t bootloaderInfo;
+  sl_status_t slstatus;
+  (void)args;
+  (void)args_len;
+
+  if (!device_info.valid) {
+    slstatus = sl_se_get_se_version(&cmd_ctx, &device_info.se_version);
+    CPC_TRACE(DRIVER_STATUS, CPC_COMMAND_GET_DEVICE_INFO, 0, slstatus);
+    bootloader_getInfo(&bootloaderInfo);
+    device_info.btl_version = bootloaderInfo.version;
+    device_info.family = (uint32_t) SYSTEM_GetFamily();
+    device_info.unique_id = SYSTEM_GetUnique();
+    // Read again next time if the SE could not answer
+    device_info.valid = (slstatus == SL_STATUS_OK);
+    if (!device_info.valid) {
+      device_info.se_version = 0;
+    }
+  }
+  cpc_put_u32(&reply[0], customer_version);
+  cpc_put_u32(&reply[4], device_info.se_version);
+  cpc_put_u32(&reply[8], device_info.btl_version);
+  cpc_put_u32(&reply[12], sl_app_properties.app.version);
+  cpc_put_u16(&reply[16], MFG_CTUNE_VAL);
+  cpc_put_u16(&reply[18], (uint16_t) RAIL_GetTune(emPhyRailHandle));
+  cpc_put_u32(&reply[20], device_info.family);
+  cpc_put_u32(&reply[24], (uint32_t) device_info.unique_id);
+  cpc_put_u32(&reply[28], (uint32_t) (device_info.unique_id >> 32));
+  return CPC_DEVICE_INFO_SIZE;
+}
 
-    case CPC_COMMAND_TONE_STOP:
-      debug_print("Cmd received: CPC_COMMAND_TONE_STOP\r\n");
-      // stop CW stream
-      rail_status = RAIL_StopTxStream(emPhyRailHandle);
-      debug_print("RAIL_StopTxStream(), status=0x%x\r\n",rail_status);
-      tx_ptr = MALLOC(sizeof(rail_status)); // rail_status reply
-      memcpy(tx_ptr, &rail_status, sizeof(rail_status)); //copy 1B rail_status
-      transmit_len = sizeof(rail_status);
+static uint8_t cmd_get_stats(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  cpc_reply_pool_stats_t pool;
+  cpc_command_ring_stats_t ring;
+  uint64_t ms;
+  uint8_t *entry = &reply[CPC_STATS_HEADER_SIZE];
+  uint8_t count = 0;
+  uint8_t next = 0;
+  (void)args_len;
+
+  for (uint16_t opcode = args[0]; opcode <= CPC_COMMAND_OPCODE_MAX; opcode++) {
+    if ((stats.completed[opcode] == 0) && (stats.cycles[opcode] == 0)) {
+      continue;
+    }
+    if (count == CPC_STATS_ENTRIES_MAX) {
+      next = (uint8_t) opcode;
       break;
+    }
+    entry[0] = (uint8_t) opcode;
+    cpc_put_u32(&entry[1], stats.completed[opcode]);
+    cpc_put_u32(&entry[5], stats.cycles[opcode]);
+    entry += CPC_STATS_ENTRY_SIZE;
+    count++;
+  }
+  cpc_reply_pool_get_stats(&pool);
+  cpc_command_ring_get_stats(&ring);
+  sl_sleeptimer_tick64_to_ms(sl_sleeptimer_get_tick_count64(), &ms);
+  cpc_put_u32(&reply[0], (uint32_t) ms);
+  cpc_put_u32(&reply[4], SystemCoreClockGet());
+  cpc_put_u32(&reply[8], stats.commands);
+  cpc_put_u32(&reply[12], stats.rejected);
+  cpc_put_u32(&reply[16], stats.write_refused);
+  cpc_put_u32(&reply[20], stats.write_failures);
+  cpc_put_u32(&reply[24], custom_link.stats.reconnects);
+  cpc_put_u32(&reply[28], pool.acquire_failures);
+  reply[32] = pool.high_water;
+  reply[33] = ring.high_water;
+  reply[34] = next;
+  reply[35] = count;
+  return (uint8_t) (CPC_STATS_HEADER_SIZE + count * CPC_STATS_ENTRY_SIZE);
+}
 
-    case CPC_COMMAND_ERASE_USERDATA_PAGE:
-      debug_print("Cmd received: CPC_COMMAND_ERASE_USERDATA_PAGE\r\n");
-#if defined (_SILICON_LABS_32B_SERIES_2_CONFIG_1)
-      // xG21 erases userdata with the SE
-      slstatus = sl_se_erase_user_data(&cmd_ctx);
-      debug_print("sl_se_erase_user_data status 0x%lx\r\n", slstatus);
-      tx_ptr = MALLOC(sizeof(uint16_t)); // two byte status reply
-      memcpy(tx_ptr, &slstatus, sizeof(uint16_t)); //copy lower two bytes of slstatus
-      transmit_len = sizeof(uint16_t);
-#else
-      // use MSC API to erase userdata
-      CMU_ClockEnable(cmuClock_MSC, true);
-      msc_status = MSC_ErasePage((uint32_t *)USERDATA_BASE);
-      debug_print("msc status 0x%x\r\n", msc_status);
-      tx_ptr = MALLOC(sizeof(msc_status)); // status reply
-      memcpy(tx_ptr, &msc_status, sizeof(msc_status)); //copy lower two bytes of msc_status
-      transmit_len = sizeof(msc_status);
-#endif
+static uint8_t cmd_trace_drain(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  uint32_t lost;
+  uint16_t left;
+  (void)args;
+  (void)args_len;
+
+  reply[10] = cpc_trace_drain(&reply[CPC_TRACE_DRAIN_HEADER_SIZE], CPC_TRACE_DRAIN_MAX, &lost, &left);
+  cpc_put_u32(&reply[0], SystemCoreClockGet());
+  cpc_put_u32(&reply[4], lost);
+  cpc_put_u16(&reply[8], left);
+  return (uint8_t) (CPC_TRACE_DRAIN_HEADER_SIZE + reply[10] * CPC_TRACE_RECORD_SIZE);
+}
 
-      break;
+static uint8_t cmd_userdata_read(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  uint16_t offset = cpc_get_u16(&args[0]);
+  uint16_t len = cpc_get_u16(&args[2]);
+  (void)args_len;
 
-    case CPC_COMMAND_GET_BTL_VERSION:
-      // get version info from bootloader API
-      debug_print("Cmd received: CPC_COMMAND_GET_BTL_VERSION\r\n");
-      bootloader_getInfo(&bootloaderInfo);
-      tx_ptr = MALLOC(sizeof(bootloaderInfo.version));
-      memcpy(tx_ptr, &bootloaderInfo.version, sizeof(bootloaderInfo.version));
-      transmit_len = sizeof(bootloaderInfo.version);
-      break;
+  if (len > CPC_USERDATA_CHUNK_MAX) {
+    reply[0] = CPC_USERDATA_BAD_RANGE;
+    return 1;
+  }
+  reply[0] = cpc_userdata_read(offset, len, &reply[1]);
+  if (reply[0] != CPC_USERDATA_OK) {
+    return 1;
+  }
+  cpc_put_u32(&reply[1 + len], cpc_crc32(0, &reply[1], len));
+  return (uint8_t) (1 + len + sizeof(uint32_t));
+}
 
-    case CPC_COMMAND_GET_APP_PROPERTIES_VERSION:
-      // get version from Application_Properties_t (set in App Properties component)
-      debug_print("Cmd received: CPC_COMMAND_GET_APP_PROPERTIES_VERSION\r\n");
-      tx_ptr = MALLOC(sizeof(sl_app_properties.app.version));
-      memcpy(tx_ptr, &sl_app_properties.app.version, sizeof(sl_app_properties.app.version));
-      transmit_len = sizeof(sl_app_properties.app.version);
-      break;
+static uint8_t cmd_userdata_stage(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  uint16_t offset;
+  uint16_t len;
 
-    default:
-      debug_print("default case hit on cmd rcv\r\n");
-      transmit_len = 0; //no tx reply
-      break;
+  // offset, at least one data byte, crc
+  if ((args_len < sizeof(uint16_t) + 1 + sizeof(uint32_t))
+      || (args_len > sizeof(uint16_t) + CPC_USERDATA_CHUNK_MAX + sizeof(uint32_t))) {
+    reply[0] = CPC_USERDATA_BAD_RANGE;
+    return 1;
   }
-  if (transmit_len > 0) {
-    slstatus = sl_cpc_write(&custom_endpoint_handle,
-                              tx_ptr,
-                              transmit_len,
-                              0,
-                              NULL); //no flag, no write complete arg
-    debug_print("sl_cpc_write status=0x%lx\r\n", slstatus);
+  offset = cpc_get_u16(&args[0]);
+  len = args_len - sizeof(uint16_t) - sizeof(uint32_t);
+  if (cpc_crc32(0, &args[2], len) != cpc_get_u32(&args[2 + len])) {
+    reply[0] = CPC_USERDATA_BAD_CRC;
+  } else {
+    reply[0] = cpc_userdata_stage(offset, &args[2], len);
   }
+  return 1;
 }
 
-static void cpc_write_complete(sl_cpc_user_endpoint_id_t endpoint_id, void *buffer, void *arg, sl_status_t status){
-  (void)endpoint_id;
-  (void)buffer;
-  (void)arg;
-  //(void)status;
-  printf("Write complete, status=0x%x\r\n", (unsigned int) status);
-  if (status == 0) {
-    debug_print("successfully completed write\r\n");
-    if (tx_ptr) {
-        FREE(tx_ptr); // free the tx buffer
-        tx_ptr = NULL;
+// Progress of a userdata commit, in bytes of the page
+static uint8_t reply_userdata_pending(uint16_t done, uint8_t *reply){
+  cpc_put_u16(&reply[0], done);
+  cpc_put_u16(&reply[2], USERDATA_SIZE);
+  return CPC_REPLY_PENDING;
+}
+
+static uint8_t cmd_userdata_commit(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  bool erased;
+  uint32_t crc;
+  uint16_t done;
+  uint8_t status;
+  (void)args;
+  (void)args_len;
+
+  status = cpc_userdata_commit_step(&erased, &crc, &done);
+  if (status == CPC_USERDATA_PENDING) {
+    return reply_userdata_pending(done, reply);
+  }
+  reply[0] = status;
+  reply[1] = erased;
+  cpc_put_u32(&reply[2], crc);
+  return 2 + sizeof(uint32_t);
+}
+
+static uint8_t cmd_userdata_abort(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args;
+  (void)args_len;
+
+  cpc_userdata_abort();
+  reply[0] = CPC_USERDATA_OK;
+  return 1;
+}
+
+static uint8_t cmd_userdata_provision(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  bool erased = false;
+  uint32_t crc = 0;
+  uint16_t done = 0;
+  uint16_t len;
+
+  // token list, crc
+  if ((args_len <= sizeof(uint32_t)) || (args_len > CPC_PROVISION_ARGS_MAX)) {
+    reply[0] = CPC_USERDATA_BAD_RANGE;
+  } else {
+    len = args_len - sizeof(uint32_t);
+    if (cpc_crc32(0, args, len) != cpc_get_u32(&args[len])) {
+      reply[0] = CPC_USERDATA_BAD_CRC;
+    } else {
+      reply[0] = cpc_userdata_provision_step(args, len, &erased, &crc, &done);
     }
   }
-  //error handling would go here
+  if (reply[0] == CPC_USERDATA_PENDING) {
+    return reply_userdata_pending(done, reply);
+  }
+  reply[1] = erased;
+  cpc_put_u32(&reply[2], crc);
+  return 2 + sizeof(uint32_t);
 }
 
-static void cpc_read_command(uint8_t endpoint_id, void *arg)
+static uint8_t cmd_ctune_sweep(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args_len;
 
-{
-  (void)endpoint_id;
-  (void)arg;
+  reply[0] = cpc_ctune_sweep_start(cpc_get_u16(&args[0]), cpc_get_u16(&args[2]), cpc_get_u16(&args[4]), cpc_get_u16(&args[6]));
+  return 1;
+}
+
+static uint8_t cmd_ctune_search(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args_len;
+
+  reply[0] = cpc_ctune_search_start(cpc_get_u16(&args[0]), cpc_get_u16(&args[2]));
+  return 1;
+}
+
+static uint8_t cmd_ctune_feedback(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args_len;
+
+  reply[0] = cpc_ctune_feedback((int8_t) args[0]);
+  return 1;
+}
+
+static uint8_t cmd_ctune_stop(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  (void)args;
+  (void)args_len;
+
+  reply[0] = cpc_ctune_sweep_stop();
+  return 1;
+}
+
+static uint8_t cmd_tone_plan(const uint8_t *args, uint16_t args_len, uint8_t *reply){
+  reply[0] = cpc_tone_plan_start(args, args_len);
+  return 1;
+}
+
+// Every reply must fit in a reply pool slot
+#define CPC_COMMAND_CHECK_REPLY(name, opcode, request_len, reply_max, retry, handler, option, help) \
+  _Static_assert(CPC_FRAME_HEADER_SIZE + (reply_max) <= CPC_REPLY_SLOT_SIZE, \
+                 "CPC_REPLY_SLOT_SIZE too small for CPC_COMMAND_" #name);
+CPC_COMMAND_TABLE(CPC_COMMAND_CHECK_REPLY)
+
+#define CPC_COMMAND_DESC(name, opcode, request_len, reply_max, retry, handler, option, help) \
+  [opcode] = { cmd_##handler, (request_len), (reply_max) },
+
+// Indexed by opcode, kept in flash
+static const cpc_command_desc_t command_table[CPC_COMMAND_OPCODE_MAX + 1] = {
+  CPC_COMMAND_TABLE(CPC_COMMAND_DESC)
+};
+
+// Runs one command, or one step of it, into slot. Returns the reply length
+// including the frame header, 0 if there is nothing to send. A command that
+// cannot be run gets an empty reply with the reason in the frame status. A
+// command that is not finished sets *pending, and slot holds a progress
+// frame.
+static uint16_t process_command(const uint8_t *commandData, uint16_t size, cpc_reply_slot_t *slot, bool *pending){
+  const cpc_command_desc_t *desc;
+  uint8_t transmit_len = 0;
+  cpc_frame_t frame;
+  uint32_t start;
+  uint8_t status;
+
+  *pending = false;
+  status = cpc_frame_decode(commandData, size, &frame);
+  if ((status == CPC_FRAME_BAD_VERSION) || (size < CPC_FRAME_HEADER_SIZE)) {
+    // nothing in it can be trusted to answer
+    CPC_TRACE(FRAME_DROPPED, 0, (size > 0) ? commandData[0] : 0, size);
+    stats.commands++;
+    stats.rejected++;
+    return 0;
+  }
+  desc = (frame.opcode <= CPC_COMMAND_OPCODE_MAX) ? &command_table[frame.opcode] : NULL;
+  if ((status == CPC_FRAME_OK) && ((desc == NULL) || (desc->handler == NULL))) {
+    status = CPC_FRAME_UNKNOWN_OPCODE;
+  }
+  if ((status == CPC_FRAME_OK) && (desc->request_len != CPC_ARGS_VARIABLE) && (frame.len != desc->request_len)) {
+    status = CPC_FRAME_BAD_LENGTH;
+  }
+
+  if (status == CPC_FRAME_OK) {
+    // Arguments are used in place, the reply is written after its header
+    start = DWT->CYCCNT;
+    transmit_len = desc->handler(frame.payload, frame.len, slot->data + CPC_FRAME_HEADER_SIZE);
+    start = DWT->CYCCNT - start;
+    stats.cycles[frame.opcode] += start;
+    if (transmit_len == CPC_REPLY_PENDING) {
+      CPC_TRACE(COMMAND_STEP, frame.opcode, cpc_get_u16(slot->data + CPC_FRAME_HEADER_SIZE), start);
+      *pending = true;
+      return (uint16_t) cpc_frame_encode(slot->data, frame.opcode, CPC_FRAME_FLAG_REPLY | CPC_FRAME_FLAG_PROGRESS,
+                                         frame.seq, CPC_FRAME_OK, CPC_FRAME_PROGRESS_SIZE);
+    }
+    EFM_ASSERT(transmit_len <= desc->reply_max);
+    // A command run in steps counts once, when it is finished
+    stats.completed[frame.opcode]++;
+    stats.commands++;
+    if (frame.opcode != CPC_COMMAND_TRACE_DRAIN) {
+      CPC_TRACE(COMMAND_DONE, frame.opcode, transmit_len, start);
+    }
+    if (transmit_len == 0) {
+      return 0;
+    }
+  } else {
+    CPC_TRACE(COMMAND_REJECTED, frame.opcode, status, frame.len);
+    stats.commands++;
+    stats.rejected++;
+  }
+  return (uint16_t) cpc_frame_encode(slot->data, frame.opcode, CPC_FRAME_FLAG_REPLY, frame.seq, status, transmit_len);
+}
+
+// Moves the commands CPC has announced into the command ring while it has
+// room; the rest stay queued in CPC, so a host window larger than the ring
+// slows down instead of losing commands. Called from the receive callback
+// and from the command task once it has freed an entry. Whoever finds the
+// other one reading leaves the work to it, and the reader checks again
+// after letting go, for commands announced meanwhile.
+static void fill_command_ring(void){
   sl_status_t status;
   uint8_t *read_array;
   uint16_t size;
 
-  status = sl_cpc_read(&custom_endpoint_handle,
-                       (void **)&read_array,
-                       &size,
-                       0, // Timeout : relevent only when using a kernel with blocking
-                       0); // flags : relevent only when using a kernel to specify a non-blocking operation (polling).
+  while (!atomic_flag_test_and_set_explicit(&rx_reading, memory_order_acquire)) {
+    while ((atomic_load(&rx_read) != atomic_load(&rx_announced)) && !cpc_command_ring_full()) {
+      status = sl_cpc_read(&custom_endpoint_handle,
+                           (void **)&read_array,
+                           &size,
+                           0, // Timeout : relevent only when using a kernel with blocking
+                           0); // flags : relevent only when using a kernel to specify a non-blocking operation (polling).
+      atomic_fetch_add(&rx_read, 1);
+      if (status != SL_STATUS_OK) {
+        // log and ignore error
+        CPC_TRACE(READ_FAILED, 0, 0, status);
+        continue;
+      }
+      // Opcode and seq as sent, checked when the command runs
+      if ((size < CPC_FRAME_HEADER_SIZE) || (read_array[1] != CPC_COMMAND_TRACE_DRAIN)) {
+        CPC_TRACE(COMMAND_RX, (size > 1) ? read_array[1] : 0, (size > 3) ? read_array[3] : 0, size);
+      }
+      cpc_command_ring_push(read_array, size);
+    }
+    atomic_flag_clear_explicit(&rx_reading, memory_order_release);
+    if ((atomic_load(&rx_read) == atomic_load(&rx_announced)) || cpc_command_ring_full()) {
+      break;
+    }
+  }
+}
 
+// Sends the progress frame of an unfinished command from a slot of its
+// own, if one is free; progress is only informative
+static void send_progress(const cpc_reply_slot_t *command, uint16_t len){
+  cpc_reply_slot_t *slot = cpc_reply_pool_acquire();
+  sl_status_t status;
+  void *token;
+
+  if (slot == NULL) {
+    return;
+  }
+  memcpy(slot->data, command->data, len);
+  token = cpc_reply_pool_write_begin(slot);
+  status = sl_cpc_write(&custom_endpoint_handle, slot->data, len, 0, token);
   if (status != SL_STATUS_OK) {
-    // log and ignore error
-    debug_print("sl_cpc_read status 0x%lx\r\n", status);
-  } else {
-#if SWODEBUG
-    printf("read status OK, command size=%d\r\n",size);
-    for(uint8_t i=0;i<size;i++) {
-        printf("data[%d]=0x%x ",i,read_array[i]);
+    CPC_TRACE(WRITE_REFUSED, slot->data[1], len, status);
+    stats.write_refused++;
+    cpc_reply_pool_write_end(token);
+  }
+}
+
+// Runs the commands in the ring, in order, as long as there is a reply
+// slot for them. A command that is not finished stays at the head of the
+// ring with its slot, and the task is signalled to run its next step after
+// CPC had a chance to run.
+static void run_commands(void){
+  cpc_command_entry_t *entry;
+  sl_status_t status;
+  uint16_t reply_len;
+  bool pending;
+  void *token;
+
+  while ((entry = cpc_command_ring_peek()) != NULL) {
+    if (command_slot == NULL) {
+      // Reply buffer is released in cpc_write_complete(), or reclaimed if
+      // CPC drops the write with the endpoint
+      command_slot = cpc_reply_pool_acquire();
+      if (command_slot == NULL) {
+        CPC_TRACE(NO_REPLY_SLOT, 0, 0, 0);
+        return;
+      }
     }
-    printf("\r\n");
-#endif
-    process_command(read_array,size);
-    sl_cpc_free_rx_buffer(read_array);
+    reply_len = process_command(entry->data, entry->size, command_slot, &pending);
+    if (pending) {
+      send_progress(command_slot, reply_len);
+      cpc_custom_signal();
+      return;
+    }
+    sl_cpc_free_rx_buffer(entry->data);
+    cpc_command_ring_pop();
+
+    if (reply_len > 0) {
+      token = cpc_reply_pool_write_begin(command_slot);
+      status = sl_cpc_write(&custom_endpoint_handle,
+                            command_slot->data,
+                            reply_len,
+                            0,
+                            token); //no flag, the slot's token is the write complete arg
+      if (status != SL_STATUS_OK) {
+        CPC_TRACE(WRITE_REFUSED, command_slot->data[1], reply_len, status);
+        stats.write_refused++;
+        cpc_reply_pool_write_end(token); // write was not queued, no completion will follow
+      }
+    } else {
+      cpc_reply_pool_release(command_slot);
+    }
+    command_slot = NULL;
+    fill_command_ring();
+  }
+}
+
+// Forgets the commands of a host that went away. CPC has closed the
+// endpoint, so no receive callback runs meanwhile. Replies already written
+// are reclaimed once the endpoint is freed.
+static void drop_commands(void){
+  cpc_command_entry_t *entry;
+
+  if (command_slot != NULL) {
+    cpc_reply_pool_release(command_slot);
+    command_slot = NULL;
+  }
+  while ((entry = cpc_command_ring_peek()) != NULL) {
+    sl_cpc_free_rx_buffer(entry->data);
+    cpc_command_ring_pop();
   }
+  atomic_store(&rx_read, atomic_load(&rx_announced));
+}
+
+static void on_retry(sl_sleeptimer_timer_handle_t *handle, void *data){
+  (void)handle;
+  (void)data;
+  cpc_custom_signal();
+}
 
+// Runs cpc_custom_process_action() again in delay_ms, for the waits no
+// CPC callback ends. A run that comes earlier checks again and calls this
+// for the time left.
+static void retry_later(uint32_t delay_ms){
+  bool running = false;
+
+  sl_sleeptimer_is_timer_running(&retry_timer, &running);
+  if (!running) {
+    sl_sleeptimer_start_timer_ms(&retry_timer, delay_ms, on_retry, NULL, 0, 0);
+  }
+}
+
+bool cpc_custom_send_event(uint8_t opcode, const uint8_t *payload, uint8_t len){
+  static uint8_t event_seq = 0;
+  cpc_reply_slot_t *slot;
+  sl_status_t status;
+  void *token;
+
+  if (!cpc_link_is_connected(&custom_link) || (CPC_FRAME_HEADER_SIZE + len > CPC_REPLY_SLOT_SIZE)) {
+    return false;
+  }
+  slot = cpc_reply_pool_acquire();
+  if (slot == NULL) {
+    return false;
+  }
+  memcpy(slot->data + CPC_FRAME_HEADER_SIZE, payload, len);
+  token = cpc_reply_pool_write_begin(slot);
+  status = sl_cpc_write(&custom_endpoint_handle,
+                        slot->data,
+                        cpc_frame_encode(slot->data, opcode, CPC_FRAME_FLAG_EVENT, event_seq, CPC_FRAME_OK, len),
+                        0,
+                        token);
+  if (status != SL_STATUS_OK) {
+    CPC_TRACE(WRITE_REFUSED, opcode, CPC_FRAME_HEADER_SIZE + len, status);
+    stats.write_refused++;
+    cpc_reply_pool_write_end(token);
+    retry_later(CPC_CUSTOM_RETRY_MS); // no write completion will wake the caller
+    return false;
+  }
+  CPC_TRACE(EVENT_SENT, opcode, event_seq, CPC_FRAME_HEADER_SIZE + len);
+  event_seq++;
+  return true;
+}
+
+static void cpc_write_complete(sl_cpc_user_endpoint_id_t endpoint_id, void *buffer, void *arg, sl_status_t status){
+  (void)endpoint_id;
+  (void)buffer;
+  if (status == SL_STATUS_OK) {
+    CPC_TRACE(WRITE_DONE, 0, 0, 0);
+  } else {
+    CPC_TRACE(WRITE_FAILED, 0, 0, status);
+    stats.write_failures++;
+  }
+  // The buffer is ours again whether or not the write succeeded, unless it
+  // was reclaimed after a disconnect and may already hold another reply
+  if (!cpc_reply_pool_write_end(arg)) {
+    CPC_TRACE(WRITE_STALE, 0, 0, 0);
+    return;
+  }
+  // Commands or events may have been waiting for it
+  cpc_custom_signal();
+}
+
+static void cpc_read_command(uint8_t endpoint_id, void *arg)
+
+{
+  (void)endpoint_id;
+  (void)arg;
+  // Only queue the command, it is run by the command task
+  atomic_fetch_add(&rx_announced, 1);
+  fill_command_ring();
+  cpc_custom_signal();
 }
 
 static void cpc_error_cb(uint8_t endpoint_id, void *arg)
 {
   (void)endpoint_id;
   (void)arg;
-  uint8_t state = sl_cpc_get_endpoint_state(&custom_endpoint_handle);
-  debug_print("cpc_error_cb, ep id=%d, state = %d\r\n", endpoint_id, state);
-  if (state == SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE) {
-    // This error is thrown on disconnect. Use this to change endpoint state
-    sl_status_t status = sl_cpc_close_endpoint(&custom_endpoint_handle);
-    EFM_ASSERT(status == SL_STATUS_OK);
-    endpoint_status = CPC_ENDPOINT_DISCONNECTED;
-  }
+  CPC_TRACE(ENDPOINT_ERROR, 0, sl_cpc_get_endpoint_state(&custom_endpoint_handle), 0);
+  // Thrown on disconnect (SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE) and
+  // on link faults. The command task closes the endpoint, it may be
+  // running a command.
+  cpc_link_on_error(&custom_link);
+  cpc_custom_signal();
 }
 
 #if defined(SL_CATALOG_CPC_SECURITY_PRESENT)
@@ -343,13 +824,20 @@ void cpc_connect_command(uint8_t endpoint_id, void *arg)
   // This callback tells us we are connected
   (void)arg;
   if (SL_CPC_ENDPOINT_USER_ID_0 == endpoint_id) {
-      debug_print("user ep connected\r\n");
-      endpoint_status = CPC_ENDPOINT_CONNECTED;
+      CPC_TRACE(CONNECTED, 0, 0, 0);
+      cpc_link_on_connect(&custom_link);
+      cpc_custom_signal();
   }
 }
 
-static cpc_endpoint_status_t connect(){
+/***************************************************************************//**
+ * Link operations, see cpc_link.h. Run by the command task.
+ ******************************************************************************/
+
+static bool link_open(void){
   sl_status_t status;
+  // CPC only supports a link window of 1. Several commands can still be
+  // queued by the host, they are matched to replies by the frame seq field.
   uint8_t window_size = 1;
   uint8_t flags = 0;
 
@@ -359,24 +847,24 @@ static cpc_endpoint_status_t connect(){
                                          window_size);
 
   if (status != SL_STATUS_OK && status != SL_STATUS_ALREADY_EXISTS ) {
-    debug_print("sl_cpc_open_user_endpoint failed, status = 0x%lx\r\n", status);
-    return CPC_ENDPOINT_CLOSED;
+    CPC_TRACE(ENDPOINT_SETUP_FAILED, 0, 0, status);
+    return false;
   }
 
   status = sl_cpc_set_endpoint_option(&custom_endpoint_handle,
                                       SL_CPC_ENDPOINT_ON_IFRAME_WRITE_COMPLETED,
                                       (void *)cpc_write_complete);
   if (status != SL_STATUS_OK) {
-    debug_print("sl_cpc_set_endpoint_option SL_CPC_ENDPOINT_ON_IFRAME_WRITE_COMPLETED failed, status = 0x%lx\r\n", status);
-    return CPC_ENDPOINT_CLOSED;
+    CPC_TRACE(ENDPOINT_SETUP_FAILED, 0, 1, status);
+    return false;
   }
 
   status = sl_cpc_set_endpoint_option(&custom_endpoint_handle,
                                       SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE,
                                       (void *)cpc_read_command);
   if (status != SL_STATUS_OK) {
-    debug_print("sl_cpc_set_endpoint_option SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE failed, status = 0x%lx\r\n", status);
-    return CPC_ENDPOINT_CLOSED;
+    CPC_TRACE(ENDPOINT_SETUP_FAILED, 0, 2, status);
+    return false;
   }
 
 
@@ -384,8 +872,8 @@ static cpc_endpoint_status_t connect(){
                                       SL_CPC_ENDPOINT_ON_ERROR,
                                       (void*)cpc_error_cb);
   if (status != SL_STATUS_OK) {
-    debug_print("sl_cpc_set_endpoint_option SL_CPC_ENDPOINT_ON_ERROR failed, status = 0x%lx\r\n", status);
-    return CPC_ENDPOINT_CLOSED;
+    CPC_TRACE(ENDPOINT_SETUP_FAILED, 0, 3, status);
+    return false;
   }
 
 
@@ -393,59 +881,141 @@ static cpc_endpoint_status_t connect(){
                                       SL_CPC_ENDPOINT_ON_CONNECT,
                                       (void*)cpc_connect_command);
   if (status != SL_STATUS_OK) {
-    debug_print("sl_cpc_set_endpoint_option SL_CPC_ENDPOINT_ON_CONNECT failed, status = 0x%lx\r\n", status);
-    return CPC_ENDPOINT_CLOSED;
+    CPC_TRACE(ENDPOINT_SETUP_FAILED, 0, 4, status);
+    return false;
   }
 
-  return CPC_ENDPOINT_OPEN;
+  return true;
 
 }
 
-// Check & Update endpoint status
-void cpc_test_endpoint_status(){
-  if ( endpoint_status == CPC_ENDPOINT_DISCONNECTED && sl_cpc_get_endpoint_state(&custom_endpoint_handle) == SL_CPC_STATE_FREED){
-      endpoint_status = CPC_ENDPOINT_CLOSED;
+static void link_close(void){
+  sl_status_t status = sl_cpc_close_endpoint(&custom_endpoint_handle);
+
+  // The link polls for the endpoint being freed either way
+  if (status != SL_STATUS_OK) {
+    CPC_TRACE(ENDPOINT_CLOSE_FAILED, 0, 0, status);
   }
-  // If closed, open endpoint
-  if ( endpoint_status == CPC_ENDPOINT_CLOSED ){
-      debug_print("ep closed, connecting...\r\n");
-      endpoint_status = connect();
-      debug_print("ep status after connection attempt = %d\r\n", endpoint_status);
+}
+
+static bool link_is_freed(void){
+  return sl_cpc_get_endpoint_state(&custom_endpoint_handle) == SL_CPC_STATE_FREED;
+}
+
+static void link_host_gone(void){
+  drop_commands();
+  // A host that went away cannot finish a staged write
+  cpc_userdata_abort();
+  cpc_ctune_sweep_reset();
+  cpc_tone_reset();
+}
+
+static uint8_t link_reclaim(void){
+  uint8_t count = cpc_reply_pool_reclaim();
+
+  CPC_TRACE(ENDPOINT_FREED, 0, count, 0);
+  return count;
+}
+
+static const cpc_link_ops_t link_ops = {
+  .open = link_open,
+  .close = link_close,
+  .is_freed = link_is_freed,
+  .host_gone = link_host_gone,
+  .reclaim = link_reclaim,
+};
+
+// Opens, closes and reopens the endpoint as the link needs
+static void step_link(void){
+  uint64_t ms = 0;
+  uint32_t delay_ms;
+
+  sl_sleeptimer_tick64_to_ms(sl_sleeptimer_get_tick_count64(), &ms);
+  delay_ms = cpc_link_step(&custom_link, (uint32_t) ms);
+  if (delay_ms > 0) {
+    retry_later(delay_ms);
   }
 }
 
+void cpc_custom_signal(void){
+  work_pending = true;
+#if defined(SL_CATALOG_KERNEL_PRESENT)
+  if (custom_task_handle == NULL) {
+    return; // the task runs once anyway when it starts
+  }
+  if (xPortIsInsideInterrupt()) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(custom_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+  } else {
+    xTaskNotifyGive(custom_task_handle);
+  }
+#endif
+}
+
+bool cpc_custom_is_ok_to_sleep(void){
+  return !work_pending;
+}
+
 #if defined(SL_CATALOG_KERNEL_PRESENT)
 void cpc_custom_task(void *pvParameter) {
   (void)pvParameter;
 
   while (1) {
       cpc_custom_process_action();
+      // Blocks until a CPC callback or timer has something for us
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
   }
 }
 #endif
 
 void cpc_custom_init(){
-  debug_print("cpc_custom_init\r\n");
+  cpc_reply_pool_init();
+  cpc_link_init(&custom_link, &link_ops);
+
+  // Cycle counter for the GET_STATS handler times and trace timestamps
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-  // Check endpoint state and connect if needed
-  cpc_test_endpoint_status();
+  // Open the endpoint
+  step_link();
 
-// If FreeRTOS, create polling task
+// If FreeRTOS, create the command task
 #if defined(SL_CATALOG_KERNEL_PRESENT)
   xTaskCreate(cpc_custom_task,
               "cpc_custom_task",
-              configMINIMAL_STACK_SIZE,
+              CPC_CUSTOM_TASK_STACK_SIZE,
                   NULL,
-                  1,
-                  NULL);
+                  CPC_CUSTOM_TASK_PRIORITY,
+                  &custom_task_handle);
 #endif
 }
 
 void cpc_custom_process_action(){
-  // This is a polled function, called either from the super loop or
-  // as a FreeRTOS task
+  // Called from the super loop or the FreeRTOS task, only does work after
+  // cpc_custom_signal()
+  bool run;
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  run = work_pending;
+  work_pending = false;
+  CORE_EXIT_ATOMIC();
+  if (!run) {
+    return;
+  }
+
+  // Handle a disconnect, reconnect when CPC allows it
+  step_link();
 
-  // Check endpoint state and connect if needed
-  cpc_test_endpoint_status();
+  // Commands received, and those held back while the ring or the reply
+  // pool was full
+  if (cpc_link_is_connected(&custom_link)) {
+    fill_command_ring();
+    run_commands();
+  }
 
+  // Advance a CTUNE sweep or tone plan and send their step events
+  cpc_ctune_sweep_process();
+  cpc_tone_process();
 }
@@ -31,9 +31,30 @@
 #ifndef CPC_CUSTOM_H_
 #define CPC_CUSTOM_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// 802.15.4 channel of the CW tone
+#ifndef DEFAULT_802154_CH
+#define DEFAULT_802154_CH 11 //default channel 11
+#endif
 
 void cpc_custom_init();
 void cpc_custom_process_action();
 
+// Schedules a cpc_custom_process_action() run: wakes the FreeRTOS task, or
+// the next super loop pass on bare metal. Callable from interrupts and CPC
+// or sleeptimer callbacks.
+void cpc_custom_signal(void);
+
+// True when cpc_custom_process_action() has nothing to do until the next
+// cpc_custom_signal(), for a bare-metal app's sleep hook.
+bool cpc_custom_is_ok_to_sleep(void);
+
+// Sends an unsolicited event frame (opcode with CPC_EVENT_FLAG set) to the
+// host. Returns false if the endpoint is not connected or no reply buffer
+// is free; the caller retries later.
+bool cpc_custom_send_event(uint8_t opcode, const uint8_t *payload, uint8_t len);
+
 
 #endif /* CPC_CUSTOM_H_ */
@@ -0,0 +1,222 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_frame.h
+ * Frame format of the custom CPC endpoint, shared by the RCP and the host
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_FRAME_H_
+#define CPC_FRAME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every frame on the custom endpoint, command, reply or event, is
+ *
+ *   version u8     CPC_FRAME_VERSION, frames with another one are dropped
+ *   opcode u8      enum CustCpcCommand, or an event opcode
+ *   flags u8       CPC_FRAME_FLAG_*
+ *   seq u8         request ID chosen by the host, echoed in the reply;
+ *                  event counter in events
+ *   status u8      enum CpcFrameStatus, set by the RCP in replies
+ *   len u16        length of the payload
+ *   payload        command arguments, reply or event data
+ *   TLVs           only with CPC_FRAME_FLAG_TLV: { type u8, len u8, value }
+ *                  up to the end of the frame
+ *
+ * All integers are little endian, in the header and in the payloads. The
+ * functions below work in place on the frame buffer: the encoder writes
+ * the header in front of a payload already in the buffer, and the decoder
+ * returns pointers into the buffer it was given.
+ */
+#define CPC_FRAME_VERSION 2
+#define CPC_FRAME_HEADER_SIZE 7
+
+#define CPC_FRAME_FLAG_REPLY 0x01  // reply to a command
+#define CPC_FRAME_FLAG_EVENT 0x02  // sent by the RCP on its own
+#define CPC_FRAME_FLAG_TLV   0x04  // TLVs follow the payload
+#define CPC_FRAME_FLAG_PROGRESS 0x08 // with REPLY: the command is still running,
+                                     // payload done u16, total u16; the
+                                     // final reply follows with the same seq
+
+#define CPC_FRAME_PROGRESS_SIZE 4
+
+enum CpcFrameStatus {
+  CPC_FRAME_OK = 0,
+  CPC_FRAME_BAD_VERSION,    // unsupported version
+  CPC_FRAME_UNKNOWN_OPCODE, // no such command on the RCP
+  CPC_FRAME_BAD_LENGTH,     // wrong argument length for the command
+  CPC_FRAME_MALFORMED,      // header length or TLVs do not match the frame
+  // Only sent by the daemon (cpc_daemon.h), in place of a reply from the RCP
+  CPC_FRAME_NOT_CONNECTED,  // not connected to the RCP
+  CPC_FRAME_BUSY,           // too many requests in flight
+  CPC_FRAME_EXPIRED         // no reply from the RCP in time
+};
+
+// Decoded frame. payload and tlv point into the decoded buffer.
+typedef struct {
+  uint8_t version;
+  uint8_t opcode;
+  uint8_t flags;
+  uint8_t seq;
+  uint8_t status;
+  uint16_t len;
+  const uint8_t *payload;
+  const uint8_t *tlv;       // NULL without CPC_FRAME_FLAG_TLV
+  uint16_t tlv_len;
+} cpc_frame_t;
+
+static inline uint16_t cpc_get_u16(const uint8_t *p){
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline void cpc_put_u16(uint8_t *p, uint16_t value){
+  p[0] = (uint8_t) value;
+  p[1] = (uint8_t) (value >> 8);
+}
+
+static inline uint32_t cpc_get_u32(const uint8_t *p){
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void cpc_put_u32(uint8_t *p, uint32_t value){
+  p[0] = (uint8_t) value;
+  p[1] = (uint8_t) (value >> 8);
+  p[2] = (uint8_t) (value >> 16);
+  p[3] = (uint8_t) (value >> 24);
+}
+
+// Writes the header of a frame whose len byte payload is already at
+// frame + CPC_FRAME_HEADER_SIZE. Returns the frame length.
+static inline size_t cpc_frame_encode(uint8_t *frame,
+                                      uint8_t opcode,
+                                      uint8_t flags,
+                                      uint8_t seq,
+                                      uint8_t status,
+                                      uint16_t len){
+  frame[0] = CPC_FRAME_VERSION;
+  frame[1] = opcode;
+  frame[2] = flags;
+  frame[3] = seq;
+  frame[4] = status;
+  cpc_put_u16(&frame[5], len);
+  return CPC_FRAME_HEADER_SIZE + (size_t) len;
+}
+
+// Replaces the seq of an encoded frame, for relays that remap it
+static inline void cpc_frame_set_seq(uint8_t *frame, uint8_t seq){
+  frame[3] = seq;
+}
+
+// Appends a TLV to a frame of frame_len bytes in a buffer of size bytes
+// and sets CPC_FRAME_FLAG_TLV. Returns the new frame length, or 0 if the
+// TLV does not fit.
+static inline size_t cpc_frame_add_tlv(uint8_t *frame,
+                                       size_t frame_len,
+                                       size_t size,
+                                       uint8_t type,
+                                       uint8_t len,
+                                       const void *value){
+  const uint8_t *v = (const uint8_t *) value;
+
+  if ((frame_len < CPC_FRAME_HEADER_SIZE) || (frame_len + 2 + len > size)) {
+    return 0;
+  }
+  frame[2] |= CPC_FRAME_FLAG_TLV;
+  frame[frame_len] = type;
+  frame[frame_len + 1] = len;
+  for (uint8_t i = 0; i < len; i++) {
+    frame[frame_len + 2 + i] = v[i];
+  }
+  return frame_len + 2 + len;
+}
+
+// Decodes size bytes of frame into f without copying. Returns an enum
+// CpcFrameStatus: anything but CPC_FRAME_OK means the frame cannot be
+// used, although the header fields are filled in if it has one (to
+// answer a bad command). The whole TLV section is checked here, so
+// cpc_frame_next_tlv() needs no bounds checks of its own.
+static inline uint8_t cpc_frame_decode(const uint8_t *frame, size_t size, cpc_frame_t *f){
+  size_t end;
+
+  if (size < CPC_FRAME_HEADER_SIZE) {
+    return CPC_FRAME_MALFORMED;
+  }
+  f->version = frame[0];
+  f->opcode = frame[1];
+  f->flags = frame[2];
+  f->seq = frame[3];
+  f->status = frame[4];
+  f->len = cpc_get_u16(&frame[5]);
+  f->payload = frame + CPC_FRAME_HEADER_SIZE;
+  f->tlv = NULL;
+  f->tlv_len = 0;
+  if (f->version != CPC_FRAME_VERSION) {
+    return CPC_FRAME_BAD_VERSION;
+  }
+
+  end = CPC_FRAME_HEADER_SIZE + (size_t) f->len;
+  if (end > size) {
+    return CPC_FRAME_MALFORMED;
+  }
+  if (!(f->flags & CPC_FRAME_FLAG_TLV)) {
+    return (end == size) ? CPC_FRAME_OK : CPC_FRAME_MALFORMED;
+  }
+  if (size - end > UINT16_MAX) {
+    return CPC_FRAME_MALFORMED;
+  }
+  f->tlv = frame + end;
+  f->tlv_len = (uint16_t) (size - end);
+  while (end < size) {
+    if (size - end < 2) {
+      return CPC_FRAME_MALFORMED;
+    }
+    end += 2 + (size_t) frame[end + 1];
+  }
+  return (end == size) ? CPC_FRAME_OK : CPC_FRAME_MALFORMED;
+}
+
+// Iterates over the TLVs of a decoded frame. *offset starts at 0.
+// Returns false after the last one.
+static inline bool cpc_frame_next_tlv(const cpc_frame_t *f,
+                                      uint16_t *offset,
+                                      uint8_t *type,
+                                      uint8_t *len,
+                                      const uint8_t **value){
+  if ((f->tlv == NULL) || (*offset >= f->tlv_len)) {
+    return false;
+  }
+  *type = f->tlv[*offset];
+  *len = f->tlv[*offset + 1];
+  *value = &f->tlv[*offset + 2];
+  *offset = (uint16_t) (*offset + 2 + *len);
+  return true;
+}
+
+#endif /* CPC_FRAME_H_ */
@@ -0,0 +1,133 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_link.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include "cpc_link.h"
+
+void cpc_link_init(cpc_link_t *link, const cpc_link_ops_t *ops){
+  link->ops = ops;
+  link->state = CPC_LINK_CLOSED;
+  atomic_store(&link->connect_seen, false);
+  atomic_store(&link->error_seen, false);
+  link->retry_ms = CPC_LINK_RETRY_MIN_MS;
+  link->next_ms = 0;
+  link->stats = (cpc_link_stats_t) { 0 };
+}
+
+void cpc_link_on_connect(cpc_link_t *link){
+  atomic_store(&link->connect_seen, true);
+}
+
+void cpc_link_on_error(cpc_link_t *link){
+  atomic_store(&link->error_seen, true);
+}
+
+bool cpc_link_is_connected(const cpc_link_t *link){
+  return link->state == CPC_LINK_CONNECTED;
+}
+
+// Schedules the next try retry_ms from now, and doubles the delay after it
+static void back_off(cpc_link_t *link, uint32_t now_ms){
+  link->next_ms = now_ms + link->retry_ms;
+  link->retry_ms = (link->retry_ms * 2 > CPC_LINK_RETRY_MAX_MS) ? CPC_LINK_RETRY_MAX_MS : link->retry_ms * 2;
+}
+
+// Time left until next_ms, 0 if it has passed. The clock may wrap.
+static uint32_t remaining(const cpc_link_t *link, uint32_t now_ms){
+  int32_t left = (int32_t) (link->next_ms - now_ms);
+
+  return (left > 0) ? (uint32_t) left : 0;
+}
+
+uint32_t cpc_link_step(cpc_link_t *link, uint32_t now_ms){
+  const cpc_link_ops_t *ops = link->ops;
+  uint32_t left;
+
+  // An error ends the connection, and a connect seen before it with it
+  if (atomic_exchange(&link->error_seen, false)) {
+    if ((link->state == CPC_LINK_WAIT_CONNECTION) || (link->state == CPC_LINK_CONNECTED)) {
+      if (link->state == CPC_LINK_CONNECTED) {
+        link->stats.reconnects++;
+      }
+      atomic_store(&link->connect_seen, false);
+      ops->close();
+      ops->host_gone();
+      link->state = CPC_LINK_CLOSING;
+      link->retry_ms = CPC_LINK_RETRY_MIN_MS;
+      link->next_ms = now_ms;
+    }
+  }
+  if (atomic_exchange(&link->connect_seen, false) && (link->state == CPC_LINK_WAIT_CONNECTION)) {
+    link->state = CPC_LINK_CONNECTED;
+    link->retry_ms = CPC_LINK_RETRY_MIN_MS;
+  }
+
+  while (1) {
+    switch (link->state) {
+      case CPC_LINK_CLOSED:
+        if (ops->open()) {
+          link->state = CPC_LINK_WAIT_CONNECTION;
+          return 0;
+        }
+        link->stats.open_failures++;
+        back_off(link, now_ms);
+        link->state = CPC_LINK_BACKOFF;
+        return remaining(link, now_ms);
+
+      case CPC_LINK_BACKOFF:
+        left = remaining(link, now_ms);
+        if (left > 0) {
+          return left;
+        }
+        link->state = CPC_LINK_CLOSED;
+        break;
+
+      case CPC_LINK_CLOSING:
+        left = remaining(link, now_ms);
+        if (left > 0) {
+          return left; // woken early, keep the poll period
+        }
+        if (!ops->is_freed()) {
+          // CPC has no callback for the endpoint being freed
+          back_off(link, now_ms);
+          return remaining(link, now_ms);
+        }
+        // CPC holds none of our buffers anymore
+        link->stats.reclaimed += ops->reclaim();
+        link->retry_ms = CPC_LINK_RETRY_MIN_MS;
+        link->state = CPC_LINK_CLOSED;
+        break;
+
+      case CPC_LINK_WAIT_CONNECTION:
+      case CPC_LINK_CONNECTED:
+      default:
+        return 0;
+    }
+  }
+}
@@ -0,0 +1,112 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_link.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_LINK_H_
+#define CPC_LINK_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bounds of the backoff between endpoint open attempts, and between polls
+// of an endpoint that is being freed (can be overridden by global compiler
+// define)
+#ifndef CPC_LINK_RETRY_MIN_MS
+#define CPC_LINK_RETRY_MIN_MS 10
+#endif
+#ifndef CPC_LINK_RETRY_MAX_MS
+#define CPC_LINK_RETRY_MAX_MS 1000
+#endif
+
+/*
+ * Connection state of the custom endpoint:
+ *
+ *   CLOSED           open ok: WAIT_CONNECTION, open failed: BACKOFF
+ *   BACKOFF          delay over: CLOSED
+ *   WAIT_CONNECTION  connect callback: CONNECTED
+ *   WAIT_CONNECTION,
+ *   CONNECTED        error callback: endpoint closed, host state dropped,
+ *                    CLOSING
+ *   CLOSING          endpoint freed: reply buffers reclaimed, CLOSED
+ *
+ * The CPC callbacks only record what happened; cpc_link_step(), run by the
+ * command task, makes the transitions, so the host's commands are never
+ * dropped under a command that is running. The delay before each new open
+ * or poll doubles from CPC_LINK_RETRY_MIN_MS up to CPC_LINK_RETRY_MAX_MS,
+ * and starts over once the host connects or the endpoint is freed.
+ */
+typedef enum {
+  CPC_LINK_CLOSED,
+  CPC_LINK_WAIT_CONNECTION,
+  CPC_LINK_CONNECTED,
+  CPC_LINK_CLOSING,
+  CPC_LINK_BACKOFF,
+} cpc_link_state_t;
+
+// What the state machine does to CPC and to the application, so that it
+// can be driven without CPC
+typedef struct {
+  bool (*open)(void);       // opens the endpoint and sets its callbacks
+  void (*close)(void);      // closes it after an error
+  bool (*is_freed)(void);   // CPC released it, it can be opened again
+  void (*host_gone)(void);  // forgets the commands and state of the host
+  uint8_t (*reclaim)(void); // frees buffers of writes CPC dropped, returns how many
+} cpc_link_ops_t;
+
+typedef struct {
+  uint32_t reconnects;    // errors while connected
+  uint32_t open_failures; // open attempts that failed
+  uint32_t reclaimed;     // buffers returned by ops->reclaim
+} cpc_link_stats_t;
+
+typedef struct {
+  const cpc_link_ops_t *ops;
+  cpc_link_state_t state;
+  atomic_bool connect_seen; // set by the callbacks, taken by cpc_link_step()
+  atomic_bool error_seen;
+  uint32_t retry_ms;        // delay before the next open or poll
+  uint32_t next_ms;         // BACKOFF, CLOSING: time of the next try
+  cpc_link_stats_t stats;
+} cpc_link_t;
+
+void cpc_link_init(cpc_link_t *link, const cpc_link_ops_t *ops);
+
+// From the CPC connect and error callbacks, any context
+void cpc_link_on_connect(cpc_link_t *link);
+void cpc_link_on_error(cpc_link_t *link);
+
+// Makes the transitions due at now_ms (any free running millisecond
+// clock). Returns the time in ms until it must run again, or 0 if only a
+// callback can change the state.
+uint32_t cpc_link_step(cpc_link_t *link, uint32_t now_ms);
+
+bool cpc_link_is_connected(const cpc_link_t *link);
+
+#endif /* CPC_LINK_H_ */
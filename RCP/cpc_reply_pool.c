@@ -0,0 +1,152 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_reply_pool.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+
+#include "cpc_reply_pool.h"
+#include "em_core.h"
+#include "em_assert.h"
+
+static cpc_reply_slot_t slots[CPC_REPLY_POOL_SLOTS];
+
+// Stack of free slot indexes, free_stack[0..free_count-1] are available
+static uint8_t free_stack[CPC_REPLY_POOL_SLOTS];
+static uint8_t free_count;
+
+static cpc_reply_pool_stats_t pool_stats;
+
+void cpc_reply_pool_init(void){
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  for (uint8_t i = 0; i < CPC_REPLY_POOL_SLOTS; i++) {
+    slots[i].index = i;
+    slots[i].writing = false;
+    free_stack[i] = i;
+  }
+  free_count = CPC_REPLY_POOL_SLOTS;
+  pool_stats.in_use = 0;
+  CORE_EXIT_ATOMIC();
+}
+
+cpc_reply_slot_t *cpc_reply_pool_acquire(void){
+  cpc_reply_slot_t *slot = NULL;
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  if (free_count > 0) {
+    slot = &slots[free_stack[--free_count]];
+    pool_stats.in_use++;
+    if (pool_stats.in_use > pool_stats.high_water) {
+      pool_stats.high_water = pool_stats.in_use;
+    }
+  } else {
+    pool_stats.acquire_failures++;
+  }
+  CORE_EXIT_ATOMIC();
+
+  return slot;
+}
+
+// Called with interrupts masked
+static void release(cpc_reply_slot_t *slot){
+  EFM_ASSERT(free_count < CPC_REPLY_POOL_SLOTS);
+  slot->writing = false;
+  free_stack[free_count++] = slot->index;
+  pool_stats.in_use--;
+}
+
+void cpc_reply_pool_release(cpc_reply_slot_t *slot){
+  CORE_DECLARE_IRQ_STATE;
+
+  EFM_ASSERT(slot == &slots[slot->index]);
+  CORE_ENTER_ATOMIC();
+  release(slot);
+  CORE_EXIT_ATOMIC();
+}
+
+// The token is the slot index in the low byte and the write id above it
+void *cpc_reply_pool_write_begin(cpc_reply_slot_t *slot){
+  uintptr_t token;
+  CORE_DECLARE_IRQ_STATE;
+
+  EFM_ASSERT(slot == &slots[slot->index]);
+  CORE_ENTER_ATOMIC();
+  slot->write_id++;
+  slot->writing = true;
+  token = ((uintptr_t) slot->write_id << 8) | slot->index;
+  CORE_EXIT_ATOMIC();
+
+  return (void *) token;
+}
+
+bool cpc_reply_pool_write_end(void *token){
+  uintptr_t value = (uintptr_t) token;
+  cpc_reply_slot_t *slot;
+  bool current;
+  CORE_DECLARE_IRQ_STATE;
+
+  EFM_ASSERT((value & 0xFF) < CPC_REPLY_POOL_SLOTS);
+  slot = &slots[value & 0xFF];
+  CORE_ENTER_ATOMIC();
+  current = slot->writing && (slot->write_id == (uint16_t) (value >> 8));
+  if (current) {
+    release(slot);
+  } else {
+    pool_stats.stale_writes++;
+  }
+  CORE_EXIT_ATOMIC();
+
+  return current;
+}
+
+uint8_t cpc_reply_pool_reclaim(void){
+  uint8_t count = 0;
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  for (uint8_t i = 0; i < CPC_REPLY_POOL_SLOTS; i++) {
+    if (slots[i].writing) {
+      release(&slots[i]);
+      count++;
+    }
+  }
+  pool_stats.reclaimed += count;
+  CORE_EXIT_ATOMIC();
+
+  return count;
+}
+
+void cpc_reply_pool_get_stats(cpc_reply_pool_stats_t *stats){
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  *stats = pool_stats;
+  CORE_EXIT_ATOMIC();
+}
@@ -0,0 +1,96 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_reply_pool.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+
+#ifndef CPC_REPLY_POOL_H_
+#define CPC_REPLY_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of replies that can be outstanding (written but not yet completed)
+#ifndef CPC_REPLY_POOL_SLOTS
+#define CPC_REPLY_POOL_SLOTS 4
+#endif
+
+// Size of one reply buffer, including the frame header. The largest reply
+// is a USERDATA_READ chunk: header, status, CPC_USERDATA_CHUNK_MAX bytes
+// and CRC.
+#ifndef CPC_REPLY_SLOT_SIZE
+#define CPC_REPLY_SLOT_SIZE 140
+#endif
+
+typedef struct {
+  uint8_t data[CPC_REPLY_SLOT_SIZE];
+  uint8_t index; // position in the pool, set by cpc_reply_pool_init()
+  bool writing;  // handed to sl_cpc_write(), see cpc_reply_pool_write_begin()
+  uint16_t write_id; // counts the writes of the slot, tells stale completions apart
+} cpc_reply_slot_t;
+
+typedef struct {
+  uint8_t in_use;            // slots currently acquired
+  uint8_t high_water;        // most slots ever acquired at once
+  uint32_t acquire_failures; // acquires that found the pool empty
+  uint32_t reclaimed;        // slots taken back from writes CPC dropped
+  uint32_t stale_writes;     // write completions that came after a reclaim
+} cpc_reply_pool_stats_t;
+
+void cpc_reply_pool_init(void);
+
+// Returns a free slot, or NULL if all slots are in use. O(1).
+cpc_reply_slot_t *cpc_reply_pool_acquire(void);
+
+// Returns a slot to the pool. O(1).
+void cpc_reply_pool_release(cpc_reply_slot_t *slot);
+
+/*
+ * Writes in flight. A slot handed to sl_cpc_write() is only released by
+ * its write completion, which CPC does not always report: writes queued
+ * when the host goes away may be dropped with the endpoint. The argument
+ * passed to sl_cpc_write() is a token naming the slot and the write, so
+ * that a slot can be reclaimed once the endpoint is freed, and a
+ * completion that still turns up afterwards cannot release the slot again
+ * while it holds a later reply.
+ */
+
+// Marks slot as written and returns the sl_cpc_write() argument for it
+void *cpc_reply_pool_write_begin(cpc_reply_slot_t *slot);
+
+// Releases the slot of a write that completed or was refused. Returns
+// false, and leaves the pool alone, if the write was reclaimed. O(1).
+bool cpc_reply_pool_write_end(void *token);
+
+// Releases every slot still being written. Only call once CPC freed the
+// endpoint, and no longer holds the buffers. Returns the number released.
+uint8_t cpc_reply_pool_reclaim(void);
+
+void cpc_reply_pool_get_stats(cpc_reply_pool_stats_t *stats);
+
+#endif /* CPC_REPLY_POOL_H_ */
@@ -0,0 +1,220 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_tone.c
+ * Transmit test tones and tone plans for the custom CPC endpoint
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include "cpc_tone.h"
+#include "cpc_commands.h"
+#include "cpc_custom.h"
+#include "cpc_ctune_sweep.h"
+#include "rail.h"
+#include "sl_sleeptimer.h"
+
+extern RAIL_Handle_t emPhyRailHandle;
+
+struct tone {
+  uint16_t channel;
+  int16_t power_ddbm;
+  uint8_t mode;
+  uint16_t duration_ms;
+};
+
+static struct {
+  bool running;
+  uint8_t count;
+  uint8_t index;            // entry being played
+  struct tone entries[CPC_TONE_PLAN_MAX];
+  sl_sleeptimer_timer_handle_t timer;
+} plan;
+
+// Power to restore when the tone stops
+static bool power_saved = false;
+static RAIL_TxPower_t saved_power;
+
+// Set from the sleeptimer interrupt
+static volatile bool duration_elapsed = false;
+
+// Step event waiting for a free reply buffer
+static bool event_pending = false;
+static uint8_t event[CPC_TONE_STEP_EVENT_SIZE];
+
+static uint32_t now_ms(void){
+  uint64_t ms = 0;
+
+  sl_sleeptimer_tick64_to_ms(sl_sleeptimer_get_tick_count64(), &ms);
+  return (uint32_t) ms;
+}
+
+static void queue_event(uint8_t kind, const struct tone *tone, uint8_t status){
+  uint32_t time = now_ms();
+
+  event[0] = kind;
+  event[1] = plan.index;
+  event[2] = tone->channel & 0xff;
+  event[3] = tone->channel >> 8;
+  event[4] = (uint16_t) tone->power_ddbm & 0xff;
+  event[5] = (uint16_t) tone->power_ddbm >> 8;
+  event[6] = tone->mode;
+  event[7] = status;
+  for (int i = 0; i < 4; i++) {
+    event[8 + i] = (uint8_t) (time >> (8 * i));
+  }
+  event_pending = true;
+  cpc_custom_signal();
+}
+
+static void on_duration(sl_sleeptimer_timer_handle_t *handle, void *data){
+  (void)handle;
+  (void)data;
+  duration_elapsed = true;
+  cpc_custom_signal();
+}
+
+static void restore_power(void){
+  if (power_saved) {
+    RAIL_SetTxPowerDbm(emPhyRailHandle, saved_power);
+    power_saved = false;
+  }
+}
+
+static uint8_t start_stream(uint16_t channel, int16_t power_ddbm, uint8_t mode){
+  RAIL_Status_t status;
+
+  if (power_ddbm != CPC_TONE_POWER_UNCHANGED) {
+    if (!power_saved) {
+      saved_power = RAIL_GetTxPowerDbm(emPhyRailHandle);
+      power_saved = true;
+    }
+    status = RAIL_SetTxPowerDbm(emPhyRailHandle, power_ddbm);
+    if (status != RAIL_STATUS_NO_ERROR) {
+      return status;
+    }
+  }
+  return RAIL_StartTxStream(emPhyRailHandle, channel, mode);
+}
+
+uint8_t cpc_tone_start(uint16_t channel, int16_t power_ddbm, uint8_t mode){
+  // A plan or CTUNE sweep owns the transmitter until it ends
+  if (plan.running || cpc_ctune_sweep_running()) {
+    return RAIL_STATUS_INVALID_STATE;
+  }
+  return start_stream(channel, power_ddbm, mode);
+}
+
+static void finish(uint8_t kind, uint8_t status){
+  const struct tone *tone = &plan.entries[plan.index];
+
+  RAIL_StopTxStream(emPhyRailHandle);
+  sl_sleeptimer_stop_timer(&plan.timer);
+  restore_power();
+  plan.running = false;
+  queue_event(kind, tone, status);
+}
+
+// Plays the current entry and reports it
+static void play(void){
+  const struct tone *tone = &plan.entries[plan.index];
+  RAIL_Status_t status;
+
+  RAIL_StopTxStream(emPhyRailHandle);
+  status = start_stream(tone->channel, tone->power_ddbm, tone->mode);
+  if (status != RAIL_STATUS_NO_ERROR) {
+    finish(CPC_CTUNE_STEP_ERROR, status);
+    return;
+  }
+  queue_event(CPC_CTUNE_STEP, tone, status);
+  duration_elapsed = false;
+  sl_sleeptimer_start_timer_ms(&plan.timer, tone->duration_ms, on_duration, NULL, 0, 0);
+}
+
+uint8_t cpc_tone_stop(void){
+  if (plan.running) {
+    finish(CPC_CTUNE_STEP_ABORTED, RAIL_STATUS_NO_ERROR);
+    return RAIL_STATUS_NO_ERROR;
+  }
+  // The CW tone of a CTUNE sweep or search is stopped too
+  cpc_ctune_sweep_stop();
+  restore_power();
+  return RAIL_StopTxStream(emPhyRailHandle);
+}
+
+uint8_t cpc_tone_plan_start(const uint8_t *entries, uint16_t len){
+  uint8_t count = (uint8_t) (len / CPC_TONE_PLAN_ENTRY_SIZE);
+
+  if (plan.running || cpc_ctune_sweep_running()) {
+    return CPC_CTUNE_SWEEP_BUSY;
+  }
+  if ((len == 0) || (len % CPC_TONE_PLAN_ENTRY_SIZE != 0)
+      || (len > CPC_TONE_PLAN_MAX * CPC_TONE_PLAN_ENTRY_SIZE)) {
+    return CPC_CTUNE_SWEEP_BAD_ARGS;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    const uint8_t *e = &entries[i * CPC_TONE_PLAN_ENTRY_SIZE];
+    struct tone *tone = &plan.entries[i];
+
+    tone->channel = (uint16_t) (e[0] | (e[1] << 8));
+    tone->power_ddbm = (int16_t) (e[2] | (e[3] << 8));
+    tone->mode = e[4];
+    tone->duration_ms = (uint16_t) (e[5] | (e[6] << 8));
+    if (tone->duration_ms == 0) {
+      return CPC_CTUNE_SWEEP_BAD_ARGS;
+    }
+  }
+  plan.count = count;
+  plan.index = 0;
+  plan.running = true;
+  play();
+  return CPC_CTUNE_SWEEP_OK;
+}
+
+bool cpc_tone_plan_running(void){
+  return plan.running;
+}
+
+void cpc_tone_reset(void){
+  cpc_tone_stop();
+  event_pending = false; // nobody left to tell
+}
+
+void cpc_tone_process(void){
+  if (event_pending) {
+    if (!cpc_custom_send_event(CPC_EVENT_TONE_STEP, event, sizeof(event))) {
+      return; // retried on the next call, the plan waits for it
+    }
+    event_pending = false;
+  }
+  if (plan.running && duration_elapsed) {
+    duration_elapsed = false;
+    if (plan.index + 1 >= plan.count) {
+      finish(CPC_CTUNE_STEP_DONE, RAIL_STATUS_NO_ERROR);
+    } else {
+      plan.index++;
+      play();
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_tone.h
+ * Transmit test tones and tone plans for the custom CPC endpoint
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_TONE_H_
+#define CPC_TONE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Transmit tones for RF testing, see TONE_START and TONE_PLAN in
+ * cpc_commands.h. The transmit power found before the first tone is
+ * restored when the tone or plan stops.
+ */
+
+// Starts a tone. Returns the RAIL status, RAIL_STATUS_INVALID_STATE while a
+// plan or CTUNE sweep runs.
+uint8_t cpc_tone_start(uint16_t channel, int16_t power_ddbm, uint8_t mode);
+
+// Stops the tone, aborting a running plan or CTUNE sweep. Returns the RAIL
+// status.
+uint8_t cpc_tone_stop(void);
+
+// Starts a plan of CPC_TONE_PLAN_ENTRY_SIZE byte entries. Returns an
+// enum CpcCtuneSweepStatus.
+uint8_t cpc_tone_plan_start(const uint8_t *entries, uint16_t len);
+
+bool cpc_tone_plan_running(void);
+
+// Stops everything without an event, for when the host has gone away
+void cpc_tone_reset(void);
+
+void cpc_tone_process(void);
+
+#endif /* CPC_TONE_H_ */
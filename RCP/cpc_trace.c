@@ -0,0 +1,125 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_trace.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include "cpc_trace.h"
+#include "em_core.h"
+#include "em_device.h"
+
+#if CPC_TRACE_LEVEL > CPC_TRACE_LEVEL_OFF
+
+_Static_assert((CPC_TRACE_RING_SIZE & (CPC_TRACE_RING_SIZE - 1)) == 0,
+               "CPC_TRACE_RING_SIZE must be a power of two");
+_Static_assert(CPC_TRACE_RING_SIZE <= UINT16_MAX, "CPC_TRACE_RING_SIZE too large");
+
+#define RING_MASK (CPC_TRACE_RING_SIZE - 1)
+
+typedef struct {
+  uint32_t cycles;
+  uint8_t id;
+  uint8_t a;
+  uint16_t b;
+  uint32_t c;
+} cpc_trace_record_t;
+
+static cpc_trace_record_t records[CPC_TRACE_RING_SIZE];
+
+// Free running counters, records[head & RING_MASK] is the oldest record.
+// Writers may be interrupts, so both only change in critical sections.
+static uint32_t head;
+static uint32_t tail;
+static uint32_t lost;
+
+void cpc_trace_write(uint8_t id, uint8_t a, uint16_t b, uint32_t c){
+  cpc_trace_record_t *record;
+  CORE_DECLARE_IRQ_STATE;
+
+  CORE_ENTER_ATOMIC();
+  if (tail - head == CPC_TRACE_RING_SIZE) {
+    head++;
+    lost++;
+  }
+  record = &records[tail++ & RING_MASK];
+  record->cycles = DWT->CYCCNT;
+  record->id = id;
+  record->a = a;
+  record->b = b;
+  record->c = c;
+  CORE_EXIT_ATOMIC();
+}
+
+uint8_t cpc_trace_drain(uint8_t *out, uint8_t max, uint32_t *lost_out, uint16_t *left){
+  uint8_t count = 0;
+  CORE_DECLARE_IRQ_STATE;
+
+  // One record per critical section, so writers are never held up long
+  while (count < max) {
+    cpc_trace_record_t record;
+
+    CORE_ENTER_ATOMIC();
+    if (head == tail) {
+      CORE_EXIT_ATOMIC();
+      break;
+    }
+    record = records[head++ & RING_MASK];
+    CORE_EXIT_ATOMIC();
+    cpc_put_u32(&out[0], record.cycles);
+    out[4] = record.id;
+    out[5] = record.a;
+    cpc_put_u16(&out[6], record.b);
+    cpc_put_u32(&out[8], record.c);
+    out += CPC_TRACE_RECORD_SIZE;
+    count++;
+  }
+  CORE_ENTER_ATOMIC();
+  *lost_out = lost;
+  lost = 0;
+  *left = (uint16_t) (tail - head);
+  CORE_EXIT_ATOMIC();
+  return count;
+}
+
+#else
+
+void cpc_trace_write(uint8_t id, uint8_t a, uint16_t b, uint32_t c){
+  (void) id;
+  (void) a;
+  (void) b;
+  (void) c;
+}
+
+uint8_t cpc_trace_drain(uint8_t *out, uint8_t max, uint32_t *lost, uint16_t *left){
+  (void) out;
+  (void) max;
+  *lost = 0;
+  *left = 0;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_trace.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_TRACE_H_
+#define CPC_TRACE_H_
+
+#include <stdint.h>
+#include "cpc_commands.h"
+
+// Records compiled in: CPC_TRACE_LEVEL_OFF, _ERROR, _INFO or _DEBUG (can be
+// overridden by global compiler define). With CPC_TRACE_LEVEL_OFF no trace
+// code or RAM is left and TRACE_DRAIN returns no records.
+#ifndef CPC_TRACE_LEVEL
+#define CPC_TRACE_LEVEL CPC_TRACE_LEVEL_INFO
+#endif
+
+// Records kept until drained, a power of two; the oldest are written over
+#ifndef CPC_TRACE_RING_SIZE
+#define CPC_TRACE_RING_SIZE 64
+#endif
+
+/*
+ * Writes a CPC_TRACE_<name> record (see CPC_TRACE_EVENT_TABLE in
+ * cpc_commands.h) with the cycle counter as its time. Nothing is formatted
+ * on the RCP: a record is a few stores in a short critical section, so it
+ * can be written from the CPC callbacks and interrupts. A record above
+ * CPC_TRACE_LEVEL compiles to nothing, arguments included.
+ */
+#define CPC_TRACE(name, a, b, c) \
+  do { \
+    if (CPC_TRACE_##name##_LEVEL <= CPC_TRACE_LEVEL) { \
+      cpc_trace_write(CPC_TRACE_##name, (uint8_t) (a), (uint16_t) (b), (uint32_t) (c)); \
+    } \
+  } while (0)
+
+void cpc_trace_write(uint8_t id, uint8_t a, uint16_t b, uint32_t c);
+
+// Moves up to max of the oldest records into out, CPC_TRACE_RECORD_SIZE
+// bytes each, and returns their number. *lost receives the records
+// written over since the previous drain, *left those still in the ring.
+uint8_t cpc_trace_drain(uint8_t *out, uint8_t max, uint32_t *lost, uint16_t *left);
+
+#endif /* CPC_TRACE_H_ */
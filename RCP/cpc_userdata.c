@@ -0,0 +1,248 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_userdata.c
+ * USERDATA page access with RAM staging for the custom CPC commands
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include "cpc_userdata.h"
+#include "cpc_commands.h"
+#include <string.h>
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_msc.h"
+#include "sl_se_manager_util.h"
+
+#define USERDATA_WORDS (USERDATA_SIZE / sizeof(uint32_t))
+#define ERASED_WORD 0xFFFFFFFFu
+
+#define STEP_WORDS (CPC_USERDATA_STEP_BYTES / sizeof(uint32_t))
+
+// RAM copy of the page, valid while staging
+static uint32_t shadow[USERDATA_WORDS];
+static bool staging = false;
+
+// Commit in progress, see cpc_userdata_commit_step()
+typedef enum {
+  COMMIT_IDLE,
+  COMMIT_ERASE,
+  COMMIT_PROGRAM,
+  COMMIT_VERIFY
+} commit_phase_t;
+
+static struct {
+  commit_phase_t phase;
+  bool erased;
+  uint32_t next_word; // first word not programmed yet
+} commit;
+
+static const uint32_t *flash_words(void){
+  return (const uint32_t *) USERDATA_BASE;
+}
+
+static bool in_page(uint16_t offset, uint16_t len){
+  return ((uint32_t) offset + len) <= USERDATA_SIZE;
+}
+
+static bool erase_page(void){
+#if defined (_SILICON_LABS_32B_SERIES_2_CONFIG_1)
+  // xG21 erases userdata with the SE
+  extern sl_se_command_context_t cmd_ctx;
+  return sl_se_erase_user_data(&cmd_ctx) == SL_STATUS_OK;
+#else
+  CMU_ClockEnable(cmuClock_MSC, true);
+  return MSC_ErasePage((uint32_t *) USERDATA_BASE) == mscReturnOk;
+#endif
+}
+
+// Programs words [first, first + count) of the page from the shadow
+static bool write_words(uint32_t first, uint32_t count){
+#if defined (_SILICON_LABS_32B_SERIES_2_CONFIG_1)
+  // xG21 writes userdata with the SE
+  extern sl_se_command_context_t cmd_ctx;
+  return sl_se_write_user_data(&cmd_ctx,
+                               first * sizeof(uint32_t),
+                               &shadow[first],
+                               count * sizeof(uint32_t)) == SL_STATUS_OK;
+#else
+  MSC_Status_TypeDef msc_status;
+
+  CMU_ClockEnable(cmuClock_MSC, true);
+  MSC_Init();
+  msc_status = MSC_WriteWord((uint32_t *) USERDATA_BASE + first,
+                             &shadow[first],
+                             count * sizeof(uint32_t));
+  MSC_Deinit();
+  return msc_status == mscReturnOk;
+#endif
+}
+
+uint8_t cpc_userdata_read(uint16_t offset, uint16_t len, uint8_t *data){
+  if (!in_page(offset, len)) {
+    return CPC_USERDATA_BAD_RANGE;
+  }
+  memcpy(data, (const uint8_t *) USERDATA_BASE + offset, len);
+  return CPC_USERDATA_OK;
+}
+
+uint8_t cpc_userdata_stage(uint16_t offset, const uint8_t *data, uint16_t len){
+  if (!in_page(offset, len)) {
+    return CPC_USERDATA_BAD_RANGE;
+  }
+  if (!staging) {
+    memcpy(shadow, flash_words(), USERDATA_SIZE);
+    staging = true;
+  }
+  memcpy((uint8_t *) shadow + offset, data, len);
+  return CPC_USERDATA_OK;
+}
+
+static uint8_t commit_finish(uint8_t status, bool *erased, uint32_t *crc){
+  // On failure the data stays staged so the commit can be retried
+  staging = staging && (status != CPC_USERDATA_OK);
+  *erased = commit.erased;
+  *crc = cpc_crc32(0, (const uint8_t *) flash_words(), USERDATA_SIZE);
+  commit.phase = COMMIT_IDLE;
+  return status;
+}
+
+uint8_t cpc_userdata_commit_step(bool *erased, uint32_t *crc, uint16_t *done){
+  const uint32_t *flash = flash_words();
+  uint32_t end;
+
+  switch (commit.phase) {
+    case COMMIT_IDLE:
+      commit.erased = false;
+      commit.next_word = 0;
+      *done = 0;
+      if (!staging) {
+        return commit_finish(CPC_USERDATA_OK, erased, crc);
+      }
+      // Flash can only clear bits: changed words must still be blank,
+      // otherwise the whole page is erased and rewritten
+      commit.phase = COMMIT_PROGRAM;
+      for (uint32_t i = 0; i < USERDATA_WORDS; i++) {
+        if ((shadow[i] != flash[i]) && (flash[i] != ERASED_WORD)) {
+          commit.phase = COMMIT_ERASE;
+          break;
+        }
+      }
+      return CPC_USERDATA_PENDING;
+
+    case COMMIT_ERASE:
+      commit.erased = true;
+      if (!erase_page()) {
+        return commit_finish(CPC_USERDATA_FLASH_ERROR, erased, crc);
+      }
+      commit.phase = COMMIT_PROGRAM;
+      *done = 0;
+      return CPC_USERDATA_PENDING;
+
+    case COMMIT_PROGRAM:
+      // Program runs of words that differ from flash, up to the step end
+      end = commit.next_word + STEP_WORDS;
+      if (end > USERDATA_WORDS) {
+        end = USERDATA_WORDS;
+      }
+      for (uint32_t i = commit.next_word; i < end; ) {
+        uint32_t run = 0;
+
+        while ((i + run < end) && (shadow[i + run] != flash[i + run])) {
+          run++;
+        }
+        if ((run > 0) && !write_words(i, run)) {
+          return commit_finish(CPC_USERDATA_FLASH_ERROR, erased, crc);
+        }
+        i += (run > 0) ? run : 1;
+      }
+      commit.next_word = end;
+      if (end == USERDATA_WORDS) {
+        commit.phase = COMMIT_VERIFY;
+      }
+      *done = (uint16_t) (end * sizeof(uint32_t));
+      return CPC_USERDATA_PENDING;
+
+    case COMMIT_VERIFY:
+    default:
+      return commit_finish((memcmp(shadow, flash, USERDATA_SIZE) == 0) ? CPC_USERDATA_OK : CPC_USERDATA_VERIFY_FAILED,
+                           erased, crc);
+  }
+}
+
+void cpc_userdata_abort(void){
+  staging = false;
+  commit.phase = COMMIT_IDLE;
+}
+
+// Size of a token list entry header: offset u16, length u8
+#define TOKEN_HEADER_SIZE 3
+
+uint8_t cpc_userdata_provision_step(const uint8_t *list, uint16_t len, bool *erased, uint32_t *crc, uint16_t *done){
+  uint16_t pos;
+  uint8_t status;
+
+  if (commit.phase != COMMIT_IDLE) {
+    // Later steps of this provisioning
+    status = cpc_userdata_commit_step(erased, crc, done);
+    if (status != CPC_USERDATA_PENDING) {
+      cpc_userdata_abort();
+    }
+    return status;
+  }
+
+  *erased = false;
+  *done = 0;
+  cpc_userdata_abort();
+
+  // Check the whole list before staging anything
+  for (pos = 0; pos < len; ) {
+    uint16_t offset;
+    uint8_t value_len;
+
+    if (len - pos < TOKEN_HEADER_SIZE) {
+      break;
+    }
+    offset = (uint16_t) (list[pos] | (list[pos + 1] << 8));
+    value_len = list[pos + 2];
+    if ((value_len == 0) || (len - pos - TOKEN_HEADER_SIZE < value_len) || !in_page(offset, value_len)) {
+      break;
+    }
+    pos += TOKEN_HEADER_SIZE + value_len;
+  }
+  if ((len == 0) || (pos != len)) {
+    *crc = cpc_crc32(0, (const uint8_t *) flash_words(), USERDATA_SIZE);
+    return CPC_USERDATA_BAD_RANGE;
+  }
+
+  for (pos = 0; pos < len; pos += TOKEN_HEADER_SIZE + list[pos + 2]) {
+    cpc_userdata_stage((uint16_t) (list[pos] | (list[pos + 1] << 8)), &list[pos + TOKEN_HEADER_SIZE], list[pos + 2]);
+  }
+  status = cpc_userdata_commit_step(erased, crc, done);
+  if (status != CPC_USERDATA_PENDING) {
+    cpc_userdata_abort();
+  }
+  return status;
+}
@@ -0,0 +1,79 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_userdata.h
+ * USERDATA page access with RAM staging for the custom CPC commands
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_USERDATA_H_
+#define CPC_USERDATA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Writes are staged in a RAM copy of the USERDATA page. The first staged
+ * chunk snapshots the page; cpc_userdata_commit_step() then writes only the
+ * words that changed, erasing the page once if any of them is not blank
+ * in flash. Status values are enum CpcUserdataStatus.
+ */
+
+// Flash programmed per commit step (can be overridden by global compiler
+// define), a multiple of 4
+#ifndef CPC_USERDATA_STEP_BYTES
+#define CPC_USERDATA_STEP_BYTES 128
+#endif
+
+// Returned by the commit and provision steps while flash work remains
+#define CPC_USERDATA_PENDING 0xFF
+
+// Copies len bytes at offset of the page to data (staged data is not
+// visible until committed)
+uint8_t cpc_userdata_read(uint16_t offset, uint16_t len, uint8_t *data);
+
+// Copies len bytes of data to offset of the staged page
+uint8_t cpc_userdata_stage(uint16_t offset, const uint8_t *data, uint16_t len);
+
+// Writes the staged page to flash and verifies it, one step per call
+// (deciding whether to erase, the erase, CPC_USERDATA_STEP_BYTES of
+// programming, the verify) so the caller can let CPC run in between.
+// Returns CPC_USERDATA_PENDING with *done bytes of the page handled until
+// the last step, which returns the status: *erased is set if the page had
+// to be erased, *crc receives the CRC of the page after commit.
+uint8_t cpc_userdata_commit_step(bool *erased, uint32_t *crc, uint16_t *done);
+
+// Discards staged data, and stops a commit between two steps
+void cpc_userdata_abort(void);
+
+// Writes a USERDATA_PROVISION token list (without its CRC): discards any
+// staged data, stages every token and commits. Nothing is written if a
+// token is outside the page or the list is malformed, and nothing stays
+// staged afterwards. Steps like cpc_userdata_commit_step(), called again
+// with the same list while it returns CPC_USERDATA_PENDING.
+uint8_t cpc_userdata_provision_step(const uint8_t *list, uint16_t len, bool *erased, uint32_t *crc, uint16_t *done);
+
+#endif /* CPC_USERDATA_H_ */
@@ -0,0 +1,615 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_bench.c
+ * Latency benchmark for the custom CPC commands, broken down by phase
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include "cpc_commands.h"
+#include "custom_cpc.h"
+
+#define OPTSTRING "h"
+
+#define DEFAULT_ITERATIONS 100
+#define DEFAULT_SESSIONS 10
+
+// Bytes moved per --userdata sample, the USERDATA page size of series 2
+// devices
+#define USERDATA_BENCH_SIZE 1024
+
+// Offset of the CTUNE token in the USERDATA page
+#define CTUNE_TOKEN_OFFSET 0x100
+
+// Frames encoded or decoded per --codec sample, so that the microsecond
+// columns read as nanoseconds per frame
+#define CODEC_BATCH 1000
+
+static struct option long_options[] = {
+     {"help",          no_argument,       0, 'h' },
+     {"iterations",    required_argument, 0, 'i' },
+     {"sessions",      required_argument, 0, 's' },
+     {"commands",      required_argument, 0, 'c' },
+     {"include_erase", no_argument,       0, 'e' },
+     {"format",        required_argument, 0, 'f' },
+     {"timeout_ms",    required_argument, 0, 't' },
+     {"socket",        required_argument, 0, 'o' },
+     {"instance",      required_argument, 0, 'p' },
+     {"no_close_wait", no_argument,       0, 'q' },
+     {"userdata",      no_argument,       0, 'u' },
+     {"window",        required_argument, 0, 'w' },
+     {"codec",         no_argument,       0, 'x' },
+     {0,               0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_bench <arguments>\n"\
+"                                   \n"\
+"Times each phase of talking to the RCP: cpc_init (with retries), endpoint open, endpoint close (including the\n"\
+"wait for the closed state), cpc_deinit, and for every command the send and the wait for its reply.\n"\
+"Prints min/p50/p99/max/mean in microseconds and the throughput per phase (and in bytes for --userdata).\n"\
+"\n"\
+"ARGUMENTS: \n"\
+"--help        \n" \
+"-h                         Prints help message.\n"\
+"--iterations <value>       Number of times each command is sent (default 100).\n"\
+"--sessions <value>         Number of open/close cycles timed (default 10).\n"\
+"--commands <a,b,...>       Commands to time, using the custom_cpc_host option names without the leading \"--\"\n"\
+"                             (default: all except erase_userdata_page).\n"\
+"--include_erase            Also times erase_userdata_page. WARNING - this erases the userdata page of the RCP.\n"\
+"--format <csv|json>        Output format (default csv).\n"\
+"--timeout_ms <value>       Maximum time in milliseconds to wait for a reply from the RCP (default 500).\n"\
+"--socket <path>            Connects through a daemon listening on <path> instead of connecting to cpcd.\n"\
+"--instance <name>          cpcd instance to connect to.\n"\
+"--no_close_wait            Closes the endpoint without waiting for cpcd to report it closed.\n"\
+"--userdata                 Also times reading the first 1024 bytes of the USERDATA page and writing the same\n"\
+"                             content back (staged and committed, but no flash word changes).\n"\
+"--window <value>           Number of commands or USERDATA chunks kept in flight (default 1, max 128).\n"\
+"--codec                    Only times encoding and decoding frames in memory, no RCP needed. Each sample is 1000\n"\
+"                             frames, so the microsecond columns read as nanoseconds per frame. The random phase\n"\
+"                             decodes random bytes and counts as errors any frame accepted out of bounds.\n"\
+"\n"\
+"Commands that change the RCP state write back harmless values: set_ctune_value writes the current CTUNE value,\n"\
+"set_ctune_token writes 0xFFFF (no flash bits change), provision writes the current CTUNE token back, gpio_write\n"\
+"writes 0 and the tone is stopped at the end. ctune_sweep, ctune_search and tone_plan are sent with\n"\
+"arguments the RCP rejects, so only the command path is timed, and tone_start without arguments.\n"\
+"\n"\
+
+// Commands to time, indexed by opcode
+static bool selected[CPC_COMMAND_OPCODE_MAX + 1];
+
+// Samples of one phase, in nanoseconds
+struct bench_stat {
+  const char *phase;
+  const char *command;
+  uint64_t *samples;
+  size_t count;
+  size_t errors;
+  size_t bytes; // moved per sample, 0 if not a transfer
+};
+
+// Three stats per command (send, wait, round trip) plus the session,
+// USERDATA and codec phases
+#define MAX_STATS (3 * (CPC_COMMAND_OPCODE_MAX + 1) + 10)
+
+static struct bench_stat stats[MAX_STATS];
+static size_t stat_count = 0;
+
+static uint64_t nowNs(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static struct bench_stat *addStat(const char *phase, const char *command, size_t capacity){
+  struct bench_stat *stat = &stats[stat_count++];
+
+  stat->phase = phase;
+  stat->command = command;
+  stat->samples = calloc(capacity, sizeof(uint64_t));
+  if (stat->samples == NULL) {
+    fprintf(stderr,"out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return stat;
+}
+
+static int compareU64(const void *a, const void *b){
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+static double percentileUs(const struct bench_stat *stat, unsigned int percent){
+  size_t rank = (stat->count * percent + 99) / 100;
+
+  return (double) stat->samples[(rank > 0) ? rank - 1 : 0] / 1000.0;
+}
+
+static void printResults(bool json, unsigned long iterations, unsigned long sessions){
+  if (json) {
+    printf("{\n  \"iterations\": %lu,\n  \"sessions\": %lu,\n  \"results\": [", iterations, sessions);
+  } else {
+    printf("phase,command,samples,errors,min_us,p50_us,p99_us,max_us,mean_us,per_second,bytes_per_second\n");
+  }
+
+  for (size_t i = 0; i < stat_count; i++) {
+    struct bench_stat *stat = &stats[i];
+    uint64_t total = 0;
+    double min = 0, p50 = 0, p99 = 0, max = 0, mean = 0, per_second = 0;
+
+    if (stat->count > 0) {
+      qsort(stat->samples, stat->count, sizeof(uint64_t), compareU64);
+      for (size_t j = 0; j < stat->count; j++) {
+        total += stat->samples[j];
+      }
+      min = (double) stat->samples[0] / 1000.0;
+      p50 = percentileUs(stat, 50);
+      p99 = percentileUs(stat, 99);
+      max = (double) stat->samples[stat->count - 1] / 1000.0;
+      mean = (double) total / (double) stat->count / 1000.0;
+      per_second = (total > 0) ? (double) stat->count * 1e9 / (double) total : 0;
+    }
+
+    if (json) {
+      printf("%s\n    {\"phase\": \"%s\", \"command\": \"%s\", \"samples\": %zu, \"errors\": %zu, "
+             "\"min_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+             "\"mean_us\": %.1f, \"per_second\": %.1f, \"bytes_per_second\": %.0f}",
+             (i > 0) ? "," : "", stat->phase, stat->command, stat->count, stat->errors,
+             min, p50, p99, max, mean, per_second, per_second * (double) stat->bytes);
+    } else {
+      printf("%s,%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.0f\n",
+             stat->phase, stat->command, stat->count, stat->errors,
+             min, p50, p99, max, mean, per_second, per_second * (double) stat->bytes);
+    }
+  }
+
+  if (json) {
+    printf("\n  ]\n}\n");
+  }
+}
+
+// Time open/close cycles without any command
+static void benchSessions(const custom_cpc_config_t *config, unsigned long sessions){
+  struct bench_stat *init = addStat("init", "", sessions);
+  struct bench_stat *open = addStat("open", "", sessions);
+  struct bench_stat *close = addStat("close", "", sessions);
+  struct bench_stat *deinit = addStat("deinit", "", sessions);
+  custom_cpc_phase_times_t times;
+  custom_cpc_config_t session_config = *config;
+  custom_cpc_t *ctx;
+
+  session_config.phase_times = &times;
+  for (unsigned long i = 0; i < sessions; i++) {
+    memset(&times, 0, sizeof(times));
+    if (custom_cpc_open(&ctx, &session_config) < 0) {
+      open->errors++;
+      continue;
+    }
+    custom_cpc_close(ctx);
+
+    // A daemon connection has no init or deinit phase
+    if (config->socket_path == NULL) {
+      init->samples[init->count++] = times.init_ns;
+      deinit->samples[deinit->count++] = times.deinit_ns;
+    }
+    open->samples[open->count++] = times.open_ns;
+    close->samples[close->count++] = times.close_ns;
+  }
+}
+
+// Arguments for commands that need one, chosen not to change the RCP state
+static size_t commandArgs(custom_cpc_t *ctx, enum CustCpcCommand command, uint8_t *args){
+  custom_cpc_token_t token;
+  uint16_t ctune;
+  int len;
+
+  switch (command) {
+    case CPC_COMMAND_SET_CTUNE_TOKEN:
+      args[0] = 0xff;
+      args[1] = 0xff;
+      return 2;
+    case CPC_COMMAND_SET_CTUNE_VALUE:
+      if (custom_cpc_get_ctune_value(ctx, &ctune) < 0) {
+        ctune = 0;
+      }
+      args[0] = ctune & 0xff;
+      args[1] = ctune >> 8;
+      return 2;
+    case CPC_COMMAND_GPIO_WRITE:
+      args[0] = 0;
+      return 1;
+    case CPC_COMMAND_USERDATA_PROVISION:
+      if (custom_cpc_get_ctune_token(ctx, &ctune) < 0) {
+        ctune = 0xffff;
+      }
+      token = (custom_cpc_token_t) { CTUNE_TOKEN_OFFSET, sizeof(ctune), &ctune };
+      len = custom_cpc_provision_encode(&token, 1, args, CPC_PROVISION_ARGS_MAX);
+      return (len < 0) ? 0 : (size_t) len;
+    case CPC_COMMAND_CTUNE_SWEEP:
+      memset(args, 0, 8); // zero step and dwell, rejected before the tone starts
+      return 8;
+    case CPC_COMMAND_CTUNE_SEARCH:
+      args[0] = 1; // empty range 1..0, rejected
+      args[1] = 0;
+      args[2] = 0;
+      args[3] = 0;
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+static int benchCommands(const custom_cpc_config_t *config, unsigned long iterations){
+  const custom_cpc_command_info_t *info;
+  custom_cpc_t *ctx;
+  size_t count;
+  int ret;
+
+  ret = custom_cpc_open(&ctx, config);
+  if (ret < 0) {
+    fprintf(stderr,"cannot connect: %d (%s)\n", ret, strerror(-ret));
+    return ret;
+  }
+
+  info = custom_cpc_commands(&count);
+  for (size_t c = 0; c < count; c++) {
+    struct bench_stat *send, *wait, *round_trip;
+    uint8_t args[CPC_PROVISION_ARGS_MAX];
+    size_t args_len;
+
+    if (!selected[info[c].opcode]) {
+      continue;
+    }
+    send = addStat("send", info[c].name, iterations);
+    wait = addStat("wait", info[c].name, iterations);
+    round_trip = addStat("round_trip", info[c].name, iterations);
+    args_len = commandArgs(ctx, (enum CustCpcCommand) info[c].opcode, args);
+
+    for (unsigned long i = 0; i < iterations; i++) {
+      uint64_t start = nowNs();
+      uint64_t sent;
+      int request;
+
+      request = custom_cpc_submit(ctx, info[c].opcode, args, args_len, NULL, NULL);
+      sent = nowNs();
+      if (request < 0) {
+        send->errors++;
+        continue;
+      }
+      ret = custom_cpc_wait(ctx, request, NULL, 0, NULL);
+      if (ret < 0) {
+        wait->errors++;
+        round_trip->errors++;
+        continue;
+      }
+      send->samples[send->count++] = sent - start;
+      wait->samples[wait->count++] = nowNs() - sent;
+      round_trip->samples[round_trip->count++] = nowNs() - start;
+    }
+  }
+
+  // Leave the radio idle if the tone was started
+  if (selected[CPC_COMMAND_TONE_START]) {
+    int32_t status;
+    custom_cpc_tone_stop(ctx, &status);
+  }
+  custom_cpc_close(ctx);
+  return 0;
+}
+
+// Time a USERDATA page read and a write of the same content
+static int benchUserdata(const custom_cpc_config_t *config, unsigned long iterations){
+  struct bench_stat *read = addStat("transfer", "userdata_read", iterations);
+  struct bench_stat *write = addStat("transfer", "userdata_write", iterations);
+  uint8_t page[USERDATA_BENCH_SIZE];
+  custom_cpc_t *ctx;
+  int ret;
+
+  read->bytes = sizeof(page);
+  write->bytes = sizeof(page);
+  ret = custom_cpc_open(&ctx, config);
+  if (ret < 0) {
+    fprintf(stderr,"cannot connect: %d (%s)\n", ret, strerror(-ret));
+    return ret;
+  }
+
+  for (unsigned long i = 0; i < iterations; i++) {
+    uint64_t start = nowNs();
+
+    if (custom_cpc_userdata_read(ctx, 0, page, sizeof(page)) < 0) {
+      read->errors++;
+      continue;
+    }
+    read->samples[read->count++] = nowNs() - start;
+
+    start = nowNs();
+    if (custom_cpc_userdata_write(ctx, 0, page, sizeof(page), NULL) < 0) {
+      write->errors++;
+      continue;
+    }
+    write->samples[write->count++] = nowNs() - start;
+  }
+  custom_cpc_close(ctx);
+  return 0;
+}
+
+// xorshift32, enough to feed the decoder garbage
+static uint32_t nextRandom(uint32_t *state){
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+// Checks that a frame accepted by cpc_frame_decode() stays within its
+// size bytes, TLVs included
+static bool frameInBounds(const uint8_t *frame, size_t size, const cpc_frame_t *f){
+  uint16_t offset = 0;
+  const uint8_t *value;
+  uint8_t type, len;
+
+  if (f->payload + f->len > frame + size) {
+    return false;
+  }
+  while (cpc_frame_next_tlv(f, &offset, &type, &len, &value)) {
+    if (value + len > frame + size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Time the frame encoder and decoder, without the RCP
+static void benchCodec(unsigned long iterations){
+  struct bench_stat *encode = addStat("codec", "encode", iterations);
+  struct bench_stat *decode = addStat("codec", "decode", iterations);
+  struct bench_stat *decode_tlv = addStat("codec", "decode_tlv", iterations);
+  struct bench_stat *random = addStat("codec", "decode_random", iterations);
+  uint8_t frame[CPC_FRAME_HEADER_SIZE + 64];
+  uint8_t tlv_frame[sizeof(frame)];
+  uint8_t garbage[CODEC_BATCH][32];
+  size_t garbage_len[CODEC_BATCH];
+  size_t frame_len, tlv_len;
+  uint32_t state = 0x2545f491;
+  volatile size_t sink = 0;
+  cpc_frame_t f;
+
+  memset(frame, 0xa5, sizeof(frame));
+  frame_len = cpc_frame_encode(frame, CPC_COMMAND_GET_CUST_VERSION, CPC_FRAME_FLAG_REPLY, 0, CPC_FRAME_OK, 4);
+  memcpy(tlv_frame, frame, frame_len);
+  tlv_len = frame_len;
+  for (uint8_t type = 1; type <= 4; type++) {
+    tlv_len = cpc_frame_add_tlv(tlv_frame, tlv_len, sizeof(tlv_frame), type, 4, &frame[CPC_FRAME_HEADER_SIZE]);
+  }
+  encode->bytes = CODEC_BATCH * frame_len;
+  decode->bytes = CODEC_BATCH * frame_len;
+  decode_tlv->bytes = CODEC_BATCH * tlv_len;
+
+  for (unsigned long i = 0; i < iterations; i++) {
+    uint64_t start = nowNs();
+
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      sink += cpc_frame_encode(frame, CPC_COMMAND_GET_CUST_VERSION, CPC_FRAME_FLAG_REPLY, (uint8_t) n, CPC_FRAME_OK, 4);
+    }
+    encode->samples[encode->count++] = nowNs() - start;
+
+    start = nowNs();
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      sink += cpc_frame_decode(frame, frame_len, &f) + f.len;
+    }
+    decode->samples[decode->count++] = nowNs() - start;
+
+    start = nowNs();
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      uint16_t offset = 0;
+      const uint8_t *value;
+      uint8_t type, len;
+
+      sink += cpc_frame_decode(tlv_frame, tlv_len, &f);
+      while (cpc_frame_next_tlv(&f, &offset, &type, &len, &value)) {
+        sink += type;
+      }
+    }
+    decode_tlv->samples[decode_tlv->count++] = nowNs() - start;
+
+    // Valid version byte so that the length and TLV checks are reached
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      garbage_len[n] = nextRandom(&state) % (sizeof(garbage[n]) + 1);
+      for (size_t b = 0; b < garbage_len[n]; b++) {
+        garbage[n][b] = (uint8_t) nextRandom(&state);
+      }
+      if (garbage_len[n] > 0) {
+        garbage[n][0] = CPC_FRAME_VERSION;
+      }
+      if (garbage_len[n] > 6) {
+        garbage[n][6] = 0; // keep len below 256 so that some frames are accepted
+      }
+    }
+    start = nowNs();
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      sink += cpc_frame_decode(garbage[n], garbage_len[n], &f);
+    }
+    random->samples[random->count++] = nowNs() - start;
+    for (unsigned int n = 0; n < CODEC_BATCH; n++) {
+      if ((cpc_frame_decode(garbage[n], garbage_len[n], &f) == CPC_FRAME_OK)
+          && !frameInBounds(garbage[n], garbage_len[n], &f)) {
+        random->errors++;
+      }
+    }
+  }
+  (void) sink;
+}
+
+static int selectCommands(char *list){
+  memset(selected, 0, sizeof(selected));
+  for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    const custom_cpc_command_info_t *info = custom_cpc_command_find(name);
+
+    if (info == NULL) {
+      fprintf(stderr,"unknown command: %s\n", name);
+      return -1;
+    }
+    if (info->help == NULL) {
+      fprintf(stderr,"%s is only available through the library\n", name);
+      return -1;
+    }
+    selected[info->opcode] = true;
+  }
+  return 0;
+}
+
+// Default selection: every command line command except erase_userdata_page
+static void selectDefaultCommands(void){
+  const custom_cpc_command_info_t *info;
+  size_t count;
+
+  info = custom_cpc_commands(&count);
+  for (size_t c = 0; c < count; c++) {
+    selected[info[c].opcode] = (info[c].help != NULL)
+                               && (info[c].opcode != CPC_COMMAND_ERASE_USERDATA_PAGE);
+  }
+}
+
+int main(int argc, char* argv[]) {
+    custom_cpc_config_t config = CUSTOM_CPC_CONFIG_DEFAULT;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    unsigned long sessions = DEFAULT_SESSIONS;
+    bool json = false;
+    bool userdata = false;
+    bool codec = false;
+    unsigned long value;
+    size_t errors = 0;
+    int opt = 0;
+
+    selectDefaultCommands();
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'i':
+          iterations = strtoul(optarg,NULL,0);
+          break;
+
+        case 's':
+          sessions = strtoul(optarg,NULL,0);
+          break;
+
+        case 'c':
+          if (selectCommands(optarg) != 0) {
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'e':
+          selected[CPC_COMMAND_ERASE_USERDATA_PAGE] = true;
+          break;
+
+        case 'f':
+          if (strcmp(optarg, "json") == 0) {
+            json = true;
+          } else if (strcmp(optarg, "csv") != 0) {
+            fprintf(stderr,"invalid format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 't':
+          config.timeout_ms = strtoul(optarg,NULL,0);
+          if (config.timeout_ms == 0) {
+            fprintf(stderr,"invalid timeout: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'o':
+          config.socket_path = optarg;
+          break;
+
+        case 'p':
+          config.instance_name = optarg;
+          break;
+
+        case 'q':
+          config.no_close_wait = true;
+          break;
+
+        case 'u':
+          userdata = true;
+          break;
+
+        case 'w':
+          value = strtoul(optarg,NULL,0);
+          if ((value == 0) || (value > CUSTOM_CPC_MAX_WINDOW)) {
+            fprintf(stderr,"invalid window size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          config.window_size = (uint8_t) value;
+          break;
+
+        case 'x':
+          codec = true;
+          break;
+
+        default:
+          printf(HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+          break;
+      }
+    }
+
+    if (codec) {
+      benchCodec(iterations);
+    } else {
+      benchSessions(&config, sessions);
+      if (benchCommands(&config, iterations) < 0) {
+        errors++;
+      }
+      if (userdata && (benchUserdata(&config, iterations) < 0)) {
+        errors++;
+      }
+    }
+    printResults(json, iterations, sessions);
+
+    for (size_t i = 0; i < stat_count; i++) {
+      errors += stats[i].errors;
+      free(stats[i].samples);
+    }
+    exit(errors ? EXIT_FAILURE : 0);
+}
@@ -0,0 +1,515 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_daemon.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include "sl_cpc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cpc_commands.h"
+#include "cpc_daemon.h"
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+#define debug_print(...) \
+            do { if (DEBUG) printf(__VA_ARGS__); } while (0)
+
+#define DAEMON_MAX_CLIENTS 32
+#define DAEMON_LISTEN_BACKLOG 8
+
+// Reconnect backoff bounds
+#define DAEMON_RECONNECT_MIN_MS 100
+#define DAEMON_RECONNECT_MAX_MS 5000
+
+// Endpoint read timeout, bounds how long shutdown and reset handling wait.
+// Shortened to a quarter of the request timeout so requests expire on time.
+#define DAEMON_READ_TIMEOUT_MS 1000
+#define DAEMON_READ_TIMEOUT_MIN_MS 10
+
+// A daemon sequence number stays reserved until its reply comes or it
+// expires, even if its client went away, so a late reply is never routed
+// to the next owner of the number.
+struct pending_request {
+  bool busy;
+  int client_fd;      // -1 once the client is gone
+  uint8_t client_seq; // sequence number chosen by the client
+  uint8_t opcode;
+  uint64_t sent_ns;   // with latency
+  uint64_t expiry_ns; // restarted by progress frames
+};
+
+static cpc_handle_t lib_handle;
+static cpc_endpoint_t endpoint;
+static bool cpc_initialized = false;
+static bool connected = false;
+static bool tracing = false;
+static custom_cpc_latency_t *latency = NULL; // recorded by the reader thread
+static uint64_t timeout_ns;
+static unsigned long read_timeout_ms;
+
+// Guards the endpoint, connected, pending[] and clients[]
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pending_request pending[UINT8_MAX + 1];
+static uint8_t next_seq = 0;
+static int clients[DAEMON_MAX_CLIENTS]; // connected clients, for events
+static size_t client_count = 0;
+
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t reset_pending = 0;
+static volatile sig_atomic_t dump_pending = 0;
+
+static void on_signal(int signum){
+  if (signum == SIGUSR1) {
+    dump_pending = 1;
+    return;
+  }
+  stop = 1;
+}
+
+// Called by libcpc when the secondary resets
+static void on_reset(void){
+  reset_pending = 1;
+}
+
+static void sleep_ms(unsigned int ms){
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Called with lock held. Answers a request of client_fd in place of the
+// RCP, with an empty reply carrying status.
+static void send_status(int client_fd, uint8_t opcode, uint8_t client_seq, uint8_t status){
+  uint8_t reply[CPC_FRAME_HEADER_SIZE];
+
+  cpc_frame_encode(reply, opcode, CPC_FRAME_FLAG_REPLY, client_seq, status, 0);
+  if (send(client_fd, reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+    debug_print("reply to client %d failed: %s\r\n", client_fd, strerror(errno));
+  }
+}
+
+// Called with lock held. The requests of a client that went away keep
+// their sequence numbers until they are answered or expire.
+static void orphan_pending(int client_fd){
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    if (pending[i].client_fd == client_fd) {
+      pending[i].client_fd = -1;
+    }
+  }
+}
+
+// Called with lock held. Frees every sequence number, once no reply can
+// come for them any more. Clients still waiting get
+// CPC_FRAME_NOT_CONNECTED.
+static void drop_pending(void){
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    struct pending_request *p = &pending[i];
+
+    if (p->busy && (p->client_fd >= 0)) {
+      send_status(p->client_fd, p->opcode, p->client_seq, CPC_FRAME_NOT_CONNECTED);
+    }
+    p->busy = false;
+    p->client_fd = -1;
+  }
+}
+
+// Frees the sequence numbers whose reply did not come in time: the RCP
+// lost the request, or the client gave up on it. Clients still waiting
+// get CPC_FRAME_EXPIRED.
+static void expire_pending(uint64_t now){
+  pthread_mutex_lock(&lock);
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    struct pending_request *p = &pending[i];
+
+    if (!p->busy || (now < p->expiry_ns)) {
+      continue;
+    }
+    debug_print("request seq %zu expired\r\n", i);
+    if (p->client_fd >= 0) {
+      send_status(p->client_fd, p->opcode, p->client_seq, CPC_FRAME_EXPIRED);
+    }
+    if (latency != NULL) {
+      custom_cpc_latency_timeout(latency, p->opcode);
+    }
+    p->busy = false;
+    p->client_fd = -1;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// Called with lock held
+static int daemon_connect(void){
+  int ret;
+
+  if (!cpc_initialized) {
+    ret = cpc_init(&lib_handle, NULL, tracing, on_reset);
+  } else {
+    ret = cpc_restart(&lib_handle);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  cpc_initialized = true;
+
+  ret = cpc_open_endpoint(lib_handle,
+                          &endpoint,
+                          SL_CPC_ENDPOINT_USER_ID_0,
+                          1);
+  if (ret < 0) {
+    return ret;
+  }
+
+  cpc_timeval_t rx_timeout = {
+    .seconds = (int) (read_timeout_ms / 1000),
+    .microseconds = (int) (read_timeout_ms % 1000) * 1000
+  };
+  ret = cpc_set_endpoint_option(endpoint,
+                                CPC_OPTION_RX_TIMEOUT,
+                                &rx_timeout,
+                                sizeof(rx_timeout));
+  if (ret < 0) {
+    cpc_close_endpoint(&endpoint);
+    return ret;
+  }
+  return 0;
+}
+
+// Called with lock held. Requests in flight are answered with
+// CPC_FRAME_NOT_CONNECTED and dropped.
+static void daemon_disconnect(void){
+  if (connected) {
+    cpc_close_endpoint(&endpoint);
+    connected = false;
+  }
+  drop_pending();
+}
+
+// Called with lock held
+static void remove_client(int client_fd){
+  for (size_t i = 0; i < client_count; i++) {
+    if (clients[i] == client_fd) {
+      clients[i] = clients[--client_count];
+      break;
+    }
+  }
+}
+
+// Route one reply from the RCP back to the client that asked for it.
+// Progress frames go to it too, and keep the request pending. Events
+// belong to no request and go to every client.
+static void forward_reply(uint8_t *buffer, ssize_t len){
+  cpc_frame_t frame;
+  uint8_t seq;
+  int client_fd;
+
+  if (cpc_frame_decode(buffer, (size_t) len, &frame) != CPC_FRAME_OK) {
+    debug_print("dropping invalid reply, len %zd\r\n", len);
+    return;
+  }
+  seq = frame.seq;
+
+  pthread_mutex_lock(&lock);
+  if (frame.flags & CPC_FRAME_FLAG_EVENT) {
+    for (size_t i = 0; i < client_count; i++) {
+      send(clients[i], buffer, (size_t) len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  if (!pending[seq].busy) {
+    debug_print("dropping unexpected reply, seq %d\r\n", seq);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  client_fd = pending[seq].client_fd;
+  if (frame.flags & CPC_FRAME_FLAG_PROGRESS) {
+    pending[seq].expiry_ns = now_ns() + timeout_ns;
+  } else {
+    pending[seq].busy = false;
+    pending[seq].client_fd = -1;
+    if (latency != NULL) {
+      custom_cpc_latency_record(latency, pending[seq].opcode, now_ns() - pending[seq].sent_ns);
+    }
+  }
+  if (client_fd >= 0) {
+    cpc_frame_set_seq(buffer, pending[seq].client_seq);
+    // Sent under the lock so the fd can't be closed and reused meanwhile
+    if (send(client_fd, buffer, (size_t) len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+      debug_print("reply to client %d failed: %s\r\n", client_fd, strerror(errno));
+    }
+  } else {
+    debug_print("dropping reply to a client that went away, seq %d\r\n", seq);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// Owns the endpoint reads and the (re)connection to cpcd
+static void *reader_thread(void *arg){
+  (void) arg;
+  uint8_t buffer[SL_CPC_READ_MINIMUM_SIZE];
+  unsigned int backoff_ms = DAEMON_RECONNECT_MIN_MS;
+  bool was_connected;
+  ssize_t len;
+  int ret = 0;
+
+  while (!stop) {
+    pthread_mutex_lock(&lock);
+    was_connected = connected;
+    if (!was_connected) {
+      ret = daemon_connect();
+      if (ret == 0) {
+        connected = true;
+        reset_pending = 0;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (!was_connected) {
+      if (ret == 0) {
+        fprintf(stderr,"connected to cpcd\n");
+        backoff_ms = DAEMON_RECONNECT_MIN_MS;
+      } else {
+        debug_print("connect failed with %d, retry in %ums\r\n", ret, backoff_ms);
+        sleep_ms(backoff_ms);
+        backoff_ms = (backoff_ms * 2 > DAEMON_RECONNECT_MAX_MS) ? DAEMON_RECONNECT_MAX_MS : backoff_ms * 2;
+      }
+      continue;
+    }
+
+    len = cpc_read_endpoint(endpoint, buffer, sizeof(buffer), CPC_ENDPOINT_READ_FLAG_NONE);
+    if ((len < 0 && len != -EAGAIN && len != -EINTR) || reset_pending) {
+      fprintf(stderr,"lost connection to cpcd (%zd), reconnecting\n", len);
+      pthread_mutex_lock(&lock);
+      daemon_disconnect();
+      pthread_mutex_unlock(&lock);
+    } else if (len > 0) {
+      forward_reply(buffer, len);
+    }
+    // Also on read timeouts, so windows close and requests expire while idle
+    expire_pending(now_ns());
+    custom_cpc_latency_check(latency, now_ns());
+  }
+  return NULL;
+}
+
+// Send one frame from a client to the RCP
+static void forward_request(int client_fd, uint8_t *buffer, ssize_t len){
+  cpc_frame_t frame;
+  uint16_t tries;
+  uint8_t seq;
+
+  // Malformed frames are still forwarded, the RCP reports them
+  if (((size_t) len < CPC_FRAME_HEADER_SIZE)
+      || (cpc_frame_decode(buffer, (size_t) len, &frame) == CPC_FRAME_BAD_VERSION)) {
+    debug_print("dropping invalid request, len %zd\r\n", len);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  if (!connected) {
+    send_status(client_fd, frame.opcode, frame.seq, CPC_FRAME_NOT_CONNECTED);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  // Find a free daemon sequence number
+  for (tries = 0; tries <= UINT8_MAX && pending[next_seq].busy; tries++) {
+    next_seq++;
+  }
+  if (tries > UINT8_MAX) {
+    debug_print("too many requests in flight, refusing\r\n");
+    send_status(client_fd, frame.opcode, frame.seq, CPC_FRAME_BUSY);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  seq = next_seq++;
+  pending[seq].busy = true;
+  pending[seq].client_fd = client_fd;
+  pending[seq].client_seq = frame.seq;
+  pending[seq].opcode = frame.opcode;
+  pending[seq].sent_ns = now_ns();
+  pending[seq].expiry_ns = pending[seq].sent_ns + timeout_ns;
+  cpc_frame_set_seq(buffer, seq);
+  if (cpc_write_endpoint(endpoint, buffer, (size_t) len, CPC_ENDPOINT_WRITE_FLAG_NONE) < 0) {
+    pending[seq].busy = false;
+    pending[seq].client_fd = -1;
+    send_status(client_fd, frame.opcode, frame.seq, CPC_FRAME_NOT_CONNECTED);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+static int open_listen_socket(const char *socket_path){
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd;
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr,"socket path too long: %s\n", socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0) {
+    fprintf(stderr,"socket() failed: %s\n", strerror(errno));
+    return -1;
+  }
+  unlink(socket_path);
+  if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      || (listen(fd, DAEMON_LISTEN_BACKLOG) < 0)) {
+    fprintf(stderr,"cannot listen on %s: %s\n", socket_path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int cpc_daemon_run(const char *socket_path,
+                   bool enable_tracing,
+                   unsigned long request_timeout_ms,
+                   custom_cpc_latency_t *reply_latency){
+  struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+  uint8_t buffer[SL_CPC_READ_MINIMUM_SIZE];
+  struct sigaction sa = { .sa_handler = on_signal };
+  sigset_t mask, old_mask;
+  nfds_t nfds = 1;
+  int ret;
+  pthread_t reader;
+  ssize_t len;
+
+  tracing = enable_tracing;
+  latency = reply_latency;
+  timeout_ns = (uint64_t) request_timeout_ms * 1000000ull;
+  read_timeout_ms = request_timeout_ms / 4;
+  if (read_timeout_ms > DAEMON_READ_TIMEOUT_MS) {
+    read_timeout_ms = DAEMON_READ_TIMEOUT_MS;
+  } else if (read_timeout_ms < DAEMON_READ_TIMEOUT_MIN_MS) {
+    read_timeout_ms = DAEMON_READ_TIMEOUT_MIN_MS;
+  }
+  drop_pending();
+
+  // No SA_RESTART so poll() returns on shutdown
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  if (latency != NULL) {
+    sigaction(SIGUSR1, &sa, NULL);
+  }
+
+  fds[0].fd = open_listen_socket(socket_path);
+  fds[0].events = POLLIN;
+  if (fds[0].fd < 0) {
+    return -1;
+  }
+
+  // Signals go to this thread, whose poll() they interrupt
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+  ret = pthread_create(&reader, NULL, reader_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+  if (ret != 0) {
+    fprintf(stderr,"cannot start reader thread\n");
+    close(fds[0].fd);
+    return -1;
+  }
+  fprintf(stderr,"listening on %s\n", socket_path);
+
+  while (!stop) {
+    if (dump_pending) {
+      dump_pending = 0;
+      custom_cpc_latency_dump(latency, stderr, "");
+    }
+    if (poll(fds, nfds, -1) < 0) {
+      continue; // EINTR on shutdown or SIGUSR1
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int client_fd = accept(fds[0].fd, NULL, NULL);
+      if (client_fd >= 0 && nfds <= DAEMON_MAX_CLIENTS) {
+        fds[nfds].fd = client_fd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+        pthread_mutex_lock(&lock);
+        clients[client_count++] = client_fd;
+        pthread_mutex_unlock(&lock);
+        debug_print("client %d connected\r\n", client_fd);
+      } else if (client_fd >= 0) {
+        debug_print("too many clients, refusing %d\r\n", client_fd);
+        close(client_fd);
+      }
+    }
+
+    for (nfds_t i = 1; i < nfds; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      len = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+      if (len > 0) {
+        forward_request(fds[i].fd, buffer, len);
+      } else if (len == 0 || (errno != EINTR && errno != EAGAIN)) {
+        debug_print("client %d disconnected\r\n", fds[i].fd);
+        pthread_mutex_lock(&lock);
+        orphan_pending(fds[i].fd);
+        remove_client(fds[i].fd);
+        close(fds[i].fd);
+        pthread_mutex_unlock(&lock);
+        fds[i--] = fds[--nfds];
+      }
+    }
+  }
+
+  pthread_join(reader, NULL);
+  // Before the clients are closed, so those still waiting are answered
+  pthread_mutex_lock(&lock);
+  daemon_disconnect();
+  pthread_mutex_unlock(&lock);
+  for (nfds_t i = 1; i < nfds; i++) {
+    close(fds[i].fd);
+  }
+  close(fds[0].fd);
+  unlink(socket_path);
+  custom_cpc_latency_dump(latency, stderr, "");
+  return 0;
+}
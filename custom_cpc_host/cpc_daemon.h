@@ -0,0 +1,67 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_daemon.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CPC_DAEMON_H_
+#define CPC_DAEMON_H_
+
+#include <stdbool.h>
+#include "custom_cpc_latency.h"
+
+/*
+ * Daemon mode: keeps the custom endpoint open and relays frames between
+ * local clients and the RCP.
+ *
+ * Clients connect to a SOCK_SEQPACKET Unix domain socket. Each message is
+ * one frame as defined in cpc_commands.h (header + arguments) and each
+ * reply is sent back as one message, header included. Clients pick their
+ * own sequence numbers; the daemon remaps them so that requests from
+ * different clients never collide on the endpoint.
+ *
+ * If cpcd goes away the daemon reconnects on its own. Requests pending at
+ * that time get no reply, so clients should use a timeout. A request the
+ * RCP does not answer within request_timeout_ms of its write (or of its
+ * last progress frame) expires: its client, if still connected, gets an
+ * empty reply with status CPC_FRAME_EXPIRED, and its sequence number is
+ * used again. Requests sent while the daemon is not connected to cpcd,
+ * or with all 256 sequence numbers in flight, are answered at once with
+ * CPC_FRAME_NOT_CONNECTED or CPC_FRAME_BUSY.
+ *
+ * With latency, the time from writing each request to the endpoint to its
+ * reply is recorded there, and the histograms are dumped to stderr on
+ * SIGUSR1 and on shutdown.
+ */
+
+// Runs until SIGINT or SIGTERM. Returns 0 on clean shutdown, -1 on error.
+int cpc_daemon_run(const char *socket_path,
+                   bool enable_tracing,
+                   unsigned long request_timeout_ms,
+                   custom_cpc_latency_t *latency);
+
+#endif /* CPC_DAEMON_H_ */
@@ -0,0 +1,464 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_replay.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include "sl_cpc.h"
+#include "cpc_commands.h"
+#include "cpc_frame.h"
+#include "custom_cpc.h"
+#include "custom_cpc_capture.h"
+
+#define OPTSTRING "h"
+
+#define TX_WINDOW_SIZE 1
+
+// cpc_init attempts, 100ms apart
+#define INIT_RETRIES 5
+
+#define DEFAULT_TIMEOUT_MS 500
+
+static struct option long_options[] = {
+     {"help",       no_argument,       0, 'h' },
+     {"speed",      required_argument, 0, 's' },
+     {"instance",   required_argument, 0, 'p' },
+     {"timeout_ms", required_argument, 0, 't' },
+     {"list",       no_argument,       0, 'l' },
+     {0,            0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_replay <arguments> <file>\n"\
+"                                   \n"\
+"Sends the commands of a capture file written by custom_cpc_host --capture to the RCP again, at the times\n"\
+"they were sent and never with more commands in flight than then, and compares the replies and round trip\n"\
+"times with the recorded ones. Prints one CSV line per command with the recorded and replayed p50/max round\n"\
+"trip in microseconds.\n"\
+"\n"\
+"ARGUMENTS: \n"\
+"--help        \n" \
+"-h                         Prints help message.\n"\
+"--speed <factor>           Plays the capture <factor> times faster (default 1). 0 sends each command as soon as\n"\
+"                             the replies it waited for when it was recorded have arrived.\n"\
+"--instance <name>          cpcd instance to connect to.\n"\
+"--timeout_ms <value>       Maximum time in milliseconds to wait for a reply after the last command (default 500).\n"\
+"--list                     Only prints the records of the capture, one line per frame, without an RCP.\n"\
+"\n"\
+"The exit status is non-zero if a reply is missing. Replies may differ from the recorded ones without an error,\n"\
+"as some (stats, trace, uptime) change from run to run; they are counted in the different column.\n"\
+"\n"\
+
+// One command of the capture
+struct replay_command {
+  const uint8_t *frame;
+  uint16_t len;
+  uint8_t opcode;
+  uint64_t offset_ns;          // recorded send time, from the first command
+  unsigned int inflight;       // recorded commands in flight when it was sent
+  const uint8_t *reply;        // recorded reply, NULL if none
+  uint16_t reply_len;
+  uint64_t recorded_ns;        // recorded round trip
+  uint64_t sent_ns;
+  uint64_t replayed_ns;        // 0 until its reply arrives
+  bool different;
+};
+
+static struct replay_command *replay_commands;
+static size_t replay_count = 0;
+
+// Replayed command waiting for its reply, by sequence number
+static struct replay_command *pending[UINT8_MAX + 1];
+static unsigned int pending_count = 0;
+
+static uint64_t nowNs(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static const char *commandName(uint8_t opcode){
+  const custom_cpc_command_info_t *info = custom_cpc_command_info(opcode);
+
+  return (info != NULL) ? info->name : "unknown";
+}
+
+// --list
+static int listCapture(custom_cpc_capture_reader_t *reader){
+  custom_cpc_capture_record_t record;
+  uint64_t first = 0;
+  int ret;
+
+  while ((ret = custom_cpc_capture_next(reader, &record)) > 0) {
+    cpc_frame_t frame;
+
+    if (first == 0) {
+      first = record.time_ns;
+    }
+    printf("%12.3f ms %s ", (double) (record.time_ns - first) / 1e6,
+           (record.direction == CUSTOM_CPC_CAPTURE_TX) ? ">" : "<");
+    if (cpc_frame_decode(record.frame, record.len, &frame) != CPC_FRAME_OK) {
+      printf("malformed frame, %u bytes\n", record.len);
+      continue;
+    }
+    printf("%-22s seq %3u flags 0x%02x status %u:", commandName(frame.opcode),
+           frame.seq, frame.flags, frame.status);
+    for (uint16_t i = 0; i < frame.len; i++) {
+      printf(" %02x", frame.payload[i]);
+    }
+    printf("\n");
+  }
+  return ret;
+}
+
+// Pairs every command of the capture with its recorded reply
+static int loadCapture(custom_cpc_capture_reader_t *reader){
+  custom_cpc_capture_record_t record;
+  // Index plus one of the command waiting for its reply, by sequence number,
+  // 0 if none: replay_commands moves when it grows
+  size_t waiting[UINT8_MAX + 1] = { 0 };
+  unsigned int inflight = 0;
+  uint64_t first = 0;
+  size_t capacity = 0;
+  int ret;
+
+  while ((ret = custom_cpc_capture_next(reader, &record)) > 0) {
+    cpc_frame_t frame;
+    struct replay_command *c;
+
+    if (cpc_frame_decode(record.frame, record.len, &frame) != CPC_FRAME_OK) {
+      continue;
+    }
+    if (record.direction == CUSTOM_CPC_CAPTURE_RX) {
+      if ((waiting[frame.seq] != 0) && (frame.flags & CPC_FRAME_FLAG_REPLY)
+          && !(frame.flags & CPC_FRAME_FLAG_PROGRESS)) {
+        c = &replay_commands[waiting[frame.seq] - 1];
+        c->reply = record.frame;
+        c->reply_len = record.len;
+        c->recorded_ns = record.time_ns - first - c->offset_ns;
+        waiting[frame.seq] = 0;
+        inflight--;
+      }
+      continue;
+    }
+
+    if (replay_count == capacity) {
+      capacity = (capacity == 0) ? 64 : capacity * 2;
+      c = realloc(replay_commands, capacity * sizeof(*c));
+      if (c == NULL) {
+        return -ENOMEM;
+      }
+      replay_commands = c;
+    }
+    if (first == 0) {
+      first = record.time_ns;
+    }
+    c = &replay_commands[replay_count++];
+    memset(c, 0, sizeof(*c));
+    c->frame = record.frame;
+    c->len = record.len;
+    c->opcode = frame.opcode;
+    c->offset_ns = record.time_ns - first;
+    c->inflight = inflight;
+    if (waiting[frame.seq] == 0) {
+      inflight++;
+    }
+    waiting[frame.seq] = replay_count;
+  }
+  return ret;
+}
+
+static int connectRcp(const char *instance, cpc_handle_t *handle, cpc_endpoint_t *endpoint){
+  int ret;
+
+  for (uint8_t retry = 0; retry < INIT_RETRIES; retry++) {
+    ret = cpc_init(handle, instance, false, NULL);
+    if (ret == 0) {
+      break;
+    }
+    nanosleep((const struct timespec[]){{ 0, 100000000L } }, NULL);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  ret = cpc_open_endpoint(*handle, endpoint, SL_CPC_ENDPOINT_USER_ID_0, TX_WINDOW_SIZE);
+  if (ret < 0) {
+    cpc_deinit(handle);
+  }
+  return ret;
+}
+
+// Collects the replies that arrive until deadline
+static void readReplies(cpc_endpoint_t endpoint, uint64_t deadline){
+  static uint8_t buffer[SL_CPC_READ_MINIMUM_SIZE];
+
+  while (pending_count > 0) {
+    uint64_t now = nowNs();
+    uint64_t wait_us = (deadline > now) ? (deadline - now) / 1000 : 0;
+    cpc_timeval_t timeout;
+    cpc_frame_t frame;
+    struct replay_command *c;
+    ssize_t len;
+
+    if (wait_us == 0) {
+      return;
+    }
+    // A zero RX timeout means no timeout to libcpc
+    timeout.seconds = (int) (wait_us / 1000000);
+    timeout.microseconds = (int) (wait_us % 1000000);
+    cpc_set_endpoint_option(endpoint, CPC_OPTION_RX_TIMEOUT, &timeout, sizeof(timeout));
+    len = cpc_read_endpoint(endpoint, buffer, sizeof(buffer), CPC_ENDPOINT_READ_FLAG_NONE);
+    if (len == -EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      return;
+    }
+    now = nowNs();
+    if ((cpc_frame_decode(buffer, (size_t) len, &frame) != CPC_FRAME_OK)
+        || !(frame.flags & CPC_FRAME_FLAG_REPLY)
+        || (frame.flags & CPC_FRAME_FLAG_PROGRESS)) {
+      continue;
+    }
+    c = pending[frame.seq];
+    if (c == NULL) {
+      continue;
+    }
+    c->replayed_ns = now - c->sent_ns;
+    c->different = (c->reply == NULL) || (c->reply_len != (uint16_t) len)
+                   || (memcmp(c->reply, buffer, (size_t) len) != 0);
+    pending[frame.seq] = NULL;
+    pending_count--;
+  }
+}
+
+static int replay(const char *instance, double speed, unsigned long timeout_ms){
+  cpc_handle_t handle;
+  cpc_endpoint_t endpoint;
+  uint64_t start;
+  int ret;
+
+  ret = connectRcp(instance, &handle, &endpoint);
+  if (ret < 0) {
+    fprintf(stderr,"cannot connect to cpcd: %d (%s)\n", ret, strerror(-ret));
+    return ret;
+  }
+
+  start = nowNs();
+  for (size_t i = 0; i < replay_count; i++) {
+    struct replay_command *c = &replay_commands[i];
+    uint8_t seq = c->frame[3];
+
+    // Keep the recorded window: a command sent after a reply is not
+    // sent before it, whatever the speed
+    while (pending_count > c->inflight) {
+      unsigned int before = pending_count;
+
+      readReplies(endpoint, nowNs() + timeout_ms * 1000000ull);
+      if (pending_count == before) {
+        break; // timed out, send anyway
+      }
+    }
+    if (speed > 0) {
+      uint64_t due = start + (uint64_t) ((double) c->offset_ns / speed);
+
+      readReplies(endpoint, due);
+      while (nowNs() < due) {
+        // nothing in flight: readReplies() returned at once
+        nanosleep((const struct timespec[]){{ 0, 10000L } }, NULL);
+      }
+    }
+    if (pending[seq] != NULL) {
+      pending[seq] = NULL; // never answered, its seq is reused
+      pending_count--;
+    }
+    c->sent_ns = nowNs();
+    ret = (int) cpc_write_endpoint(endpoint, c->frame, c->len, CPC_ENDPOINT_WRITE_FLAG_NONE);
+    if (ret < 0) {
+      fprintf(stderr,"cannot send %s: %s\n", commandName(c->opcode), strerror(-ret));
+      continue;
+    }
+    pending[seq] = c;
+    pending_count++;
+  }
+  readReplies(endpoint, nowNs() + timeout_ms * 1000000ull);
+
+  cpc_close_endpoint(&endpoint);
+  cpc_deinit(&handle);
+  return 0;
+}
+
+static int compareU64(const void *a, const void *b){
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+// Nearest rank median and maximum of count samples, in microseconds
+static void summarize(uint64_t *samples, size_t count, double *p50, double *max){
+  *p50 = 0;
+  *max = 0;
+  if (count == 0) {
+    return;
+  }
+  qsort(samples, count, sizeof(uint64_t), compareU64);
+  *p50 = (double) samples[(count + 1) / 2 - 1] / 1000.0;
+  *max = (double) samples[count - 1] / 1000.0;
+}
+
+// One line per opcode, then one for all commands. Returns the number of
+// missing replies.
+static size_t printResults(void){
+  uint64_t *recorded = calloc(replay_count + 1, sizeof(uint64_t));
+  uint64_t *replayed = calloc(replay_count + 1, sizeof(uint64_t));
+  size_t total_missing = 0;
+
+  if ((recorded == NULL) || (replayed == NULL)) {
+    fprintf(stderr,"out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  printf("command,count,missing,different,recorded_p50_us,recorded_max_us,replay_p50_us,replay_max_us\n");
+  for (int opcode = 0; opcode <= CPC_COMMAND_OPCODE_MAX + 1; opcode++) {
+    bool all = (opcode > CPC_COMMAND_OPCODE_MAX);
+    size_t count = 0, missing = 0, different = 0, recorded_count = 0, replayed_count = 0;
+    double recorded_p50, recorded_max, replayed_p50, replayed_max;
+
+    for (size_t i = 0; i < replay_count; i++) {
+      struct replay_command *c = &replay_commands[i];
+
+      if (!all && (c->opcode != opcode)) {
+        continue;
+      }
+      count++;
+      if (c->reply != NULL) {
+        recorded[recorded_count++] = c->recorded_ns;
+      }
+      if (c->replayed_ns != 0) {
+        replayed[replayed_count++] = c->replayed_ns;
+        different += c->different ? 1 : 0;
+      } else {
+        missing++;
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    summarize(recorded, recorded_count, &recorded_p50, &recorded_max);
+    summarize(replayed, replayed_count, &replayed_p50, &replayed_max);
+    printf("%s,%zu,%zu,%zu,%.1f,%.1f,%.1f,%.1f\n", all ? "all" : commandName((uint8_t) opcode),
+           count, missing, different, recorded_p50, recorded_max, replayed_p50, replayed_max);
+    if (all) {
+      total_missing = missing;
+    }
+  }
+  free(recorded);
+  free(replayed);
+  return total_missing;
+}
+
+int main(int argc, char* argv[]) {
+    custom_cpc_capture_reader_t reader;
+    const char *instance = NULL;
+    unsigned long timeout_ms = DEFAULT_TIMEOUT_MS;
+    double speed = 1.0;
+    bool list = false;
+    char *end;
+    int opt = 0;
+    int ret;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 's':
+          speed = strtod(optarg, &end);
+          if ((*end != '\0') || (speed < 0)) {
+            fprintf(stderr,"invalid speed: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'p':
+          instance = optarg;
+          break;
+
+        case 't':
+          timeout_ms = strtoul(optarg,NULL,0);
+          if (timeout_ms == 0) {
+            fprintf(stderr,"invalid timeout: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'l':
+          list = true;
+          break;
+
+        default:
+          printf(HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+          break;
+      }
+    }
+    if (optind != argc - 1) {
+      printf(HELP_MESSAGE);
+      exit(EXIT_FAILURE);
+    }
+
+    ret = custom_cpc_capture_read_open(&reader, argv[optind]);
+    if (ret < 0) {
+      fprintf(stderr,"cannot read capture %s: %s\n", argv[optind], strerror(-ret));
+      exit(EXIT_FAILURE);
+    }
+    ret = list ? listCapture(&reader) : loadCapture(&reader);
+    if (ret == -EBADMSG) {
+      fprintf(stderr,"%s: last record cut short, ignored\n", argv[optind]);
+    } else if (ret < 0) {
+      fprintf(stderr,"cannot read capture %s: %s\n", argv[optind], strerror(-ret));
+      exit(EXIT_FAILURE);
+    }
+    if (list) {
+      exit(0);
+    }
+    if (replay_count == 0) {
+      fprintf(stderr,"%s: no command to replay\n", argv[optind]);
+      exit(EXIT_FAILURE);
+    }
+    if (replay(instance, speed, timeout_ms) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    exit(printResults() > 0 ? EXIT_FAILURE : 0);
+}
@@ -0,0 +1,1483 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include "sl_cpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "custom_cpc.h"
+#include "custom_cpc_capture.h"
+
+#define TX_WINDOW_SIZE 1 // CPC link window, only 1 supported
+
+// cpc_init attempts, 100ms apart
+#define INIT_RETRIES 5
+
+// Endpoint state polls after close: exponential backoff from
+// CLOSE_POLL_MIN_US up to CLOSE_POLL_MAX_US, giving up after CLOSE_TIMEOUT_MS
+#define CLOSE_POLL_MIN_US 50
+#define CLOSE_POLL_MAX_US 20000
+#define CLOSE_TIMEOUT_MS 600
+
+#define COMMAND_INFO(name, opcode, request_len, reply_max, retry, handler, option, help) \
+  { (opcode), (request_len), (reply_max), (retry) == CPC_RETRY_SAFE, (option), (help) },
+
+static const custom_cpc_command_info_t command_info[] = {
+  CPC_COMMAND_TABLE(COMMAND_INFO)
+};
+
+#define COMMAND_COUNT (sizeof(command_info) / sizeof(command_info[0]))
+
+struct trace_event {
+  uint8_t id;
+  uint8_t level;       // CPC_TRACE_LEVEL_*
+  const char *args;    // arguments of format, from "abc"
+  const char *format;
+};
+
+#define TRACE_EVENT(name, id, level, args, format) \
+  { (id), CPC_TRACE_LEVEL_##level, (args), (format) },
+
+static const struct trace_event trace_events[] = {
+  CPC_TRACE_EVENT_TABLE(TRACE_EVENT)
+};
+
+#define TRACE_EVENT_COUNT (sizeof(trace_events) / sizeof(trace_events[0]))
+
+struct request {
+  bool busy;       // sequence number in use
+  bool done;       // reply (or error) received, future not yet collected
+  uint8_t opcode;
+  custom_cpc_callback_t callback;
+  void *user_arg;
+  int status;
+  uint8_t *reply;  // futures only
+  size_t reply_len;
+  uint64_t sent_ns; // last send
+  uint64_t expiry_ns; // restarted by progress frames
+  uint8_t *frame;   // copy of the frame sent, kept while retries are left
+  size_t frame_len;
+  unsigned int retries_left;
+};
+
+// Events received but not yet collected by custom_cpc_wait_event()
+#define EVENT_QUEUE_SIZE 16
+
+struct custom_cpc {
+  custom_cpc_config_t config;
+  cpc_handle_t lib_handle;
+  cpc_endpoint_t endpoint;
+  bool endpoint_open;
+  int socket_fd; // >= 0 when talking to a daemon
+  custom_cpc_capture_t *capture; // NULL without capture_path
+  uint8_t next_seq;
+  unsigned int inflight;
+  struct request requests[UINT8_MAX + 1]; // indexed by sequence number
+  custom_cpc_event_t events[EVENT_QUEUE_SIZE];
+  unsigned int event_head;
+  unsigned int event_count;
+  bool event_seen;
+  uint8_t event_seq;   // expected seq of the next event
+  uint8_t tx_buffer[SL_CPC_READ_MINIMUM_SIZE];
+  uint8_t rx_buffer[SL_CPC_READ_MINIMUM_SIZE];
+};
+
+static void sleep_100ms(void){
+  nanosleep((const struct timespec[]){{ 0, 100000000L } }, NULL);
+}
+
+static void sleep_us(unsigned long us){
+  struct timespec ts = { (time_t) (us / 1000000), (long) (us % 1000000) * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int connect_socket(custom_cpc_t *ctx){
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (strlen(ctx->config.socket_path) >= sizeof(addr.sun_path)) {
+    return -ENAMETOOLONG;
+  }
+  strcpy(addr.sun_path, ctx->config.socket_path);
+
+  ctx->socket_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (ctx->socket_fd < 0) {
+    return -errno;
+  }
+  if (connect(ctx->socket_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    int ret = -errno;
+    close(ctx->socket_fd);
+    ctx->socket_fd = -1;
+    return ret;
+  }
+  return 0;
+}
+
+static int open_endpoint(custom_cpc_t *ctx){
+  int ret;
+
+  ret = cpc_open_endpoint(ctx->lib_handle,
+                          &ctx->endpoint,
+                          SL_CPC_ENDPOINT_USER_ID_0,
+                          TX_WINDOW_SIZE);
+  if (ret < 0) {
+    return ret;
+  }
+  ctx->endpoint_open = true;
+  return 0;
+}
+
+static int connect_cpc(custom_cpc_t *ctx){
+  custom_cpc_phase_times_t *times = ctx->config.phase_times;
+  uint64_t start = now_ns();
+  uint8_t retry = 0;
+  int ret;
+
+  do {
+    ret = cpc_init(&ctx->lib_handle,
+                   ctx->config.instance_name,
+                   ctx->config.enable_tracing,
+                   NULL);
+    if (ret == 0) {
+      // speed up boot process if everything seems ok
+      break;
+    }
+    sleep_100ms();
+    retry++;
+  } while (retry < INIT_RETRIES);
+  if (times != NULL) {
+    times->init_ns = now_ns() - start;
+    times->init_attempts = (ret == 0) ? retry + 1u : retry;
+  }
+  if (ret < 0) {
+    return ret;
+  }
+
+  start = now_ns();
+  ret = open_endpoint(ctx);
+  if (times != NULL) {
+    times->open_ns = now_ns() - start;
+  }
+  return ret;
+}
+
+// Waits for cpcd to report the endpoint closed, so the next open does
+// not race with the close. Gives up on error or after CLOSE_TIMEOUT_MS.
+static unsigned int wait_closed(custom_cpc_t *ctx){
+  cpc_endpoint_state_t state;
+  uint64_t deadline = now_ns() + CLOSE_TIMEOUT_MS * 1000000ull;
+  unsigned long backoff_us = CLOSE_POLL_MIN_US;
+  unsigned int polls = 0;
+
+  while (1) {
+    int ret = cpc_get_endpoint_state(ctx->lib_handle, SL_CPC_ENDPOINT_USER_ID_0, &state);
+    polls++;
+    if ((ret < 0) || (state == SL_CPC_STATE_CLOSED) || (now_ns() >= deadline)) {
+      return polls;
+    }
+    sleep_us(backoff_us);
+    backoff_us = (backoff_us * 2 > CLOSE_POLL_MAX_US) ? CLOSE_POLL_MAX_US : backoff_us * 2;
+  }
+}
+
+static void disconnect_cpc(custom_cpc_t *ctx){
+  custom_cpc_phase_times_t *times = ctx->config.phase_times;
+  uint64_t start = now_ns();
+  unsigned int polls = 0;
+
+  if (ctx->endpoint_open) {
+    cpc_close_endpoint(&ctx->endpoint);
+    ctx->endpoint_open = false;
+    if (!ctx->config.no_close_wait) {
+      polls = wait_closed(ctx);
+    }
+  }
+  if (times != NULL) {
+    times->close_ns = now_ns() - start;
+    times->close_polls = polls;
+    start = now_ns();
+  }
+  cpc_deinit(&ctx->lib_handle);
+  if (times != NULL) {
+    times->deinit_ns = now_ns() - start;
+  }
+}
+
+static ssize_t transport_write(custom_cpc_t *ctx, const uint8_t *buffer, size_t len){
+  ssize_t ret;
+
+  if (ctx->socket_fd >= 0) {
+    ret = send(ctx->socket_fd, buffer, len, MSG_NOSIGNAL);
+    ret = (ret < 0) ? -errno : ret;
+  } else {
+    ret = cpc_write_endpoint(ctx->endpoint, buffer, len, CPC_ENDPOINT_WRITE_FLAG_NONE);
+  }
+  if ((ret > 0) && (ctx->capture != NULL)) {
+    custom_cpc_capture_frame(ctx->capture, CUSTOM_CPC_CAPTURE_TX, buffer, (size_t) ret);
+  }
+  return ret;
+}
+
+// Blocks until one frame arrives or deadline passes (-EAGAIN)
+static ssize_t transport_receive(custom_cpc_t *ctx, uint8_t *buffer, uint64_t deadline){
+  uint64_t now = now_ns();
+  uint64_t wait_us = (deadline > now) ? (deadline - now + 999) / 1000 : 0;
+  ssize_t size;
+
+  if (ctx->socket_fd >= 0) {
+    struct pollfd pfd = { .fd = ctx->socket_fd, .events = POLLIN };
+    int ret;
+
+    do {
+      ret = poll(&pfd, 1, (int) ((wait_us + 999) / 1000));
+    } while ((ret < 0) && (errno == EINTR));
+    if (ret == 0) {
+      return -EAGAIN;
+    }
+    size = recv(ctx->socket_fd, buffer, SL_CPC_READ_MINIMUM_SIZE, 0);
+    if (size == 0) {
+      return -ECONNRESET; // daemon went away
+    }
+    return (size < 0) ? -errno : size;
+  }
+
+  // A zero RX timeout means no timeout to libcpc
+  cpc_timeval_t rx_timeout = {
+    .seconds = (int) (wait_us / 1000000),
+    .microseconds = (int) ((wait_us == 0) ? 1 : wait_us % 1000000)
+  };
+  cpc_set_endpoint_option(ctx->endpoint, CPC_OPTION_RX_TIMEOUT, &rx_timeout, sizeof(rx_timeout));
+  do {
+    size = cpc_read_endpoint(ctx->endpoint,
+                             buffer,
+                             SL_CPC_READ_MINIMUM_SIZE,
+                             CPC_ENDPOINT_READ_FLAG_NONE);
+  } while (size == -EINTR);
+  return size;
+}
+
+static ssize_t transport_read(custom_cpc_t *ctx, uint8_t *buffer, uint64_t deadline){
+  ssize_t size = transport_receive(ctx, buffer, deadline);
+
+  if ((size > 0) && (ctx->capture != NULL)) {
+    custom_cpc_capture_frame(ctx->capture, CUSTOM_CPC_CAPTURE_RX, buffer, (size_t) size);
+  }
+  return size;
+}
+
+static void complete(custom_cpc_t *ctx, uint8_t seq, int status, const uint8_t *payload, size_t len){
+  struct request *r = &ctx->requests[seq];
+
+  ctx->inflight--;
+  free(r->frame);
+  r->frame = NULL;
+  if (r->callback != NULL) {
+    r->busy = false;
+    r->callback(r->user_arg, status, r->opcode, payload, len);
+    return;
+  }
+
+  // Future: keep the reply until custom_cpc_wait()
+  r->status = status;
+  r->reply_len = 0;
+  r->reply = NULL;
+  if (status == 0 && len > 0) {
+    r->reply = malloc(len);
+    if (r->reply == NULL) {
+      r->status = -ENOMEM;
+    } else {
+      memcpy(r->reply, payload, len);
+      r->reply_len = len;
+    }
+  }
+  r->done = true;
+}
+
+// Reopens the link after cpcd or the daemon went away, as the daemon does
+// for its own endpoint
+static int reconnect(custom_cpc_t *ctx){
+  int ret;
+
+  if (ctx->socket_fd >= 0) {
+    close(ctx->socket_fd);
+    ctx->socket_fd = -1;
+    return connect_socket(ctx);
+  }
+  if (ctx->endpoint_open) {
+    cpc_close_endpoint(&ctx->endpoint);
+    ctx->endpoint_open = false;
+  }
+  ret = cpc_restart(&ctx->lib_handle);
+  if (ret < 0) {
+    return ret;
+  }
+  return open_endpoint(ctx);
+}
+
+// Ends the wait for a request in flight with status. If resend and it has
+// retries left, it is sent again instead. Returns 1 if it completed.
+static int retry_request(custom_cpc_t *ctx, uint8_t seq, int status, bool resend){
+  struct request *r = &ctx->requests[seq];
+
+  if ((status == -ETIMEDOUT) && (ctx->config.latency != NULL)) {
+    custom_cpc_latency_timeout(ctx->config.latency, r->opcode);
+  }
+  if (resend && (r->retries_left > 0)) {
+    r->retries_left--;
+    r->sent_ns = now_ns();
+    r->expiry_ns = r->sent_ns + ctx->config.timeout_ms * 1000000ull;
+    if (transport_write(ctx, r->frame, r->frame_len) > 0) {
+      return 0;
+    }
+  }
+  complete(ctx, seq, status, NULL, 0);
+  return 1;
+}
+
+// Same for every request still in flight. Returns the number of requests
+// completed.
+static int retry_inflight(custom_cpc_t *ctx, int status, bool resend){
+  int count = 0;
+
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    struct request *r = &ctx->requests[i];
+
+    if (r->busy && !r->done) {
+      count += retry_request(ctx, (uint8_t) i, status, resend);
+    }
+  }
+  return count;
+}
+
+// Earliest reply deadline of the requests in flight, UINT64_MAX if none
+static uint64_t next_expiry(const custom_cpc_t *ctx){
+  uint64_t expiry = UINT64_MAX;
+
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    const struct request *r = &ctx->requests[i];
+
+    if (r->busy && !r->done && (r->expiry_ns < expiry)) {
+      expiry = r->expiry_ns;
+    }
+  }
+  return expiry;
+}
+
+// Fails (-ETIMEDOUT) the requests whose reply deadline has passed, or sends
+// them again if they have retries left. The others keep waiting. Returns
+// the number of requests completed.
+static int expire_inflight(custom_cpc_t *ctx, uint64_t now){
+  int count = 0;
+
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    struct request *r = &ctx->requests[i];
+
+    if (r->busy && !r->done && (now >= r->expiry_ns)) {
+      count += retry_request(ctx, (uint8_t) i, -ETIMEDOUT, ctx->config.retries > 0);
+    }
+  }
+  return count;
+}
+
+// The link failed. With retries, it is reopened and the requests with
+// retries left are sent again; the others complete with status. Returns
+// the number of requests completed.
+static int fail_inflight(custom_cpc_t *ctx, int status){
+  bool resend = (ctx->config.retries > 0);
+
+  if (resend) {
+    resend = (reconnect(ctx) == 0); // else the next submit tries again
+  }
+  return retry_inflight(ctx, status, resend);
+}
+
+int custom_cpc_open(custom_cpc_t **ctx, const custom_cpc_config_t *config){
+  const custom_cpc_config_t defaults = CUSTOM_CPC_CONFIG_DEFAULT;
+  custom_cpc_t *c;
+  int ret;
+
+  if (ctx == NULL) {
+    return -EINVAL;
+  }
+  if (config == NULL) {
+    config = &defaults;
+  }
+  if ((config->timeout_ms == 0)
+      || (config->window_size == 0)
+      || (config->window_size > CUSTOM_CPC_MAX_WINDOW)) {
+    return -EINVAL;
+  }
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    return -ENOMEM;
+  }
+  c->config = *config;
+  c->socket_fd = -1;
+
+  if (config->capture_path != NULL) {
+    ret = custom_cpc_capture_open(&c->capture, config->capture_path);
+    if (ret < 0) {
+      free(c);
+      return ret;
+    }
+  }
+
+  if (config->socket_path != NULL) {
+    uint64_t start = now_ns();
+
+    ret = connect_socket(c);
+    if (config->phase_times != NULL) {
+      config->phase_times->open_ns = now_ns() - start;
+    }
+  } else {
+    ret = connect_cpc(c);
+  }
+  if (ret < 0) {
+    custom_cpc_close(c);
+    return ret;
+  }
+
+  *ctx = c;
+  return 0;
+}
+
+void custom_cpc_close(custom_cpc_t *ctx){
+  if (ctx == NULL) {
+    return;
+  }
+  if (ctx->socket_fd >= 0) {
+    uint64_t start = now_ns();
+
+    close(ctx->socket_fd); // a daemon keeps its endpoint open
+    if (ctx->config.phase_times != NULL) {
+      ctx->config.phase_times->close_ns = now_ns() - start;
+    }
+  } else if (ctx->lib_handle.ptr != NULL) {
+    disconnect_cpc(ctx);
+  }
+  custom_cpc_capture_close(ctx->capture);
+  for (size_t i = 0; i <= UINT8_MAX; i++) {
+    free(ctx->requests[i].reply);
+    free(ctx->requests[i].frame);
+  }
+  free(ctx);
+}
+
+int custom_cpc_submit(custom_cpc_t *ctx,
+                      uint8_t opcode,
+                      const void *args,
+                      size_t args_len,
+                      custom_cpc_callback_t callback,
+                      void *user_arg){
+  struct iovec iov = { .iov_base = (void *) args, .iov_len = args_len };
+
+  if ((args == NULL) && (args_len > 0)) {
+    return -EINVAL;
+  }
+  return custom_cpc_submitv(ctx, opcode, &iov, (args_len > 0) ? 1 : 0, callback, user_arg);
+}
+
+int custom_cpc_submitv(custom_cpc_t *ctx,
+                       uint8_t opcode,
+                       const struct iovec *iov,
+                       int iovcnt,
+                       custom_cpc_callback_t callback,
+                       void *user_arg){
+  const custom_cpc_command_info_t *info;
+  size_t args_len = 0;
+  uint64_t sent_ns;
+  uint8_t *frame = NULL;
+  uint16_t frame_len;
+  uint16_t tries;
+  uint8_t seq;
+  ssize_t ret;
+
+  if ((ctx == NULL) || (iovcnt < 0) || ((iov == NULL) && (iovcnt > 0))) {
+    return -EINVAL;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    if ((iov[i].iov_base == NULL) && (iov[i].iov_len > 0)) {
+      return -EINVAL;
+    }
+    args_len += iov[i].iov_len;
+  }
+  if (args_len > sizeof(ctx->tx_buffer) - CPC_FRAME_HEADER_SIZE) {
+    return -EMSGSIZE;
+  }
+  info = custom_cpc_command_info(opcode);
+  if ((info != NULL) && (info->request_len != CPC_ARGS_VARIABLE) && (args_len != info->request_len)) {
+    return -EINVAL;
+  }
+
+  // Wait for room in the window
+  while (ctx->inflight >= ctx->config.window_size) {
+    ret = custom_cpc_process(ctx);
+    if (ret < 0) {
+      return (int) ret;
+    }
+  }
+
+  // Find a free sequence number (uncollected futures keep theirs)
+  for (tries = 0; tries <= UINT8_MAX && ctx->requests[ctx->next_seq].busy; tries++) {
+    ctx->next_seq++;
+  }
+  if (tries > UINT8_MAX) {
+    return -EBUSY;
+  }
+
+  seq = ctx->next_seq++;
+  args_len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > 0) {
+      memcpy(ctx->tx_buffer + CPC_FRAME_HEADER_SIZE + args_len, iov[i].iov_base, iov[i].iov_len);
+      args_len += iov[i].iov_len;
+    }
+  }
+
+  frame_len = cpc_frame_encode(ctx->tx_buffer, opcode, 0, seq, CPC_FRAME_OK, (uint16_t) args_len);
+  if ((ctx->config.retries > 0) && (info != NULL) && info->retry_safe) {
+    frame = malloc(frame_len);
+    if (frame == NULL) {
+      return -ENOMEM;
+    }
+    memcpy(frame, ctx->tx_buffer, frame_len);
+  }
+
+  sent_ns = now_ns();
+  ret = transport_write(ctx, ctx->tx_buffer, frame_len);
+  if ((ret < 0) && (ctx->config.retries > 0) && (reconnect(ctx) == 0)) {
+    // What was in flight was lost with the link. Nothing of this command
+    // was sent, so it goes on the reopened link whatever it is.
+    retry_inflight(ctx, (int) ret, true);
+    ret = transport_write(ctx, ctx->tx_buffer, frame_len);
+  }
+  if (ret < 0) {
+    free(frame);
+    return (int) ret;
+  }
+
+  ctx->requests[seq] = (struct request) {
+    .busy = true,
+    .opcode = opcode,
+    .callback = callback,
+    .user_arg = user_arg,
+    .sent_ns = sent_ns,
+    .expiry_ns = sent_ns + ctx->config.timeout_ms * 1000000ull,
+    .frame = frame,
+    .frame_len = frame_len,
+    .retries_left = (frame != NULL) ? ctx->config.retries : 0,
+  };
+  ctx->inflight++;
+  return seq;
+}
+
+// Queues an event frame, dropping the oldest one if the queue is full
+static void queue_event(custom_cpc_t *ctx, const cpc_frame_t *frame){
+  custom_cpc_event_t *e;
+
+  if (ctx->event_count == EVENT_QUEUE_SIZE) {
+    ctx->event_head = (ctx->event_head + 1) % EVENT_QUEUE_SIZE;
+    ctx->event_count--;
+  }
+  e = &ctx->events[(ctx->event_head + ctx->event_count) % EVENT_QUEUE_SIZE];
+  ctx->event_count++;
+
+  e->opcode = frame->opcode;
+  e->seq = frame->seq;
+  e->lost = ctx->event_seen ? (uint8_t) (frame->seq - ctx->event_seq) : 0;
+  e->len = (frame->len < sizeof(e->payload)) ? frame->len : sizeof(e->payload);
+  memcpy(e->payload, frame->payload, e->len);
+  ctx->event_seen = true;
+  ctx->event_seq = frame->seq + 1;
+}
+
+// Error returned for a command the RCP could not run
+static int frame_status_error(uint8_t status){
+  switch (status) {
+    case CPC_FRAME_UNKNOWN_OPCODE:
+      return -EOPNOTSUPP;
+    case CPC_FRAME_BAD_LENGTH:
+      return -EINVAL;
+    case CPC_FRAME_MALFORMED:
+      return -EBADMSG;
+    case CPC_FRAME_NOT_CONNECTED:
+      return -ENOTCONN;
+    case CPC_FRAME_BUSY:
+      return -EBUSY;
+    case CPC_FRAME_EXPIRED:
+      return -ETIMEDOUT;
+    default:
+      return -EPROTO;
+  }
+}
+
+// Dispatches one frame from the RCP. Returns the number of requests
+// completed (0 or 1).
+static int handle_frame(custom_cpc_t *ctx, size_t len){
+  const custom_cpc_command_info_t *info;
+  cpc_frame_t frame;
+  struct request *r;
+
+  if (cpc_frame_decode(ctx->rx_buffer, len, &frame) != CPC_FRAME_OK) {
+    return 0; // not a frame we can use, drop it
+  }
+  if (frame.flags & CPC_FRAME_FLAG_EVENT) {
+    queue_event(ctx, &frame);
+    return 0;
+  }
+  r = &ctx->requests[frame.seq];
+  if (!(frame.flags & CPC_FRAME_FLAG_REPLY) || !r->busy || r->done || (frame.opcode != r->opcode)) {
+    return 0; // stale or unexpected reply
+  }
+  if (frame.flags & CPC_FRAME_FLAG_PROGRESS) {
+    // The command is still running, its reply follows
+    r->expiry_ns = now_ns() + ctx->config.timeout_ms * 1000000ull;
+    if ((ctx->config.progress != NULL) && (frame.len >= CPC_FRAME_PROGRESS_SIZE)) {
+      ctx->config.progress(ctx->config.progress_arg, frame.opcode,
+                           cpc_get_u16(&frame.payload[0]), cpc_get_u16(&frame.payload[2]));
+    }
+    return 0;
+  }
+  if (ctx->config.latency != NULL) {
+    uint64_t now = now_ns();
+
+    // NOT_CONNECTED, BUSY and EXPIRED come from the daemon, not the RCP
+    if (frame.status == CPC_FRAME_EXPIRED) {
+      custom_cpc_latency_timeout(ctx->config.latency, r->opcode);
+    } else if ((frame.status != CPC_FRAME_NOT_CONNECTED) && (frame.status != CPC_FRAME_BUSY)) {
+      custom_cpc_latency_record(ctx->config.latency, r->opcode, now - r->sent_ns);
+    }
+    custom_cpc_latency_check(ctx->config.latency, now);
+  }
+  if (frame.status != CPC_FRAME_OK) {
+    complete(ctx, frame.seq, frame_status_error(frame.status), NULL, 0);
+    return 1;
+  }
+  info = custom_cpc_command_info(r->opcode);
+  if ((info != NULL) && (frame.len > info->reply_max)) {
+    complete(ctx, frame.seq, -EPROTO, NULL, 0);
+    return 1;
+  }
+  complete(ctx, frame.seq, 0, frame.payload, frame.len);
+  return 1;
+}
+
+int custom_cpc_process(custom_cpc_t *ctx){
+  ssize_t len;
+  int count;
+
+  if (ctx == NULL) {
+    return -EINVAL;
+  }
+  if (ctx->inflight == 0) {
+    return 0;
+  }
+
+  // Frames for other requests do not hold back an overdue one
+  count = expire_inflight(ctx, now_ns());
+  if (count > 0) {
+    return count;
+  }
+  len = transport_read(ctx, ctx->rx_buffer, next_expiry(ctx));
+  if (len == -EAGAIN) {
+    return expire_inflight(ctx, now_ns());
+  }
+  if (len < 0) {
+    return fail_inflight(ctx, (int) len);
+  }
+  return handle_frame(ctx, (size_t) len);
+}
+
+int custom_cpc_wait_event(custom_cpc_t *ctx, custom_cpc_event_t *event, unsigned long timeout_ms){
+  uint64_t deadline;
+  ssize_t len;
+
+  if ((ctx == NULL) || (event == NULL)) {
+    return -EINVAL;
+  }
+  deadline = now_ns() + (uint64_t) timeout_ms * 1000000ull;
+
+  // Each read waits up to the next reply deadline, replies that arrive
+  // meanwhile complete their requests as in custom_cpc_process()
+  while (ctx->event_count == 0) {
+    uint64_t now = now_ns();
+    uint64_t expiry;
+
+    if (now >= deadline) {
+      return -ETIMEDOUT;
+    }
+    expire_inflight(ctx, now);
+    expiry = next_expiry(ctx);
+    len = transport_read(ctx, ctx->rx_buffer, (expiry < deadline) ? expiry : deadline);
+    if (len == -EAGAIN) {
+      continue;
+    } else if (len < 0) {
+      fail_inflight(ctx, (int) len);
+      return (int) len;
+    } else {
+      handle_frame(ctx, (size_t) len);
+    }
+  }
+
+  *event = ctx->events[ctx->event_head];
+  ctx->event_head = (ctx->event_head + 1) % EVENT_QUEUE_SIZE;
+  ctx->event_count--;
+  return 0;
+}
+
+unsigned int custom_cpc_pending(const custom_cpc_t *ctx){
+  return (ctx == NULL) ? 0 : ctx->inflight;
+}
+
+int custom_cpc_wait(custom_cpc_t *ctx,
+                    int request,
+                    void *reply,
+                    size_t reply_size,
+                    size_t *reply_len){
+  struct request *r;
+  int ret;
+
+  if ((ctx == NULL) || (request < 0) || (request > UINT8_MAX)) {
+    return -EINVAL;
+  }
+  r = &ctx->requests[request];
+  if (!r->busy || (r->callback != NULL)) {
+    return -EINVAL;
+  }
+
+  while (!r->done) {
+    ret = custom_cpc_process(ctx);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  if (reply != NULL) {
+    memcpy(reply, r->reply, (r->reply_len < reply_size) ? r->reply_len : reply_size);
+  }
+  if (reply_len != NULL) {
+    *reply_len = r->reply_len;
+  }
+  ret = r->status;
+  free(r->reply);
+  *r = (struct request) { 0 };
+  return ret;
+}
+
+int custom_cpc_transact(custom_cpc_t *ctx,
+                        uint8_t opcode,
+                        const void *args,
+                        size_t args_len,
+                        void *reply,
+                        size_t reply_size,
+                        size_t *reply_len){
+  int request = custom_cpc_submit(ctx, opcode, args, args_len, NULL, NULL);
+
+  if (request < 0) {
+    return request;
+  }
+  return custom_cpc_wait(ctx, request, reply, reply_size, reply_len);
+}
+
+int32_t custom_cpc_decode_status(const uint8_t *payload, size_t len){
+  uint32_t value = 0;
+
+  if (len == 0 || len > sizeof(value)) {
+    return 0;
+  }
+  for (size_t i = 0; i < len; i++) {
+    value |= (uint32_t) payload[i] << (8 * i);
+  }
+  // sign extend from the reply width
+  if (len < sizeof(value) && (payload[len - 1] & 0x80)) {
+    value |= UINT32_MAX << (8 * len);
+  }
+  return (int32_t) value;
+}
+
+const custom_cpc_command_info_t *custom_cpc_commands(size_t *count){
+  if (count != NULL) {
+    *count = COMMAND_COUNT;
+  }
+  return command_info;
+}
+
+const custom_cpc_command_info_t *custom_cpc_command_info(uint8_t opcode){
+  for (size_t i = 0; i < COMMAND_COUNT; i++) {
+    if (command_info[i].opcode == opcode) {
+      return &command_info[i];
+    }
+  }
+  return NULL;
+}
+
+const custom_cpc_command_info_t *custom_cpc_command_find(const char *name){
+  for (size_t i = 0; i < COMMAND_COUNT; i++) {
+    if (strcmp(command_info[i].name, name) == 0) {
+      return &command_info[i];
+    }
+  }
+  return NULL;
+}
+
+// Round trip for a command whose reply is a little endian integer of
+// exactly len bytes
+static int transact_uint(custom_cpc_t *ctx,
+                         enum CustCpcCommand command,
+                         const uint8_t *args,
+                         size_t args_len,
+                         uint32_t *value,
+                         size_t len){
+  uint8_t reply[sizeof(uint32_t)];
+  size_t reply_len;
+  int ret;
+
+  ret = custom_cpc_transact(ctx, (uint8_t) command, args, args_len, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  if (reply_len != len) {
+    return -EPROTO;
+  }
+  *value = (uint32_t) custom_cpc_decode_status(reply, len) & (UINT32_MAX >> (32 - 8 * len));
+  return 0;
+}
+
+static int transact_u16(custom_cpc_t *ctx, enum CustCpcCommand command, uint16_t *value){
+  uint32_t v;
+  int ret = transact_uint(ctx, command, NULL, 0, &v, sizeof(uint16_t));
+
+  if (ret == 0) {
+    *value = (uint16_t) v;
+  }
+  return ret;
+}
+
+// Round trip for a command that replies with a status of any width
+static int transact_status(custom_cpc_t *ctx,
+                           enum CustCpcCommand command,
+                           const uint8_t *args,
+                           size_t args_len,
+                           int32_t *status){
+  uint8_t reply[sizeof(uint32_t)];
+  size_t reply_len;
+  int ret;
+
+  ret = custom_cpc_transact(ctx, (uint8_t) command, args, args_len, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  if (reply_len == 0 || reply_len > sizeof(reply)) {
+    return -EPROTO;
+  }
+  *status = custom_cpc_decode_status(reply, reply_len);
+  return 0;
+}
+
+int custom_cpc_get_cust_version(custom_cpc_t *ctx, uint32_t *version){
+  return transact_uint(ctx, CPC_COMMAND_GET_CUST_VERSION, NULL, 0, version, sizeof(uint32_t));
+}
+
+int custom_cpc_get_se_version(custom_cpc_t *ctx, uint32_t *version){
+  return transact_uint(ctx, CPC_COMMAND_GET_SE_VERSION, NULL, 0, version, sizeof(uint32_t));
+}
+
+int custom_cpc_get_ctune_token(custom_cpc_t *ctx, uint16_t *ctune){
+  return transact_u16(ctx, CPC_COMMAND_GET_CTUNE_TOKEN, ctune);
+}
+
+int custom_cpc_set_ctune_token(custom_cpc_t *ctx, uint16_t ctune, int32_t *status){
+  uint8_t args[] = { ctune & 0xff, ctune >> 8 };
+  return transact_status(ctx, CPC_COMMAND_SET_CTUNE_TOKEN, args, sizeof(args), status);
+}
+
+int custom_cpc_get_ctune_value(custom_cpc_t *ctx, uint16_t *ctune){
+  return transact_u16(ctx, CPC_COMMAND_GET_CTUNE_VALUE, ctune);
+}
+
+int custom_cpc_set_ctune_value(custom_cpc_t *ctx, uint16_t ctune, int32_t *status){
+  uint8_t args[] = { ctune & 0xff, ctune >> 8 };
+  return transact_status(ctx, CPC_COMMAND_SET_CTUNE_VALUE, args, sizeof(args), status);
+}
+
+int custom_cpc_tone_start(custom_cpc_t *ctx, int32_t *status){
+  return transact_status(ctx, CPC_COMMAND_TONE_START, NULL, 0, status);
+}
+
+int custom_cpc_tone_stop(custom_cpc_t *ctx, int32_t *status){
+  return transact_status(ctx, CPC_COMMAND_TONE_STOP, NULL, 0, status);
+}
+
+int custom_cpc_gpio_write(custom_cpc_t *ctx, uint8_t value, int32_t *status){
+  return transact_status(ctx, CPC_COMMAND_GPIO_WRITE, &value, sizeof(value), status);
+}
+
+int custom_cpc_erase_userdata_page(custom_cpc_t *ctx, int32_t *status){
+  return transact_status(ctx, CPC_COMMAND_ERASE_USERDATA_PAGE, NULL, 0, status);
+}
+
+int custom_cpc_get_btl_version(custom_cpc_t *ctx, uint32_t *version){
+  return transact_uint(ctx, CPC_COMMAND_GET_BTL_VERSION, NULL, 0, version, sizeof(uint32_t));
+}
+
+int custom_cpc_get_app_properties_version(custom_cpc_t *ctx, uint32_t *version){
+  return transact_uint(ctx, CPC_COMMAND_GET_APP_PROPERTIES_VERSION, NULL, 0, version, sizeof(uint32_t));
+}
+
+static int userdata_errno(uint8_t status){
+  switch (status) {
+    case CPC_USERDATA_OK:
+      return 0;
+    case CPC_USERDATA_BAD_RANGE:
+      return -ERANGE;
+    case CPC_USERDATA_BAD_CRC:
+      return -EBADMSG;
+    default:
+      return -EIO;
+  }
+}
+
+// One USERDATA_READ or USERDATA_STAGE chunk waiting for its reply
+struct userdata_chunk {
+  int request;
+  uint8_t *data;
+  uint16_t len;
+};
+
+// Collects the oldest chunk in flight. Reads check the chunk's CRC and
+// copy it out.
+static int userdata_collect(custom_cpc_t *ctx, const struct userdata_chunk *chunk, bool read){
+  uint8_t reply[1 + CPC_USERDATA_CHUNK_MAX + sizeof(uint32_t)];
+  size_t reply_len;
+  int ret;
+
+  ret = custom_cpc_wait(ctx, chunk->request, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  if (reply_len < 1) {
+    return -EPROTO;
+  }
+  ret = userdata_errno(reply[0]);
+  if ((ret < 0) || !read) {
+    return ret;
+  }
+  if (reply_len != 1u + chunk->len + sizeof(uint32_t)) {
+    return -EPROTO;
+  }
+  if (cpc_crc32(0, reply + 1, chunk->len) != cpc_get_u32(reply + 1 + chunk->len)) {
+    return -EBADMSG;
+  }
+  memcpy(chunk->data, reply + 1, chunk->len);
+  return 0;
+}
+
+// Streams [offset, offset + len) in CPC_USERDATA_CHUNK_MAX chunks, keeping
+// up to window_size of them in flight. Stops submitting on the first
+// error but still collects everything already sent.
+static int userdata_stream(custom_cpc_t *ctx, uint16_t offset, uint8_t *data, size_t len, bool read){
+  struct userdata_chunk chunks[CUSTOM_CPC_MAX_WINDOW];
+  size_t head = 0;
+  size_t count = 0;
+  size_t done = 0;
+  int status = 0;
+  int ret;
+
+  if ((ctx == NULL) || ((data == NULL) && (len > 0))) {
+    return -EINVAL;
+  }
+  if ((size_t) offset + len > UINT16_MAX + 1u) {
+    return -ERANGE;
+  }
+
+  while ((done < len && status == 0) || count > 0) {
+    if (done < len && status == 0 && count < ctx->config.window_size) {
+      struct userdata_chunk *chunk = &chunks[(head + count) % CUSTOM_CPC_MAX_WINDOW];
+      uint16_t chunk_offset = (uint16_t) (offset + done);
+      uint8_t hdr[2 * sizeof(uint16_t)];
+      uint8_t crc[sizeof(uint32_t)];
+
+      chunk->data = data + done;
+      chunk->len = (uint16_t) ((len - done < CPC_USERDATA_CHUNK_MAX) ? len - done : CPC_USERDATA_CHUNK_MAX);
+      cpc_put_u16(hdr, chunk_offset);
+      if (read) {
+        cpc_put_u16(hdr + 2, chunk->len);
+        chunk->request = custom_cpc_submit(ctx, CPC_COMMAND_USERDATA_READ, hdr, sizeof(hdr), NULL, NULL);
+      } else {
+        // Header, data and CRC are gathered straight into the frame
+        struct iovec iov[] = {
+          { .iov_base = hdr, .iov_len = sizeof(uint16_t) },
+          { .iov_base = chunk->data, .iov_len = chunk->len },
+          { .iov_base = crc, .iov_len = sizeof(crc) },
+        };
+
+        cpc_put_u32(crc, cpc_crc32(0, chunk->data, chunk->len));
+        chunk->request = custom_cpc_submitv(ctx, CPC_COMMAND_USERDATA_STAGE, iov, 3, NULL, NULL);
+      }
+      if (chunk->request < 0) {
+        status = chunk->request;
+      } else {
+        done += chunk->len;
+        count++;
+      }
+      continue;
+    }
+
+    ret = userdata_collect(ctx, &chunks[head], read);
+    if (ret < 0 && status == 0) {
+      status = ret;
+    }
+    head = (head + 1) % CUSTOM_CPC_MAX_WINDOW;
+    count--;
+  }
+  return status;
+}
+
+int custom_cpc_userdata_read(custom_cpc_t *ctx, uint16_t offset, void *data, size_t len){
+  return userdata_stream(ctx, offset, data, len, true);
+}
+
+int custom_cpc_userdata_stage(custom_cpc_t *ctx, uint16_t offset, const void *data, size_t len){
+  return userdata_stream(ctx, offset, (uint8_t *) data, len, false);
+}
+
+// Decodes a USERDATA_COMMIT or USERDATA_PROVISION reply
+static int userdata_commit_reply(const uint8_t *reply, size_t reply_len, bool *erased, uint32_t *page_crc){
+  int ret;
+
+  if (reply_len < 1) {
+    return -EPROTO;
+  }
+  ret = userdata_errno(reply[0]);
+  if (ret < 0) {
+    return ret;
+  }
+  if (reply_len != 2 + sizeof(uint32_t)) {
+    return -EPROTO;
+  }
+  if (erased != NULL) {
+    *erased = reply[1] != 0;
+  }
+  if (page_crc != NULL) {
+    *page_crc = cpc_get_u32(reply + 2);
+  }
+  return 0;
+}
+
+int custom_cpc_userdata_commit(custom_cpc_t *ctx, bool *erased, uint32_t *page_crc){
+  uint8_t reply[2 + sizeof(uint32_t)];
+  size_t reply_len;
+  int ret;
+
+  ret = custom_cpc_transact(ctx, CPC_COMMAND_USERDATA_COMMIT, NULL, 0, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  return userdata_commit_reply(reply, reply_len, erased, page_crc);
+}
+
+int custom_cpc_userdata_abort(custom_cpc_t *ctx){
+  uint8_t reply;
+  size_t reply_len;
+  int ret;
+
+  ret = custom_cpc_transact(ctx, CPC_COMMAND_USERDATA_ABORT, NULL, 0, &reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  return (reply_len == 1) ? userdata_errno(reply) : -EPROTO;
+}
+
+int custom_cpc_userdata_write(custom_cpc_t *ctx, uint16_t offset, const void *data, size_t len, bool *erased){
+  int ret;
+
+  // Start from a clean slate in case an earlier write was interrupted
+  ret = custom_cpc_userdata_abort(ctx);
+  if (ret == 0) {
+    ret = custom_cpc_userdata_stage(ctx, offset, data, len);
+  }
+  if (ret == 0) {
+    ret = custom_cpc_userdata_commit(ctx, erased, NULL);
+  }
+  if (ret < 0 && ret != -ETIMEDOUT) {
+    custom_cpc_userdata_abort(ctx);
+  }
+  return ret;
+}
+
+int custom_cpc_provision_encode(const custom_cpc_token_t *tokens, size_t count, uint8_t *buffer, size_t size){
+  size_t len = 0;
+
+  if ((tokens == NULL) || (count == 0) || (buffer == NULL)) {
+    return -EINVAL;
+  }
+  if (size > CPC_PROVISION_ARGS_MAX) {
+    size = CPC_PROVISION_ARGS_MAX;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if ((tokens[i].len == 0) || (tokens[i].value == NULL)) {
+      return -EINVAL;
+    }
+    if (len + 3 + tokens[i].len + sizeof(uint32_t) > size) {
+      return -EMSGSIZE;
+    }
+    cpc_put_u16(buffer + len, tokens[i].offset);
+    buffer[len + 2] = tokens[i].len;
+    memcpy(buffer + len + 3, tokens[i].value, tokens[i].len);
+    len += 3 + tokens[i].len;
+  }
+  cpc_put_u32(buffer + len, cpc_crc32(0, buffer, len));
+  return (int) (len + sizeof(uint32_t));
+}
+
+int custom_cpc_userdata_provision(custom_cpc_t *ctx,
+                                  const custom_cpc_token_t *tokens,
+                                  size_t count,
+                                  bool *erased,
+                                  uint32_t *page_crc){
+  uint8_t args[CPC_PROVISION_ARGS_MAX];
+  uint8_t reply[2 + sizeof(uint32_t)];
+  size_t reply_len;
+  int len;
+  int ret;
+
+  len = custom_cpc_provision_encode(tokens, count, args, sizeof(args));
+  if (len < 0) {
+    return len;
+  }
+  ret = custom_cpc_transact(ctx, CPC_COMMAND_USERDATA_PROVISION, args, (size_t) len, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  return userdata_commit_reply(reply, reply_len, erased, page_crc);
+}
+
+int custom_cpc_ctune_sweep(custom_cpc_t *ctx,
+                           uint16_t start,
+                           uint16_t stop,
+                           uint16_t step,
+                           uint16_t dwell_ms,
+                           int32_t *status){
+  uint8_t args[4 * sizeof(uint16_t)];
+
+  cpc_put_u16(&args[0], start);
+  cpc_put_u16(&args[2], stop);
+  cpc_put_u16(&args[4], step);
+  cpc_put_u16(&args[6], dwell_ms);
+  return transact_status(ctx, CPC_COMMAND_CTUNE_SWEEP, args, sizeof(args), status);
+}
+
+int custom_cpc_ctune_search(custom_cpc_t *ctx, uint16_t low, uint16_t high, int32_t *status){
+  uint8_t args[2 * sizeof(uint16_t)];
+
+  cpc_put_u16(&args[0], low);
+  cpc_put_u16(&args[2], high);
+  return transact_status(ctx, CPC_COMMAND_CTUNE_SEARCH, args, sizeof(args), status);
+}
+
+int custom_cpc_ctune_feedback(custom_cpc_t *ctx, int8_t error, int32_t *status){
+  uint8_t arg = (uint8_t) error;
+  return transact_status(ctx, CPC_COMMAND_CTUNE_FEEDBACK, &arg, sizeof(arg), status);
+}
+
+int custom_cpc_ctune_stop(custom_cpc_t *ctx, int32_t *status){
+  return transact_status(ctx, CPC_COMMAND_CTUNE_STOP, NULL, 0, status);
+}
+
+int custom_cpc_decode_ctune_step(const custom_cpc_event_t *event, custom_cpc_ctune_step_t *step){
+  if ((event == NULL) || (step == NULL) || (event->opcode != CPC_EVENT_CTUNE_STEP)) {
+    return -EINVAL;
+  }
+  if (event->len < CPC_CTUNE_STEP_EVENT_SIZE) {
+    return -EPROTO;
+  }
+  step->kind = event->payload[0];
+  step->index = cpc_get_u16(&event->payload[1]);
+  step->ctune = cpc_get_u16(&event->payload[3]);
+  step->rail_status = event->payload[5];
+  step->time_ms = cpc_get_u32(&event->payload[6]);
+  return 0;
+}
+
+int custom_cpc_tone_start_params(custom_cpc_t *ctx, const custom_cpc_tone_t *tone, int32_t *status){
+  uint8_t args[CPC_TONE_ARGS_SIZE];
+
+  if (tone == NULL) {
+    return -EINVAL;
+  }
+  cpc_put_u16(&args[0], tone->channel);
+  cpc_put_u16(&args[2], (uint16_t) tone->power_ddbm);
+  args[4] = tone->mode;
+  return transact_status(ctx, CPC_COMMAND_TONE_START, args, sizeof(args), status);
+}
+
+int custom_cpc_tone_plan_encode(const custom_cpc_tone_t *tones, size_t count, uint8_t *buffer, size_t size){
+  if ((tones == NULL) || (count == 0) || (buffer == NULL)) {
+    return -EINVAL;
+  }
+  if ((count > CPC_TONE_PLAN_MAX) || (count * CPC_TONE_PLAN_ENTRY_SIZE > size)) {
+    return -EMSGSIZE;
+  }
+  for (size_t i = 0; i < count; i++) {
+    uint8_t *e = buffer + i * CPC_TONE_PLAN_ENTRY_SIZE;
+
+    cpc_put_u16(&e[0], tones[i].channel);
+    cpc_put_u16(&e[2], (uint16_t) tones[i].power_ddbm);
+    e[4] = tones[i].mode;
+    cpc_put_u16(&e[5], tones[i].duration_ms);
+  }
+  return (int) (count * CPC_TONE_PLAN_ENTRY_SIZE);
+}
+
+int custom_cpc_tone_plan(custom_cpc_t *ctx, const custom_cpc_tone_t *tones, size_t count, int32_t *status){
+  uint8_t args[CPC_TONE_PLAN_MAX * CPC_TONE_PLAN_ENTRY_SIZE];
+  int len;
+
+  len = custom_cpc_tone_plan_encode(tones, count, args, sizeof(args));
+  if (len < 0) {
+    return len;
+  }
+  return transact_status(ctx, CPC_COMMAND_TONE_PLAN, args, (size_t) len, status);
+}
+
+int custom_cpc_decode_tone_step(const custom_cpc_event_t *event, custom_cpc_tone_step_t *step){
+  if ((event == NULL) || (step == NULL) || (event->opcode != CPC_EVENT_TONE_STEP)) {
+    return -EINVAL;
+  }
+  if (event->len < CPC_TONE_STEP_EVENT_SIZE) {
+    return -EPROTO;
+  }
+  step->kind = event->payload[0];
+  step->index = event->payload[1];
+  step->tone.channel = cpc_get_u16(&event->payload[2]);
+  step->tone.power_ddbm = (int16_t) cpc_get_u16(&event->payload[4]);
+  step->tone.mode = event->payload[6];
+  step->tone.duration_ms = 0;
+  step->rail_status = event->payload[7];
+  step->time_ms = cpc_get_u32(&event->payload[8]);
+  return 0;
+}
+
+int custom_cpc_decode_device_info(const uint8_t *payload, size_t len, custom_cpc_device_info_t *info){
+  if ((payload == NULL) || (info == NULL)) {
+    return -EINVAL;
+  }
+  if (len != CPC_DEVICE_INFO_SIZE) {
+    return -EPROTO;
+  }
+  info->cust_version = cpc_get_u32(&payload[0]);
+  info->se_version = cpc_get_u32(&payload[4]);
+  info->btl_version = cpc_get_u32(&payload[8]);
+  info->app_properties_version = cpc_get_u32(&payload[12]);
+  info->ctune_token = cpc_get_u16(&payload[16]);
+  info->ctune = cpc_get_u16(&payload[18]);
+  info->family = cpc_get_u32(&payload[20]);
+  info->unique_id = (uint64_t) cpc_get_u32(&payload[24]) | ((uint64_t) cpc_get_u32(&payload[28]) << 32);
+  return 0;
+}
+
+int custom_cpc_get_device_info(custom_cpc_t *ctx, custom_cpc_device_info_t *info){
+  uint8_t reply[CPC_DEVICE_INFO_SIZE];
+  size_t reply_len;
+  int ret;
+
+  if (info == NULL) {
+    return -EINVAL;
+  }
+  ret = custom_cpc_transact(ctx, CPC_COMMAND_GET_DEVICE_INFO, NULL, 0, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    return ret;
+  }
+  return custom_cpc_decode_device_info(reply, reply_len, info);
+}
+
+int custom_cpc_decode_stats(const uint8_t *payload, size_t len, custom_cpc_stats_t *stats, uint8_t *next){
+  const uint8_t *entry;
+
+  if ((payload == NULL) || (stats == NULL) || (next == NULL)) {
+    return -EINVAL;
+  }
+  if ((len < CPC_STATS_HEADER_SIZE)
+      || (len != CPC_STATS_HEADER_SIZE + (size_t) payload[35] * CPC_STATS_ENTRY_SIZE)) {
+    return -EPROTO;
+  }
+  stats->uptime_ms = cpc_get_u32(&payload[0]);
+  stats->core_clock_hz = cpc_get_u32(&payload[4]);
+  stats->commands = cpc_get_u32(&payload[8]);
+  stats->rejected = cpc_get_u32(&payload[12]);
+  stats->write_refused = cpc_get_u32(&payload[16]);
+  stats->write_failures = cpc_get_u32(&payload[20]);
+  stats->reconnects = cpc_get_u32(&payload[24]);
+  stats->pool_acquire_failures = cpc_get_u32(&payload[28]);
+  stats->pool_high_water = payload[32];
+  stats->ring_high_water = payload[33];
+  *next = payload[34];
+  entry = &payload[CPC_STATS_HEADER_SIZE];
+  for (uint8_t i = 0; i < payload[35]; i++, entry += CPC_STATS_ENTRY_SIZE) {
+    // Commands of a newer firmware are skipped
+    if (entry[0] <= CPC_COMMAND_OPCODE_MAX) {
+      stats->opcodes[entry[0]].completed = cpc_get_u32(&entry[1]);
+      stats->opcodes[entry[0]].cycles = cpc_get_u32(&entry[5]);
+    }
+  }
+  return 0;
+}
+
+int custom_cpc_get_stats(custom_cpc_t *ctx, custom_cpc_stats_t *stats){
+  uint8_t reply[CPC_STATS_HEADER_SIZE + CPC_STATS_ENTRIES_MAX * CPC_STATS_ENTRY_SIZE];
+  size_t reply_len;
+  uint8_t first = 0;
+  int ret;
+
+  if (stats == NULL) {
+    return -EINVAL;
+  }
+  memset(stats, 0, sizeof(*stats));
+  do {
+    uint8_t next;
+
+    ret = custom_cpc_transact(ctx, CPC_COMMAND_GET_STATS, &first, sizeof(first), reply, sizeof(reply), &reply_len);
+    if (ret == 0) {
+      ret = custom_cpc_decode_stats(reply, reply_len, stats, &next);
+    }
+    if ((ret == 0) && (next != 0) && (next <= first)) {
+      ret = -EPROTO; // would never end
+    }
+    first = next;
+  } while ((ret == 0) && (first != 0));
+  return ret;
+}
+
+int custom_cpc_trace_drain(custom_cpc_t *ctx,
+                           custom_cpc_trace_record_t *records,
+                           size_t max,
+                           size_t *count,
+                           uint32_t *lost,
+                           uint32_t *core_clock_hz){
+  uint8_t reply[CPC_TRACE_DRAIN_HEADER_SIZE + CPC_TRACE_DRAIN_MAX * CPC_TRACE_RECORD_SIZE];
+  size_t reply_len;
+  uint16_t left;
+  int ret;
+
+  if ((records == NULL) || (count == NULL) || (lost == NULL) || (core_clock_hz == NULL)
+      || (max < CPC_TRACE_DRAIN_MAX)) {
+    return -EINVAL;
+  }
+  *count = 0;
+  *lost = 0;
+  *core_clock_hz = 0;
+  // Stop short of max rather than take records from the RCP we cannot keep
+  do {
+    ret = custom_cpc_transact(ctx, CPC_COMMAND_TRACE_DRAIN, NULL, 0, reply, sizeof(reply), &reply_len);
+    if (ret < 0) {
+      return ret;
+    }
+    if ((reply_len < CPC_TRACE_DRAIN_HEADER_SIZE)
+        || (reply_len != CPC_TRACE_DRAIN_HEADER_SIZE + (size_t) reply[10] * CPC_TRACE_RECORD_SIZE)
+        || (*count + reply[10] > max)) {
+      return -EPROTO;
+    }
+    *core_clock_hz = cpc_get_u32(&reply[0]);
+    *lost += cpc_get_u32(&reply[4]);
+    left = cpc_get_u16(&reply[8]);
+    for (uint8_t i = 0; i < reply[10]; i++) {
+      const uint8_t *r = &reply[CPC_TRACE_DRAIN_HEADER_SIZE + i * CPC_TRACE_RECORD_SIZE];
+      custom_cpc_trace_record_t *record = &records[*count];
+
+      record->cycles = cpc_get_u32(&r[0]);
+      // Unwrapped, records are at most one counter period apart
+      record->time_cycles = (*count == 0) ? 0 : records[*count - 1].time_cycles
+                                                + (uint32_t) (record->cycles - records[*count - 1].cycles);
+      record->id = r[4];
+      record->a = r[5];
+      record->b = cpc_get_u16(&r[6]);
+      record->c = cpc_get_u32(&r[8]);
+      (*count)++;
+    }
+  } while ((left > 0) && (reply[10] > 0) && (*count + CPC_TRACE_DRAIN_MAX <= max));
+  return 0;
+}
+
+const char *custom_cpc_trace_level(const custom_cpc_trace_record_t *record){
+  static const char *const names[] = { "off", "error", "info", "debug" };
+
+  for (size_t i = 0; i < TRACE_EVENT_COUNT; i++) {
+    if (trace_events[i].id == record->id) {
+      return names[trace_events[i].level];
+    }
+  }
+  return "?";
+}
+
+int custom_cpc_trace_format(const custom_cpc_trace_record_t *record, char *buffer, size_t size){
+  unsigned int values[3] = { 0 };
+
+  for (size_t i = 0; i < TRACE_EVENT_COUNT; i++) {
+    const struct trace_event *event = &trace_events[i];
+
+    if (event->id != record->id) {
+      continue;
+    }
+    for (size_t n = 0; (n < 3) && (event->args[n] != '\0'); n++) {
+      values[n] = (event->args[n] == 'a') ? record->a
+                  : (event->args[n] == 'b') ? record->b : record->c;
+    }
+    return snprintf(buffer, size, event->format, values[0], values[1], values[2]);
+  }
+  // Event of a newer firmware
+  return snprintf(buffer, size, "event %u: 0x%x 0x%x 0x%x", record->id, record->a, record->b, record->c);
+}
+
+void custom_cpc_stats_delta(const custom_cpc_stats_t *before, const custom_cpc_stats_t *after, custom_cpc_stats_t *delta){
+  *delta = *after;
+  delta->uptime_ms = after->uptime_ms - before->uptime_ms;
+  delta->commands = after->commands - before->commands;
+  delta->rejected = after->rejected - before->rejected;
+  delta->write_refused = after->write_refused - before->write_refused;
+  delta->write_failures = after->write_failures - before->write_failures;
+  delta->reconnects = after->reconnects - before->reconnects;
+  delta->pool_acquire_failures = after->pool_acquire_failures - before->pool_acquire_failures;
+  for (size_t i = 0; i <= CPC_COMMAND_OPCODE_MAX; i++) {
+    delta->opcodes[i].completed = after->opcodes[i].completed - before->opcodes[i].completed;
+    delta->opcodes[i].cycles = after->opcodes[i].cycles - before->opcodes[i].cycles;
+  }
+}
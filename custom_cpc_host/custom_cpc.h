@@ -0,0 +1,448 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CUSTOM_CPC_H_
+#define CUSTOM_CPC_H_
+
+/*
+ * libcustomcpc: host client library for the custom CPC commands.
+ *
+ * Each custom_cpc_t is an independent connection to one RCP, either
+ * directly through cpcd or through a daemon started with
+ * "custom_cpc_host --daemon". The library has no global state, so several
+ * connections can be used from one process. A single connection must not
+ * be used from several threads at once.
+ *
+ * All functions return 0 (or a non-negative value where documented) on
+ * success and a negative errno on failure. Nothing is printed and the
+ * library never exits the process.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "cpc_commands.h"
+#include "custom_cpc_latency.h"
+
+typedef struct custom_cpc custom_cpc_t;
+
+/*
+ * Time spent in each phase of connecting to and disconnecting from cpcd,
+ * in nanoseconds. Filled in by custom_cpc_open() and custom_cpc_close()
+ * when custom_cpc_config_t.phase_times is set. With a daemon socket only
+ * open_ns and close_ns are used.
+ */
+typedef struct {
+  uint64_t init_ns;            // cpc_init(), including retries
+  unsigned int init_attempts;
+  uint64_t open_ns;            // cpc_open_endpoint() and endpoint options
+  uint64_t close_ns;           // cpc_close_endpoint() and the wait for CLOSED
+  unsigned int close_polls;
+  uint64_t deinit_ns;          // cpc_deinit()
+} custom_cpc_phase_times_t;
+
+/*
+ * Progress of a command the RCP runs in steps (USERDATA_COMMIT and
+ * USERDATA_PROVISION, done and total in bytes of the page). Called while
+ * waiting for the reply; every progress frame also restarts the reply
+ * deadline, so slow flash work does not time out.
+ */
+typedef void (*custom_cpc_progress_t)(void *user_arg, uint8_t opcode, uint16_t done, uint16_t total);
+
+typedef struct {
+  const char *instance_name;   // cpcd instance, NULL for the default one
+  const char *socket_path;     // daemon socket, NULL to connect to cpcd directly
+  unsigned long timeout_ms;    // reply deadline of each command, from its send
+  uint8_t window_size;         // commands kept in flight, 1..CUSTOM_CPC_MAX_WINDOW
+  bool enable_tracing;         // libcpc tracing to stderr
+  bool no_close_wait;          // close without waiting for cpcd to report the endpoint
+                               // closed, for processes that exit right after
+  custom_cpc_phase_times_t *phase_times; // optional, see above
+  custom_cpc_progress_t progress;        // optional, see above
+  void *progress_arg;
+  const char *capture_path;    // optional, records every frame sent and received
+                               // to this file, see custom_cpc_capture.h
+  custom_cpc_latency_t *latency; // optional, records the time from sending each
+                                 // command to its reply, see custom_cpc_latency.h
+  unsigned int retries;        // times a command is sent again, see below
+} custom_cpc_config_t;
+
+#define CUSTOM_CPC_MAX_WINDOW 128
+
+#define CUSTOM_CPC_CONFIG_DEFAULT { \
+    .instance_name = NULL,          \
+    .socket_path = NULL,            \
+    .timeout_ms = 500,              \
+    .window_size = 1,               \
+    .enable_tracing = false,        \
+    .no_close_wait = false,         \
+    .phase_times = NULL,            \
+    .progress = NULL,               \
+    .progress_arg = NULL,           \
+    .capture_path = NULL,           \
+    .latency = NULL,                \
+    .retries = 0                    \
+}
+
+/*
+ * Completion callback for asynchronous commands. status is 0 when a reply
+ * arrived, or a negative errno (-ETIMEDOUT if none did before the
+ * deadline). A command the RCP could not run fails with -EOPNOTSUPP
+ * (unknown opcode, e.g. older firmware), -EINVAL (wrong argument length)
+ * or -EBADMSG (malformed frame). payload excludes the frame header and is
+ * only valid during the call.
+ */
+typedef void (*custom_cpc_callback_t)(void *user_arg,
+                                      int status,
+                                      uint8_t opcode,
+                                      const uint8_t *payload,
+                                      size_t len);
+
+/*
+ * Retries. A command marked CPC_RETRY_SAFE in the command table is sent
+ * again, with the same request ID, up to config.retries times when its
+ * reply deadline passes or the link to cpcd or the daemon fails, instead
+ * of failing. After a link failure the endpoint (or daemon socket) is
+ * reopened first; the RCP forgets the commands of a host that went away,
+ * so nothing else is replayed. Other commands fail as without retries,
+ * except that any command whose send fails is sent once more on the
+ * reopened link, as it never reached the RCP.
+ */
+
+int custom_cpc_open(custom_cpc_t **ctx, const custom_cpc_config_t *config);
+void custom_cpc_close(custom_cpc_t *ctx);
+
+/*
+ * Asynchronous API.
+ *
+ * custom_cpc_submit() sends a command and returns a request ID (>= 0).
+ * If the window is full it first waits for earlier replies.
+ *
+ * With a callback, the callback runs from custom_cpc_process(),
+ * custom_cpc_submit() or custom_cpc_wait() once the reply arrives and the
+ * request ID is then released. With a NULL callback the request behaves
+ * as a future: its reply is kept until custom_cpc_wait() collects it.
+ */
+int custom_cpc_submit(custom_cpc_t *ctx,
+                      uint8_t opcode,
+                      const void *args,
+                      size_t args_len,
+                      custom_cpc_callback_t callback,
+                      void *user_arg);
+
+// Same as custom_cpc_submit() with the arguments gathered from iovcnt
+// buffers, which are copied once straight into the frame
+int custom_cpc_submitv(custom_cpc_t *ctx,
+                       uint8_t opcode,
+                       const struct iovec *iov,
+                       int iovcnt,
+                       custom_cpc_callback_t callback,
+                       void *user_arg);
+
+// Waits for at most one reply (or the earliest reply deadline) and
+// dispatches it. Requests whose deadline has passed fail with -ETIMEDOUT
+// one by one, whatever else arrives. Returns the number of requests
+// completed.
+int custom_cpc_process(custom_cpc_t *ctx);
+
+/*
+ * Events: frames the RCP sends on its own (opcode with CPC_EVENT_FLAG
+ * set), such as CTUNE sweep steps. They are queued as they arrive, up to
+ * 16 (older ones are dropped), and collected with custom_cpc_wait_event(),
+ * which waits up to timeout_ms for one. Replies that arrive meanwhile are
+ * dispatched as by custom_cpc_process(). lost is the number of events the
+ * RCP sent before this one that never arrived or were dropped.
+ */
+typedef struct {
+  uint8_t opcode;
+  uint8_t seq;
+  uint8_t lost;
+  size_t len;
+  uint8_t payload[32];
+} custom_cpc_event_t;
+
+int custom_cpc_wait_event(custom_cpc_t *ctx, custom_cpc_event_t *event, unsigned long timeout_ms);
+
+// Number of requests sent and not yet completed
+unsigned int custom_cpc_pending(const custom_cpc_t *ctx);
+
+/*
+ * Waits for a future returned by custom_cpc_submit() and copies at most
+ * reply_size bytes of its payload to reply. *reply_len receives the full
+ * payload length. Returns 0 or the request's negative errno.
+ */
+int custom_cpc_wait(custom_cpc_t *ctx,
+                    int request,
+                    void *reply,
+                    size_t reply_size,
+                    size_t *reply_len);
+
+// Blocking round trip: submit + wait
+int custom_cpc_transact(custom_cpc_t *ctx,
+                        uint8_t opcode,
+                        const void *args,
+                        size_t args_len,
+                        void *reply,
+                        size_t reply_size,
+                        size_t *reply_len);
+
+/*
+ * Typed blocking calls, one per CustCpcCommand. Commands that only return
+ * a status from the RCP (RAIL_Status_t, MSC_Status_TypeDef or the lower
+ * bytes of sl_status_t, depending on the command and chip) store it,
+ * sign extended, in *status.
+ */
+int custom_cpc_get_cust_version(custom_cpc_t *ctx, uint32_t *version);
+int custom_cpc_get_se_version(custom_cpc_t *ctx, uint32_t *version);
+int custom_cpc_get_ctune_token(custom_cpc_t *ctx, uint16_t *ctune);
+int custom_cpc_set_ctune_token(custom_cpc_t *ctx, uint16_t ctune, int32_t *status);
+int custom_cpc_get_ctune_value(custom_cpc_t *ctx, uint16_t *ctune);
+int custom_cpc_set_ctune_value(custom_cpc_t *ctx, uint16_t ctune, int32_t *status);
+int custom_cpc_tone_start(custom_cpc_t *ctx, int32_t *status);
+int custom_cpc_tone_stop(custom_cpc_t *ctx, int32_t *status);
+int custom_cpc_gpio_write(custom_cpc_t *ctx, uint8_t value, int32_t *status);
+int custom_cpc_erase_userdata_page(custom_cpc_t *ctx, int32_t *status);
+int custom_cpc_get_btl_version(custom_cpc_t *ctx, uint32_t *version);
+int custom_cpc_get_app_properties_version(custom_cpc_t *ctx, uint32_t *version);
+
+/*
+ * USERDATA page transfers. Data is split into CPC_USERDATA_CHUNK_MAX byte
+ * chunks, each checked with cpc_crc32(), and up to window_size chunks are
+ * kept in flight. Errors reported by the RCP map to -ERANGE (outside the
+ * page), -EBADMSG (corrupted chunk) or -EIO (flash error).
+ *
+ * custom_cpc_userdata_stage() only fills the RCP's RAM copy of the page;
+ * custom_cpc_userdata_commit() programs it, erasing the page at most once
+ * and only when a changed word is not blank, then verifies it.
+ * *erased and *page_crc (both optional) report whether the page was
+ * erased and the CRC of the whole page. custom_cpc_userdata_write() does
+ * abort + stage + commit and discards the staged data on failure.
+ */
+int custom_cpc_userdata_read(custom_cpc_t *ctx, uint16_t offset, void *data, size_t len);
+int custom_cpc_userdata_stage(custom_cpc_t *ctx, uint16_t offset, const void *data, size_t len);
+int custom_cpc_userdata_commit(custom_cpc_t *ctx, bool *erased, uint32_t *page_crc);
+int custom_cpc_userdata_abort(custom_cpc_t *ctx);
+int custom_cpc_userdata_write(custom_cpc_t *ctx, uint16_t offset, const void *data, size_t len, bool *erased);
+
+/*
+ * Provisioning: several tokens written with a single USERDATA_PROVISION
+ * command. The RCP merges them into a copy of the page and commits it
+ * like custom_cpc_userdata_commit(), so every other value in the page is
+ * kept, and replies with one status. Nothing is written if any token is
+ * outside the page (-ERANGE).
+ *
+ * custom_cpc_provision_encode() builds the command arguments into buffer
+ * and returns their length, or -EMSGSIZE if they exceed
+ * CPC_PROVISION_ARGS_MAX or size.
+ */
+typedef struct {
+  uint16_t offset;    // in the USERDATA page
+  uint8_t len;        // 1..255
+  const void *value;
+} custom_cpc_token_t;
+
+int custom_cpc_provision_encode(const custom_cpc_token_t *tokens, size_t count, uint8_t *buffer, size_t size);
+int custom_cpc_userdata_provision(custom_cpc_t *ctx,
+                                  const custom_cpc_token_t *tokens,
+                                  size_t count,
+                                  bool *erased,
+                                  uint32_t *page_crc);
+
+/*
+ * CTUNE calibration (see CTUNE_SWEEP in cpc_commands.h). *status is an
+ * enum CpcCtuneSweepStatus. Each step is reported by a CPC_EVENT_CTUNE_STEP
+ * event, decoded by custom_cpc_decode_ctune_step(); the last one has kind
+ * CPC_CTUNE_STEP_DONE, _ABORTED or _ERROR.
+ */
+typedef struct {
+  uint8_t kind;         // enum CpcCtuneStepKind
+  uint16_t index;
+  uint16_t ctune;
+  uint8_t rail_status;
+  uint32_t time_ms;     // RCP sleeptimer time
+} custom_cpc_ctune_step_t;
+
+int custom_cpc_ctune_sweep(custom_cpc_t *ctx,
+                           uint16_t start,
+                           uint16_t stop,
+                           uint16_t step,
+                           uint16_t dwell_ms,
+                           int32_t *status);
+int custom_cpc_ctune_search(custom_cpc_t *ctx, uint16_t low, uint16_t high, int32_t *status);
+int custom_cpc_ctune_feedback(custom_cpc_t *ctx, int8_t error, int32_t *status);
+int custom_cpc_ctune_stop(custom_cpc_t *ctx, int32_t *status);
+int custom_cpc_decode_ctune_step(const custom_cpc_event_t *event, custom_cpc_ctune_step_t *step);
+
+/*
+ * Transmit tests (see TONE_START and TONE_PLAN in cpc_commands.h).
+ * custom_cpc_tone_start() above keeps the firmware defaults;
+ * custom_cpc_tone_start_params() sets the channel, power (deci-dBm, or
+ * CPC_TONE_POWER_UNCHANGED) and stream mode (RAIL_StreamMode_t), and
+ * *status is the RAIL status. custom_cpc_tone_plan() plays up to
+ * CPC_TONE_PLAN_MAX tones, each for duration_ms, and *status is an enum
+ * CpcCtuneSweepStatus. Each tone is reported by a CPC_EVENT_TONE_STEP
+ * event, decoded by custom_cpc_decode_tone_step(); the last one has kind
+ * CPC_CTUNE_STEP_DONE, _ABORTED or _ERROR. custom_cpc_tone_stop() aborts.
+ *
+ * custom_cpc_tone_plan_encode() builds the TONE_PLAN arguments into
+ * buffer and returns their length, or -EMSGSIZE if the plan is too long
+ * for size or CPC_TONE_PLAN_MAX.
+ */
+typedef struct {
+  uint16_t channel;
+  int16_t power_ddbm;
+  uint8_t mode;
+  uint16_t duration_ms; // plan entries only
+} custom_cpc_tone_t;
+
+typedef struct {
+  uint8_t kind;         // enum CpcCtuneStepKind
+  uint8_t index;        // plan entry
+  custom_cpc_tone_t tone;
+  uint8_t rail_status;
+  uint32_t time_ms;     // RCP sleeptimer time
+} custom_cpc_tone_step_t;
+
+int custom_cpc_tone_start_params(custom_cpc_t *ctx, const custom_cpc_tone_t *tone, int32_t *status);
+int custom_cpc_tone_plan_encode(const custom_cpc_tone_t *tones, size_t count, uint8_t *buffer, size_t size);
+int custom_cpc_tone_plan(custom_cpc_t *ctx, const custom_cpc_tone_t *tones, size_t count, int32_t *status);
+int custom_cpc_decode_tone_step(const custom_cpc_event_t *event, custom_cpc_tone_step_t *step);
+
+/*
+ * Inventory: everything the version and CTUNE getters return, plus the
+ * chip family and unique ID, in one round trip. custom_cpc_decode_device_info()
+ * decodes a GET_DEVICE_INFO reply collected with the asynchronous API.
+ */
+typedef struct {
+  uint32_t cust_version;
+  uint32_t se_version;          // 0 if the SE did not answer
+  uint32_t btl_version;
+  uint32_t app_properties_version;
+  uint16_t ctune_token;
+  uint16_t ctune;
+  uint32_t family;              // SYSTEM_PartFamily_TypeDef
+  uint64_t unique_id;
+} custom_cpc_device_info_t;
+
+int custom_cpc_get_device_info(custom_cpc_t *ctx, custom_cpc_device_info_t *info);
+int custom_cpc_decode_device_info(const uint8_t *payload, size_t len, custom_cpc_device_info_t *info);
+
+/*
+ * Runtime statistics (see GET_STATS in cpc_commands.h).
+ * custom_cpc_get_stats() collects every per-opcode entry, in more than one
+ * round trip if they do not fit a reply. custom_cpc_decode_stats() decodes
+ * one GET_STATS reply into stats, adding its entries to those already
+ * there; *next receives the first opcode to ask for next, 0 when done.
+ *
+ * custom_cpc_stats_delta() sets delta to after - before: counters modulo
+ * 2^32, so a counter that wrapped once in between is still right, and the
+ * high water marks and core clock as in after.
+ */
+typedef struct {
+  uint32_t completed; // commands run to their reply
+  uint32_t cycles;    // handler time in core clock cycles
+} custom_cpc_opcode_stats_t;
+
+typedef struct {
+  uint32_t uptime_ms;
+  uint32_t core_clock_hz;
+  uint32_t commands;
+  uint32_t rejected;
+  uint32_t write_refused;
+  uint32_t write_failures;
+  uint32_t reconnects;
+  uint32_t pool_acquire_failures;
+  uint8_t pool_high_water;
+  uint8_t ring_high_water;
+  custom_cpc_opcode_stats_t opcodes[CPC_COMMAND_OPCODE_MAX + 1]; // by opcode
+} custom_cpc_stats_t;
+
+int custom_cpc_get_stats(custom_cpc_t *ctx, custom_cpc_stats_t *stats);
+int custom_cpc_decode_stats(const uint8_t *payload, size_t len, custom_cpc_stats_t *stats, uint8_t *next);
+void custom_cpc_stats_delta(const custom_cpc_stats_t *before, const custom_cpc_stats_t *after, custom_cpc_stats_t *delta);
+
+/*
+ * RCP trace (see TRACE_DRAIN in cpc_commands.h). custom_cpc_trace_drain()
+ * moves the records of the RCP trace ring into records, oldest first, in
+ * as many round trips as needed, stopping early rather than take more than
+ * max (at least CPC_TRACE_DRAIN_MAX). *count receives their number, *lost the records the RCP wrote over
+ * before they were drained, *core_clock_hz the clock of their times.
+ * time_cycles counts from the first record returned, assuming records are
+ * less than 2^32 cycles apart.
+ *
+ * custom_cpc_trace_format() writes the message of a record into buffer as
+ * snprintf() does; custom_cpc_trace_level() returns its level, "error",
+ * "info" or "debug", or "?" for an event this library does not know.
+ */
+typedef struct {
+  uint32_t cycles;       // RCP cycle counter when written
+  uint64_t time_cycles;  // unwrapped, since the first record of the drain
+  uint8_t id;            // enum CpcTraceEvent
+  uint8_t a;
+  uint16_t b;
+  uint32_t c;
+} custom_cpc_trace_record_t;
+
+int custom_cpc_trace_drain(custom_cpc_t *ctx,
+                           custom_cpc_trace_record_t *records,
+                           size_t max,
+                           size_t *count,
+                           uint32_t *lost,
+                           uint32_t *core_clock_hz);
+int custom_cpc_trace_format(const custom_cpc_trace_record_t *record, char *buffer, size_t size);
+const char *custom_cpc_trace_level(const custom_cpc_trace_record_t *record);
+
+// Decodes a little endian reply payload of up to 4 bytes, sign extended
+int32_t custom_cpc_decode_status(const uint8_t *payload, size_t len);
+
+/*
+ * Command descriptors, generated from CPC_COMMAND_TABLE in cpc_commands.h.
+ * custom_cpc_submit() rejects known commands whose arguments do not have
+ * the table's request length (unless it is CPC_ARGS_VARIABLE), and fails replies longer than reply_max
+ * with -EPROTO. Unknown opcodes are passed through unchecked.
+ */
+typedef struct {
+  uint8_t opcode;
+  uint8_t request_len;
+  uint8_t reply_max;
+  bool retry_safe;   // CPC_RETRY_SAFE, see config.retries
+  const char *name;  // command line option / script command
+  const char *help;  // lines separated by \n
+} custom_cpc_command_info_t;
+
+// All known commands in opcode order, *count receives their number
+const custom_cpc_command_info_t *custom_cpc_commands(size_t *count);
+
+// NULL if the opcode or name is not in the table
+const custom_cpc_command_info_t *custom_cpc_command_info(uint8_t opcode);
+const custom_cpc_command_info_t *custom_cpc_command_find(const char *name);
+
+#endif /* CUSTOM_CPC_H_ */
@@ -0,0 +1,204 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_cache.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "custom_cpc_cache.h"
+
+#define CACHE_MAGIC "custom_cpc_cache 1"
+
+static const char *instanceName(const char *instance_name){
+  return (instance_name != NULL) ? instance_name : CUSTOM_CPC_DEFAULT_INSTANCE;
+}
+
+static int entryPath(char *path, size_t size, const char *dir, const char *instance_name, const char *suffix){
+  int len;
+
+  if ((dir == NULL) || (strchr(instanceName(instance_name), '/') != NULL)) {
+    return -EINVAL;
+  }
+  len = snprintf(path, size, "%s/%s.cache%s", dir, instanceName(instance_name), suffix);
+  return ((len < 0) || ((size_t) len >= size)) ? -ENAMETOOLONG : 0;
+}
+
+int custom_cpc_cache_stamp(const char *socket_folder, const char *instance_name, custom_cpc_cache_stamp_t *stamp){
+  char path[PATH_MAX];
+  struct stat st;
+  int len;
+
+  if (stamp == NULL) {
+    return -EINVAL;
+  }
+  len = snprintf(path, sizeof(path), "%s/cpcd/%s/ctrl.cpcd.sock",
+                 (socket_folder != NULL) ? socket_folder : CUSTOM_CPC_SOCKET_FOLDER,
+                 instanceName(instance_name));
+  if ((len < 0) || ((size_t) len >= sizeof(path))) {
+    return -ENAMETOOLONG;
+  }
+  if (stat(path, &st) != 0) {
+    return -errno;
+  }
+  stamp->dev = (uint64_t) st.st_dev;
+  stamp->ino = (uint64_t) st.st_ino;
+  stamp->mtime_ns = (uint64_t) st.st_mtim.tv_sec * 1000000000ull + (uint64_t) st.st_mtim.tv_nsec;
+  return 0;
+}
+
+int custom_cpc_cache_load(const char *dir,
+                          const char *instance_name,
+                          const custom_cpc_cache_stamp_t *stamp,
+                          custom_cpc_device_info_t *info){
+  custom_cpc_cache_stamp_t saved;
+  char path[PATH_MAX];
+  char magic[32];
+  unsigned long long unique_id;
+  FILE *f;
+  int ret;
+
+  if ((stamp == NULL) || (info == NULL)) {
+    return -EINVAL;
+  }
+  ret = entryPath(path, sizeof(path), dir, instance_name, "");
+  if (ret < 0) {
+    return ret;
+  }
+  f = fopen(path, "r");
+  if (f == NULL) {
+    return -errno;
+  }
+  memset(info, 0, sizeof(*info));
+  ret = fscanf(f, "%31[^\n] stamp %" SCNu64 " %" SCNu64 " %" SCNu64
+                  " cust_version %" SCNx32 " se_version %" SCNx32 " btl_version %" SCNx32
+                  " app_properties_version %" SCNx32 " family %" SCNx32 " unique_id %llx",
+               magic, &saved.dev, &saved.ino, &saved.mtime_ns,
+               &info->cust_version, &info->se_version, &info->btl_version,
+               &info->app_properties_version, &info->family, &unique_id);
+  fclose(f);
+  if ((ret != 10) || (strcmp(magic, CACHE_MAGIC) != 0)) {
+    return -ENOENT; // not written by this version, treat as missing
+  }
+  info->unique_id = (uint64_t) unique_id;
+  if ((saved.dev != stamp->dev) || (saved.ino != stamp->ino) || (saved.mtime_ns != stamp->mtime_ns)) {
+    return -ESTALE;
+  }
+  return 0;
+}
+
+int custom_cpc_cache_store(const char *dir,
+                           const char *instance_name,
+                           const custom_cpc_cache_stamp_t *stamp,
+                           const custom_cpc_device_info_t *info){
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+  char suffix[32];
+  FILE *f;
+  int ret;
+
+  if ((stamp == NULL) || (info == NULL)) {
+    return -EINVAL;
+  }
+  snprintf(suffix, sizeof(suffix), ".%ld", (long) getpid());
+  ret = entryPath(path, sizeof(path), dir, instance_name, "");
+  if (ret == 0) {
+    ret = entryPath(tmp, sizeof(tmp), dir, instance_name, suffix);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+    return -errno;
+  }
+
+  // Written aside and renamed, so readers never see half an entry
+  f = fopen(tmp, "w");
+  if (f == NULL) {
+    return -errno;
+  }
+  fprintf(f, "%s\nstamp %" PRIu64 " %" PRIu64 " %" PRIu64 "\n"
+             "cust_version 0x%08" PRIx32 "\nse_version 0x%08" PRIx32 "\nbtl_version 0x%08" PRIx32 "\n"
+             "app_properties_version 0x%08" PRIx32 "\nfamily 0x%08" PRIx32 "\nunique_id 0x%016llx\n",
+          CACHE_MAGIC, stamp->dev, stamp->ino, stamp->mtime_ns,
+          info->cust_version, info->se_version, info->btl_version,
+          info->app_properties_version, info->family, (unsigned long long) info->unique_id);
+  if (ferror(f)) {
+    fclose(f);
+    unlink(tmp);
+    return -EIO;
+  }
+  if (fclose(f) != 0) {
+    ret = -errno;
+    unlink(tmp);
+    return ret;
+  }
+  if (rename(tmp, path) != 0) {
+    ret = -errno;
+    unlink(tmp);
+    return ret;
+  }
+  return 0;
+}
+
+int custom_cpc_cache_remove(const char *dir, const char *instance_name){
+  char path[PATH_MAX];
+  int ret = entryPath(path, sizeof(path), dir, instance_name, "");
+
+  if (ret < 0) {
+    return ret;
+  }
+  return ((unlink(path) != 0) && (errno != ENOENT)) ? -errno : 0;
+}
+
+size_t custom_cpc_cache_reply(const custom_cpc_device_info_t *info, uint8_t opcode, uint8_t *reply){
+  uint32_t value;
+
+  switch (opcode) {
+    case CPC_COMMAND_GET_CUST_VERSION:
+      value = info->cust_version;
+      break;
+    case CPC_COMMAND_GET_SE_VERSION:
+      value = info->se_version;
+      break;
+    case CPC_COMMAND_GET_BTL_VERSION:
+      value = info->btl_version;
+      break;
+    case CPC_COMMAND_GET_APP_PROPERTIES_VERSION:
+      value = info->app_properties_version;
+      break;
+    default:
+      return 0;
+  }
+  cpc_put_u32(reply, value);
+  return sizeof(uint32_t);
+}
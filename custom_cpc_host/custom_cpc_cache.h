@@ -0,0 +1,89 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_cache.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CUSTOM_CPC_CACHE_H_
+#define CUSTOM_CPC_CACHE_H_
+
+/*
+ * On-disk cache of the RCP properties that only change when the RCP is
+ * reflashed: the four versions, the chip family and the unique ID, as
+ * returned by GET_DEVICE_INFO. There is one entry per cpcd instance,
+ * a small text file <dir>/<instance>.cache.
+ *
+ * An entry is stamped with the identity (device, inode, mtime) of the
+ * control socket cpcd creates when it starts. cpcd exits when the
+ * secondary resets, which a reflash always does, and creates a new socket
+ * when it is started again, so an entry with another stamp is stale.
+ * Callers that talk to the RCP anyway should also compare its replies
+ * with the entry and remove it if they differ.
+ */
+
+#include <stdint.h>
+#include "custom_cpc.h"
+
+// socket_folder of cpcd.conf
+#ifndef CUSTOM_CPC_SOCKET_FOLDER
+#define CUSTOM_CPC_SOCKET_FOLDER "/dev/shm"
+#endif
+
+// Instance name cpcd uses when none is configured
+#define CUSTOM_CPC_DEFAULT_INSTANCE "cpcd_0"
+
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t mtime_ns;
+} custom_cpc_cache_stamp_t;
+
+// Stamp of the running cpcd instance. NULL socket_folder or instance_name
+// for the defaults. -ENOENT if cpcd is not running.
+int custom_cpc_cache_stamp(const char *socket_folder, const char *instance_name, custom_cpc_cache_stamp_t *stamp);
+
+// Returns 0 and fills in info (ctune fields 0) if the entry has the given
+// stamp, -ENOENT if there is none, -ESTALE if it was written for another
+// cpcd run.
+int custom_cpc_cache_load(const char *dir,
+                          const char *instance_name,
+                          const custom_cpc_cache_stamp_t *stamp,
+                          custom_cpc_device_info_t *info);
+
+// Replaces the entry, creating dir if needed
+int custom_cpc_cache_store(const char *dir,
+                           const char *instance_name,
+                           const custom_cpc_cache_stamp_t *stamp,
+                           const custom_cpc_device_info_t *info);
+
+int custom_cpc_cache_remove(const char *dir, const char *instance_name);
+
+// Builds the reply the RCP would send to opcode from a cached entry.
+// Returns its length, or 0 if opcode is not answered from the cache.
+size_t custom_cpc_cache_reply(const custom_cpc_device_info_t *info, uint8_t opcode, uint8_t *reply);
+
+#endif /* CUSTOM_CPC_CACHE_H_ */
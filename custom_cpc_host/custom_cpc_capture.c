@@ -0,0 +1,229 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_capture.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cpc_frame.h"
+#include "custom_cpc_capture.h"
+
+struct custom_cpc_capture {
+  int fd;
+  int error;     // first write error, records are dropped after it
+  size_t used;
+  uint8_t buffer[CUSTOM_CPC_CAPTURE_BUFFER_SIZE];
+};
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void put_u64(uint8_t *p, uint64_t value){
+  cpc_put_u32(p, (uint32_t) value);
+  cpc_put_u32(p + 4, (uint32_t) (value >> 32));
+}
+
+static uint64_t get_u64(const uint8_t *p){
+  return (uint64_t) cpc_get_u32(p) | ((uint64_t) cpc_get_u32(p + 4) << 32);
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len){
+  while (len > 0) {
+    ssize_t ret = write(fd, data, len);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    data += ret;
+    len -= (size_t) ret;
+  }
+  return 0;
+}
+
+static int flush(custom_cpc_capture_t *cap){
+  if ((cap->error == 0) && (cap->used > 0)) {
+    cap->error = write_all(cap->fd, cap->buffer, cap->used);
+  }
+  cap->used = 0;
+  return cap->error;
+}
+
+int custom_cpc_capture_open(custom_cpc_capture_t **cap, const char *path){
+  custom_cpc_capture_t *c;
+
+  if ((cap == NULL) || (path == NULL)) {
+    return -EINVAL;
+  }
+  c = malloc(sizeof(*c));
+  if (c == NULL) {
+    return -ENOMEM;
+  }
+  c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (c->fd < 0) {
+    int ret = -errno;
+    free(c);
+    return ret;
+  }
+  c->error = 0;
+  memcpy(c->buffer, CUSTOM_CPC_CAPTURE_MAGIC, 4);
+  c->buffer[4] = CUSTOM_CPC_CAPTURE_VERSION;
+  memset(&c->buffer[5], 0, 3);
+  c->used = CUSTOM_CPC_CAPTURE_HEADER_SIZE;
+  *cap = c;
+  return 0;
+}
+
+int custom_cpc_capture_frame(custom_cpc_capture_t *cap, uint8_t direction, const uint8_t *frame, size_t len){
+  uint8_t header[CUSTOM_CPC_CAPTURE_RECORD_SIZE];
+
+  if ((cap == NULL) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+  if (cap->error != 0) {
+    return cap->error;
+  }
+  put_u64(header, now_ns());
+  header[8] = direction;
+  header[9] = 0;
+  cpc_put_u16(&header[10], (uint16_t) len);
+
+  if (cap->used + sizeof(header) + len > sizeof(cap->buffer)) {
+    if (flush(cap) < 0) {
+      return cap->error;
+    }
+  }
+  if (sizeof(header) + len > sizeof(cap->buffer)) {
+    // Larger than the whole buffer: straight to the file, after the
+    // records flushed above
+    cap->error = write_all(cap->fd, header, sizeof(header));
+    if (cap->error == 0) {
+      cap->error = write_all(cap->fd, frame, len);
+    }
+    return cap->error;
+  }
+  memcpy(&cap->buffer[cap->used], header, sizeof(header));
+  memcpy(&cap->buffer[cap->used + sizeof(header)], frame, len);
+  cap->used += sizeof(header) + len;
+  return 0;
+}
+
+int custom_cpc_capture_close(custom_cpc_capture_t *cap){
+  int ret;
+
+  if (cap == NULL) {
+    return 0;
+  }
+  ret = flush(cap);
+  if ((close(cap->fd) < 0) && (ret == 0)) {
+    ret = -errno;
+  }
+  free(cap);
+  return ret;
+}
+
+int custom_cpc_capture_read_open(custom_cpc_capture_reader_t *reader, const char *path){
+  struct stat st;
+  void *data;
+  int fd;
+
+  if ((reader == NULL) || (path == NULL)) {
+    return -EINVAL;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  if (fstat(fd, &st) < 0) {
+    int ret = -errno;
+    close(fd);
+    return ret;
+  }
+  if ((size_t) st.st_size < CUSTOM_CPC_CAPTURE_HEADER_SIZE) {
+    close(fd);
+    return -EBADMSG;
+  }
+  data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -errno;
+  }
+  reader->data = data;
+  reader->size = (size_t) st.st_size;
+  reader->offset = CUSTOM_CPC_CAPTURE_HEADER_SIZE;
+  if ((memcmp(reader->data, CUSTOM_CPC_CAPTURE_MAGIC, 4) != 0)
+      || (reader->data[4] != CUSTOM_CPC_CAPTURE_VERSION)) {
+    custom_cpc_capture_read_close(reader);
+    return -EBADMSG;
+  }
+  return 0;
+}
+
+int custom_cpc_capture_next(custom_cpc_capture_reader_t *reader, custom_cpc_capture_record_t *record){
+  const uint8_t *p;
+  size_t left;
+
+  if ((reader == NULL) || (reader->data == NULL) || (record == NULL)) {
+    return -EINVAL;
+  }
+  left = reader->size - reader->offset;
+  if (left == 0) {
+    return 0;
+  }
+  p = reader->data + reader->offset;
+  if ((left < CUSTOM_CPC_CAPTURE_RECORD_SIZE)
+      || (left - CUSTOM_CPC_CAPTURE_RECORD_SIZE < cpc_get_u16(&p[10]))) {
+    return -EBADMSG;
+  }
+  record->time_ns = get_u64(p);
+  record->direction = p[8];
+  record->len = cpc_get_u16(&p[10]);
+  record->frame = p + CUSTOM_CPC_CAPTURE_RECORD_SIZE;
+  reader->offset += CUSTOM_CPC_CAPTURE_RECORD_SIZE + record->len;
+  return 1;
+}
+
+void custom_cpc_capture_read_close(custom_cpc_capture_reader_t *reader){
+  if ((reader == NULL) || (reader->data == NULL)) {
+    return;
+  }
+  munmap((void *) reader->data, reader->size);
+  reader->data = NULL;
+  reader->size = 0;
+}
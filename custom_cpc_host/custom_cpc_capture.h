@@ -0,0 +1,103 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_capture.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CUSTOM_CPC_CAPTURE_H_
+#define CUSTOM_CPC_CAPTURE_H_
+
+/*
+ * Capture file of the frames exchanged with the RCP, written by the
+ * library when custom_cpc_config_t.capture_path is set and read back by
+ * cpc_replay.
+ *
+ * The file starts with an 8-byte header: "CPCC", the format version and
+ * 3 reserved bytes. Each record follows as a 12-byte header, time_ns u64
+ * (CLOCK_MONOTONIC), direction u8, reserved u8 and len u16, then the len
+ * bytes of the frame as sent or received, CPC frame header included. All
+ * integers are little endian.
+ *
+ * The writer copies each record into a memory buffer and only writes it
+ * to the file when the buffer is full and on close, so capturing adds a
+ * copy and a clock read per frame to the command path.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CUSTOM_CPC_CAPTURE_MAGIC "CPCC"
+#define CUSTOM_CPC_CAPTURE_VERSION 1
+#define CUSTOM_CPC_CAPTURE_HEADER_SIZE 8
+#define CUSTOM_CPC_CAPTURE_RECORD_SIZE 12
+
+// Bytes kept in memory before a write to the file
+#ifndef CUSTOM_CPC_CAPTURE_BUFFER_SIZE
+#define CUSTOM_CPC_CAPTURE_BUFFER_SIZE 65536
+#endif
+
+enum CustomCpcCaptureDirection {
+  CUSTOM_CPC_CAPTURE_TX = 0, // host to RCP
+  CUSTOM_CPC_CAPTURE_RX = 1  // RCP to host
+};
+
+typedef struct custom_cpc_capture custom_cpc_capture_t;
+
+typedef struct {
+  uint64_t time_ns;
+  uint8_t direction;    // enum CustomCpcCaptureDirection
+  uint16_t len;
+  const uint8_t *frame; // into the mapped file
+} custom_cpc_capture_record_t;
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+} custom_cpc_capture_reader_t;
+
+// Creates (or truncates) the file at path
+int custom_cpc_capture_open(custom_cpc_capture_t **cap, const char *path);
+
+// Adds one frame, timestamped now. Once a write to the file has failed,
+// the records are dropped and the error is returned by every call.
+int custom_cpc_capture_frame(custom_cpc_capture_t *cap, uint8_t direction, const uint8_t *frame, size_t len);
+
+// Writes out the buffer and closes the file. Returns the first write
+// error, if any.
+int custom_cpc_capture_close(custom_cpc_capture_t *cap);
+
+// Maps a capture file for reading. -EBADMSG if it is not one.
+int custom_cpc_capture_read_open(custom_cpc_capture_reader_t *reader, const char *path);
+
+// Returns 1 and fills in record, 0 at the end of the file, or -EBADMSG
+// if the last record is cut short (a capture whose writer was killed).
+int custom_cpc_capture_next(custom_cpc_capture_reader_t *reader, custom_cpc_capture_record_t *record);
+
+void custom_cpc_capture_read_close(custom_cpc_capture_reader_t *reader);
+
+#endif /* CUSTOM_CPC_CAPTURE_H_ */
@@ -27,14 +27,24 @@
  * 3. This notice may not be removed or altered from any source distribution.
  *
  ******************************************************************************/
-#include "sl_cpc.h"
 #include <stdlib.h>
+#include <limits.h>
 #include <time.h>
 #include <getopt.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "string.h"
 #include "cpc_commands.h"
+#include "custom_cpc.h"
+#include "custom_cpc_cache.h"
+#include "cpc_daemon.h"
 
 #ifndef DEBUG
 #define DEBUG 0
@@ -53,49 +63,83 @@
 
 #define OPTSTRING "hv"
 
-static struct option long_options[] = {
+// Options that are not RCP commands. The commands are added from
+// CPC_COMMAND_TABLE at start-up, see buildOptions().
+static const struct option host_options[] = {
      {"help",       no_argument,       0,  'h' },
-     {"cust_version",     no_argument, 0,  'a' },
-     {"se_version",      no_argument, 0,  'b' },
-     {"get_ctune_token",  no_argument, 0,  'c' },
-     {"set_ctune_token",     required_argument, 0,  'd' },
-     {"get_ctune_value",      no_argument, 0,  'e' },
-     {"set_ctune_value",  required_argument, 0, 'f' },
-     {"tone_start",  no_argument, 0,  'g' },
-     {"tone_stop",  no_argument, 0,  'i' },
-     {"gpio_write",  required_argument, 0,  'j' },
-     {"erase_userdata_page",  no_argument, 0,  'k' },
      {"version", no_argument, 0, 'v'},
-     {"btl_version", no_argument, 0, 'l'},
-     {"app_properties_version", no_argument, 0, 'm'},
+     {"timeout_ms", required_argument, 0, 't'},
+     {"script", required_argument, 0, 's'},
+     {"window", required_argument, 0, 'w'},
+     {"daemon", required_argument, 0, 'n'},
+     {"socket", required_argument, 0, 'o'},
+     {"instances", required_argument, 0, 'p'},
+     {"no_close_wait", no_argument, 0, 'q'},
+     {"userdata_read", required_argument, 0, 'r'},
+     {"userdata_write", required_argument, 0, 'u'},
+     {"cache", required_argument, 0, 'c'},
+     {"socket_folder", required_argument, 0, 'f'},
+     {"progress", no_argument, 0, 'g'},
+     {"capture", required_argument, 0, 'a'},
+     {"latency", no_argument, 0, 'l'},
+     {"slo", required_argument, 0, 'e'},
+     {"slo_window_ms", required_argument, 0, 'm'},
+     {"retries", required_argument, 0, 'y'},
      {0,           0,                 0,  0  }};
 
-#define HELP_MESSAGE \
+// getopt value of a command option: COMMAND_OPT_BASE + opcode
+#define COMMAND_OPT_BASE 0x100
+
+#define HOST_OPTION_COUNT (sizeof(host_options) / sizeof(host_options[0]))
+#define MAX_COMMAND_OPTIONS (CPC_COMMAND_OPCODE_MAX + 1)
+
+static struct option long_options[MAX_COMMAND_OPTIONS + HOST_OPTION_COUNT];
+
+#define HELP_HEADER \
 "./custom_cpc_host <arguments>\n"\
 "                                   \n"\
 "ARGUMENTS: \n"\
 "--help        \n" \
 "-h                         Prints help message.\n"\
-"--cust_version             Returns 32-but customer version defined in the RCP firmware application (CUSTOMER_VERSION).\n"\
-"--se_version               Returns the Secure Element version on the series 2 device running the RCP firmware. \n"\
-"--get_ctune_token          Reads the CTUNE manufacturing token stored in userdata flash on the RCP target. This is a 16-bit value and will \n"\
-"                             be FF FF when not already flashed/programmed \n"\
-"--set_ctune_token <value>  Writes the CTUNE manufacturing token stored in userdata flash on the RCP target. Note that if the CTUNE \n"\
-"                             manufacturing token is already written, this call will fail as the value can only be written if blank. \n"\
-"--get_ctune_value          Reads the CTUNE register value currently set in firmware running on the RCP target. This is a 16-bit value\n"\
-"--set_ctune_value <value>  Sets the CTUNE register value in firmware running on the RCP target. This is a 16-bit value\n"\
-"                             NOTE: The radio needs to be in idle mode for this command to succeeed\n"\
-"--gpio_write <value>       Writes the value of the GPIO pins(s) as determined by the RCP firmware. In the example firmware, \n"\
-"                             value=\"1\" turns on the LED on the BRD4181B and value=\"0\" turns it off.\n"\
-"--erase_userdata_page      Erase the page on the RCP device containing the manfacturing tokens, including the CTUNE manufacturing token. \n"\
-"                             This allows a previously written CTUNE manufacturing token to be written to a new value.\n"\
-"                             WARNING - any other values stored in the userdata page will also be erased, so use caution\n"\
-"--tone_start               Enable a CW tone on the transmitter of the RCP at the 802.15.4 channel defined in the RCP firmware and at\n"\
-"                             a default power level. \n"\
-"--tone_stop                Disable the CW tone on the transmitter of the RCP.\n"\
+
+#define HELP_MESSAGE \
 "--version                  Prints the version of the host application.\n"\
-"--btl_version              Gets the bootloader version running on the RCP target.\n"\
-"--app_properties_version   Gets the app version from the Application_Properties_t struct of the RCP application.\n"\
+"--timeout_ms <value>       Maximum time in milliseconds to wait for the reply to each command (default 500).\n"\
+"--retries <value>          Times a command that is safe to repeat (reads, set_ctune_value, gpio_write, ...) is sent\n"\
+"                             again when its reply does not come in time or the link to cpcd is lost (default 0).\n"\
+"                             The link is reopened first if it was lost.\n"\
+"--script <file>            Reads commands from a file (or stdin if <file> is \"-\"), one per line, using the option names\n"\
+"                             above without the leading \"--\" (e.g. \"set_ctune_value 0x50\"). Lines starting with # are ignored.\n"\
+"--window <value>           Number of commands sent to the RCP before waiting for their replies (default 1, max 128).\n"\
+"--daemon <path>            Runs as a daemon that keeps the CPC endpoint open and serves commands from local clients\n"\
+"                             on the Unix socket <path>. Reconnects automatically if cpcd restarts. Commands the RCP\n"\
+"                             does not answer within --timeout_ms are failed with a timeout.\n"\
+"--socket <path>            Sends the commands through a daemon listening on <path> instead of connecting to cpcd.\n"\
+"--instances <a,b,...>      Runs the commands on every listed cpcd instance in parallel, one RCP per instance.\n"\
+"                             Each reply line is prefixed with [instance].\n"\
+"--userdata_read <offset>,<length>[,<file>]\n"\
+"                           Reads <length> bytes of the USERDATA page starting at <offset>, into <file> if given\n"\
+"                             (suffixed with .<instance> with --instances) or else printed in hex.\n"\
+"--userdata_write <offset>,<file>\n"\
+"                           Writes the content of <file> to the USERDATA page at <offset>. The page is erased at\n"\
+"                             most once, only if needed, and verified after programming.\n"\
+"--no_close_wait            Exits without waiting for cpcd to report the endpoint closed. Saves up to a few hundred\n"\
+"                             milliseconds, but a command run right after may find the endpoint still closing.\n"\
+"--cache <dir>              Answers cust_version, se_version, btl_version and app_properties_version from a cache in\n"\
+"                             <dir>, one file per cpcd instance, without connecting to the RCP. The cache is refreshed\n"\
+"                             when cpcd has restarted (as it does when the RCP resets or is reflashed).\n"\
+"--socket_folder <path>     socket_folder set in cpcd.conf (default /dev/shm), used by --cache to detect cpcd restarts.\n"\
+"--progress                 Prints the progress of the flash work of provision and userdata_write to stderr.\n"\
+"--capture <file>           Records every frame sent to and received from the RCP, with its time, to <file>\n"\
+"                             (suffixed with .<instance> with --instances), for cpc_replay.\n"\
+"--latency                  Prints a histogram of the time from sending each command to its reply, per command, at\n"\
+"                             the end of the run (with --daemon: on SIGUSR1 and on exit, to stderr).\n"\
+"--slo <command>=<us>[,...] Warns on stderr when the p99 time to reply of a command over the last --slo_window_ms\n"\
+"                             goes over <us> microseconds, and when it is back under.\n"\
+"--slo_window_ms <value>    Window of the --slo p99, evaluated every quarter of it (default 10000).\n"\
+"\n"\
+"Several commands may be given, on the command line and/or in a script. They are run in order over a single\n"\
+"CPC connection and one reply line is printed per command.\n"\
 "\n"\
 
 #ifndef DEFAULT_CHANNEL
@@ -105,225 +149,1591 @@ static struct option long_options[] = {
 #define DEFAULT_POWER_DDBM 0
 #endif
 
-#define TIMEOUT_SECONDS 5
+// Maximum number of commands run in one session
+#ifndef MAX_BATCH_COMMANDS
+#define MAX_BATCH_COMMANDS 64
+#endif
+
+#define MAX_SCRIPT_LINE 128
+
+// Most trace records collected by one --trace
+#ifndef MAX_TRACE_RECORDS
+#define MAX_TRACE_RECORDS 1024
+#endif
+
+// USERDATA transfer, run synchronously between the other commands
+struct userdata_transfer {
+  bool write;
+  uint16_t offset;
+  size_t len;
+  const char *path;     // read: output file, NULL to print
+  const uint8_t *data;  // write: mapped input file
+};
+
+struct host_command {
+  const custom_cpc_command_info_t *info; // NULL for a USERDATA transfer
+  uint32_t arg; // sent as info->request_len little endian bytes
+  uint8_t *payload; // prebuilt arguments of a variable length command
+  size_t payload_len;
+  struct userdata_transfer *transfer;
+};
+
+struct command_result {
+  bool done;
+  int status;       // 0 or negative errno
+  uint8_t *payload;
+  size_t len;
+};
+
+// Maximum number of cpcd instances driven in parallel
+#ifndef MAX_INSTANCES
+#define MAX_INSTANCES 32
+#endif
+
+// One connection to an RCP, running the whole command list
+struct session {
+  const char *instance_name; // NULL for the default cpcd instance
+  struct command_result results[MAX_BATCH_COMMANDS];
+  int failures;
+  pthread_t thread;
+  // --cache state
+  bool cache_usable;         // cpcd is running, stamp is set
+  bool cache_hit;            // cached holds a valid entry
+  bool cache_mismatch;       // a live reply differed from the entry
+  custom_cpc_cache_stamp_t stamp;
+  custom_cpc_device_info_t cached;
+  // stats delta state
+  bool has_stats;
+  custom_cpc_stats_t last_stats;
+  custom_cpc_latency_t *latency; // --latency or --slo
+};
+
+static struct host_command commands[MAX_BATCH_COMMANDS];
+static uint8_t command_count = 0;
+
+static struct session sessions[MAX_INSTANCES];
+static uint8_t session_count = 0;
+static bool multi_instance = false; // prefix output with the instance name
+static bool show_progress = false;  // --progress
+static bool show_latency = false;   // --latency
+static bool has_slo = false;        // --slo
+static uint32_t slo_us[CPC_COMMAND_OPCODE_MAX + 1];
+static unsigned long slo_window_ms = CUSTOM_CPC_LATENCY_WINDOW_MS_DEFAULT;
+static const char *daemon_path = NULL; // --daemon
+
+static custom_cpc_config_t config = CUSTOM_CPC_CONFIG_DEFAULT;
+static const char *cache_dir = NULL;     // --cache, NULL when disabled
+static const char *socket_folder = NULL; // --socket_folder, NULL for the default
+
+// tone_start and stats work with or without parameters
+static int argumentKind(const custom_cpc_command_info_t *info){
+  if ((info->opcode == CPC_COMMAND_TONE_START) || (info->opcode == CPC_COMMAND_GET_STATS)) {
+    return optional_argument;
+  }
+  return (info->request_len > 0) ? required_argument : no_argument;
+}
+
+static bool hasOptionalArgument(int opt){
+  const custom_cpc_command_info_t *info;
+
+  if (opt < COMMAND_OPT_BASE) {
+    return false;
+  }
+  info = custom_cpc_command_info((uint8_t) (opt - COMMAND_OPT_BASE));
+  return (info != NULL) && (argumentKind(info) == optional_argument);
+}
+
+// Fill long_options with one option per RCP command followed by the
+// host options
+static void buildOptions(void){
+  const custom_cpc_command_info_t *info;
+  size_t count;
+  size_t n = 0;
+
+  info = custom_cpc_commands(&count);
+  for (size_t i = 0; i < count && n < MAX_COMMAND_OPTIONS; i++) {
+    if (info[i].help == NULL) {
+      continue; // library only
+    }
+    long_options[n++] = (struct option) {
+      .name = info[i].name,
+      .has_arg = argumentKind(&info[i]),
+      .flag = NULL,
+      .val = COMMAND_OPT_BASE + info[i].opcode,
+    };
+  }
+  memcpy(&long_options[n], host_options, sizeof(host_options));
+}
+
+static void printHelp(void){
+  const custom_cpc_command_info_t *info;
+  size_t count;
+
+  printf(HELP_HEADER);
+  info = custom_cpc_commands(&count);
+  for (size_t i = 0; i < count; i++) {
+    char option[64];
+    const char *line = info[i].help;
+
+    if (line == NULL) {
+      continue;
+    }
+    snprintf(option, sizeof(option), "--%s%s", info[i].name,
+             (argumentKind(&info[i]) == optional_argument) ? " [<value>]"
+             : (argumentKind(&info[i]) == required_argument) ? " <value>" : "");
+    printf("%-27s", option);
+    // Continuation lines of the help text are indented
+    while (1) {
+      const char *end = strchr(line, '\n');
+      int len = (end != NULL) ? (int) (end - line) : (int) strlen(line);
+
+      printf("%.*s\n", len, line);
+      if (end == NULL) {
+        break;
+      }
+      line = end + 1;
+      printf("%29s", "");
+    }
+  }
+  printf(HELP_MESSAGE);
+}
+
+// Encode a --provision list "<offset>=<value>[/<bytes>],..." into the
+// command arguments. Values are little endian, 4 bytes by default.
+static int parseProvision(struct host_command *cmd, const char *arg){
+  custom_cpc_token_t tokens[CPC_PROVISION_ARGS_MAX / 4];
+  uint8_t values[CPC_PROVISION_ARGS_MAX / 4][sizeof(uint64_t)];
+  size_t count = 0;
+  char *list = strdup(arg);
+  char *save = NULL;
+  bool valid = true;
+  int len = -1;
+
+  if (list == NULL) {
+    return -1;
+  }
+  for (char *item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    unsigned long offset;
+    unsigned long long value;
+    unsigned long bytes = sizeof(uint32_t);
+    char *end;
+
+    if (count >= sizeof(tokens) / sizeof(tokens[0])) {
+      fprintf(stderr,"too many tokens for provision\n");
+      goto out;
+    }
+    errno = 0;
+    offset = strtoul(item, &end, 0);
+    if ((end == item) || (*end != '=') || (offset > UINT16_MAX)) {
+      valid = false;
+      break;
+    }
+    item = end + 1;
+    value = strtoull(item, &end, 0);
+    if ((end == item) || (errno != 0)) {
+      valid = false;
+      break;
+    }
+    if (*end == '/') {
+      item = end + 1;
+      bytes = strtoul(item, &end, 0);
+    }
+    if ((*end != '\0') || (bytes == 0) || (bytes > sizeof(uint64_t))
+        || ((bytes < sizeof(uint64_t)) && (value >> (8 * bytes) != 0))) {
+      valid = false;
+      break;
+    }
+    for (size_t i = 0; i < bytes; i++) {
+      values[count][i] = (uint8_t) (value >> (8 * i));
+    }
+    tokens[count] = (custom_cpc_token_t) { (uint16_t) offset, (uint8_t) bytes, values[count] };
+    count++;
+  }
+  if (!valid || (count == 0)) {
+    fprintf(stderr,"invalid value for provision: %s\n", arg);
+    goto out;
+  }
+
+  cmd->payload = malloc(CPC_PROVISION_ARGS_MAX);
+  if (cmd->payload != NULL) {
+    len = custom_cpc_provision_encode(tokens, count, cmd->payload, CPC_PROVISION_ARGS_MAX);
+    if (len < 0) {
+      fprintf(stderr,"provision list too long (max %d bytes encoded)\n", CPC_PROVISION_ARGS_MAX);
+      free(cmd->payload);
+      cmd->payload = NULL;
+    } else {
+      cmd->payload_len = (size_t) len;
+    }
+  }
+out:
+  free(list);
+  return (len < 0) ? -1 : 0;
+}
+
+// Encode a comma separated list of 16-bit values, as many as the command
+// takes, into the command arguments
+static int parseValues(struct host_command *cmd, const char *arg){
+  size_t count = cmd->info->request_len / sizeof(uint16_t);
+  const char *item = arg;
+  char *end;
+
+  cmd->payload = malloc(cmd->info->request_len);
+  if (cmd->payload == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    unsigned long value;
+
+    errno = 0;
+    value = strtoul(item, &end, 0);
+    if ((errno != 0) || (end == item) || (value > UINT16_MAX)
+        || (*end != ((i + 1 < count) ? ',' : '\0'))) {
+      fprintf(stderr,"invalid value for %s: %s\n", cmd->info->name, arg);
+      free(cmd->payload);
+      cmd->payload = NULL;
+      return -1;
+    }
+    cmd->payload[2 * i] = (uint8_t) value;
+    cmd->payload[2 * i + 1] = (uint8_t) (value >> 8);
+    item = end + 1;
+  }
+  cmd->payload_len = cmd->info->request_len;
+  return 0;
+}
+
+// CTUNE sweeps and searches run synchronously, printing a line per step
+static bool isCalibration(const struct host_command *cmd){
+  return (cmd->info != NULL)
+         && ((cmd->info->opcode == CPC_COMMAND_CTUNE_SWEEP)
+             || (cmd->info->opcode == CPC_COMMAND_CTUNE_SEARCH));
+}
+
+static bool isTonePlan(const struct host_command *cmd){
+  return (cmd->info != NULL) && (cmd->info->opcode == CPC_COMMAND_TONE_PLAN);
+}
+
+// --stats output formats, kept in host_command.arg
+enum stats_format { STATS_TEXT, STATS_DELTA, STATS_PROMETHEUS };
+static const char *const stats_formats[] = { "text", "delta", "prometheus" };
+
+// Statistics may take several round trips and print several lines
+static bool isStats(const struct host_command *cmd){
+  return (cmd->info != NULL) && (cmd->info->opcode == CPC_COMMAND_GET_STATS);
+}
+
+struct stats_result {
+  bool delta; // stats is the change since the previous read
+  custom_cpc_stats_t stats;
+};
+
+static bool isTrace(const struct host_command *cmd){
+  return (cmd->info != NULL) && (cmd->info->opcode == CPC_COMMAND_TRACE_DRAIN);
+}
+
+struct trace_result {
+  size_t count;
+  uint32_t lost;
+  uint32_t core_clock_hz;
+  custom_cpc_trace_record_t records[MAX_TRACE_RECORDS];
+};
+
+// Commands --cache can answer
+static bool isCached(const struct host_command *cmd){
+  const custom_cpc_device_info_t none = { 0 };
+  uint8_t reply[sizeof(uint32_t)];
+
+  return (cmd->info != NULL) && (custom_cpc_cache_reply(&none, cmd->info->opcode, reply) > 0);
+}
 
-#define TX_WINDOW_SIZE 1 //only 1 supported for now
+// Stream mode names, indexed by RAIL_StreamMode_t
+static const char *const stream_modes[] = { "cw", "pn9", "10", "cw_phasenoise", "ramp", "cw_shifted" };
+
+static const char *streamModeName(uint8_t mode){
+  return (mode < sizeof(stream_modes) / sizeof(stream_modes[0])) ? stream_modes[mode] : "?";
+}
+
+// Parse "<channel><sep><power_dbm>[<sep><duration_ms>][<sep><mode>]"; the
+// duration is only read if duration is true. The mode is a name from
+// stream_modes or a number.
+static int parseTone(char *arg, const char *sep, bool duration, custom_cpc_tone_t *tone){
+  char *save = NULL;
+  char *channel = strtok_r(arg, sep, &save);
+  char *power = strtok_r(NULL, sep, &save);
+  char *time = duration ? strtok_r(NULL, sep, &save) : NULL;
+  char *mode = strtok_r(NULL, sep, &save);
+  unsigned long value;
+  double dbm;
+  char *end;
+
+  if ((channel == NULL) || (power == NULL) || (duration && (time == NULL))
+      || (strtok_r(NULL, sep, &save) != NULL)) {
+    return -1;
+  }
+  value = strtoul(channel, &end, 0);
+  if ((end == channel) || (*end != '\0') || (value > UINT16_MAX)) {
+    return -1;
+  }
+  tone->channel = (uint16_t) value;
+
+  // Power in dBm, sent in deci-dBm
+  dbm = strtod(power, &end);
+  if ((end == power) || (*end != '\0') || (dbm < -3000.0) || (dbm > 3000.0)) {
+    return -1;
+  }
+  tone->power_ddbm = (int16_t) ((dbm < 0) ? dbm * 10 - 0.5 : dbm * 10 + 0.5);
+
+  tone->duration_ms = 0;
+  if (duration) {
+    value = strtoul(time, &end, 0);
+    if ((end == time) || (*end != '\0') || (value == 0) || (value > UINT16_MAX)) {
+      return -1;
+    }
+    tone->duration_ms = (uint16_t) value;
+  }
+
+  tone->mode = 0; // RAIL_STREAM_CARRIER_WAVE
+  if (mode != NULL) {
+    size_t i;
+
+    for (i = 0; i < sizeof(stream_modes) / sizeof(stream_modes[0]); i++) {
+      if (strcmp(mode, stream_modes[i]) == 0) {
+        break;
+      }
+    }
+    value = i;
+    if (i == sizeof(stream_modes) / sizeof(stream_modes[0])) {
+      value = strtoul(mode, &end, 0);
+      if ((end == mode) || (*end != '\0') || (value > UINT8_MAX)) {
+        return -1;
+      }
+    }
+    tone->mode = (uint8_t) value;
+  }
+  return 0;
+}
+
+// Encode tone_start "<channel>,<power_dbm>[,<mode>]", or the host defaults
+// without an argument, into the command arguments
+static int parseToneStart(struct host_command *cmd, const char *arg){
+  custom_cpc_tone_t tone = { DEFAULT_CHANNEL, DEFAULT_POWER_DDBM, 0, 0 };
+  char *copy = (arg != NULL) ? strdup(arg) : NULL;
+  int ret = 0;
+
+  if ((arg != NULL) && ((copy == NULL) || (parseTone(copy, ",", false, &tone) != 0))) {
+    fprintf(stderr,"invalid value for %s: %s\n", cmd->info->name, arg);
+    ret = -1;
+  }
+  free(copy);
+  if (ret != 0) {
+    return ret;
+  }
+  cmd->payload = malloc(CPC_TONE_ARGS_SIZE);
+  if (cmd->payload == NULL) {
+    return -1;
+  }
+  cmd->payload[0] = (uint8_t) tone.channel;
+  cmd->payload[1] = (uint8_t) (tone.channel >> 8);
+  cmd->payload[2] = (uint8_t) tone.power_ddbm;
+  cmd->payload[3] = (uint8_t) ((uint16_t) tone.power_ddbm >> 8);
+  cmd->payload[4] = tone.mode;
+  cmd->payload_len = CPC_TONE_ARGS_SIZE;
+  return 0;
+}
 
-static cpc_handle_t lib_handle;
-static cpc_endpoint_t endpoint;
+// Encode a --tone_plan list "<channel>:<power_dbm>:<duration_ms>[:<mode>],..."
+static int parseTonePlan(struct host_command *cmd, const char *arg){
+  custom_cpc_tone_t tones[CPC_TONE_PLAN_MAX];
+  size_t count = 0;
+  char *list = strdup(arg);
+  char *save = NULL;
+  bool valid = true;
+  int len = -1;
+
+  if (list == NULL) {
+    return -1;
+  }
+  for (char *item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    if (count >= CPC_TONE_PLAN_MAX) {
+      fprintf(stderr,"too many tones for %s (max %d)\n", cmd->info->name, CPC_TONE_PLAN_MAX);
+      goto out;
+    }
+    if (parseTone(item, ":", true, &tones[count]) != 0) {
+      valid = false;
+      break;
+    }
+    count++;
+  }
+  if (!valid || (count == 0)) {
+    fprintf(stderr,"invalid value for %s: %s\n", cmd->info->name, arg);
+    goto out;
+  }
+
+  cmd->payload = malloc(CPC_TONE_PLAN_MAX * CPC_TONE_PLAN_ENTRY_SIZE);
+  if (cmd->payload != NULL) {
+    len = custom_cpc_tone_plan_encode(tones, count, cmd->payload, CPC_TONE_PLAN_MAX * CPC_TONE_PLAN_ENTRY_SIZE);
+    cmd->payload_len = (size_t) len;
+  }
+out:
+  free(list);
+  return (len < 0) ? -1 : 0;
+}
+
+// Queue the command selected by a command line/script option.
+// Returns 0 if handled, 1 if opt is not a command, -1 on error.
+static int addCommand(int opt, const char *arg){
+  struct host_command cmd = { 0 };
+  char *end;
+
+  if (opt < COMMAND_OPT_BASE) {
+    return 1;
+  }
+  cmd.info = custom_cpc_command_info((uint8_t) (opt - COMMAND_OPT_BASE));
+  if (cmd.info == NULL) {
+    return 1;
+  }
+  debug_print("command %s (0x%x)\r\n", cmd.info->name, cmd.info->opcode);
+  if (cmd.info->opcode == CPC_COMMAND_USERDATA_PROVISION) {
+    if (parseProvision(&cmd, arg) != 0) {
+      return -1;
+    }
+  } else if (isCalibration(&cmd)) {
+    if (parseValues(&cmd, arg) != 0) {
+      return -1;
+    }
+  } else if (cmd.info->opcode == CPC_COMMAND_TONE_START) {
+    if (parseToneStart(&cmd, arg) != 0) {
+      return -1;
+    }
+  } else if (isTonePlan(&cmd)) {
+    if (parseTonePlan(&cmd, arg) != 0) {
+      return -1;
+    }
+  } else if (isStats(&cmd)) {
+    cmd.arg = STATS_TEXT;
+    while ((arg != NULL) && (strcmp(arg, stats_formats[cmd.arg]) != 0)) {
+      if (++cmd.arg == sizeof(stats_formats) / sizeof(stats_formats[0])) {
+        fprintf(stderr,"invalid format for %s: %s\n", cmd.info->name, arg);
+        return -1;
+      }
+    }
+  } else if (cmd.info->request_len > sizeof(cmd.arg)) {
+    fprintf(stderr,"%s cannot be sent from the command line\n", cmd.info->name);
+    return -1;
+  } else if (cmd.info->request_len > 0) {
+    unsigned long value;
+
+    errno = 0;
+    value = strtoul(arg, &end, 0);
+    // The argument must fit in request_len bytes
+    if ((errno != 0) || (end == arg) || (*end != '\0')
+        || ((cmd.info->request_len < sizeof(uint32_t))
+            && (value >> (8 * cmd.info->request_len) != 0))
+        || (value > UINT32_MAX)) {
+      fprintf(stderr,"invalid value for %s: %s\n", cmd.info->name, arg);
+      return -1;
+    }
+    cmd.arg = (uint32_t) value;
+  }
+
+  if (command_count >= MAX_BATCH_COMMANDS) {
+    fprintf(stderr,"too many commands (max %d)\n", MAX_BATCH_COMMANDS);
+    return -1;
+  }
+  commands[command_count++] = cmd;
+  return 0;
+}
+
+// Queue a --userdata_read "<offset>,<length>[,<file>]" or
+// --userdata_write "<offset>,<file>" transfer. Files to write are mapped
+// once and shared by every session.
+static int addTransfer(bool write, char *arg){
+  struct userdata_transfer *t;
+  char *offset = strtok(arg, ",");
+  char *second = strtok(NULL, ",");
+  char *third = strtok(NULL, "");
+  unsigned long value;
+  char *end;
+
+  if (command_count >= MAX_BATCH_COMMANDS) {
+    fprintf(stderr,"too many commands (max %d)\n", MAX_BATCH_COMMANDS);
+    return -1;
+  }
+  t = calloc(1, sizeof(*t));
+  if (t == NULL) {
+    return -1;
+  }
+  t->write = write;
+
+  value = (offset != NULL) ? strtoul(offset, &end, 0) : ULONG_MAX;
+  if ((offset == NULL) || (end == offset) || (*end != '\0') || (value > UINT16_MAX)
+      || (second == NULL) || (write && (third != NULL))) {
+    fprintf(stderr,"invalid argument for --userdata_%s\n", write ? "write" : "read");
+    free(t);
+    return -1;
+  }
+  t->offset = (uint16_t) value;
+
+  if (write) {
+    struct stat st;
+    int fd = open(second, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
+      fprintf(stderr,"cannot open %s: %s\n", second, strerror(errno));
+      if (fd >= 0) {
+        close(fd);
+      }
+      free(t);
+      return -1;
+    }
+    t->len = (size_t) st.st_size;
+    t->path = second;
+    if (t->len > 0) {
+      void *map = mmap(NULL, t->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (map == MAP_FAILED) {
+        fprintf(stderr,"cannot map %s: %s\n", second, strerror(errno));
+        close(fd);
+        free(t);
+        return -1;
+      }
+      t->data = map;
+    }
+    close(fd);
+  } else {
+    value = strtoul(second, &end, 0);
+    if ((end == second) || (*end != '\0') || (value == 0) || (value > UINT16_MAX + 1ul)) {
+      fprintf(stderr,"invalid length for --userdata_read: %s\n", second);
+      free(t);
+      return -1;
+    }
+    t->len = value;
+    t->path = third;
+  }
+
+  commands[command_count++] = (struct host_command) { .transfer = t };
+  return 0;
+}
+
+// Queue every command listed in a script file ("-" reads stdin)
+static int readScript(const char *path){
+  char line[MAX_SCRIPT_LINE];
+  unsigned int line_num = 0;
+  FILE *f = stdin;
+  int ret = 0;
+
+  if (strcmp(path, "-") != 0) {
+    f = fopen(path, "r");
+    if (f == NULL) {
+      fprintf(stderr,"cannot open script %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  while ((ret == 0) && (fgets(line, sizeof(line), f) != NULL)) {
+    char *name;
+    char *arg;
+    const struct option *o;
+
+    line_num++;
+    name = strtok(line, " \t\r\n");
+    if ((name == NULL) || (name[0] == '#')) {
+      continue;
+    }
+    arg = strtok(NULL, " \t\r\n");
+
+    for (o = long_options; o->name != NULL; o++) {
+      if (strcmp(o->name, name) == 0) {
+        break;
+      }
+    }
+    if ((o->name == NULL) || ((o->has_arg == required_argument) && (arg == NULL))) {
+      fprintf(stderr,"%s:%u: invalid command \"%s\"\n", path, line_num, name);
+      ret = -1;
+    } else if ((o->val == 'r') || (o->val == 'u')) {
+      // The transfer keeps pointers into its argument
+      char *copy = strdup(arg);
+
+      if ((copy == NULL) || (addTransfer(o->val == 'u', copy) != 0)) {
+        fprintf(stderr,"%s:%u: invalid transfer\n", path, line_num);
+        ret = -1;
+      }
+    } else if (addCommand(o->val, arg) != 0) {
+      fprintf(stderr,"%s:%u: \"%s\" is not an RCP command\n", path, line_num, name);
+      ret = -1;
+    }
+  }
+
+  if (f != stdin) {
+    fclose(f);
+  }
+  return ret;
+}
+
+// Build the arguments for a command into buffer. Returns their length.
+static size_t buildArgs(const struct host_command *cmd, uint8_t *buffer){
+  if (cmd->payload != NULL) {
+    memcpy(buffer, cmd->payload, cmd->payload_len);
+    return cmd->payload_len;
+  }
+  for (size_t i = 0; i < cmd->info->request_len; i++) {
+    buffer[i] = (uint8_t) (cmd->arg >> (8 * i));
+  }
+  debug_print("sending command 0x%x with %d argument bytes\r\n", cmd->info->opcode, cmd->info->request_len);
+  return cmd->info->request_len;
+}
+
+// Run a USERDATA transfer to completion. A read without an output file
+// keeps the data in result->payload for printReply().
+static void runTransfer(custom_cpc_t *ctx,
+                        const struct session *session,
+                        const struct userdata_transfer *t,
+                        struct command_result *result){
+  uint8_t *data;
+  bool erased = false;
+  int ret;
+
+  result->done = true;
+  if (t->write) {
+    result->status = custom_cpc_userdata_write(ctx, t->offset, t->data, t->len, &erased);
+    result->len = erased ? 1 : 0; // printed as the erase flag
+    return;
+  }
+
+  data = malloc(t->len);
+  if (data == NULL) {
+    result->status = -ENOMEM;
+    return;
+  }
+  ret = custom_cpc_userdata_read(ctx, t->offset, data, t->len);
+  if ((ret == 0) && (t->path != NULL)) {
+    char path[PATH_MAX];
+    FILE *f;
+
+    if (multi_instance) {
+      snprintf(path, sizeof(path), "%s.%s", t->path, session->instance_name);
+    } else {
+      snprintf(path, sizeof(path), "%s", t->path);
+    }
+    f = fopen(path, "wb");
+    if ((f == NULL) || (fwrite(data, 1, t->len, f) != t->len)) {
+      ret = -errno;
+    }
+    if ((f != NULL) && (fclose(f) != 0) && (ret == 0)) {
+      ret = -errno;
+    }
+    free(data);
+    data = NULL;
+  }
+  result->status = ret;
+  if ((ret == 0) && (data != NULL)) {
+    result->payload = data;
+    result->len = t->len;
+  } else {
+    free(data);
+  }
+}
+
+// Read the frequency error sign for a search step from stdin: "+", "-",
+// "0" or a signed number. Returns -1 at end of input.
+static int readFeedback(int8_t *error){
+  char line[MAX_SCRIPT_LINE];
+
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    char *end;
+    long value = strtol(line, &end, 0);
+
+    if (end == line) {
+      if (line[0] == '+') {
+        value = 1;
+      } else if (line[0] == '-') {
+        value = -1;
+      } else {
+        fprintf(stderr,"expected +, - or 0\n");
+        continue;
+      }
+    }
+    *error = (value > 0) ? 1 : (value < 0) ? -1 : 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Run a CTUNE sweep or search to its end. The last step is kept in
+// result->payload for printReply().
+static void runCalibration(custom_cpc_t *ctx,
+                           const struct session *session,
+                           const struct host_command *cmd,
+                           struct command_result *result){
+  bool search = (cmd->info->opcode == CPC_COMMAND_CTUNE_SEARCH);
+  uint16_t dwell_ms = search ? 0 : (uint16_t) (cmd->payload[6] | (cmd->payload[7] << 8));
+  custom_cpc_ctune_step_t step = { 0 };
+  custom_cpc_event_t event;
+  int32_t status;
+  int ret;
+
+  result->done = true;
+  if (search) {
+    ret = custom_cpc_ctune_search(ctx,
+                                  (uint16_t) (cmd->payload[0] | (cmd->payload[1] << 8)),
+                                  (uint16_t) (cmd->payload[2] | (cmd->payload[3] << 8)),
+                                  &status);
+  } else {
+    ret = custom_cpc_ctune_sweep(ctx,
+                                 (uint16_t) (cmd->payload[0] | (cmd->payload[1] << 8)),
+                                 (uint16_t) (cmd->payload[2] | (cmd->payload[3] << 8)),
+                                 (uint16_t) (cmd->payload[4] | (cmd->payload[5] << 8)),
+                                 dwell_ms,
+                                 &status);
+  }
+  if (ret < 0) {
+    result->status = ret;
+    return;
+  }
+  if (status != CPC_CTUNE_SWEEP_OK) {
+    result->status = (status == CPC_CTUNE_SWEEP_BUSY) ? -EBUSY : -EINVAL;
+    return;
+  }
+
+  while (1) {
+    // A step event follows the previous one after dwell_ms
+    ret = custom_cpc_wait_event(ctx, &event, dwell_ms + config.timeout_ms);
+    if (ret < 0) {
+      custom_cpc_ctune_stop(ctx, &status);
+      break;
+    }
+    if (custom_cpc_decode_ctune_step(&event, &step) != 0) {
+      continue;
+    }
+    if (step.kind != CPC_CTUNE_STEP) {
+      break;
+    }
+    flockfile(stdout);
+    if (multi_instance) {
+      printf("[%s] ", session->instance_name);
+    }
+    printf("CTUNE step %u: 0x%x at %u ms%s\r\n", step.index, step.ctune, step.time_ms,
+           search ? ", frequency error (+/-/0)?" : "");
+    funlockfile(stdout);
+    fflush(stdout);
+    if (search) {
+      int8_t error;
+
+      if (readFeedback(&error) != 0) {
+        custom_cpc_ctune_stop(ctx, &status);
+        continue; // collect the ABORTED event
+      }
+      ret = custom_cpc_ctune_feedback(ctx, error, &status);
+      if (ret < 0) {
+        break;
+      }
+    }
+  }
+
+  if (ret < 0) {
+    result->status = ret;
+  } else if (step.kind == CPC_CTUNE_STEP_DONE) {
+    result->status = 0;
+  } else {
+    result->status = (step.kind == CPC_CTUNE_STEP_ABORTED) ? -ECANCELED : -EIO;
+  }
+  result->payload = malloc(sizeof(step));
+  if (result->payload != NULL) {
+    memcpy(result->payload, &step, sizeof(step));
+    result->len = sizeof(step);
+  }
+}
 
-static void connectcpc(){
-  uint8_t retry = 0;
+// Play a tone plan to its end. The last step is kept in result->payload
+// for printReply().
+static void runTonePlan(custom_cpc_t *ctx,
+                        const struct session *session,
+                        const struct host_command *cmd,
+                        struct command_result *result){
+  custom_cpc_tone_step_t step = { 0 };
+  unsigned long longest_ms = 0;
+  custom_cpc_event_t event;
+  uint8_t reply[1];
+  size_t reply_len = 0;
+  int32_t status;
   int ret;
-  do {
-    ret = cpc_init(&lib_handle, NULL, ENABLE_TRACING, NULL);
-    if (ret == 0) {
-      // speed up boot process if everything seems ok
+
+  for (size_t i = 0; i < cmd->payload_len; i += CPC_TONE_PLAN_ENTRY_SIZE) {
+    unsigned long ms = cmd->payload[i + 5] | (cmd->payload[i + 6] << 8);
+    longest_ms = (ms > longest_ms) ? ms : longest_ms;
+  }
+
+  result->done = true;
+  ret = custom_cpc_transact(ctx, cmd->info->opcode, cmd->payload, cmd->payload_len, reply, sizeof(reply), &reply_len);
+  if (ret < 0) {
+    result->status = ret;
+    return;
+  }
+  if ((reply_len < 1) || (reply[0] != CPC_CTUNE_SWEEP_OK)) {
+    result->status = ((reply_len == 1) && (reply[0] == CPC_CTUNE_SWEEP_BUSY)) ? -EBUSY : -EINVAL;
+    return;
+  }
+
+  while (1) {
+    ret = custom_cpc_wait_event(ctx, &event, longest_ms + config.timeout_ms);
+    if (ret < 0) {
+      custom_cpc_tone_stop(ctx, &status);
       break;
     }
-    nanosleep((const struct timespec[]){{ 0, 100000000L } }, NULL);
-    retry++;
-  } while ((ret != 0) && (retry < TIMEOUT_SECONDS));
+    if (custom_cpc_decode_tone_step(&event, &step) != 0) {
+      continue;
+    }
+    if (step.kind != CPC_CTUNE_STEP) {
+      break;
+    }
+    flockfile(stdout);
+    if (multi_instance) {
+      printf("[%s] ", session->instance_name);
+    }
+    printf("Tone %u: channel %u, %.1f dBm, %s at %u ms\r\n", step.index, step.tone.channel,
+           step.tone.power_ddbm / 10.0, streamModeName(step.tone.mode), step.time_ms);
+    funlockfile(stdout);
+  }
 
   if (ret < 0) {
-    fprintf(stderr,"cpc_init returned with %d (%s)\n", ret, strerror(-ret));
-    exit(EXIT_FAILURE);
-  }
-  
-  ret = cpc_open_endpoint(lib_handle,
-                          &endpoint,
-                          SL_CPC_ENDPOINT_USER_ID_0,
-                          TX_WINDOW_SIZE);
+    result->status = ret;
+  } else if (step.kind == CPC_CTUNE_STEP_DONE) {
+    result->status = 0;
+  } else {
+    result->status = (step.kind == CPC_CTUNE_STEP_ABORTED) ? -ECANCELED : -EIO;
+  }
+  result->payload = malloc(sizeof(step));
+  if (result->payload != NULL) {
+    memcpy(result->payload, &step, sizeof(step));
+    result->len = sizeof(step);
+  }
+}
+
+// Read the RCP statistics into a struct stats_result kept in
+// result->payload for printReply(). For delta, the change since the
+// previous read of the session, if any.
+static void runStats(custom_cpc_t *ctx,
+                     struct session *session,
+                     const struct host_command *cmd,
+                     struct command_result *result){
+  struct stats_result *stats = malloc(sizeof(*stats));
+  custom_cpc_stats_t now;
+
+  result->done = true;
+  if (stats == NULL) {
+    result->status = -ENOMEM;
+    return;
+  }
+  result->status = custom_cpc_get_stats(ctx, &now);
+  if (result->status != 0) {
+    free(stats);
+    return;
+  }
+  stats->delta = (cmd->arg == STATS_DELTA) && session->has_stats;
+  if (stats->delta) {
+    custom_cpc_stats_delta(&session->last_stats, &now, &stats->stats);
+  } else {
+    stats->stats = now;
+  }
+  session->last_stats = now;
+  session->has_stats = true;
+  result->payload = (uint8_t *) stats;
+  result->len = sizeof(*stats);
+}
+
+// Drain the RCP trace into a struct trace_result kept in result->payload
+// for printReply()
+static void runTrace(custom_cpc_t *ctx, struct command_result *result){
+  struct trace_result *trace = malloc(sizeof(*trace));
+
+  result->done = true;
+  if (trace == NULL) {
+    result->status = -ENOMEM;
+    return;
+  }
+  result->status = custom_cpc_trace_drain(ctx, trace->records, MAX_TRACE_RECORDS,
+                                          &trace->count, &trace->lost, &trace->core_clock_hz);
+  if (result->status != 0) {
+    free(trace);
+    return;
+  }
+  result->payload = (uint8_t *) trace;
+  result->len = sizeof(*trace);
+}
+
+// A summary line, then one line per record with its time since the first
+static void printTrace(const struct session *session, const struct trace_result *trace){
+  char message[128];
+
+  printf("Trace: %zu records, %u lost\r\n", trace->count, trace->lost);
+  for (size_t i = 0; i < trace->count; i++) {
+    const custom_cpc_trace_record_t *record = &trace->records[i];
+
+    custom_cpc_trace_format(record, message, sizeof(message));
+    if (multi_instance) {
+      printf("[%s] ", session->instance_name);
+    }
+    printf("  %12.1f us %-5s %s\r\n",
+           (trace->core_clock_hz != 0) ? record->time_cycles * 1e6 / trace->core_clock_hz : 0.0,
+           custom_cpc_trace_level(record), message);
+  }
+}
+
+static double cyclesToSeconds(const custom_cpc_stats_t *stats, uint32_t cycles){
+  return (stats->core_clock_hz != 0) ? (double) cycles / stats->core_clock_hz : 0.0;
+}
+
+// One line of totals, then one per command that ran
+static void printStatsText(const struct session *session, const struct stats_result *result){
+  const custom_cpc_stats_t *stats = &result->stats;
+
+  if (result->delta) {
+    printf("Stats over %u ms: ", stats->uptime_ms);
+  } else {
+    printf("Stats since boot (%u ms): ", stats->uptime_ms);
+  }
+  printf("%u commands (%u rejected), %u writes refused, %u write failures, %u reconnects, "
+         "reply pool high water %u (%u acquire failures), command ring high water %u\r\n",
+         stats->commands, stats->rejected, stats->write_refused, stats->write_failures, stats->reconnects,
+         stats->pool_high_water, stats->pool_acquire_failures, stats->ring_high_water);
+  for (size_t i = 0; i <= CPC_COMMAND_OPCODE_MAX; i++) {
+    const custom_cpc_opcode_stats_t *op = &stats->opcodes[i];
+    const custom_cpc_command_info_t *info = custom_cpc_command_info((uint8_t) i);
+    double us = cyclesToSeconds(stats, op->cycles) * 1e6;
+
+    if ((op->completed == 0) && (op->cycles == 0)) {
+      continue;
+    }
+    if (multi_instance) {
+      printf("[%s] ", session->instance_name);
+    }
+    printf("  %s: %u completed, %.1f us handler time (%.1f us per command)\r\n",
+           (info != NULL) ? info->name : "?", op->completed, us,
+           (op->completed != 0) ? us / op->completed : us);
+  }
+}
+
+// Prometheus text exposition format, the RCP named by an rcp label with
+// --instances
+static void printStatsPrometheus(const struct session *session, const custom_cpc_stats_t *stats){
+  const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+    double value;
+  } metrics[] = {
+    { "custom_cpc_uptime_seconds", "gauge", "Time since the RCP started.", stats->uptime_ms / 1000.0 },
+    { "custom_cpc_commands_total", "counter", "Command frames run by the RCP, rejected ones included.", stats->commands },
+    { "custom_cpc_rejected_total", "counter", "Command frames rejected by the RCP.", stats->rejected },
+    { "custom_cpc_writes_refused_total", "counter", "Replies and events sl_cpc_write() refused.", stats->write_refused },
+    { "custom_cpc_write_failures_total", "counter", "Writes completed with an error.", stats->write_failures },
+    { "custom_cpc_reconnects_total", "counter", "Host disconnects seen by the RCP.", stats->reconnects },
+    { "custom_cpc_reply_pool_acquire_failures_total", "counter", "Replies delayed by a full reply pool.",
+      stats->pool_acquire_failures },
+    { "custom_cpc_reply_pool_high_water", "gauge", "Most reply buffers in use at once.", stats->pool_high_water },
+    { "custom_cpc_command_ring_high_water", "gauge", "Most received commands queued at once.", stats->ring_high_water },
+  };
+  char rcp[128] = "";
+
+  if (multi_instance) {
+    snprintf(rcp, sizeof(rcp), "rcp=\"%s\"", session->instance_name);
+  }
+  for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+    printf("# HELP %s %s\n# TYPE %s %s\n", metrics[i].name, metrics[i].help, metrics[i].name, metrics[i].type);
+    printf("%s%s%s%s %.15g\n", metrics[i].name, multi_instance ? "{" : "", rcp, multi_instance ? "}" : "",
+           metrics[i].value);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    const char *name = (pass == 0) ? "custom_cpc_command_completed_total" : "custom_cpc_command_handler_seconds_total";
+
+    printf("# HELP %s %s\n# TYPE %s counter\n", name,
+           (pass == 0) ? "Commands run to their reply." : "Time spent in the command handler.", name);
+    for (size_t i = 0; i <= CPC_COMMAND_OPCODE_MAX; i++) {
+      const custom_cpc_opcode_stats_t *op = &stats->opcodes[i];
+      const custom_cpc_command_info_t *info = custom_cpc_command_info((uint8_t) i);
+
+      if ((info == NULL) || ((op->completed == 0) && (op->cycles == 0))) {
+        continue;
+      }
+      printf("%s{%s%scommand=\"%s\"} %.15g\n", name, rcp, multi_instance ? "," : "", info->name,
+             (pass == 0) ? (double) op->completed : cyclesToSeconds(stats, op->cycles));
+    }
+  }
+}
+
+// Print a reply on a single line
+static void printReply(const struct session *session,
+                       const struct host_command *cmd,
+                       const struct command_result *result){
+  const struct userdata_transfer *t = cmd->transfer;
+  custom_cpc_device_info_t info;
+
+  flockfile(stdout); // keep lines from parallel sessions whole
+  if (isStats(cmd) && (cmd->arg == STATS_PROMETHEUS) && (result->status == 0)) {
+    printStatsPrometheus(session, &((const struct stats_result *) result->payload)->stats);
+    funlockfile(stdout);
+    return;
+  }
+  if (multi_instance) {
+    printf("[%s] ", session->instance_name);
+  }
+  if (t != NULL) {
+    printf("Userdata %s 0x%x+%zu: ", t->write ? "write" : "read", t->offset, t->len);
+    if (result->status != 0) {
+      printf("failed, %s\r\n", strerror(-result->status));
+    } else if (t->write) {
+      printf("ok, %s\r\n", (result->len > 0) ? "page erased" : "no erase needed");
+    } else if (result->payload == NULL) {
+      printf("ok, saved to %s%s%s\r\n", t->path,
+             multi_instance ? "." : "", multi_instance ? session->instance_name : "");
+    } else {
+      for (size_t i=0;i<result->len;i++) {
+        printf("0x%x ", result->payload[i]);
+      }
+      printf("\r\n");
+    }
+  } else if (isCalibration(cmd)) {
+    const custom_cpc_ctune_step_t *step = (const custom_cpc_ctune_step_t *) result->payload;
+
+    printf("CTUNE %s ", (cmd->info->opcode == CPC_COMMAND_CTUNE_SEARCH) ? "search" : "sweep");
+    if ((result->status == 0) && (step != NULL)) {
+      printf("done, CTUNE 0x%x after %u steps\r\n", step->ctune, step->index + 1u);
+    } else if ((step != NULL) && (step->kind == CPC_CTUNE_STEP_ERROR)) {
+      printf("failed at 0x%x, RAIL status %u\r\n", step->ctune, step->rail_status);
+    } else {
+      printf("failed, %s\r\n", strerror(-result->status));
+    }
+  } else if (isTonePlan(cmd)) {
+    const custom_cpc_tone_step_t *step = (const custom_cpc_tone_step_t *) result->payload;
+
+    if ((result->status == 0) && (step != NULL)) {
+      printf("Tone plan done after %u tones\r\n", step->index + 1u);
+    } else if ((step != NULL) && (step->kind == CPC_CTUNE_STEP_ERROR)) {
+      printf("Tone plan failed at tone %u (channel %u), RAIL status %u\r\n",
+             step->index, step->tone.channel, step->rail_status);
+    } else {
+      printf("Tone plan failed, %s\r\n", strerror(-result->status));
+    }
+  } else if (isTrace(cmd) && (result->status == 0)) {
+    printTrace(session, (const struct trace_result *) result->payload);
+  } else if (isStats(cmd) && (result->status == 0)) {
+    printStatsText(session, (const struct stats_result *) result->payload);
+  } else if ((cmd->info->opcode == CPC_COMMAND_GET_DEVICE_INFO)
+             && (result->status == 0)
+             && (custom_cpc_decode_device_info(result->payload, result->len, &info) == 0)) {
+    printf("Device info: cust_version 0x%08x, se_version 0x%08x, btl_version 0x%08x, "
+           "app_properties_version 0x%08x, ctune_token 0x%04x, ctune 0x%04x, family 0x%08x, "
+           "unique_id 0x%016llx\r\n",
+           info.cust_version, info.se_version, info.btl_version, info.app_properties_version,
+           info.ctune_token, info.ctune, info.family, (unsigned long long) info.unique_id);
+  } else if (result->status == 0) {
+    printf("Reply to command 0x%x, len=%zu: ",cmd->info->opcode, result->len);
+    for (size_t i=0;i<result->len;i++) {
+      printf("0x%x ", result->payload[i]);
+    }
+    printf("\r\n");
+  } else {
+    printf("Reply to command 0x%x, len=%d: read timeout! last error %s\r\n",
+           cmd->info->opcode, result->status, strerror(-result->status));
+  }
+  funlockfile(stdout);
+}
+
+static void onReply(void *user_arg, int status, uint8_t opcode, const uint8_t *payload, size_t len){
+  struct command_result *result = user_arg;
+  (void) opcode;
+
+  result->status = status;
+  result->len = len;
+  if (status == 0 && len > 0) {
+    result->payload = malloc(len);
+    if (result->payload == NULL) {
+      result->status = -ENOMEM;
+    } else {
+      memcpy(result->payload, payload, len);
+    }
+  }
+  result->done = true;
+}
+
+// Run all queued commands, keeping up to config.window_size of them in
+// flight. Replies may arrive in any order; they are printed in command
+// order. Returns the number of failed commands.
+static int runCommands(custom_cpc_t *ctx, struct session *session){
+  struct command_result *results = session->results;
+  uint8_t args[CPC_PROVISION_ARGS_MAX];
+  uint8_t next_print = 0;
+  int failures = 0;
+  int ret;
+
+  for (uint8_t i = 0; i < command_count; i++) {
+    if (commands[i].transfer != NULL) {
+      // Transfers stream their own chunks: finish earlier commands first
+      while (custom_cpc_pending(ctx) > 0) {
+        custom_cpc_process(ctx);
+      }
+      runTransfer(ctx, session, commands[i].transfer, &results[i]);
+    } else if (isCalibration(&commands[i])) {
+      while (custom_cpc_pending(ctx) > 0) {
+        custom_cpc_process(ctx);
+      }
+      runCalibration(ctx, session, &commands[i], &results[i]);
+    } else if (isTonePlan(&commands[i])) {
+      while (custom_cpc_pending(ctx) > 0) {
+        custom_cpc_process(ctx);
+      }
+      runTonePlan(ctx, session, &commands[i], &results[i]);
+    } else if (isStats(&commands[i])) {
+      // Counts the commands before it
+      while (custom_cpc_pending(ctx) > 0) {
+        custom_cpc_process(ctx);
+      }
+      runStats(ctx, session, &commands[i], &results[i]);
+    } else if (isTrace(&commands[i])) {
+      while (custom_cpc_pending(ctx) > 0) {
+        custom_cpc_process(ctx);
+      }
+      runTrace(ctx, &results[i]);
+    } else {
+      ret = custom_cpc_submit(ctx,
+                              commands[i].info->opcode,
+                              args,
+                              buildArgs(&commands[i], args),
+                              onReply,
+                              &results[i]);
+      if (ret < 0) {
+        results[i].status = ret;
+        results[i].done = true;
+      }
+    }
+    // Print completed commands in order
+    while ((next_print < command_count) && results[next_print].done) {
+      printReply(session, &commands[next_print], &results[next_print]);
+      next_print++;
+    }
+  }
+
+  while (custom_cpc_pending(ctx) > 0) {
+    custom_cpc_process(ctx);
+    while ((next_print < command_count) && results[next_print].done) {
+      printReply(session, &commands[next_print], &results[next_print]);
+      next_print++;
+    }
+  }
+
+  for (uint8_t i = 0; i < command_count; i++) {
+    if (results[i].status != 0) {
+      failures++;
+    } else if (session->cache_hit && isCached(&commands[i])) {
+      // Same cpcd run but another firmware: the entry is out of date
+      uint8_t expected[sizeof(uint32_t)];
+      size_t len = custom_cpc_cache_reply(&session->cached, commands[i].info->opcode, expected);
+
+      if ((results[i].len != len) || (memcmp(results[i].payload, expected, len) != 0)) {
+        session->cache_mismatch = true;
+      }
+    }
+    free(results[i].payload);
+  }
+  return failures;
+}
+
+// Answer the whole command list from the cache if every command is
+// cached and the entry is valid. Returns false if the RCP must be asked.
+static bool runFromCache(struct session *session){
+  uint8_t reply[sizeof(uint32_t)];
+
+  if ((cache_dir == NULL) || (config.socket_path != NULL)) {
+    return false; // through a daemon, the cpcd instance is not known
+  }
+  session->cache_usable = (custom_cpc_cache_stamp(socket_folder, session->instance_name, &session->stamp) == 0);
+  if (session->cache_usable) {
+    session->cache_hit = (custom_cpc_cache_load(cache_dir, session->instance_name,
+                                                &session->stamp, &session->cached) == 0);
+  }
+  if (!session->cache_hit) {
+    return false;
+  }
+  for (uint8_t i = 0; i < command_count; i++) {
+    if (!isCached(&commands[i])) {
+      return false;
+    }
+  }
+
+  for (uint8_t i = 0; i < command_count; i++) {
+    struct command_result result = {
+      .done = true,
+      .status = 0,
+      .payload = reply,
+      .len = custom_cpc_cache_reply(&session->cached, commands[i].info->opcode, reply),
+    };
+
+    printReply(session, &commands[i], &result);
+  }
+  return true;
+}
+
+// After a live run, fill in a missing or out of date cache entry. Only
+// costs a round trip if the command list asked for a cached value.
+static void updateCache(custom_cpc_t *ctx, struct session *session){
+  custom_cpc_device_info_t info;
+  bool wanted = false;
+  int ret;
+
+  if (!session->cache_usable || (session->cache_hit && !session->cache_mismatch)) {
+    return;
+  }
+  for (uint8_t i = 0; i < command_count; i++) {
+    wanted = wanted || isCached(&commands[i]);
+  }
+  if (!wanted) {
+    return;
+  }
+  ret = custom_cpc_get_device_info(ctx, &info);
+  if ((ret == 0) && (info.se_version == 0)) {
+    ret = -EAGAIN; // the SE did not answer, do not cache a made up version
+  }
+  if (ret == 0) {
+    ret = custom_cpc_cache_store(cache_dir, session->instance_name, &session->stamp, &info);
+  } else {
+    custom_cpc_cache_remove(cache_dir, session->instance_name);
+  }
   if (ret < 0) {
-    fprintf(stderr,"cpc_open_endpoint returned with %d\n", ret);
-    exit(EXIT_FAILURE);
+    fprintf(stderr,"cannot update cache in %s: %s\n", cache_dir, strerror(-ret));
   }
 }
 
-static void sendCmd(uint8_t *buffer, uint8_t len){
-  cpc_write_endpoint(endpoint, buffer, (size_t) len, CPC_ENDPOINT_WRITE_FLAG_NONE);
+// --progress: one line per progress frame of a command the RCP runs in
+// steps
+static void printProgress(void *user_arg, uint8_t opcode, uint16_t done, uint16_t total){
+  struct session *session = user_arg;
+  const custom_cpc_command_info_t *info = custom_cpc_command_info(opcode);
+
+  flockfile(stderr);
+  if (multi_instance) {
+    fprintf(stderr,"[%s] ", session->instance_name);
+  }
+  fprintf(stderr,"%s: %u/%u bytes\n", (info != NULL) ? info->name : "command", done, total);
+  funlockfile(stderr);
+}
+
+// --slo: one line when a command goes over its threshold and one when it
+// is back under
+static void printSloAlert(void *user_arg, uint8_t opcode, bool over, uint32_t p99_us, uint32_t threshold_us, uint32_t samples){
+  const char *instance_name = user_arg;
+  const custom_cpc_command_info_t *info = custom_cpc_command_info(opcode);
+
+  flockfile(stderr);
+  if (instance_name != NULL) {
+    fprintf(stderr,"[%s] ", instance_name);
+  }
+  fprintf(stderr,"slo: %s p99 %u us %s %u us (%u replies in the last %lu ms)\n",
+          (info != NULL) ? info->name : "command", p99_us, over ? "over" : "back under",
+          threshold_us, samples, slo_window_ms);
+  funlockfile(stderr);
 }
 
-// Read RCP data from CPC
-static ssize_t getReply(uint8_t *buffer){
-  uint8_t retry = 0;
-  ssize_t size;
+// Histograms for --latency and --slo, NULL if neither is given
+static custom_cpc_latency_t *createLatency(const char *instance_name){
+  custom_cpc_latency_t *latency;
+  int ret;
+
+  if (!show_latency && !has_slo) {
+    return NULL;
+  }
+  ret = custom_cpc_latency_create(&latency, slo_window_ms);
+  if (ret < 0) {
+    fprintf(stderr,"cannot create latency histograms: %s\n", strerror(-ret));
+    return NULL;
+  }
+  for (unsigned int op = 0; op <= CPC_COMMAND_OPCODE_MAX; op++) {
+    custom_cpc_latency_set_threshold(latency, (uint8_t) op, slo_us[op]);
+  }
+  custom_cpc_latency_set_alert(latency, printSloAlert, (void *) instance_name);
+  return latency;
+}
 
-  do {
-    size = cpc_read_endpoint(endpoint,
-                            buffer,
-                            SL_CPC_READ_MINIMUM_SIZE,
-                            CPC_ENDPOINT_EVENT_FLAG_NON_BLOCKING);
-    nanosleep((const struct timespec[]){{ 0, 100000000L } }, NULL);
-    retry++;
-    debug_print("cpc_read_endpoint attempt, size/status=%d, retry #%d\r\n", 
-        size,retry);
-  } while ((size <= 0) && (retry < TIMEOUT_SECONDS));
+// Parses --slo <command>=<us>[,...]
+static int addSlo(char *list){
+  for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+    const custom_cpc_command_info_t *info;
+    char *value = strchr(item, '=');
+    char *end;
+    unsigned long us;
 
-  return size;
+    if (value == NULL) {
+      fprintf(stderr,"invalid slo: %s\n", item);
+      return -1;
+    }
+    *value++ = '\0';
+    info = custom_cpc_command_find(item);
+    us = strtoul(value, &end, 0);
+    if (info == NULL) {
+      fprintf(stderr,"unknown command: %s\n", item);
+      return -1;
+    }
+    if ((*end != '\0') || (us == 0) || (us > CUSTOM_CPC_LATENCY_MAX_US)) {
+      fprintf(stderr,"invalid slo for %s: %s\n", item, value);
+      return -1;
+    }
+    slo_us[info->opcode] = (uint32_t) us;
+  }
+  has_slo = true;
+  return 0;
 }
 
-static void disconnectcpc(){
-  //TODO: wait for endpoint to close with timeout?
+// Connect to one RCP and run the command list on it
+static void *runSession(void *arg){
+  struct session *session = arg;
+  custom_cpc_config_t session_config = config;
+  char capture_path[PATH_MAX];
+  custom_cpc_t *ctx;
   int ret;
-  uint8_t retry=0;
-  cpc_endpoint_state_t state;
-  debug_print("Closing endpoint...\r\n");
-  ret = cpc_close_endpoint(&endpoint);
-  if (ret != 0) {
-    printf("cpc_close_endpoint error %d\r\n", ret);
+
+  session_config.instance_name = session->instance_name;
+  if ((config.capture_path != NULL) && multi_instance) {
+    snprintf(capture_path, sizeof(capture_path), "%s.%s", config.capture_path, session->instance_name);
+    session_config.capture_path = capture_path;
+  }
+  if (show_progress) {
+    session_config.progress = printProgress;
+    session_config.progress_arg = session;
   }
-  debug_print("waiting for endpoint to close...\r\n");
-  do {
-    ret = cpc_get_endpoint_state(lib_handle, SL_CPC_ENDPOINT_USER_ID_0,&state);
-    nanosleep((const struct timespec[]){{ 0, 100000000L } }, NULL);
-    retry++;
-  } while ((state != SL_CPC_STATE_CLOSED) && (retry <= TIMEOUT_SECONDS));
-  debug_print("endpoint closed\r\n");
+  if (runFromCache(session)) {
+    session->failures = 0;
+    return NULL;
+  }
+  if (session_config.capture_path != NULL) {
+    // Checked here so that custom_cpc_open() errors read as connection errors
+    int fd = open(session_config.capture_path, O_WRONLY | O_CREAT, 0644);
+
+    if (fd < 0) {
+      fprintf(stderr,"cannot create capture file %s: %s\n", session_config.capture_path, strerror(errno));
+      session->failures = command_count;
+      return NULL;
+    }
+    close(fd);
+  }
+  session->latency = createLatency(multi_instance ? session->instance_name : NULL);
+  session_config.latency = session->latency;
+  ret = custom_cpc_open(&ctx, &session_config);
+  if (ret < 0) {
+    flockfile(stderr);
+    if (multi_instance) {
+      fprintf(stderr,"[%s] ", session->instance_name);
+    }
+    if (config.socket_path != NULL) {
+      fprintf(stderr,"cannot connect to daemon at %s: %s\n", config.socket_path, strerror(-ret));
+    } else {
+      fprintf(stderr,"cannot connect to cpcd: %d (%s)\n", ret, strerror(-ret));
+    }
+    funlockfile(stderr);
+    session->failures = command_count;
+    custom_cpc_latency_destroy(session->latency);
+    return NULL;
+  }
+
+  session->failures = runCommands(ctx, session);
+  updateCache(ctx, session);
+
+  custom_cpc_close(ctx);
+  if (session->latency != NULL) {
+    char prefix[64] = "";
+
+    // Runs are usually shorter than a window slice
+    custom_cpc_latency_evaluate(session->latency);
+    if (show_latency) {
+      if (multi_instance) {
+        snprintf(prefix, sizeof(prefix), "[%s] ", session->instance_name);
+      }
+      flockfile(stdout);
+      printf("%sLatency:\n", prefix);
+      custom_cpc_latency_dump(session->latency, stdout, prefix);
+      funlockfile(stdout);
+    }
+    custom_cpc_latency_destroy(session->latency);
+  }
+  return NULL;
 }
 
+// Add one session per instance name in a comma separated list
+static int addInstances(char *list){
+  for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    if (session_count >= MAX_INSTANCES) {
+      fprintf(stderr,"too many instances (max %d)\n", MAX_INSTANCES);
+      return -1;
+    }
+    sessions[session_count++].instance_name = name;
+  }
+  multi_instance = true;
+  return 0;
+}
 
 int main(int argc, char* argv[]) {
     int opt = 0;
-    enum CustCpcCommand custCommand;
-    uint16_t ctune_val;
-    uint8_t cpc_tx_buf[SL_CPC_READ_MINIMUM_SIZE];
-    uint8_t gpio_out_val;
-    ssize_t len;
+    int failures = 0;
+    unsigned long value;
+    int ret;
+
+    config.enable_tracing = ENABLE_TRACING;
+    buildOptions();
 
     if (argc < 2)
     {
-      printf(HELP_MESSAGE);
+      printHelp();
       exit(0);
     }
-    // Process command line options.
+    // Process command line options. Commands are queued in the order given.
     while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
       switch (opt) {
         case 'h':
-          printf(HELP_MESSAGE);
+          printHelp();
           exit(0);
         break;
 
-        case 'a':
-          custCommand = CPC_COMMAND_GET_CUST_VERSION;
-          debug_print("CPC_COMMAND_GET_CUST_VERSION\r\n");
-        break;
+        case 'v':
+          //print app version info and exit
+          printf("App Version: %d.%d\r\n", APP_VERSION_MAJOR, APP_VERSION_MINOR);
+          exit(0);
+          break;
 
-        case 'b':
-          custCommand = CPC_COMMAND_GET_SE_VERSION;
-        break;
+        case 't':
+          config.timeout_ms = strtoul(optarg,NULL,0);
+          if (config.timeout_ms == 0) {
+            fprintf(stderr,"invalid timeout: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
 
-        case 'c':
-          custCommand = CPC_COMMAND_GET_CTUNE_TOKEN;
-        break;
+        case 'y':
+          config.retries = (unsigned int) strtoul(optarg,NULL,0);
+          break;
 
-        case 'd':
-          custCommand = CPC_COMMAND_SET_CTUNE_TOKEN;
-          ctune_val = (uint16_t) strtoul(optarg,NULL,0);
-          // TODO: check range?
-        break;
+        case 'w':
+          value = strtoul(optarg,NULL,0);
+          if ((value == 0) || (value > CUSTOM_CPC_MAX_WINDOW)) {
+            fprintf(stderr,"invalid window size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          config.window_size = (uint8_t) value;
+          break;
 
-        case 'e':
-          custCommand = CPC_COMMAND_GET_CTUNE_VALUE;
-        break;
+        case 'n':
+          daemon_path = optarg;
+          break;
 
-        case 'f':
-          custCommand = CPC_COMMAND_SET_CTUNE_VALUE;
-          ctune_val = (uint16_t) strtoul(optarg,NULL,0);
-          // TODO: check range?
-        break;
+        case 'o':
+          config.socket_path = optarg;
+          break;
 
-        case 'g':
-          custCommand = CPC_COMMAND_TONE_START;
-        break;
+        case 'q':
+          config.no_close_wait = true;
+          break;
 
-        case 'i':
-          custCommand = CPC_COMMAND_TONE_STOP;
-        break;
+        case 'c':
+          cache_dir = optarg;
+          break;
 
-        case 'j':
-          custCommand = CPC_COMMAND_GPIO_WRITE;
-          gpio_out_val = atoi(optarg);
-        break;
+        case 'f':
+          socket_folder = optarg;
+          break;
 
-        case 'k':
-          custCommand = CPC_COMMAND_ERASE_USERDATA_PAGE;
-        break;
+        case 'g':
+          show_progress = true;
+          break;
 
-        case 'v':
-          //print app version info and exit
-          printf("App Version: %d.%d\r\n", APP_VERSION_MAJOR, APP_VERSION_MINOR);
-          exit(0);
+        case 'a':
+          config.capture_path = optarg;
           break;
 
         case 'l':
-          custCommand = CPC_COMMAND_GET_BTL_VERSION;
+          show_latency = true;
+          break;
+
+        case 'e':
+          if (addSlo(optarg) != 0) {
+            exit(EXIT_FAILURE);
+          }
           break;
 
         case 'm':
-          custCommand = CPC_COMMAND_GET_APP_PROPERTIES_VERSION;
+          slo_window_ms = strtoul(optarg,NULL,0);
+          if (slo_window_ms < CUSTOM_CPC_LATENCY_SLICES) {
+            fprintf(stderr,"invalid slo window: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'p':
+          if (addInstances(optarg) != 0) {
+            exit(EXIT_FAILURE);
+          }
           break;
-          
+
+        case 'r':
+        case 'u':
+          if (addTransfer(opt == 'u', optarg) != 0) {
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 's':
+          if (readScript(optarg) != 0) {
+            exit(EXIT_FAILURE);
+          }
+          break;
+
         default:
+          // An optional argument may also be given as the next word
+          if ((optarg == NULL) && (optind < argc) && (argv[optind][0] != '-') && hasOptionalArgument(opt)) {
+            optarg = argv[optind++];
+          }
+          if (addCommand(opt, optarg) < 0) {
+            exit(EXIT_FAILURE);
+          }
         break;
       }
     }
 
-    connectcpc();
-
-    cpc_tx_buf[0] = (uint8_t) custCommand;
-    switch (custCommand) {
-      case CPC_COMMAND_GET_CUST_VERSION:
-      case CPC_COMMAND_GET_SE_VERSION:
-      case CPC_COMMAND_GET_CTUNE_TOKEN:
-      case CPC_COMMAND_GET_CTUNE_VALUE:
-      case CPC_COMMAND_TONE_START:
-      case CPC_COMMAND_TONE_STOP:
-      case CPC_COMMAND_ERASE_USERDATA_PAGE:
-      case CPC_COMMAND_GET_BTL_VERSION:
-      case CPC_COMMAND_GET_APP_PROPERTIES_VERSION:
-        /* For these, just send command and print result and exit*/
-        debug_print("sending command 0x%x with no argument\r\n", custCommand);
-        sendCmd(cpc_tx_buf,1);
-      break;
+    if (daemon_path != NULL) {
+      custom_cpc_latency_t *latency = createLatency(NULL);
 
-      case CPC_COMMAND_GPIO_WRITE:
-        debug_print("sending gpio command with argument %d\r\n", gpio_out_val);
-        memcpy(&cpc_tx_buf[1],&gpio_out_val,1); //send gpio val
-        sendCmd(cpc_tx_buf,2);
-      break;
-
-      case CPC_COMMAND_SET_CTUNE_TOKEN:
-        debug_print("setting ctune token to 0x%x\r\n", ctune_val);
-        memcpy(&cpc_tx_buf[1], &ctune_val, sizeof(uint16_t));
-        sendCmd(cpc_tx_buf,3);
-      break;
+      ret = cpc_daemon_run(daemon_path, ENABLE_TRACING, config.timeout_ms, latency);
+      custom_cpc_latency_destroy(latency);
+      exit(ret == 0 ? 0 : EXIT_FAILURE);
+    }
 
-      case CPC_COMMAND_SET_CTUNE_VALUE:
-        debug_print("setting ctune value to 0x%x\r\n", ctune_val);
-        memcpy(&cpc_tx_buf[1], &ctune_val, sizeof(uint16_t));
-        sendCmd(cpc_tx_buf,3);
-      break;
+    if (command_count == 0) {
+      printf("No command!\r\n");
+      printHelp();
+      exit(EXIT_FAILURE);
+    }
 
-      default:
-        printf("No command!\r\n");
-        printf(HELP_MESSAGE);
+    for (uint8_t i = 0; i < command_count && multi_instance; i++) {
+      if ((commands[i].info != NULL) && (commands[i].info->opcode == CPC_COMMAND_CTUNE_SEARCH)) {
+        fprintf(stderr,"ctune_search needs feedback for a single RCP and cannot be used with --instances\n");
         exit(EXIT_FAILURE);
-      break;
+      }
     }
 
-    /* Always receive and print reply (may just be a status byte)*/
-    len = getReply(cpc_tx_buf);
-    printf("Reply to command 0x%x, len=%d: ",custCommand, len);
-    if (len >= 0) {
-      for (uint8_t i=0;i<len;i++) {
-        printf("0x%x ", cpc_tx_buf[i]);
-      }
-      printf("\r\n");
+    if (session_count == 0) {
+      // Default cpcd instance, run in this thread
+      session_count = 1;
+      runSession(&sessions[0]);
     } else {
-      printf("read timeout! cpc_read_endpoint last returned %s\r\n", strerror(-len));
+      // One thread per instance, all running the same command list
+      for (uint8_t i = 0; i < session_count; i++) {
+        if (pthread_create(&sessions[i].thread, NULL, runSession, &sessions[i]) != 0) {
+          fprintf(stderr,"cannot start thread for instance %s\n", sessions[i].instance_name);
+          exit(EXIT_FAILURE);
+        }
+      }
+      for (uint8_t i = 0; i < session_count; i++) {
+        pthread_join(sessions[i].thread, NULL);
+      }
     }
 
-    disconnectcpc();
-    exit(0);
-}
\ No newline at end of file
+    for (uint8_t i = 0; i < session_count; i++) {
+      failures += sessions[i].failures;
+    }
+    exit(failures ? EXIT_FAILURE : 0);
+}
@@ -0,0 +1,300 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_latency.c
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "custom_cpc.h"
+#include "custom_cpc_latency.h"
+
+#define SUB_COUNT (1u << CUSTOM_CPC_LATENCY_SUB_BITS)
+#define HALF_COUNT (SUB_COUNT / 2)
+#define OPCODE_COUNT (CPC_COMMAND_OPCODE_MAX + 1)
+
+typedef struct {
+  uint32_t counts[CUSTOM_CPC_LATENCY_BUCKETS];
+  uint32_t total;
+  uint32_t max_us;
+} histogram_t;
+
+struct opcode_latency {
+  histogram_t all;
+  histogram_t slices[CUSTOM_CPC_LATENCY_SLICES];
+  uint32_t timeouts;
+  uint32_t threshold_us;
+  uint32_t violations;
+  bool over;           // last evaluation was over the threshold
+};
+
+struct custom_cpc_latency {
+  struct opcode_latency opcodes[OPCODE_COUNT];
+  unsigned int slice;  // slice being recorded
+  uint64_t slice_ns;
+  uint64_t slice_start_ns;
+  custom_cpc_slo_alert_t alert;
+  void *alert_arg;
+};
+
+static unsigned int bucket_index(uint64_t us){
+  unsigned int shift;
+
+  if (us > CUSTOM_CPC_LATENCY_MAX_US) {
+    us = CUSTOM_CPC_LATENCY_MAX_US;
+  }
+  if (us < SUB_COUNT) {
+    return (unsigned int) us;
+  }
+  shift = (unsigned int) (63 - __builtin_clzll(us)) - (CUSTOM_CPC_LATENCY_SUB_BITS - 1);
+  return shift * HALF_COUNT + (unsigned int) (us >> shift);
+}
+
+// Highest value counted in a bucket
+static uint32_t bucket_upper(unsigned int index){
+  unsigned int shift;
+
+  if (index < SUB_COUNT) {
+    return index;
+  }
+  shift = index / HALF_COUNT - 1;
+  return ((index - shift * HALF_COUNT + 1) << shift) - 1;
+}
+
+static void histogram_add(histogram_t *h, unsigned int index, uint32_t us){
+  uint32_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&h->counts[index], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+  while ((us > max)
+         && !__atomic_compare_exchange_n(&h->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void histogram_clear(histogram_t *h){
+  for (unsigned int i = 0; i < CUSTOM_CPC_LATENCY_BUCKETS; i++) {
+    __atomic_store_n(&h->counts[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&h->total, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->max_us, 0, __ATOMIC_RELAXED);
+}
+
+// Nearest rank percentile of the sum of count histograms, as the upper
+// bound of its bucket but never above the largest value seen
+static uint32_t percentile(const histogram_t *h, unsigned int count, uint32_t permille){
+  uint64_t total = 0, rank, seen = 0;
+  uint32_t max = 0;
+
+  for (unsigned int s = 0; s < count; s++) {
+    uint32_t m = __atomic_load_n(&h[s].max_us, __ATOMIC_RELAXED);
+
+    total += __atomic_load_n(&h[s].total, __ATOMIC_RELAXED);
+    max = (m > max) ? m : max;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  rank = (total * permille + 999) / 1000;
+  for (unsigned int i = 0; i < CUSTOM_CPC_LATENCY_BUCKETS; i++) {
+    for (unsigned int s = 0; s < count; s++) {
+      seen += __atomic_load_n(&h[s].counts[i], __ATOMIC_RELAXED);
+    }
+    if (seen >= rank) {
+      uint32_t upper = bucket_upper(i);
+      return (upper < max) ? upper : max;
+    }
+  }
+  return max;
+}
+
+int custom_cpc_latency_create(custom_cpc_latency_t **lat, unsigned long window_ms){
+  custom_cpc_latency_t *l;
+
+  if ((lat == NULL) || (window_ms < CUSTOM_CPC_LATENCY_SLICES)) {
+    return -EINVAL;
+  }
+  l = calloc(1, sizeof(*l));
+  if (l == NULL) {
+    return -ENOMEM;
+  }
+  l->slice_ns = (uint64_t) window_ms * 1000000ull / CUSTOM_CPC_LATENCY_SLICES;
+  *lat = l;
+  return 0;
+}
+
+void custom_cpc_latency_destroy(custom_cpc_latency_t *lat){
+  free(lat);
+}
+
+int custom_cpc_latency_set_threshold(custom_cpc_latency_t *lat, uint8_t opcode, uint32_t threshold_us){
+  if ((lat == NULL) || (opcode >= OPCODE_COUNT)) {
+    return -EINVAL;
+  }
+  lat->opcodes[opcode].threshold_us = threshold_us;
+  return 0;
+}
+
+void custom_cpc_latency_set_alert(custom_cpc_latency_t *lat, custom_cpc_slo_alert_t alert, void *user_arg){
+  if (lat != NULL) {
+    lat->alert = alert;
+    lat->alert_arg = user_arg;
+  }
+}
+
+void custom_cpc_latency_record(custom_cpc_latency_t *lat, uint8_t opcode, uint64_t ns){
+  struct opcode_latency *o;
+  uint64_t us = ns / 1000;
+  unsigned int index = bucket_index(us);
+
+  if ((lat == NULL) || (opcode >= OPCODE_COUNT)) {
+    return;
+  }
+  o = &lat->opcodes[opcode];
+  us = (us > CUSTOM_CPC_LATENCY_MAX_US) ? CUSTOM_CPC_LATENCY_MAX_US : us;
+  histogram_add(&o->all, index, (uint32_t) us);
+  histogram_add(&o->slices[__atomic_load_n(&lat->slice, __ATOMIC_RELAXED)], index, (uint32_t) us);
+}
+
+void custom_cpc_latency_timeout(custom_cpc_latency_t *lat, uint8_t opcode){
+  if ((lat != NULL) && (opcode < OPCODE_COUNT)) {
+    __atomic_fetch_add(&lat->opcodes[opcode].timeouts, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void custom_cpc_latency_evaluate(custom_cpc_latency_t *lat){
+  if (lat == NULL) {
+    return;
+  }
+  for (unsigned int op = 0; op < OPCODE_COUNT; op++) {
+    struct opcode_latency *o = &lat->opcodes[op];
+    uint32_t samples = 0, p99;
+    bool over;
+
+    if (o->threshold_us == 0) {
+      continue;
+    }
+    for (unsigned int s = 0; s < CUSTOM_CPC_LATENCY_SLICES; s++) {
+      samples += __atomic_load_n(&o->slices[s].total, __ATOMIC_RELAXED);
+    }
+    // An opcode idle for a whole window is back under
+    p99 = (samples > 0) ? percentile(o->slices, CUSTOM_CPC_LATENCY_SLICES, 990) : 0;
+    over = (p99 > o->threshold_us);
+    if (over) {
+      __atomic_fetch_add(&o->violations, 1, __ATOMIC_RELAXED);
+    }
+    if ((over != o->over) && (lat->alert != NULL)) {
+      lat->alert(lat->alert_arg, (uint8_t) op, over, p99, o->threshold_us, samples);
+    }
+    o->over = over;
+  }
+}
+
+void custom_cpc_latency_check(custom_cpc_latency_t *lat, uint64_t now_ns){
+  if (lat == NULL) {
+    return;
+  }
+  if (lat->slice_start_ns == 0) {
+    lat->slice_start_ns = now_ns;
+    return;
+  }
+  if (now_ns - lat->slice_start_ns >= lat->slice_ns * (CUSTOM_CPC_LATENCY_SLICES + 1)) {
+    // Not called for more than a window: evaluate the last one, then
+    // start over with an empty window
+    custom_cpc_latency_evaluate(lat);
+    for (unsigned int op = 0; op < OPCODE_COUNT; op++) {
+      for (unsigned int s = 0; s < CUSTOM_CPC_LATENCY_SLICES; s++) {
+        histogram_clear(&lat->opcodes[op].slices[s]);
+      }
+    }
+    lat->slice_start_ns = now_ns;
+    custom_cpc_latency_evaluate(lat);
+    return;
+  }
+  while (now_ns - lat->slice_start_ns >= lat->slice_ns) {
+    unsigned int next = (lat->slice + 1) % CUSTOM_CPC_LATENCY_SLICES;
+
+    custom_cpc_latency_evaluate(lat);
+    for (unsigned int op = 0; op < OPCODE_COUNT; op++) {
+      histogram_clear(&lat->opcodes[op].slices[next]);
+    }
+    __atomic_store_n(&lat->slice, next, __ATOMIC_RELAXED);
+    lat->slice_start_ns += lat->slice_ns;
+  }
+}
+
+int custom_cpc_latency_summary(const custom_cpc_latency_t *lat, uint8_t opcode, custom_cpc_latency_summary_t *summary){
+  const struct opcode_latency *o;
+
+  if ((lat == NULL) || (opcode >= OPCODE_COUNT) || (summary == NULL)) {
+    return -EINVAL;
+  }
+  o = &lat->opcodes[opcode];
+  summary->count = __atomic_load_n(&o->all.total, __ATOMIC_RELAXED);
+  summary->timeouts = __atomic_load_n(&o->timeouts, __ATOMIC_RELAXED);
+  if ((summary->count == 0) && (summary->timeouts == 0)) {
+    return -ENOENT;
+  }
+  summary->threshold_us = o->threshold_us;
+  summary->violations = __atomic_load_n(&o->violations, __ATOMIC_RELAXED);
+  summary->p50_us = percentile(&o->all, 1, 500);
+  summary->p90_us = percentile(&o->all, 1, 900);
+  summary->p99_us = percentile(&o->all, 1, 990);
+  summary->p999_us = percentile(&o->all, 1, 999);
+  summary->max_us = __atomic_load_n(&o->all.max_us, __ATOMIC_RELAXED);
+  return 0;
+}
+
+void custom_cpc_latency_dump(const custom_cpc_latency_t *lat, FILE *out, const char *prefix){
+  custom_cpc_latency_summary_t s;
+
+  if ((lat == NULL) || (out == NULL)) {
+    return;
+  }
+  prefix = (prefix != NULL) ? prefix : "";
+  for (unsigned int op = 0; op < OPCODE_COUNT; op++) {
+    const custom_cpc_command_info_t *info = custom_cpc_command_info((uint8_t) op);
+    const histogram_t *h = &lat->opcodes[op].all;
+
+    if (custom_cpc_latency_summary(lat, (uint8_t) op, &s) < 0) {
+      continue;
+    }
+    fprintf(out, "%s%s: %u replies, %u timeouts, p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u us",
+            prefix, (info != NULL) ? info->name : "unknown", s.count, s.timeouts,
+            s.p50_us, s.p90_us, s.p99_us, s.p999_us, s.max_us);
+    if (s.threshold_us != 0) {
+      fprintf(out, ", slo p99 %u us (%u windows over)", s.threshold_us, s.violations);
+    }
+    fprintf(out, "\n");
+    for (unsigned int i = 0; i < CUSTOM_CPC_LATENCY_BUCKETS; i++) {
+      uint32_t count = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+
+      if (count > 0) {
+        fprintf(out, "%s  <= %u us: %u\n", prefix, bucket_upper(i), count);
+      }
+    }
+  }
+}
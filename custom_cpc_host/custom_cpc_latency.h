@@ -0,0 +1,118 @@
+/***************************************************************************//**
+ * @file
+ * @brief custom_cpc_latency.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef CUSTOM_CPC_LATENCY_H_
+#define CUSTOM_CPC_LATENCY_H_
+
+/*
+ * Per-opcode histograms of the time from sending a command to its reply,
+ * with an optional p99 threshold (SLO) per opcode checked over a rolling
+ * window.
+ *
+ * Values are kept in microseconds in log-linear buckets, HDR style: exact
+ * below 32 us, then 16 buckets per power of two, so a bucket is at most
+ * 6.25% wide. Percentiles are reported as the upper bound of their bucket.
+ *
+ * Recording only does relaxed atomic increments on memory allocated by
+ * custom_cpc_latency_create(): it takes no lock and allocates nothing, so
+ * one thread may record while another reads a summary or dumps. The
+ * rolling window is kept as CUSTOM_CPC_LATENCY_SLICES slices of
+ * window_ms / CUSTOM_CPC_LATENCY_SLICES; custom_cpc_latency_check()
+ * closes the slices that are due, evaluates the thresholds over the last
+ * window_ms each time it does, and must only be called from one thread.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CUSTOM_CPC_LATENCY_SUB_BITS 5
+#define CUSTOM_CPC_LATENCY_MAX_US ((1ul << 27) - 1) // larger values count as this
+#define CUSTOM_CPC_LATENCY_BUCKETS ((27 - CUSTOM_CPC_LATENCY_SUB_BITS + 2) << (CUSTOM_CPC_LATENCY_SUB_BITS - 1))
+
+#ifndef CUSTOM_CPC_LATENCY_SLICES
+#define CUSTOM_CPC_LATENCY_SLICES 4
+#endif
+
+#define CUSTOM_CPC_LATENCY_WINDOW_MS_DEFAULT 10000
+
+typedef struct custom_cpc_latency custom_cpc_latency_t;
+
+/*
+ * Called when the p99 of an opcode over the window goes over its
+ * threshold (over true), and when it is back under it. samples is the
+ * number of replies in the window.
+ */
+typedef void (*custom_cpc_slo_alert_t)(void *user_arg,
+                                       uint8_t opcode,
+                                       bool over,
+                                       uint32_t p99_us,
+                                       uint32_t threshold_us,
+                                       uint32_t samples);
+
+typedef struct {
+  uint32_t count;        // replies since creation
+  uint32_t timeouts;     // commands that got no reply
+  uint32_t threshold_us; // 0 if none
+  uint32_t violations;   // window evaluations over the threshold
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t p999_us;
+  uint32_t max_us;
+} custom_cpc_latency_summary_t;
+
+int custom_cpc_latency_create(custom_cpc_latency_t **lat, unsigned long window_ms);
+void custom_cpc_latency_destroy(custom_cpc_latency_t *lat);
+
+// p99 threshold of opcode in microseconds, 0 to remove it
+int custom_cpc_latency_set_threshold(custom_cpc_latency_t *lat, uint8_t opcode, uint32_t threshold_us);
+void custom_cpc_latency_set_alert(custom_cpc_latency_t *lat, custom_cpc_slo_alert_t alert, void *user_arg);
+
+// Command path: a reply that arrived after ns, or none at all
+void custom_cpc_latency_record(custom_cpc_latency_t *lat, uint8_t opcode, uint64_t ns);
+void custom_cpc_latency_timeout(custom_cpc_latency_t *lat, uint8_t opcode);
+
+// Closes the window slices that ended before now_ns (CLOCK_MONOTONIC)
+void custom_cpc_latency_check(custom_cpc_latency_t *lat, uint64_t now_ns);
+
+// Evaluates the thresholds over the current window right away, e.g. at
+// the end of a run shorter than a slice
+void custom_cpc_latency_evaluate(custom_cpc_latency_t *lat);
+
+// Since creation. Returns -ENOENT if opcode has neither replies nor
+// timeouts.
+int custom_cpc_latency_summary(const custom_cpc_latency_t *lat, uint8_t opcode, custom_cpc_latency_summary_t *summary);
+
+// Writes the summary and the non-empty buckets of every opcode to out,
+// each line starting with prefix
+void custom_cpc_latency_dump(const custom_cpc_latency_t *lat, FILE *out, const char *prefix);
+
+#endif /* CUSTOM_CPC_LATENCY_H_ */
@@ -0,0 +1,284 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_cache.c
+ * Checks the --cache hits and refreshes against the simulated RCP
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "custom_cpc_cache.h"
+
+#define OPTSTRING "he:"
+
+static struct option long_options[] = {
+     {"help", no_argument,       0, 'h' },
+     {"host", required_argument, 0, 'e' },
+     {0,      0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_cache <arguments>\n"\
+"                                   \n"\
+"Runs the simulated custom_cpc_host with --cache in temporary folders and checks, from its replies and the\n"\
+"cache entry it leaves, that: nothing is cached before the simulated cpcd has started, the entry is filled\n"\
+"on the next run, a hit is answered without connecting, a restart of cpcd after a reflash makes the entry\n"\
+"stale, and a reply that differs from the entry in the same cpcd run refreshes it. Exits with an error if\n"\
+"a check fails.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -e, --host <path>               custom_cpc_host to run (default: the one next to this program)\n"\
+"                                   \n"
+
+// Instance the simulated cpcd runs as when none is given
+#define INSTANCE CUSTOM_CPC_DEFAULT_INSTANCE
+
+static char host[PATH_MAX];
+static char socket_folder[] = "/tmp/cpc_sim_cache_shm.XXXXXX";
+static char cache_dir[] = "/tmp/cpc_sim_cache_dir.XXXXXX";
+static unsigned int failures;
+
+#define CHECK(cond) \
+    do { \
+      if (!(cond)) { \
+        printf("  line %d: %s\n", __LINE__, #cond); \
+        failures++; \
+        return; \
+      } \
+    } while (0)
+
+// Runs the host with --cache and the given environment and arguments.
+// Returns its exit status, its output in out.
+static int runHost(const char *env, const char *args, char *out, size_t size) {
+    char command[3 * PATH_MAX];
+    size_t len = 0;
+    FILE *f;
+    int status;
+
+    snprintf(command, sizeof(command),
+             "CPC_SIM_SOCKET_FOLDER=%s %s %s --cache %s --socket_folder %s %s 2>&1",
+             socket_folder, env, host, cache_dir, socket_folder, args);
+    f = popen(command, "r");
+    if (f == NULL) {
+      return -1;
+    }
+    len = fread(out, 1, size - 1, f);
+    out[len] = '\0';
+    status = pclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// True if out holds the reply to --app_properties_version with version
+static bool repliedVersion(const char *out, unsigned int version) {
+    char line[64];
+
+    snprintf(line, sizeof(line), "Reply to command 0xc, len=4: 0x%x 0x0 0x0 0x0", version);
+    return strstr(out, line) != NULL;
+}
+
+// Loads the entry against the stamp of the running simulated cpcd
+static int loadEntry(custom_cpc_device_info_t *info) {
+    custom_cpc_cache_stamp_t stamp;
+    int ret;
+
+    ret = custom_cpc_cache_stamp(socket_folder, INSTANCE, &stamp);
+    if (ret < 0) {
+      return ret;
+    }
+    return custom_cpc_cache_load(cache_dir, INSTANCE, &stamp, info);
+}
+
+static bool entryExists(void) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s.cache", cache_dir, INSTANCE);
+    return access(path, F_OK) == 0;
+}
+
+static void checkMiss(void) {
+    custom_cpc_device_info_t info;
+    char out[4096];
+
+    // cpcd not started yet: nothing can be stamped, nothing is cached
+    CHECK(runHost("", "--app_properties_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 1));
+    CHECK(!entryExists());
+    // Started now: the entry is filled
+    CHECK(runHost("", "--app_properties_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 1));
+    CHECK(loadEntry(&info) == 0);
+    CHECK(info.app_properties_version == 1);
+}
+
+static void checkHit(void) {
+    char out[4096];
+
+    // Answered without cpc_init(), which would fail
+    CHECK(runHost("CPC_SIM_INIT_FAILURES=100", "--app_properties_version --cust_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 1));
+    CHECK(strstr(out, "Reply to command 0x1, len=4: 0x78 0x56 0x34 0x12") != NULL);
+    // A command that is not cached needs the RCP
+    CHECK(runHost("CPC_SIM_INIT_FAILURES=100", "--app_properties_version --get_ctune_value", out, sizeof(out)) != 0);
+}
+
+static void checkRestart(void) {
+    custom_cpc_device_info_t info;
+    char out[4096];
+
+    // Reflashed: the simulated cpcd is restarted and its socket recreated
+    CHECK(runHost("CPC_SIM_APP_VERSION=2", "--app_properties_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 2));
+    CHECK(loadEntry(&info) == 0);
+    CHECK(info.app_properties_version == 2);
+    CHECK(runHost("CPC_SIM_APP_VERSION=2 CPC_SIM_INIT_FAILURES=100", "--app_properties_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 2));
+}
+
+// Reflashes the simulated RCP without restarting cpcd: the stand-in socket
+// keeps its inode and modification time, only the version it records
+// changes, so the simulator does not recreate it
+static bool reflashInPlace(unsigned int version) {
+    char path[PATH_MAX];
+    char text[32];
+    struct stat st;
+    struct timespec times[2];
+    int fd;
+    bool ok;
+
+    snprintf(path, sizeof(path), "%s/cpcd/%s/ctrl.cpcd.sock", socket_folder, INSTANCE);
+    snprintf(text, sizeof(text), "0x%08x\n", version);
+    if (stat(path, &st) != 0) {
+      return false;
+    }
+    fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd < 0) {
+      return false;
+    }
+    ok = write(fd, text, strlen(text)) == (ssize_t) strlen(text);
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    ok = ok && (futimens(fd, times) == 0);
+    close(fd);
+    return ok;
+}
+
+static void checkMismatch(void) {
+    custom_cpc_device_info_t info;
+    custom_cpc_cache_stamp_t before, after;
+    char out[4096];
+
+    CHECK(custom_cpc_cache_stamp(socket_folder, INSTANCE, &before) == 0);
+    CHECK(reflashInPlace(3));
+    CHECK(custom_cpc_cache_stamp(socket_folder, INSTANCE, &after) == 0);
+    CHECK(memcmp(&before, &after, sizeof(before)) == 0);
+    CHECK(loadEntry(&info) == 0 && info.app_properties_version == 2);
+    // The RCP is asked for get_ctune_value, and its app version differs
+    // from the entry: the entry is refreshed
+    CHECK(runHost("CPC_SIM_APP_VERSION=3", "--app_properties_version --get_ctune_value", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 3));
+    CHECK(loadEntry(&info) == 0);
+    CHECK(info.app_properties_version == 3);
+    CHECK(runHost("CPC_SIM_APP_VERSION=3 CPC_SIM_INIT_FAILURES=100", "--app_properties_version", out, sizeof(out)) == 0);
+    CHECK(repliedVersion(out, 3));
+}
+
+static void run(const char *name, void (*check)(void)) {
+    unsigned int before = failures;
+
+    printf("%s\n", name);
+    check();
+    printf("  %s\n", (failures == before) ? "ok" : "FAILED");
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    char self[PATH_MAX];
+    ssize_t len;
+    int opt = 0;
+
+    len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len > 0) {
+      self[len] = '\0';
+      snprintf(host, sizeof(host), "%s/custom_cpc_host", dirname(self));
+    }
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'e':
+          snprintf(host, sizeof(host), "%s", optarg);
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    if (access(host, X_OK) != 0) {
+      fprintf(stderr,"cannot run %s\n", host);
+      exit(EXIT_FAILURE);
+    }
+    if ((mkdtemp(socket_folder) == NULL) || (mkdtemp(cache_dir) == NULL)) {
+      fprintf(stderr,"cannot create temporary folders: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    // mkdtemp() created the folder, the simulated cpcd is started by the
+    // first run that connects
+    run("miss, then filled", checkMiss);
+    run("hit without connecting", checkHit);
+    run("cpcd restarted after a reflash", checkRestart);
+    run("reflashed in the same cpcd run", checkMismatch);
+
+    nftw(socket_folder, removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+    nftw(cache_dir, removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+    if (failures > 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_frame.c
+ * Fuzzes the frame codec of cpc_frame.h
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+/*
+ * LLVMFuzzerTestOneInput() can be run by libFuzzer (`make fuzz`, built
+ * with CPC_FRAME_LIBFUZZER), or by the deterministic driver in main(),
+ * which `make sim` builds with AddressSanitizer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "cpc_frame.h"
+
+// Largest frame tried, a CPC frame fits in SL_CPC_READ_MINIMUM_SIZE
+#define FRAME_MAX 4096
+
+#define FUZZ_CHECK(cond) \
+    do { \
+      if (!(cond)) { \
+        fprintf(stderr,"cpc_sim_frame: line %d: %s\n", __LINE__, #cond); \
+        abort(); \
+      } \
+    } while (0)
+
+// Decodes data as a frame from the RCP or the host. data is a copy of
+// exactly size bytes on the heap, so that AddressSanitizer reports any
+// read past its end, and everything decode and the TLV iterator return
+// must lie within it.
+static void fuzzDecode(const uint8_t *data, size_t size) {
+    uint8_t *frame = malloc(size > 0 ? size : 1);
+    const uint8_t *end;
+    const uint8_t *value;
+    cpc_frame_t f;
+    uint16_t offset = 0;
+    uint16_t tlv_bytes = 0;
+    uint8_t status;
+    uint8_t type;
+    uint8_t len;
+
+    FUZZ_CHECK(frame != NULL);
+    memcpy(frame, data, size);
+    end = frame + size;
+    status = cpc_frame_decode(frame, size, &f);
+    if (status == CPC_FRAME_OK) {
+      FUZZ_CHECK(f.version == CPC_FRAME_VERSION);
+      FUZZ_CHECK(f.payload == frame + CPC_FRAME_HEADER_SIZE);
+      FUZZ_CHECK(f.payload + f.len <= end);
+      if (f.flags & CPC_FRAME_FLAG_TLV) {
+        FUZZ_CHECK(f.tlv == f.payload + f.len);
+        FUZZ_CHECK(f.tlv + f.tlv_len == end);
+      } else {
+        FUZZ_CHECK(f.tlv == NULL && f.payload + f.len == end);
+      }
+      while (cpc_frame_next_tlv(&f, &offset, &type, &len, &value)) {
+        FUZZ_CHECK(value >= f.tlv + 2 && value + len <= end);
+        FUZZ_CHECK(offset <= f.tlv_len);
+        tlv_bytes = (uint16_t) (tlv_bytes + 2 + len);
+        (void) type;
+      }
+      FUZZ_CHECK(tlv_bytes == f.tlv_len);
+    } else {
+      // The header is still filled in, to answer a bad command
+      FUZZ_CHECK(status <= CPC_FRAME_MALFORMED);
+      FUZZ_CHECK((size >= CPC_FRAME_HEADER_SIZE) || (status == CPC_FRAME_MALFORMED));
+      if (size >= CPC_FRAME_HEADER_SIZE) {
+        FUZZ_CHECK(f.opcode == frame[1] && f.seq == frame[3]);
+      }
+    }
+    free(frame);
+}
+
+// Builds a frame from data (header fields, payload, then TLVs), encodes
+// it and checks that decoding gives back what was encoded
+static void fuzzRoundTrip(const uint8_t *data, size_t size) {
+    uint8_t frame[FRAME_MAX];
+    const uint8_t *value;
+    const uint8_t *in = data;
+    const uint8_t *in_end = data + size;
+    size_t frame_len;
+    size_t payload_len;
+    size_t tlv_count = 0;
+    struct {
+      uint8_t type;
+      uint8_t len;
+      const uint8_t *value;
+    } tlvs[64];
+    cpc_frame_t f;
+    uint16_t offset = 0;
+    uint8_t header[5];
+    uint8_t type;
+    uint8_t len;
+    size_t n;
+
+    if (size < sizeof(header) + 2) {
+      return;
+    }
+    memcpy(header, in, sizeof(header));
+    in += sizeof(header);
+    payload_len = cpc_get_u16(in) % (FRAME_MAX / 2);
+    in += 2;
+    if (payload_len > (size_t) (in_end - in)) {
+      payload_len = (size_t) (in_end - in);
+    }
+    memcpy(frame + CPC_FRAME_HEADER_SIZE, in, payload_len);
+    in += payload_len;
+    frame_len = cpc_frame_encode(frame, header[0], header[1] & (uint8_t) ~CPC_FRAME_FLAG_TLV,
+                                 header[2], header[3], (uint16_t) payload_len);
+    FUZZ_CHECK(frame_len == CPC_FRAME_HEADER_SIZE + payload_len);
+
+    // The rest of data is TLVs: type, len, then up to len bytes of value
+    while ((in_end - in >= 2) && (tlv_count < sizeof(tlvs) / sizeof(tlvs[0]))) {
+      type = in[0];
+      len = in[1];
+      in += 2;
+      if (len > (size_t) (in_end - in)) {
+        len = (uint8_t) (in_end - in);
+      }
+      n = cpc_frame_add_tlv(frame, frame_len, sizeof(frame), type, len, in);
+      if (n == 0) {
+        FUZZ_CHECK(frame_len + 2 + len > sizeof(frame));
+        break;
+      }
+      FUZZ_CHECK(n == frame_len + 2 + len);
+      tlvs[tlv_count].type = type;
+      tlvs[tlv_count].len = len;
+      tlvs[tlv_count].value = in;
+      tlv_count++;
+      frame_len = n;
+      in += len;
+    }
+
+    FUZZ_CHECK(cpc_frame_decode(frame, frame_len, &f) == CPC_FRAME_OK);
+    FUZZ_CHECK(f.version == CPC_FRAME_VERSION);
+    FUZZ_CHECK(f.opcode == header[0]);
+    FUZZ_CHECK(f.flags == ((header[1] & (uint8_t) ~CPC_FRAME_FLAG_TLV) | (tlv_count > 0 ? CPC_FRAME_FLAG_TLV : 0)));
+    FUZZ_CHECK(f.seq == header[2]);
+    FUZZ_CHECK(f.status == header[3]);
+    FUZZ_CHECK(f.len == payload_len);
+    FUZZ_CHECK(memcmp(f.payload, data + sizeof(header) + 2, payload_len) == 0);
+    for (size_t i = 0; i < tlv_count; i++) {
+      FUZZ_CHECK(cpc_frame_next_tlv(&f, &offset, &type, &len, &value));
+      FUZZ_CHECK(type == tlvs[i].type && len == tlvs[i].len);
+      FUZZ_CHECK(memcmp(value, tlvs[i].value, len) == 0);
+    }
+    FUZZ_CHECK(!cpc_frame_next_tlv(&f, &offset, &type, &len, &value));
+
+    // A relay remapping the sequence number keeps the frame valid
+    cpc_frame_set_seq(frame, (uint8_t) (header[2] + 1));
+    FUZZ_CHECK(cpc_frame_decode(frame, frame_len, &f) == CPC_FRAME_OK);
+    FUZZ_CHECK(f.seq == (uint8_t) (header[2] + 1));
+
+    // Cut short, a frame without TLVs no longer decodes
+    if (tlv_count == 0) {
+      for (n = 0; n < frame_len; n++) {
+        FUZZ_CHECK(cpc_frame_decode(frame, n, &f) != CPC_FRAME_OK);
+      }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzzDecode(data, size);
+    fuzzRoundTrip(data, size);
+    return 0;
+}
+
+#ifndef CPC_FRAME_LIBFUZZER
+
+#define OPTSTRING "hn:s:"
+
+#define DEFAULT_INPUTS 1000000
+
+static struct option long_options[] = {
+     {"help",   no_argument,       0, 'h' },
+     {"inputs", required_argument, 0, 'n' },
+     {"seed",   required_argument, 0, 's' },
+     {0,        0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_frame <arguments>\n"\
+"                                   \n"\
+"Runs the frame codec of cpc_frame.h on generated inputs: random bytes, valid frames with TLVs, and valid\n"\
+"frames with a few bytes changed, cut short or extended. Each input is decoded as a frame, checking that\n"\
+"nothing decoded or iterated lies outside it, and used to build a frame that must decode back to what was\n"\
+"encoded. Aborts on the first failure.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -n, --inputs <n>                Inputs to run (default 1000000)\n"\
+"   -s, --seed <value>              Seed of the inputs (default 1)\n"\
+"                                   \n"
+
+// A valid frame of a few TLVs, or random bytes with a valid header
+static size_t validFrame(uint8_t *frame, size_t size) {
+    size_t len = cpc_frame_encode(frame, (uint8_t) rand(), (uint8_t) (rand() & ~CPC_FRAME_FLAG_TLV),
+                                  (uint8_t) rand(), (uint8_t) rand(), (uint16_t) (rand() % 64));
+    uint8_t value[255];
+    size_t n;
+
+    for (size_t i = CPC_FRAME_HEADER_SIZE; i < len; i++) {
+      frame[i] = (uint8_t) rand();
+    }
+    for (int tlvs = rand() % 4; tlvs > 0; tlvs--) {
+      uint8_t vlen = (uint8_t) (rand() % 32);
+
+      for (uint8_t i = 0; i < vlen; i++) {
+        value[i] = (uint8_t) rand();
+      }
+      n = cpc_frame_add_tlv(frame, len, size, (uint8_t) rand(), vlen, value);
+      if (n == 0) {
+        break;
+      }
+      len = n;
+    }
+    return len;
+}
+
+int main(int argc, char* argv[]) {
+    static uint8_t input[FRAME_MAX];
+    unsigned long inputs = DEFAULT_INPUTS;
+    unsigned long accepted = 0;
+    unsigned int seed = 1;
+    cpc_frame_t f;
+    size_t len;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'n':
+          inputs = strtoul(optarg,NULL,0);
+          if (inputs == 0) {
+            fprintf(stderr,"invalid inputs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 's':
+          seed = (unsigned int) strtoul(optarg,NULL,0);
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    srand(seed);
+    for (unsigned long i = 0; i < inputs; i++) {
+      switch (i % 3) {
+        case 0: // random bytes, mostly with the right version
+          len = (size_t) rand() % 300;
+          for (size_t n = 0; n < len; n++) {
+            input[n] = (uint8_t) rand();
+          }
+          if ((len > 0) && (rand() % 4 != 0)) {
+            input[0] = CPC_FRAME_VERSION;
+          }
+          break;
+
+        case 1: // valid frame
+          len = validFrame(input, sizeof(input));
+          break;
+
+        default: // valid frame, then changed, cut short or extended
+          len = validFrame(input, sizeof(input));
+          for (int changes = 1 + rand() % 3; changes > 0; changes--) {
+            input[(size_t) rand() % len] = (uint8_t) rand();
+          }
+          if (rand() % 2 == 0) {
+            len = (size_t) rand() % (len + 8);
+          }
+          break;
+      }
+      accepted += (cpc_frame_decode(input, len, &f) == CPC_FRAME_OK) ? 1 : 0;
+      LLVMFuzzerTestOneInput(input, len);
+    }
+    printf("%lu inputs, %lu decoded as valid frames\n", inputs, accepted);
+    return 0;
+}
+
+#endif /* CPC_FRAME_LIBFUZZER */
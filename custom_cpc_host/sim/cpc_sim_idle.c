@@ -0,0 +1,154 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_idle.c
+ * Counts the simulated RCP super loop wakeups while nothing happens
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include "custom_cpc.h"
+#include "sim_link.h"
+
+#define OPTSTRING "hs:m:"
+
+#define DEFAULT_SECONDS 2
+
+// Time given to the RCP to finish reacting to an open or close before the
+// idle window starts
+#define SETTLE_MS 100
+
+static struct option long_options[] = {
+     {"help",     no_argument,       0, 'h' },
+     {"seconds",  required_argument, 0, 's' },
+     {"max_rate", required_argument, 0, 'm' },
+     {0,          0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_idle <arguments>\n"\
+"                                   \n"\
+"Runs the RCP command task in the simulator and counts how often its super loop wakes up while the host\n"\
+"stays idle, once with the endpoint connected and once after the host closed it. Prints the wakeups per\n"\
+"second and how many of them ran cpc_custom_process_action() with work to do.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -s, --seconds <n>               Length of each idle window (default 2)\n"\
+"   -m, --max_rate <n>              Exits with an error if a window has more than n wakeups per second\n"\
+"                                   \n"
+
+static void sleepMs(unsigned long ms) {
+    struct timespec ts = { (time_t) (ms / 1000), (long) (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+// Returns the wakeups per second of an idle window
+static double measureIdle(const char *name, unsigned long seconds) {
+    uint64_t wakeups_start, runs_start;
+    uint64_t wakeups_end, runs_end;
+    uint64_t start_ns, end_ns;
+    double elapsed;
+
+    sleepMs(SETTLE_MS);
+    sim_secondary_counters(&wakeups_start, &runs_start);
+    start_ns = sim_now_ns();
+    sleepMs(seconds * 1000);
+    sim_secondary_counters(&wakeups_end, &runs_end);
+    end_ns = sim_now_ns();
+
+    elapsed = (double) (end_ns - start_ns) / 1e9;
+    printf("%-12s %.1f s: %.1f wakeups/s, %.1f command task runs/s\n", name, elapsed,
+           (double) (wakeups_end - wakeups_start) / elapsed,
+           (double) (runs_end - runs_start) / elapsed);
+    return (double) (wakeups_end - wakeups_start) / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    custom_cpc_config_t config = CUSTOM_CPC_CONFIG_DEFAULT;
+    custom_cpc_t *ctx = NULL;
+    unsigned long seconds = DEFAULT_SECONDS;
+    double max_rate = -1;
+    double rate;
+    uint32_t version;
+    bool too_busy = false;
+    int opt = 0;
+    int ret;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 's':
+          seconds = strtoul(optarg,NULL,0);
+          if (seconds == 0) {
+            fprintf(stderr,"invalid seconds: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 'm':
+          max_rate = strtod(optarg,NULL);
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    ret = custom_cpc_open(&ctx, &config);
+    if (ret != 0) {
+      fprintf(stderr,"custom_cpc_open failed: %d\n", ret);
+      exit(EXIT_FAILURE);
+    }
+    // One command, so that the idle window follows real traffic
+    ret = custom_cpc_get_cust_version(ctx, &version);
+    if (ret != 0) {
+      fprintf(stderr,"custom_cpc_get_cust_version failed: %d\n", ret);
+      custom_cpc_close(ctx);
+      exit(EXIT_FAILURE);
+    }
+    rate = measureIdle("connected", seconds);
+    too_busy |= (max_rate >= 0) && (rate > max_rate);
+
+    custom_cpc_close(ctx);
+    rate = measureIdle("closed", seconds);
+    too_busy |= (max_rate >= 0) && (rate > max_rate);
+
+    if (too_busy) {
+      fprintf(stderr,"more than %.1f wakeups/s while idle\n", max_rate);
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
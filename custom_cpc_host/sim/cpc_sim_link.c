@@ -0,0 +1,321 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_link.c
+ * Drives the RCP link state machine and reply pool through disconnects
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "cpc_link.h"
+#include "cpc_reply_pool.h"
+
+#define OPTSTRING "hn:"
+
+#define DEFAULT_CYCLES 10000
+
+static struct option long_options[] = {
+     {"help",   no_argument,       0, 'h' },
+     {"cycles", required_argument, 0, 'n' },
+     {0,        0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_link <arguments>\n"\
+"                                   \n"\
+"Runs the RCP link state machine (RCP/cpc_link.c) and reply pool (RCP/cpc_reply_pool.c) without CPC: the\n"\
+"endpoint operations are fakes and the CPC callbacks are called from here, on a simulated millisecond\n"\
+"clock. Checks the open backoff, a disconnect with replies still being written, completions that come\n"\
+"after their buffer was reclaimed, and many disconnects in a row. Exits with an error if a check fails.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -n, --cycles <n>                Disconnects of the last check (default 10000)\n"\
+"                                   \n"
+
+// The pool's atomic sections, single threaded here
+void sim_core_enter(void) {
+}
+
+void sim_core_exit(void) {
+}
+
+// Fake endpoint
+struct fake_endpoint {
+    unsigned int open_failures; // opens left that fail
+    unsigned int busy_polls;    // polls left that find the endpoint not yet freed
+    unsigned int opens;
+    unsigned int closes;
+    unsigned int host_gone;
+    unsigned int polls;
+};
+
+static struct fake_endpoint ep;
+
+static bool fakeOpen(void) {
+    ep.opens++;
+    if (ep.open_failures > 0) {
+      ep.open_failures--;
+      return false;
+    }
+    return true;
+}
+
+static void fakeClose(void) {
+    ep.closes++;
+}
+
+static bool fakeIsFreed(void) {
+    ep.polls++;
+    if (ep.busy_polls > 0) {
+      ep.busy_polls--;
+      return false;
+    }
+    return true;
+}
+
+static void fakeHostGone(void) {
+    ep.host_gone++;
+}
+
+static const cpc_link_ops_t ops = {
+    .open = fakeOpen,
+    .close = fakeClose,
+    .is_freed = fakeIsFreed,
+    .host_gone = fakeHostGone,
+    .reclaim = cpc_reply_pool_reclaim,
+};
+
+static cpc_link_t link_sm;
+static uint32_t now_ms;
+static unsigned int failures;
+
+#define CHECK(cond) \
+    do { \
+      if (!(cond)) { \
+        printf("  line %d: %s\n", __LINE__, #cond); \
+        failures++; \
+        return; \
+      } \
+    } while (0)
+
+static void reset(void) {
+    ep = (struct fake_endpoint) { 0 };
+    cpc_reply_pool_init();
+    cpc_link_init(&link_sm, &ops);
+    now_ms = 1000;
+}
+
+// Steps the link like the command task: on every wakeup of its retry timer
+// until nothing is left to wait for, or max_ms of simulated time
+static void runFor(uint32_t max_ms) {
+    uint32_t end = now_ms + max_ms;
+    uint32_t delay;
+
+    while ((delay = cpc_link_step(&link_sm, now_ms)) > 0 && now_ms + delay <= end) {
+      now_ms += delay;
+    }
+}
+
+static unsigned int inUse(void) {
+    cpc_reply_pool_stats_t stats;
+
+    cpc_reply_pool_get_stats(&stats);
+    return stats.in_use;
+}
+
+static void checkBackoff(void) {
+    const uint32_t expected[] = { 10, 20, 40, 80, 160, 320, 640, 1000, 1000 };
+    uint32_t delay;
+
+    reset();
+    ep.open_failures = sizeof(expected) / sizeof(expected[0]);
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+      delay = cpc_link_step(&link_sm, now_ms);
+      CHECK(delay == expected[i]);
+      CHECK(ep.opens == i + 1);
+      // Woken early by something else: no new open, the rest of the delay
+      CHECK(cpc_link_step(&link_sm, now_ms + delay / 2) == delay - delay / 2);
+      CHECK(ep.opens == i + 1);
+      now_ms += delay;
+    }
+    CHECK(cpc_link_step(&link_sm, now_ms) == 0);
+    CHECK(link_sm.state == CPC_LINK_WAIT_CONNECTION);
+    cpc_link_on_connect(&link_sm);
+    CHECK(cpc_link_step(&link_sm, now_ms) == 0);
+    CHECK(cpc_link_is_connected(&link_sm));
+    CHECK(link_sm.stats.open_failures == sizeof(expected) / sizeof(expected[0]));
+    // The backoff starts over after a connection
+    cpc_link_on_error(&link_sm);
+    ep.open_failures = 1;
+    CHECK(cpc_link_step(&link_sm, now_ms) == 10);
+}
+
+static void checkDisconnect(void) {
+    cpc_reply_slot_t *slot[3];
+    void *token[3];
+    void *stale;
+
+    reset();
+    runFor(0);
+    cpc_link_on_connect(&link_sm);
+    runFor(0);
+    CHECK(cpc_link_is_connected(&link_sm));
+
+    // Three replies written, one completes before the host goes away
+    for (int i = 0; i < 3; i++) {
+      slot[i] = cpc_reply_pool_acquire();
+      CHECK(slot[i] != NULL);
+      token[i] = cpc_reply_pool_write_begin(slot[i]);
+    }
+    CHECK(cpc_reply_pool_write_end(token[0]));
+    CHECK(inUse() == 2);
+
+    ep.busy_polls = 2;
+    cpc_link_on_error(&link_sm);
+    CHECK(cpc_link_step(&link_sm, now_ms) == 10); // closed, endpoint not freed
+    CHECK(ep.closes == 1 && ep.host_gone == 1);
+    CHECK(!cpc_link_is_connected(&link_sm));
+    CHECK(inUse() == 2); // CPC may still own the buffers
+    now_ms += 10;
+    CHECK(cpc_link_step(&link_sm, now_ms) == 20);
+    now_ms += 20;
+    CHECK(cpc_link_step(&link_sm, now_ms) == 0); // freed, reclaimed and reopened
+    CHECK(inUse() == 0);
+    CHECK(link_sm.stats.reclaimed == 2 && link_sm.stats.reconnects == 1);
+    CHECK(link_sm.state == CPC_LINK_WAIT_CONNECTION && ep.opens == 2);
+
+    // A completion CPC reports after all must not free the slot again,
+    // even once it holds a new reply
+    CHECK(!cpc_reply_pool_write_end(token[1]));
+    stale = token[2];
+    slot[0] = cpc_reply_pool_acquire();
+    CHECK(slot[0] != NULL);
+    token[0] = cpc_reply_pool_write_begin(slot[0]);
+    CHECK(!cpc_reply_pool_write_end(stale));
+    CHECK(inUse() == 1);
+    CHECK(cpc_reply_pool_write_end(token[0]));
+    CHECK(inUse() == 0);
+}
+
+static void checkErrorBeforeConnect(void) {
+    reset();
+    runFor(0);
+    CHECK(link_sm.state == CPC_LINK_WAIT_CONNECTION);
+    // Connect and error seen by the same step: the error wins
+    cpc_link_on_connect(&link_sm);
+    cpc_link_on_error(&link_sm);
+    CHECK(cpc_link_step(&link_sm, now_ms) == 0);
+    CHECK(link_sm.state == CPC_LINK_WAIT_CONNECTION && ep.opens == 2 && ep.closes == 1);
+    CHECK(link_sm.stats.reconnects == 0);
+    // An error while the endpoint is not open has nothing to close
+    ep.open_failures = 1;
+    cpc_link_on_error(&link_sm);
+    runFor(0);
+    CHECK(link_sm.state == CPC_LINK_BACKOFF && ep.closes == 2);
+    cpc_link_on_error(&link_sm);
+    runFor(100);
+    CHECK(link_sm.state == CPC_LINK_WAIT_CONNECTION && ep.closes == 2);
+}
+
+static void checkCycles(unsigned long cycles) {
+    cpc_reply_pool_stats_t stats;
+    cpc_reply_slot_t *slot;
+
+    reset();
+    for (unsigned long i = 0; i < cycles; i++) {
+      runFor(0);
+      cpc_link_on_connect(&link_sm);
+      runFor(0);
+      CHECK(cpc_link_is_connected(&link_sm));
+      // Fill the pool with writes CPC then drops
+      for (unsigned int n = 0; n <= i % CPC_REPLY_POOL_SLOTS; n++) {
+        slot = cpc_reply_pool_acquire();
+        CHECK(slot != NULL);
+        cpc_reply_pool_write_begin(slot);
+      }
+      ep.busy_polls = (unsigned int) (i % 3);
+      ep.open_failures = (unsigned int) (i % 2);
+      cpc_link_on_error(&link_sm);
+      runFor(10000);
+      CHECK(inUse() == 0);
+    }
+    cpc_reply_pool_get_stats(&stats);
+    CHECK(stats.acquire_failures == 0);
+    CHECK(link_sm.stats.reconnects == cycles);
+    printf("  %lu disconnects, %lu buffers reclaimed, %u open failures\n",
+           cycles, (unsigned long) link_sm.stats.reclaimed, (unsigned int) link_sm.stats.open_failures);
+}
+
+static void run(const char *name, void (*check)(void)) {
+    unsigned int before = failures;
+
+    printf("%s\n", name);
+    check();
+    printf("  %s\n", (failures == before) ? "ok" : "FAILED");
+}
+
+static unsigned long cycles = DEFAULT_CYCLES;
+
+static void runCycles(void) {
+    checkCycles(cycles);
+}
+
+int main(int argc, char* argv[]) {
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'n':
+          cycles = strtoul(optarg,NULL,0);
+          if (cycles == 0) {
+            fprintf(stderr,"invalid cycles: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    run("open backoff", checkBackoff);
+    run("disconnect with replies being written", checkDisconnect);
+    run("error before the host connects", checkErrorBeforeConnect);
+    run("repeated disconnects", runCycles);
+    if (failures > 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
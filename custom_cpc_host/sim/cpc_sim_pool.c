@@ -0,0 +1,422 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_pool.c
+ * Checks the RCP reply pool against a fake sl_cpc_write()
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "sl_cpc.h"
+#include "cpc_reply_pool.h"
+
+#define OPTSTRING "hn:s:"
+
+#define DEFAULT_OPERATIONS 1000000
+
+static struct option long_options[] = {
+     {"help",       no_argument,       0, 'h' },
+     {"operations", required_argument, 0, 'n' },
+     {"seed",       required_argument, 0, 's' },
+     {0,            0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_pool <arguments>\n"\
+"                                   \n"\
+"Runs the RCP reply pool (RCP/cpc_reply_pool.c) without CPC, writing its buffers with a fake sl_cpc_write()\n"\
+"that queues them until their completion is called from here. Checks acquire and release, an empty pool,\n"\
+"refused writes, completions in any order, completions that come after a reclaim, and random operations\n"\
+"against a model of the pool, where no buffer may be handed out again while it is being written. Exits\n"\
+"with an error if a check fails.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -n, --operations <n>            Random operations of the last check (default 1000000)\n"\
+"   -s, --seed <value>              Seed of the random operations (default 1)\n"\
+"                                   \n"
+
+// The pool's atomic sections, single threaded here
+void sim_core_enter(void) {
+}
+
+void sim_core_exit(void) {
+}
+
+// Fake CPC: writes are queued with their completion argument and stay
+// there until complete() or drop() is called
+struct fake_write {
+    uint8_t *data;
+    uint16_t len;
+    void *arg;
+    uint8_t pattern; // every byte of data, checked on completion
+};
+
+static struct fake_write writes[CPC_REPLY_POOL_SLOTS];
+static unsigned int write_count;
+static unsigned int refuse_writes; // writes left that are refused
+static unsigned int corrupted;     // buffers changed while being written
+
+sl_status_t sl_cpc_write(sl_cpc_endpoint_handle_t *endpoint_handle,
+                         void *data,
+                         uint16_t data_length,
+                         uint8_t flag,
+                         void *on_write_completed_arg) {
+    (void) endpoint_handle;
+    (void) flag;
+
+    if (refuse_writes > 0) {
+      refuse_writes--;
+      return SL_STATUS_BUSY;
+    }
+    if (write_count == CPC_REPLY_POOL_SLOTS) {
+      return SL_STATUS_FAIL; // more writes than slots: a slot was given twice
+    }
+    writes[write_count++] = (struct fake_write) {
+      .data = data,
+      .len = data_length,
+      .arg = on_write_completed_arg,
+      .pattern = ((uint8_t *) data)[0],
+    };
+    return SL_STATUS_OK;
+}
+
+static unsigned int failures;
+
+#define CHECK(cond) \
+    do { \
+      if (!(cond)) { \
+        printf("  line %d: %s\n", __LINE__, #cond); \
+        failures++; \
+        return; \
+      } \
+    } while (0)
+
+// Sends a reply from slot the way cpc_custom.c does. Returns its token, or
+// NULL if the write was refused and the slot released.
+static void *sendReply(cpc_reply_slot_t *slot, uint8_t pattern) {
+    void *token;
+
+    memset(slot->data, pattern, sizeof(slot->data));
+    token = cpc_reply_pool_write_begin(slot);
+    if (sl_cpc_write(NULL, slot->data, sizeof(slot->data), 0, token) != SL_STATUS_OK) {
+      cpc_reply_pool_write_end(token);
+      return NULL;
+    }
+    return token;
+}
+
+// Takes queued write i out of the fake CPC. Returns its argument.
+static void *unqueue(unsigned int i) {
+    struct fake_write w = writes[i];
+
+    for (uint16_t n = 0; n < w.len; n++) {
+      if (w.data[n] != w.pattern) {
+        corrupted++;
+        break;
+      }
+    }
+    writes[i] = writes[--write_count];
+    return w.arg;
+}
+
+// CPC completes queued write i. Returns what the pool made of it.
+static bool complete(unsigned int i) {
+    return cpc_reply_pool_write_end(unqueue(i));
+}
+
+static cpc_reply_pool_stats_t stats(void) {
+    cpc_reply_pool_stats_t s;
+
+    cpc_reply_pool_get_stats(&s);
+    return s;
+}
+
+static void reset(void) {
+    write_count = 0;
+    refuse_writes = 0;
+    corrupted = 0;
+    cpc_reply_pool_init();
+}
+
+static void checkAcquire(void) {
+    cpc_reply_slot_t *slot[CPC_REPLY_POOL_SLOTS];
+    cpc_reply_slot_t *again;
+    uint32_t failures_before;
+
+    reset();
+    failures_before = stats().acquire_failures;
+    for (unsigned int i = 0; i < CPC_REPLY_POOL_SLOTS; i++) {
+      slot[i] = cpc_reply_pool_acquire();
+      CHECK(slot[i] != NULL);
+      for (unsigned int j = 0; j < i; j++) {
+        CHECK(slot[j] != slot[i]);
+      }
+      CHECK(stats().in_use == i + 1);
+    }
+    CHECK(stats().high_water == CPC_REPLY_POOL_SLOTS);
+
+    // Empty pool
+    CHECK(cpc_reply_pool_acquire() == NULL);
+    CHECK(cpc_reply_pool_acquire() == NULL);
+    CHECK(stats().acquire_failures == failures_before + 2);
+    CHECK(stats().in_use == CPC_REPLY_POOL_SLOTS);
+
+    // A released slot is the next one handed out
+    cpc_reply_pool_release(slot[1]);
+    CHECK(stats().in_use == CPC_REPLY_POOL_SLOTS - 1);
+    again = cpc_reply_pool_acquire();
+    CHECK(again == slot[1]);
+    for (unsigned int i = 0; i < CPC_REPLY_POOL_SLOTS; i++) {
+      cpc_reply_pool_release(slot[i]);
+    }
+    CHECK(stats().in_use == 0);
+    CHECK(stats().high_water == CPC_REPLY_POOL_SLOTS);
+}
+
+static void checkWrites(void) {
+    cpc_reply_slot_t *slot;
+
+    reset();
+    // Fill the pool with writes, complete them out of order
+    for (unsigned int i = 0; i < CPC_REPLY_POOL_SLOTS; i++) {
+      slot = cpc_reply_pool_acquire();
+      CHECK(slot != NULL);
+      CHECK(sendReply(slot, (uint8_t) (0x10 + i)) != NULL);
+    }
+    CHECK(cpc_reply_pool_acquire() == NULL);
+    CHECK(write_count == CPC_REPLY_POOL_SLOTS);
+    CHECK(complete(1 % write_count));
+    CHECK(stats().in_use == CPC_REPLY_POOL_SLOTS - 1);
+    while (write_count > 0) {
+      CHECK(complete(write_count - 1));
+    }
+    CHECK(stats().in_use == 0);
+
+    // A refused write releases its slot at once
+    slot = cpc_reply_pool_acquire();
+    refuse_writes = 1;
+    CHECK(sendReply(slot, 0x20) == NULL);
+    CHECK(stats().in_use == 0 && write_count == 0);
+    CHECK(stats().stale_writes == 0);
+    CHECK(corrupted == 0);
+}
+
+static void checkStale(void) {
+    cpc_reply_slot_t *slot;
+    cpc_reply_slot_t *held;
+    void *token;
+    void *old;
+    uint32_t stale_before;
+
+    reset();
+    stale_before = stats().stale_writes;
+    // A completion reported twice only releases the slot once
+    slot = cpc_reply_pool_acquire();
+    token = sendReply(slot, 0x30);
+    CHECK(token != NULL);
+    CHECK(complete(0));
+    CHECK(!cpc_reply_pool_write_end(token));
+    CHECK(stats().in_use == 0);
+    CHECK(stats().stale_writes == stale_before + 1);
+
+    // Reclaimed writes: only slots being written are taken back, and their
+    // completions no longer release anything, even once the slot holds a
+    // later reply
+    held = cpc_reply_pool_acquire(); // acquired, not written yet
+    slot = cpc_reply_pool_acquire();
+    CHECK(held != NULL && slot != NULL);
+    old = sendReply(slot, 0x31);
+    CHECK(old != NULL);
+    CHECK(cpc_reply_pool_reclaim() == 1);
+    CHECK(stats().in_use == 1);
+    CHECK(cpc_reply_pool_reclaim() == 0);
+    unqueue(0); // CPC dropped it with the endpoint
+    slot = cpc_reply_pool_acquire();
+    CHECK(slot != NULL && slot != held);
+    token = sendReply(slot, 0x32);
+    CHECK(token != NULL && token != old);
+    CHECK(!cpc_reply_pool_write_end(old));
+    CHECK(stats().in_use == 2);
+    CHECK(stats().stale_writes == stale_before + 2);
+    CHECK(complete(0));
+    CHECK(stats().in_use == 1);
+    cpc_reply_pool_release(held);
+    CHECK(stats().in_use == 0);
+    CHECK(corrupted == 0);
+}
+
+// Random acquires, releases, writes, completions, lost writes and
+// reclaims, checked against what the pool must hold
+struct lost_write {
+    void *arg;
+    bool reclaimed; // its slot was taken back, the completion is stale
+};
+
+static void checkRandom(unsigned long operations, unsigned int seed) {
+    cpc_reply_slot_t *held[CPC_REPLY_POOL_SLOTS];
+    struct lost_write lost[64];
+    const unsigned int lost_max = sizeof(lost) / sizeof(lost[0]);
+    unsigned int held_count = 0;
+    unsigned int lost_count = 0;
+    unsigned int lost_writing = 0; // lost writes whose slot is not reclaimed
+    unsigned long stale_expected = 0;
+    uint32_t stale_before;
+    cpc_reply_slot_t *slot;
+    struct lost_write w;
+    uint8_t pattern = 0;
+    unsigned int n;
+
+    reset();
+    srand(seed);
+    stale_before = stats().stale_writes;
+    for (unsigned long i = 0; i < operations; i++) {
+      switch (rand() % 8) {
+        case 0: // acquire
+        case 1:
+          slot = cpc_reply_pool_acquire();
+          CHECK((slot == NULL) == (held_count + write_count + lost_writing == CPC_REPLY_POOL_SLOTS));
+          if (slot != NULL) {
+            held[held_count++] = slot;
+          }
+          break;
+
+        case 2: // write a held slot, sometimes refused
+          if (held_count > 0) {
+            refuse_writes = (rand() % 8 == 0) ? 1 : 0;
+            sendReply(held[--held_count], ++pattern);
+          }
+          break;
+
+        case 3: // release a held slot unwritten
+          if (held_count > 0) {
+            cpc_reply_pool_release(held[--held_count]);
+          }
+          break;
+
+        case 4: // complete a write
+          if (write_count > 0) {
+            CHECK(complete((unsigned int) rand() % write_count));
+          }
+          break;
+
+        case 5: // CPC loses the completion of a write, for now
+          if ((write_count > 0) && (lost_count < lost_max)) {
+            lost[lost_count++] = (struct lost_write) { unqueue((unsigned int) rand() % write_count), false };
+            lost_writing++;
+          }
+          break;
+
+        case 6: // a lost completion turns up after all
+          if (lost_count > 0) {
+            n = (unsigned int) rand() % lost_count;
+            w = lost[n];
+            lost[n] = lost[--lost_count];
+            CHECK(cpc_reply_pool_write_end(w.arg) == !w.reclaimed);
+            if (w.reclaimed) {
+              stale_expected++;
+            } else {
+              lost_writing--;
+            }
+          }
+          break;
+
+        case 7: // the endpoint is freed: queued writes are dropped with it
+          if ((rand() % 8 == 0) && (lost_count + write_count <= lost_max)) {
+            while (write_count > 0) {
+              lost[lost_count++] = (struct lost_write) { unqueue(0), false };
+              lost_writing++;
+            }
+            CHECK(cpc_reply_pool_reclaim() == lost_writing);
+            for (n = 0; n < lost_count; n++) {
+              lost[n].reclaimed = true;
+            }
+            lost_writing = 0;
+          }
+          break;
+      }
+      CHECK(stats().in_use == held_count + write_count + lost_writing);
+    }
+    CHECK(corrupted == 0);
+    CHECK(stats().stale_writes - stale_before == stale_expected);
+    printf("  %lu operations, %lu stale completions\n", operations, stale_expected);
+}
+
+static void run(const char *name, void (*check)(void)) {
+    unsigned int before = failures;
+
+    printf("%s\n", name);
+    check();
+    printf("  %s\n", (failures == before) ? "ok" : "FAILED");
+}
+
+static unsigned long operations = DEFAULT_OPERATIONS;
+static unsigned int seed = 1;
+
+static void runRandom(void) {
+    checkRandom(operations, seed);
+}
+
+int main(int argc, char* argv[]) {
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'n':
+          operations = strtoul(optarg,NULL,0);
+          if (operations == 0) {
+            fprintf(stderr,"invalid operations: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 's':
+          seed = (unsigned int) strtoul(optarg,NULL,0);
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    run("acquire and release", checkAcquire);
+    run("writes and their completions", checkWrites);
+    run("stale completions and reclaim", checkStale);
+    run("random operations", runRandom);
+    if (failures > 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,340 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_provision.c
+ * Checks that provisioning tokens keeps the rest of the simulated USERDATA page
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include "custom_cpc.h"
+#include "cpc_commands.h"
+
+#define OPTSTRING "hn:s:"
+
+#define DEFAULT_ROUNDS 200
+
+// USERDATA page of the simulated RCP (USERDATA_SIZE in sim/rcp/em_device.h)
+#define PAGE_SIZE 1024
+#define PAGE_WORDS (PAGE_SIZE / 4)
+#define ERASED_WORD 0xFFFFFFFFu
+
+#define MAX_TOKENS 8
+
+static struct option long_options[] = {
+     {"help",   no_argument,       0, 'h' },
+     {"rounds", required_argument, 0, 'n' },
+     {"seed",   required_argument, 0, 's' },
+     {0,        0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_provision <arguments>\n"\
+"                                   \n"\
+"Provisions tokens on the simulated RCP with custom_cpc_userdata_provision() and reads the whole USERDATA\n"\
+"page back after each provisioning, checking that the tokens were written, that every other byte of the page\n"\
+"is unchanged, that the page was only erased when a changed word was not blank, and the CRC of the page\n"\
+"in the reply. Covers tokens written without an erase, with one, unaligned tokens sharing words with other\n"\
+"data, tokens already written, a token outside the page, and random token lists. Exits with an error if a\n"\
+"check fails.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -n, --rounds <n>                Random token lists of the last check (default 200)\n"\
+"   -s, --seed <value>              Seed of the page content and random token lists (default 1)\n"\
+"                                   \n"
+
+static custom_cpc_t *ctx;
+static unsigned int failures;
+
+// What the page must hold
+static uint8_t expected[PAGE_SIZE];
+
+#define CHECK(cond) \
+    do { \
+      if (!(cond)) { \
+        printf("  line %d: %s\n", __LINE__, #cond); \
+        failures++; \
+        return; \
+      } \
+    } while (0)
+
+static uint32_t word(const uint8_t *page, size_t i) {
+    uint32_t w;
+
+    memcpy(&w, &page[i * 4], sizeof(w));
+    return w;
+}
+
+// Reads the page and compares it with expected. Prints the first byte
+// that differs.
+static bool pageMatches(void) {
+    uint8_t page[PAGE_SIZE];
+    int ret;
+
+    ret = custom_cpc_userdata_read(ctx, 0, page, sizeof(page));
+    if (ret != 0) {
+      printf("  custom_cpc_userdata_read failed: %d\n", ret);
+      return false;
+    }
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+      if (page[i] != expected[i]) {
+        printf("  offset 0x%03zx is 0x%02x, expected 0x%02x\n", i, page[i], expected[i]);
+        return false;
+      }
+    }
+    return true;
+}
+
+// Provisions count tokens and checks the reply and the whole page against
+// expected with the tokens merged in. Returns the status of the
+// provisioning, or -1 if a check failed.
+static int provision(const custom_cpc_token_t *tokens, size_t count, bool *erased) {
+    uint8_t merged[PAGE_SIZE];
+    bool must_erase = false;
+    uint32_t crc = 0;
+    int ret;
+
+    memcpy(merged, expected, sizeof(merged));
+    for (size_t i = 0; i < count; i++) {
+      if ((size_t) tokens[i].offset + tokens[i].len <= PAGE_SIZE) {
+        memcpy(&merged[tokens[i].offset], tokens[i].value, tokens[i].len);
+      }
+    }
+    for (size_t i = 0; i < PAGE_WORDS; i++) {
+      if ((word(merged, i) != word(expected, i)) && (word(expected, i) != ERASED_WORD)) {
+        must_erase = true;
+      }
+    }
+
+    ret = custom_cpc_userdata_provision(ctx, tokens, count, erased, &crc);
+    if (ret == 0) {
+      memcpy(expected, merged, sizeof(expected));
+      if (*erased != must_erase) {
+        printf("  erased %d, expected %d\n", *erased, must_erase);
+        return -1;
+      }
+      if (crc != cpc_crc32(0, expected, sizeof(expected))) {
+        printf("  page CRC 0x%08x, expected 0x%08x\n", crc, cpc_crc32(0, expected, sizeof(expected)));
+        return -1;
+      }
+    }
+    return pageMatches() ? ret : -1;
+}
+
+// Fills the page with data, leaving every fourth word blank
+static void checkFill(unsigned int seed) {
+    bool erased;
+    int ret;
+
+    srand(seed);
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+      expected[i] = (uint8_t) rand();
+    }
+    for (size_t i = 0; i < PAGE_WORDS; i += 4) {
+      memset(&expected[i * 4], 0xFF, 4);
+    }
+    ret = custom_cpc_userdata_write(ctx, 0, expected, sizeof(expected), &erased);
+    CHECK(ret == 0);
+    CHECK(pageMatches());
+}
+
+static void checkNoErase(void) {
+    const uint8_t serial[8] = { 0x53, 0x4e, 0x30, 0x30, 0x30, 0x31, 0x32, 0x33 };
+    const uint8_t flag[1] = { 0x5a };
+    const uint8_t id[4] = { 0x01, 0x02, 0x03, 0x04 };
+    // Blank words only: 0x40 (word 16), 0x80..0x84 and 0x90..0x93 (words 32 and 36)
+    const custom_cpc_token_t tokens[] = {
+      { 0x040, sizeof(flag), flag },
+      { 0x080, 4, serial },
+      { 0x090, sizeof(id), id },
+      { 0x043, sizeof(flag), flag },
+    };
+    bool erased = true;
+
+    CHECK(provision(tokens, sizeof(tokens) / sizeof(tokens[0]), &erased) == 0);
+    CHECK(!erased);
+    // Two bytes in a word that has just been written: no longer blank
+    CHECK(provision(&tokens[3], 1, &erased) == 0); // same value again
+    CHECK(!erased);
+    CHECK(provision((custom_cpc_token_t[]) { { 0x041, 2, id } }, 1, &erased) == 0);
+    CHECK(erased);
+}
+
+static void checkErase(void) {
+    const uint8_t ctune[2] = { 0x9f, 0x00 };
+    const uint8_t value[5] = { 0xde, 0xad, 0xbe, 0xef, 0x42 };
+    // Unaligned, into words holding other data: their other bytes are kept
+    const custom_cpc_token_t tokens[] = {
+      { 0x006, 2, value },
+      { 0x100, sizeof(ctune), ctune },
+      { 0x203, sizeof(value), value },
+      { PAGE_SIZE - 1, 1, value },
+    };
+    bool erased = false;
+
+    CHECK(provision(tokens, sizeof(tokens) / sizeof(tokens[0]), &erased) == 0);
+    CHECK(erased);
+    // Written again with the same values: nothing to do
+    CHECK(provision(tokens, sizeof(tokens) / sizeof(tokens[0]), &erased) == 0);
+    CHECK(!erased);
+}
+
+static void checkOutOfPage(void) {
+    const uint8_t value[4] = { 0x11, 0x22, 0x33, 0x44 };
+    const custom_cpc_token_t tokens[] = {
+      { 0x010, sizeof(value), value },
+      { PAGE_SIZE - 2, sizeof(value), value },
+    };
+    bool erased;
+
+    // The token in the page is not written either
+    CHECK(provision(tokens, sizeof(tokens) / sizeof(tokens[0]), &erased) == -ERANGE);
+}
+
+// Random token lists. Every other list only goes into blank words, so
+// that both the erase and the no erase paths are taken; the others blank
+// some words out again.
+static void checkRandom(unsigned long rounds) {
+    custom_cpc_token_t tokens[MAX_TOKENS];
+    uint8_t values[MAX_TOKENS][32];
+    uint16_t blank[PAGE_WORDS];
+    size_t blank_count;
+    unsigned long erases = 0;
+    uint8_t args[CPC_PROVISION_ARGS_MAX];
+    bool blank_only;
+    bool erased;
+    size_t count;
+    int ret;
+
+    for (unsigned long round = 0; round < rounds; round++) {
+      blank_count = 0;
+      for (uint16_t w = 0; w < PAGE_WORDS; w++) {
+        if (word(expected, w) == ERASED_WORD) {
+          blank[blank_count++] = w;
+        }
+      }
+      blank_only = (round % 2 == 0) && (blank_count > 0);
+      do {
+        count = 1 + (size_t) rand() % MAX_TOKENS;
+        for (size_t i = 0; i < count; i++) {
+          if (blank_only) {
+            // Within one blank word
+            tokens[i].len = (uint8_t) (1 + rand() % 4);
+            tokens[i].offset = (uint16_t) (blank[(size_t) rand() % blank_count] * 4 + rand() % (5 - tokens[i].len));
+          } else {
+            tokens[i].len = (uint8_t) (1 + rand() % sizeof(values[i]));
+            tokens[i].offset = (uint16_t) (rand() % (PAGE_SIZE - tokens[i].len + 1));
+          }
+          if (!blank_only && (rand() % 4 == 0)) {
+            memset(values[i], 0xFF, tokens[i].len);
+          } else {
+            for (size_t n = 0; n < tokens[i].len; n++) {
+              values[i][n] = (uint8_t) rand();
+            }
+          }
+          tokens[i].value = values[i];
+        }
+      } while (custom_cpc_provision_encode(tokens, count, args, sizeof(args)) < 0);
+
+      ret = provision(tokens, count, &erased);
+      CHECK(ret == 0);
+      erases += erased ? 1 : 0;
+    }
+    printf("  %lu token lists, %lu with an erase\n", rounds, erases);
+    CHECK((erases > 0) && (erases < rounds));
+}
+
+static void run(const char *name, void (*check)(void)) {
+    unsigned int before = failures;
+
+    printf("%s\n", name);
+    check();
+    printf("  %s\n", (failures == before) ? "ok" : "FAILED");
+}
+
+static unsigned long rounds = DEFAULT_ROUNDS;
+static unsigned int seed = 1;
+
+static void runFill(void) {
+    checkFill(seed);
+}
+
+static void runRandom(void) {
+    checkRandom(rounds);
+}
+
+int main(int argc, char* argv[]) {
+    custom_cpc_config_t config = CUSTOM_CPC_CONFIG_DEFAULT;
+    int opt = 0;
+    int ret;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'n':
+          rounds = strtoul(optarg,NULL,0);
+          if (rounds == 0) {
+            fprintf(stderr,"invalid rounds: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        case 's':
+          seed = (unsigned int) strtoul(optarg,NULL,0);
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    config.window_size = 8;
+    ret = custom_cpc_open(&ctx, &config);
+    if (ret != 0) {
+      fprintf(stderr,"custom_cpc_open failed: %d\n", ret);
+      exit(EXIT_FAILURE);
+    }
+    run("page filled, one word in four blank", runFill);
+    run("tokens into blank words, no erase", checkNoErase);
+    run("tokens into written words, erase", checkErase);
+    run("token outside the page", checkOutOfPage);
+    run("random token lists", runRandom);
+    custom_cpc_close(ctx);
+    if (failures > 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+/***************************************************************************//**
+ * @file
+ * @brief cpc_sim_ring.c
+ * Checks the RCP command ring with a producer and a consumer thread
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "cpc_command_ring.h"
+
+#define OPTSTRING "hn:"
+
+#define DEFAULT_ENTRIES 1000000
+
+static struct option long_options[] = {
+     {"help",    no_argument,       0, 'h' },
+     {"entries", required_argument, 0, 'n' },
+     {0,         0,                 0,  0  }};
+
+#define HELP_MESSAGE \
+"./cpc_sim_ring <arguments>\n"\
+"                                   \n"\
+"Runs the RCP command ring (RCP/cpc_command_ring.c) with a producer and a consumer thread, as the CPC\n"\
+"receive callback and the command task use it, and checks that every entry comes out once and in order.\n"\
+"The stream phase keeps the ring as full as possible and prints the time per entry; the handoff phase\n"\
+"pushes one entry at a time and prints the time from push to peek, the latency the ring adds to a\n"\
+"command. Exits with an error if an entry is lost, duplicated or reordered.\n"\
+"                                   \n"\
+"   -h, --help                      Prints this message\n"\
+"   -n, --entries <n>               Entries per phase (default 1000000)\n"\
+"                                   \n"
+
+static unsigned long entries = DEFAULT_ENTRIES;
+static bool handoff;
+static uint64_t push_ns;      // handoff: time of the last push
+static uint64_t *latencies;   // handoff: push to peek, per entry
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Entry i carries i in its data pointer and the low bits of i in its size
+static void *producer(void *arg) {
+    (void) arg;
+
+    for (unsigned long i = 0; i < entries; i++) {
+      if (handoff) {
+        // One entry at a time, so nothing waits behind another entry
+        while (cpc_command_ring_peek() != NULL) {
+          sched_yield();
+        }
+        __atomic_store_n(&push_ns, nowNs(), __ATOMIC_RELAXED);
+      }
+      while (!cpc_command_ring_push((uint8_t *) (uintptr_t) (i + 1), (uint16_t) i)) {
+        sched_yield();
+      }
+    }
+    return NULL;
+}
+
+// Returns the number of entries that were lost, duplicated or reordered
+static unsigned long consume(void) {
+    unsigned long errors = 0;
+    unsigned long expected = 0;
+    cpc_command_entry_t *entry;
+
+    while (expected < entries) {
+      entry = cpc_command_ring_peek();
+      if (entry == NULL) {
+        sched_yield(); // the producer may share the CPU
+        continue;
+      }
+      if (handoff) {
+        latencies[expected] = nowNs() - __atomic_load_n(&push_ns, __ATOMIC_RELAXED);
+      }
+      if (((uintptr_t) entry->data != expected + 1) || (entry->size != (uint16_t) expected)) {
+        errors++;
+        expected = (unsigned long) (uintptr_t) entry->data; // resynchronize after the entry seen
+      } else {
+        expected++;
+      }
+      cpc_command_ring_pop();
+    }
+    return errors;
+}
+
+static int compareU64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static unsigned long runPhase(const char *name, bool one_at_a_time) {
+    pthread_t thread;
+    unsigned long errors;
+    uint64_t start;
+    uint64_t elapsed;
+
+    handoff = one_at_a_time;
+    start = nowNs();
+    pthread_create(&thread, NULL, producer, NULL);
+    errors = consume();
+    pthread_join(thread, NULL);
+    elapsed = nowNs() - start;
+
+    if (!one_at_a_time) {
+      printf("%-8s %lu entries, %lu errors, %.1f ns per entry\n", name, entries, errors, (double) elapsed / entries);
+    } else {
+      qsort(latencies, entries, sizeof(latencies[0]), compareU64);
+      printf("%-8s %lu entries, %lu errors, push to peek p50 %llu ns, p99 %llu ns, max %llu ns\n", name, entries, errors,
+             (unsigned long long) latencies[entries / 2],
+             (unsigned long long) latencies[(entries * 99) / 100],
+             (unsigned long long) latencies[entries - 1]);
+    }
+    return errors;
+}
+
+int main(int argc, char* argv[]) {
+    cpc_command_ring_stats_t stats;
+    unsigned long errors;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'h':
+          printf(HELP_MESSAGE);
+          exit(0);
+          break;
+
+        case 'n':
+          entries = strtoul(optarg,NULL,0);
+          if (entries == 0) {
+            fprintf(stderr,"invalid entries: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          break;
+
+        default:
+          fprintf(stderr,"%s",HELP_MESSAGE);
+          exit(EXIT_FAILURE);
+      }
+    }
+
+    latencies = calloc(entries, sizeof(latencies[0]));
+    if (latencies == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    errors = runPhase("stream", false);
+    errors += runPhase("handoff", true);
+    cpc_command_ring_get_stats(&stats);
+    printf("ring size %d, high water %d, %d left\n", CPC_COMMAND_RING_SIZE, stats.high_water, stats.count);
+    free(latencies);
+    if ((errors > 0) || (stats.count != 0) || (stats.high_water > CPC_COMMAND_RING_SIZE)) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+/***************************************************************************//**
+ * @file
+ * @brief sl_cpc.h
+ * Simulator stand-in for the libcpc host API (subset used by custom_cpc_host)
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef SL_CPC_H
+#define SL_CPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SL_CPC_READ_MINIMUM_SIZE 4087
+
+typedef enum {
+  SL_CPC_ENDPOINT_USER_ID_0 = 90,
+} sl_cpc_user_endpoint_id_t;
+
+typedef enum {
+  SL_CPC_STATE_OPEN = 0,
+  SL_CPC_STATE_CLOSED,
+  SL_CPC_STATE_CLOSING,
+  SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE,
+  SL_CPC_STATE_ERROR_SECURITY_INCIDENT,
+  SL_CPC_STATE_ERROR_FAULT
+} cpc_endpoint_state_t;
+
+typedef struct {
+  void *ptr;
+} cpc_handle_t;
+
+typedef struct {
+  void *ptr;
+} cpc_endpoint_t;
+
+typedef struct {
+  int seconds;
+  int microseconds;
+} cpc_timeval_t;
+
+typedef enum {
+  CPC_ENDPOINT_READ_FLAG_NONE = 0,
+  CPC_ENDPOINT_READ_FLAG_NON_BLOCKING = (1 << 0)
+} cpc_read_flags_t;
+
+typedef enum {
+  CPC_ENDPOINT_WRITE_FLAG_NONE = 0,
+  CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING = (1 << 0)
+} cpc_write_flags_t;
+
+typedef enum {
+  CPC_ENDPOINT_EVENT_FLAG_NONE = 0,
+  CPC_ENDPOINT_EVENT_FLAG_NON_BLOCKING = (1 << 0)
+} cpc_event_flags_t;
+
+typedef enum {
+  CPC_OPTION_NONE = 0,
+  CPC_OPTION_BLOCKING,
+  CPC_OPTION_RX_TIMEOUT,
+  CPC_OPTION_TX_TIMEOUT,
+  CPC_OPTION_SOCKET_SIZE,
+  CPC_OPTION_MAX_WRITE_SIZE,
+  CPC_OPTION_ENCRYPTED
+} cpc_option_t;
+
+typedef void (*cpc_reset_callback_t)(void);
+
+int cpc_init(cpc_handle_t *handle, const char *instance_name, bool enable_tracing, cpc_reset_callback_t reset_callback);
+int cpc_deinit(cpc_handle_t *handle);
+int cpc_restart(cpc_handle_t *handle);
+int cpc_open_endpoint(cpc_handle_t handle, cpc_endpoint_t *endpoint, uint8_t id, uint8_t tx_window_size);
+int cpc_close_endpoint(cpc_endpoint_t *endpoint);
+ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_read_flags_t flags);
+ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_write_flags_t flags);
+int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t *state);
+int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen);
+int cpc_get_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, void *optval, size_t *optlen);
+ssize_t cpc_get_endpoint_max_write_size(cpc_endpoint_t endpoint);
+
+#endif /* SL_CPC_H */
@@ -0,0 +1,549 @@
+/***************************************************************************//**
+ * @file
+ * @brief libcpc_sim.c
+ * Simulated libcpc host library talking to the in-process simulated RCP
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "sl_cpc.h"
+#include "cpc_commands.h"
+#include "sim_link.h"
+
+/*
+ * Link behaviour is configured from the environment, read once:
+ *
+ *   CPC_SIM_LATENCY_US      one-way latency applied to every command (default 0)
+ *   CPC_SIM_JITTER_US       extra uniformly distributed latency (default 0)
+ *   CPC_SIM_CMD_LATENCY_US  per-opcode latency overrides, "opcode:us,..."
+ *   CPC_SIM_DROP_PERMILLE   commands silently lost, per thousand (default 0)
+ *   CPC_SIM_SEED            PRNG seed for jitter and drops (default 1)
+ *   CPC_SIM_INIT_FAILURES   number of cpc_init() calls that fail first (default 0)
+ *   CPC_SIM_CLOSE_DELAY_US  time the endpoint reports CLOSING after close (default 0)
+ *   CPC_SIM_RESET_EVERY     cpcd restarts on every n-th command written, which
+ *                           is lost: open endpoints fail with -ECONNRESET until
+ *                           closed and the RCP sees a disconnect (default 0, never)
+ *   CPC_SIM_SOCKET_FOLDER   if set, where stand-ins for the control sockets
+ *                           of cpcd are kept, see sim_cpcd_socket()
+ *
+ * With the same seed and settings the sequence of delays and drops is the
+ * same on every run.
+ */
+
+#define SIM_OPEN_TIMEOUT_NS 1000000000ull
+
+struct sim_config {
+  uint64_t latency_ns;
+  uint64_t jitter_ns;
+  uint64_t cmd_latency_ns[256];
+  bool cmd_latency_set[256];
+  unsigned int drop_permille;
+  uint64_t seed;
+  unsigned int init_failures;
+  uint64_t close_delay_ns;
+  unsigned int reset_every;
+};
+
+struct sim_rx_frame {
+  struct sim_rx_frame *next;
+  size_t len;
+  uint8_t data[];
+};
+
+struct sim_endpoint {
+  struct sim_endpoint *next;
+  pthread_cond_t cond;
+  struct sim_rx_frame *rx_head;
+  struct sim_rx_frame *rx_tail;
+  cpc_timeval_t rx_timeout;
+  bool blocking;
+  bool reset; // cpcd restarted since the endpoint was opened
+};
+
+// Commands in flight, indexed by the seq sent to the RCP. Every host endpoint
+// numbers its own commands, so seqs are remapped before reaching the shared RCP.
+struct sim_route {
+  struct sim_endpoint *endpoint;
+  uint8_t seq;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static struct sim_config config;
+static uint64_t prng_state;
+static struct sim_endpoint *endpoints = NULL;
+static unsigned int open_endpoints = 0;
+static struct sim_route routes[256];
+static uint8_t next_seq = 0;
+static uint64_t last_deliver_ns = 0;
+static uint64_t closing_until_ns = 0;
+static unsigned int commands_written = 0;
+
+static uint64_t env_u64(const char *name, uint64_t def){
+  const char *value = getenv(name);
+
+  return (value != NULL && *value != '\0') ? strtoull(value, NULL, 0) : def;
+}
+
+static void load_config(void){
+  const char *list = getenv("CPC_SIM_CMD_LATENCY_US");
+
+  config.latency_ns = env_u64("CPC_SIM_LATENCY_US", 0) * 1000;
+  config.jitter_ns = env_u64("CPC_SIM_JITTER_US", 0) * 1000;
+  config.drop_permille = (unsigned int) env_u64("CPC_SIM_DROP_PERMILLE", 0);
+  config.seed = env_u64("CPC_SIM_SEED", 1);
+  config.init_failures = (unsigned int) env_u64("CPC_SIM_INIT_FAILURES", 0);
+  config.close_delay_ns = env_u64("CPC_SIM_CLOSE_DELAY_US", 0) * 1000;
+  config.reset_every = (unsigned int) env_u64("CPC_SIM_RESET_EVERY", 0);
+
+  while (list != NULL && *list != '\0') {
+    char *end;
+    unsigned long opcode = strtoul(list, &end, 0);
+
+    if (*end != ':' || opcode > 255) {
+      break; // ignore the rest of a malformed list
+    }
+    config.cmd_latency_ns[opcode] = strtoull(end + 1, &end, 0) * 1000;
+    config.cmd_latency_set[opcode] = true;
+    list = (*end == ',') ? end + 1 : NULL;
+  }
+
+  prng_state = (config.seed != 0) ? config.seed : 1;
+}
+
+// xorshift64, called with lock held
+static uint64_t prng_next(void){
+  prng_state ^= prng_state << 13;
+  prng_state ^= prng_state >> 7;
+  prng_state ^= prng_state << 17;
+  return prng_state;
+}
+
+static struct timespec to_timespec(uint64_t ns){
+  struct timespec ts = { (time_t) (ns / 1000000000ull), (long) (ns % 1000000000ull) };
+  return ts;
+}
+
+static struct sim_rx_frame *push_frame(struct sim_endpoint *ep, const uint8_t *frame, size_t len){
+  struct sim_rx_frame *f = malloc(sizeof(*f) + len);
+
+  if (f == NULL) {
+    return NULL;
+  }
+  f->next = NULL;
+  f->len = len;
+  memcpy(f->data, frame, len);
+  if (ep->rx_tail != NULL) {
+    ep->rx_tail->next = f;
+  } else {
+    ep->rx_head = f;
+  }
+  ep->rx_tail = f;
+  pthread_cond_signal(&ep->cond);
+  return f;
+}
+
+void sim_host_receive(const uint8_t *frame, size_t len){
+  struct sim_route *route;
+
+  pthread_mutex_lock(&lock);
+  if (len < CPC_FRAME_HEADER_SIZE) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  route = &routes[frame[3]];
+  if (((frame[2] & CPC_FRAME_FLAG_EVENT) == 0) && (route->endpoint != NULL)) {
+    struct sim_rx_frame *f = push_frame(route->endpoint, frame, len);
+
+    if (f != NULL) {
+      cpc_frame_set_seq(f->data, route->seq);
+    }
+    if ((frame[2] & CPC_FRAME_FLAG_PROGRESS) == 0) {
+      route->endpoint = NULL; // the final reply follows a progress frame
+    }
+  } else {
+    // Not a reply to a known command, every endpoint sees it
+    for (struct sim_endpoint *ep = endpoints; ep != NULL; ep = ep->next) {
+      push_frame(ep, frame, len);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/***************************************************************************//**
+ * libcpc API
+ ******************************************************************************/
+
+/*
+ * cpcd creates <socket_folder>/cpcd/<instance>/ctrl.cpcd.sock when it
+ * starts, and exits when the secondary resets, which a reflash always
+ * does. The stand-in is a regular file holding the application version
+ * the simulated cpcd was started with. cpc_init() creates it for a new
+ * instance, and when the library is loaded every existing one is created
+ * again, with a new inode, if CPC_SIM_APP_VERSION has changed, as if cpcd
+ * had been restarted after the secondary was reflashed.
+ */
+static void sim_cpcd_socket(const char *folder, const char *instance_name){
+  char path[512];
+  char seen[32] = "";
+  char version[32];
+  FILE *f;
+
+  snprintf(version, sizeof(version), "0x%08x\n", (unsigned int) sim_firmware_app_version());
+  mkdir(folder, 0755);
+  snprintf(path, sizeof(path), "%s/cpcd", folder);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/cpcd/%s", folder, instance_name);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/cpcd/%s/ctrl.cpcd.sock", folder, instance_name);
+
+  f = fopen(path, "r");
+  if (f != NULL) {
+    if (fgets(seen, sizeof(seen), f) == NULL) {
+      seen[0] = '\0';
+    }
+    fclose(f);
+  }
+  if (strcmp(seen, version) != 0) {
+    unlink(path);
+    f = fopen(path, "w");
+    if (f != NULL) {
+      fputs(version, f);
+      fclose(f);
+    }
+  }
+}
+
+static const char *sim_socket_folder(void){
+  const char *folder = getenv("CPC_SIM_SOCKET_FOLDER");
+
+  return ((folder != NULL) && (*folder != '\0')) ? folder : NULL;
+}
+
+__attribute__((constructor)) static void sim_cpcd_restart(void){
+  const char *folder = sim_socket_folder();
+  char path[512];
+  struct dirent *entry;
+  DIR *dir;
+
+  if (folder == NULL) {
+    return;
+  }
+  snprintf(path, sizeof(path), "%s/cpcd", folder);
+  dir = opendir(path);
+  if (dir == NULL) {
+    return;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      sim_cpcd_socket(folder, entry->d_name);
+    }
+  }
+  closedir(dir);
+}
+
+int cpc_init(cpc_handle_t *handle, const char *instance_name, bool enable_tracing, cpc_reset_callback_t reset_callback){
+  (void) enable_tracing;
+  (void) reset_callback;
+
+  pthread_once(&config_once, load_config);
+  pthread_mutex_lock(&lock);
+  if (config.init_failures > 0) {
+    config.init_failures--;
+    pthread_mutex_unlock(&lock);
+    return -ECONNREFUSED;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (sim_socket_folder() != NULL) {
+    sim_cpcd_socket(sim_socket_folder(), (instance_name != NULL) ? instance_name : "cpcd_0");
+  }
+  sim_secondary_start();
+  handle->ptr = &config;
+  return 0;
+}
+
+int cpc_deinit(cpc_handle_t *handle){
+  handle->ptr = NULL;
+  return 0;
+}
+
+int cpc_restart(cpc_handle_t *handle){
+  (void) handle;
+  return 0;
+}
+
+int cpc_open_endpoint(cpc_handle_t handle, cpc_endpoint_t *endpoint, uint8_t id, uint8_t tx_window_size){
+  struct sim_endpoint *ep;
+  pthread_condattr_t attr;
+  (void) tx_window_size;
+
+  if (handle.ptr == NULL) {
+    return -EINVAL;
+  }
+  if (id != SL_CPC_ENDPOINT_USER_ID_0
+      || !sim_secondary_wait_ready(sim_now_ns() + SIM_OPEN_TIMEOUT_NS)) {
+    return -ECONNREFUSED;
+  }
+  ep = calloc(1, sizeof(*ep));
+  if (ep == NULL) {
+    return -ENOMEM;
+  }
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&ep->cond, &attr);
+  ep->blocking = true;
+
+  pthread_mutex_lock(&lock);
+  ep->next = endpoints;
+  endpoints = ep;
+  if (open_endpoints++ == 0) {
+    sim_secondary_connect();
+  }
+  pthread_mutex_unlock(&lock);
+
+  endpoint->ptr = ep;
+  return 0;
+}
+
+int cpc_close_endpoint(cpc_endpoint_t *endpoint){
+  struct sim_endpoint *ep = endpoint->ptr;
+  struct sim_endpoint **pp;
+
+  if (ep == NULL) {
+    return -EINVAL;
+  }
+  pthread_mutex_lock(&lock);
+  for (pp = &endpoints; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == ep) {
+      *pp = ep->next;
+      break;
+    }
+  }
+  for (unsigned int i = 0; i < 256; i++) {
+    if (routes[i].endpoint == ep) {
+      routes[i].endpoint = NULL;
+    }
+  }
+  // The RCP only sees a disconnect once the last host endpoint is gone
+  if (--open_endpoints == 0) {
+    sim_secondary_disconnect();
+  }
+  closing_until_ns = sim_now_ns() + config.close_delay_ns;
+  pthread_mutex_unlock(&lock);
+
+  while (ep->rx_head != NULL) {
+    struct sim_rx_frame *f = ep->rx_head;
+    ep->rx_head = f->next;
+    free(f);
+  }
+  pthread_cond_destroy(&ep->cond);
+  free(ep);
+  endpoint->ptr = NULL;
+  return 0;
+}
+
+ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_read_flags_t flags){
+  struct sim_endpoint *ep = endpoint.ptr;
+  struct sim_rx_frame *f;
+  bool blocking;
+  uint64_t timeout_ns;
+  struct timespec deadline;
+  ssize_t len;
+
+  if (ep == NULL || count < SL_CPC_READ_MINIMUM_SIZE) {
+    return -EINVAL;
+  }
+  pthread_mutex_lock(&lock);
+  blocking = ep->blocking && !(flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING);
+  timeout_ns = (uint64_t) ep->rx_timeout.seconds * 1000000000ull
+               + (uint64_t) ep->rx_timeout.microseconds * 1000ull;
+  deadline = to_timespec(sim_now_ns() + timeout_ns);
+  while (ep->rx_head == NULL && blocking && !ep->reset) {
+    if (timeout_ns == 0) {
+      pthread_cond_wait(&ep->cond, &lock);
+    } else if (pthread_cond_timedwait(&ep->cond, &lock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  f = ep->rx_head;
+  if (f == NULL) {
+    pthread_mutex_unlock(&lock);
+    return ep->reset ? -ECONNRESET : -EAGAIN;
+  }
+  ep->rx_head = f->next;
+  if (ep->rx_head == NULL) {
+    ep->rx_tail = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+
+  memcpy(buffer, f->data, f->len);
+  len = (ssize_t) f->len;
+  free(f);
+  return len;
+}
+
+ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_write_flags_t flags){
+  struct sim_endpoint *ep = endpoint.ptr;
+  const uint8_t *header = data;
+  uint8_t frame[SL_CPC_READ_MINIMUM_SIZE];
+  uint64_t deliver_at;
+  (void) flags;
+
+  if (ep == NULL || data_length == 0 || data_length > sizeof(frame)) {
+    return -EINVAL;
+  }
+  memcpy(frame, data, data_length);
+
+  pthread_mutex_lock(&lock);
+  if (ep->reset) {
+    pthread_mutex_unlock(&lock);
+    return -ECONNRESET;
+  }
+  if (config.reset_every > 0 && ++commands_written % config.reset_every == 0) {
+    // cpcd goes down with the command: every client loses its endpoint,
+    // and the frames not yet read with it
+    for (struct sim_endpoint *e = endpoints; e != NULL; e = e->next) {
+      e->reset = true;
+      pthread_cond_signal(&e->cond);
+    }
+    memset(routes, 0, sizeof(routes));
+    pthread_mutex_unlock(&lock);
+    sim_secondary_disconnect();
+    return (ssize_t) data_length;
+  }
+  if (config.drop_permille > 0 && (prng_next() % 1000) < config.drop_permille) {
+    pthread_mutex_unlock(&lock);
+    return (ssize_t) data_length; // lost on the link, the host sees a timeout
+  }
+  if (data_length >= CPC_FRAME_HEADER_SIZE) {
+    routes[next_seq].endpoint = ep;
+    routes[next_seq].seq = header[3];
+    cpc_frame_set_seq(frame, next_seq++);
+  }
+
+  deliver_at = sim_now_ns();
+  if (data_length >= CPC_FRAME_HEADER_SIZE && config.cmd_latency_set[header[1]]) {
+    deliver_at += config.cmd_latency_ns[header[1]];
+  } else {
+    deliver_at += config.latency_ns;
+  }
+  if (config.jitter_ns > 0) {
+    deliver_at += prng_next() % (config.jitter_ns + 1);
+  }
+  // The link is FIFO, jitter never reorders commands
+  if (deliver_at < last_deliver_ns) {
+    deliver_at = last_deliver_ns;
+  }
+  last_deliver_ns = deliver_at;
+  pthread_mutex_unlock(&lock);
+
+  sim_secondary_receive(frame, data_length, deliver_at);
+  return (ssize_t) data_length;
+}
+
+int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t *state){
+  if (handle.ptr == NULL || id != SL_CPC_ENDPOINT_USER_ID_0) {
+    return -EINVAL;
+  }
+  pthread_mutex_lock(&lock);
+  if (sim_now_ns() < closing_until_ns) {
+    *state = SL_CPC_STATE_CLOSING;
+  } else {
+    *state = (open_endpoints > 0) ? SL_CPC_STATE_OPEN : SL_CPC_STATE_CLOSED;
+  }
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen){
+  struct sim_endpoint *ep = endpoint.ptr;
+
+  if (ep == NULL) {
+    return -EINVAL;
+  }
+  pthread_mutex_lock(&lock);
+  switch (option) {
+    case CPC_OPTION_RX_TIMEOUT:
+      if (optlen != sizeof(cpc_timeval_t)) {
+        pthread_mutex_unlock(&lock);
+        return -EINVAL;
+      }
+      memcpy(&ep->rx_timeout, optval, sizeof(cpc_timeval_t));
+      break;
+    case CPC_OPTION_BLOCKING:
+      if (optlen != sizeof(bool)) {
+        pthread_mutex_unlock(&lock);
+        return -EINVAL;
+      }
+      memcpy(&ep->blocking, optval, sizeof(bool));
+      break;
+    default:
+      break; // accepted and ignored
+  }
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+int cpc_get_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, void *optval, size_t *optlen){
+  struct sim_endpoint *ep = endpoint.ptr;
+
+  if (ep == NULL) {
+    return -EINVAL;
+  }
+  switch (option) {
+    case CPC_OPTION_RX_TIMEOUT:
+      if (*optlen < sizeof(cpc_timeval_t)) {
+        return -EINVAL;
+      }
+      pthread_mutex_lock(&lock);
+      memcpy(optval, &ep->rx_timeout, sizeof(cpc_timeval_t));
+      pthread_mutex_unlock(&lock);
+      *optlen = sizeof(cpc_timeval_t);
+      return 0;
+    case CPC_OPTION_MAX_WRITE_SIZE:
+      if (*optlen < sizeof(size_t)) {
+        return -EINVAL;
+      }
+      *(size_t *) optval = SL_CPC_READ_MINIMUM_SIZE;
+      *optlen = sizeof(size_t);
+      return 0;
+    default:
+      return -EINVAL;
+  }
+}
+
+ssize_t cpc_get_endpoint_max_write_size(cpc_endpoint_t endpoint){
+  return (endpoint.ptr != NULL) ? SL_CPC_READ_MINIMUM_SIZE : -EINVAL;
+}
@@ -0,0 +1,65 @@
+/***************************************************************************//**
+ * @file
+ * @brief btl_interface.h
+ * Simulator stand-in for the bootloader interface and application properties
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef BTL_INTERFACE_H
+#define BTL_INTERFACE_H
+
+#include <stdint.h>
+
+typedef enum {
+  NONE,
+  SL_BOOTLOADER
+} BootloaderType_t;
+
+typedef struct {
+  BootloaderType_t type;
+  uint32_t version;
+  uint32_t capabilities;
+} BootloaderInformation_t;
+
+void bootloader_getInfo(BootloaderInformation_t *info);
+
+typedef struct {
+  uint32_t type;
+  uint32_t version;
+  uint32_t capabilities;
+  uint8_t productId[16];
+} ApplicationData_t;
+
+typedef struct {
+  uint8_t magic[16];
+  uint32_t structVersion;
+  uint32_t signatureType;
+  uint32_t signatureLocation;
+  ApplicationData_t app;
+} ApplicationProperties_t;
+
+#endif /* BTL_INTERFACE_H */
@@ -0,0 +1,50 @@
+/***************************************************************************//**
+ * @file
+ * @brief em_core.h
+ * Simulator stand-in for emlib critical sections
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef EM_CORE_H
+#define EM_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t CORE_irqState_t;
+
+// Atomic sections map to a recursive lock shared by all simulated "IRQs"
+void sim_core_enter(void);
+void sim_core_exit(void);
+
+#define CORE_DECLARE_IRQ_STATE CORE_irqState_t irqState = 0
+#define CORE_ENTER_ATOMIC()   do { (void) irqState; sim_core_enter(); } while (0)
+#define CORE_EXIT_ATOMIC()    sim_core_exit()
+#define CORE_ENTER_CRITICAL() CORE_ENTER_ATOMIC()
+#define CORE_EXIT_CRITICAL()  CORE_EXIT_ATOMIC()
+
+#endif /* EM_CORE_H */
@@ -0,0 +1,68 @@
+/***************************************************************************//**
+ * @file
+ * @brief em_device.h
+ * Simulator stand-in for the device header: memory map of the simulated RCP
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef EM_DEVICE_H
+#define EM_DEVICE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "em_assert.h"
+
+// USERDATA page, backed by RAM in the simulator (see rcp_stubs.c)
+#define USERDATA_SIZE 1024u
+extern uint32_t sim_userdata[USERDATA_SIZE / sizeof(uint32_t)];
+#define USERDATA_BASE ((uintptr_t) sim_userdata)
+
+// Core clock, and the DWT cycle counter counting it from the host clock
+#define SIM_CORE_CLOCK_HZ 80000000u
+uint32_t SystemCoreClockGet(void);
+
+typedef struct {
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+
+// Refreshes CYCCNT on every access
+DWT_Type *sim_dwt(void);
+extern CoreDebug_Type sim_core_debug;
+#define DWT (sim_dwt())
+#define CoreDebug (&sim_core_debug)
+
+#endif /* EM_DEVICE_H */
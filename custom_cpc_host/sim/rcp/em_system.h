@@ -0,0 +1,45 @@
+/***************************************************************************//**
+ * @file
+ * @brief em_system.h
+ * Simulator stand-in for emlib SYSTEM
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef EM_SYSTEM_H
+#define EM_SYSTEM_H
+
+#include <stdint.h>
+
+typedef enum {
+  systemPartFamilyUnknown = 0xFF,
+  systemPartFamilyMighty21 = 0x01150000 // the simulated device
+} SYSTEM_PartFamily_TypeDef;
+
+SYSTEM_PartFamily_TypeDef SYSTEM_GetFamily(void);
+uint64_t SYSTEM_GetUnique(void);
+
+#endif /* EM_SYSTEM_H */
@@ -0,0 +1,69 @@
+/***************************************************************************//**
+ * @file
+ * @brief rail.h
+ * Simulator stand-in for the RAIL API (subset used by cpc_custom.c)
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef RAIL_H
+#define RAIL_H
+
+#include <stdint.h>
+
+typedef void *RAIL_Handle_t;
+
+typedef uint8_t RAIL_Status_t;
+enum {
+  RAIL_STATUS_NO_ERROR,
+  RAIL_STATUS_INVALID_PARAMETER,
+  RAIL_STATUS_INVALID_STATE,
+  RAIL_STATUS_INVALID_CALL,
+  RAIL_STATUS_SUSPENDED
+};
+
+typedef uint8_t RAIL_StreamMode_t;
+enum {
+  RAIL_STREAM_CARRIER_WAVE = 0,
+  RAIL_STREAM_PN9_STREAM = 1,
+  RAIL_STREAM_10_STREAM = 2,
+  RAIL_STREAM_CARRIER_WAVE_PHASENOISE = 3,
+  RAIL_STREAM_RAMP_STREAM = 4,
+  RAIL_STREAM_CARRIER_WAVE_SHIFTED = 5,
+  RAIL_STREAM_MODES_COUNT
+};
+
+// Transmit power in deci-dBm
+typedef int16_t RAIL_TxPower_t;
+
+RAIL_Status_t RAIL_SetTune(RAIL_Handle_t railHandle, uint32_t tune);
+uint32_t RAIL_GetTune(RAIL_Handle_t railHandle);
+RAIL_Status_t RAIL_StartTxStream(RAIL_Handle_t railHandle, uint16_t channel, RAIL_StreamMode_t mode);
+RAIL_Status_t RAIL_StopTxStream(RAIL_Handle_t railHandle);
+RAIL_Status_t RAIL_SetTxPowerDbm(RAIL_Handle_t railHandle, RAIL_TxPower_t power);
+RAIL_TxPower_t RAIL_GetTxPowerDbm(RAIL_Handle_t railHandle);
+
+#endif /* RAIL_H */
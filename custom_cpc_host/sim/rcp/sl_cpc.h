@@ -0,0 +1,108 @@
+/***************************************************************************//**
+ * @file
+ * @brief sl_cpc.h
+ * Simulator stand-in for the CPC secondary API (subset used by cpc_custom.c)
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef SL_CPC_H
+#define SL_CPC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sl_status.h"
+#include "em_device.h"
+
+typedef enum {
+  SL_CPC_ENDPOINT_USER_ID_0 = 90,
+} sl_cpc_user_endpoint_id_t;
+
+enum {
+  SL_CPC_STATE_FREED = 0,
+  SL_CPC_STATE_OPEN,
+  SL_CPC_STATE_CLOSED,
+  SL_CPC_STATE_CLOSING,
+  SL_CPC_STATE_CONNECTING,
+  SL_CPC_STATE_CONNECTED,
+  SL_CPC_STATE_SHUTTING_DOWN,
+  SL_CPC_STATE_DISCONNECTED,
+  SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE,
+  SL_CPC_STATE_ERROR_SECURITY_INCIDENT,
+  SL_CPC_STATE_ERROR_FAULT
+};
+typedef uint8_t sl_cpc_endpoint_state_t;
+
+typedef enum {
+  SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE = 0,
+  SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE_ARG,
+  SL_CPC_ENDPOINT_ON_UFRAME_RECEIVE,
+  SL_CPC_ENDPOINT_ON_UFRAME_RECEIVE_ARG,
+  SL_CPC_ENDPOINT_ON_IFRAME_WRITE_COMPLETED,
+  SL_CPC_ENDPOINT_ON_UFRAME_WRITE_COMPLETED,
+  SL_CPC_ENDPOINT_ON_FINAL,
+  SL_CPC_ENDPOINT_ON_FINAL_ARG,
+  SL_CPC_ENDPOINT_ON_POLL,
+  SL_CPC_ENDPOINT_ON_POLL_ARG,
+  SL_CPC_ENDPOINT_ON_ERROR,
+  SL_CPC_ENDPOINT_ON_ERROR_ARG,
+  SL_CPC_ENDPOINT_ON_CONNECT,
+  SL_CPC_ENDPOINT_ON_CONNECT_ARG
+} sl_cpc_endpoint_option_t;
+
+typedef struct {
+  void *ep;
+  uint8_t id;
+} sl_cpc_endpoint_handle_t;
+
+typedef void (*sl_cpc_on_data_reception_t)(uint8_t endpoint_id, void *arg);
+typedef void (*sl_cpc_on_write_completed_t)(sl_cpc_user_endpoint_id_t endpoint_id, void *buffer, void *arg, sl_status_t status);
+typedef void (*sl_cpc_on_error_callback_t)(uint8_t endpoint_id, void *arg);
+typedef void (*sl_cpc_on_connect_callback_t)(uint8_t endpoint_id, void *arg);
+
+sl_status_t sl_cpc_open_user_endpoint(sl_cpc_endpoint_handle_t *endpoint_handle,
+                                      sl_cpc_user_endpoint_id_t id,
+                                      uint8_t flags,
+                                      uint8_t tx_window_size);
+sl_status_t sl_cpc_set_endpoint_option(sl_cpc_endpoint_handle_t *endpoint_handle,
+                                       sl_cpc_endpoint_option_t option,
+                                       void *value);
+sl_status_t sl_cpc_close_endpoint(sl_cpc_endpoint_handle_t *endpoint_handle);
+sl_status_t sl_cpc_read(sl_cpc_endpoint_handle_t *endpoint_handle,
+                        void **data,
+                        uint16_t *data_length,
+                        uint32_t timeout,
+                        uint8_t flags);
+sl_status_t sl_cpc_write(sl_cpc_endpoint_handle_t *endpoint_handle,
+                         void *data,
+                         uint16_t data_length,
+                         uint8_t flag,
+                         void *on_write_completed_arg);
+sl_cpc_endpoint_state_t sl_cpc_get_endpoint_state(sl_cpc_endpoint_handle_t *endpoint_handle);
+sl_status_t sl_cpc_free_rx_buffer(void *data);
+
+#endif /* SL_CPC_H */
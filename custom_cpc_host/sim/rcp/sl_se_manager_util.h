@@ -0,0 +1,46 @@
+/***************************************************************************//**
+ * @file
+ * @brief sl_se_manager_util.h
+ * Simulator stand-in for the SE manager utilities
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef SL_SE_MANAGER_UTIL_H
+#define SL_SE_MANAGER_UTIL_H
+
+#include <stdint.h>
+#include "sl_status.h"
+
+typedef struct {
+  uint32_t reserved;
+} sl_se_command_context_t;
+
+sl_status_t sl_se_get_se_version(sl_se_command_context_t *cmd_ctx, uint32_t *version);
+sl_status_t sl_se_write_user_data(sl_se_command_context_t *cmd_ctx, uint32_t offset, void *data, uint32_t num_bytes);
+sl_status_t sl_se_erase_user_data(sl_se_command_context_t *cmd_ctx);
+
+#endif /* SL_SE_MANAGER_UTIL_H */
@@ -0,0 +1,57 @@
+/***************************************************************************//**
+ * @file
+ * @brief sl_status.h
+ * Simulator stand-in for the Gecko SDK status codes
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef SL_STATUS_H
+#define SL_STATUS_H
+
+#include <stdint.h>
+
+typedef uint32_t sl_status_t;
+
+#define SL_STATUS_OK                0x0000
+#define SL_STATUS_FAIL              0x0001
+#define SL_STATUS_INVALID_STATE     0x0002
+#define SL_STATUS_NOT_READY         0x0003
+#define SL_STATUS_BUSY              0x0004
+#define SL_STATUS_IN_PROGRESS       0x0005
+#define SL_STATUS_ABORT             0x0006
+#define SL_STATUS_TIMEOUT           0x0007
+#define SL_STATUS_NOT_SUPPORTED     0x000F
+#define SL_STATUS_EMPTY             0x0011
+#define SL_STATUS_FULL              0x0012
+#define SL_STATUS_WOULD_OVERFLOW    0x0013
+#define SL_STATUS_ALLOCATION_FAILED 0x0019
+#define SL_STATUS_NO_MORE_RESOURCE  0x0019
+#define SL_STATUS_INVALID_PARAMETER 0x0021
+#define SL_STATUS_ALREADY_EXISTS    0x0022
+#define SL_STATUS_INVALID_RANGE     0x0028
+
+#endif /* SL_STATUS_H */
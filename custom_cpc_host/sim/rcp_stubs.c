@@ -0,0 +1,368 @@
+/***************************************************************************//**
+ * @file
+ * @brief rcp_stubs.c
+ * Simulated peripherals (RAIL, SE, MSC, bootloader) used by the RCP custom endpoint code
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_gpio.h"
+#include "em_msc.h"
+#include "em_system.h"
+#include "rail.h"
+#include "sl_se_manager_util.h"
+#include "btl_interface.h"
+#include "sl_sleeptimer.h"
+#include "sim_link.h"
+
+// Simulated firmware versions, chosen to be recognisable in the host output
+#define SIM_SE_VERSION          0x00020100
+#define SIM_BOOTLOADER_VERSION  0x00020400
+#define SIM_APP_VERSION         0x00000001
+#define SIM_DEFAULT_CTUNE       0x8C
+#define SIM_UNIQUE_ID           0x000D6FFFFE5A1234ull
+
+// Transmit power range of the simulated PA, in deci-dBm
+#define SIM_MIN_POWER_DDBM      (-300)
+#define SIM_MAX_POWER_DDBM      200
+
+// USERDATA flash page, erased at start-up
+uint32_t sim_userdata[USERDATA_SIZE / 4] = { [0 ... (USERDATA_SIZE / 4) - 1] = 0xFFFFFFFF };
+
+static uint32_t rail_tune = SIM_DEFAULT_CTUNE;
+static bool rail_streaming = false;
+static RAIL_TxPower_t rail_power = 0;
+static int rail_handle_storage;
+RAIL_Handle_t emPhyRailHandle = &rail_handle_storage;
+
+// Not const so that CPC_SIM_APP_VERSION can "reflash" the application,
+// see sim_firmware_app_version()
+ApplicationProperties_t sl_app_properties = {
+  .app = { .version = SIM_APP_VERSION },
+};
+
+static bool in_userdata(const void *address, uint32_t numBytes){
+  const uint8_t *start = (const uint8_t *) sim_userdata;
+  const uint8_t *p = address;
+
+  return (p >= start) && (p + numBytes <= start + USERDATA_SIZE);
+}
+
+/***************************************************************************//**
+ * RAIL
+ ******************************************************************************/
+
+RAIL_Status_t RAIL_SetTune(RAIL_Handle_t railHandle, uint32_t tune){
+  (void) railHandle;
+  if (rail_streaming) {
+    return RAIL_STATUS_INVALID_STATE;
+  }
+  rail_tune = tune;
+  return RAIL_STATUS_NO_ERROR;
+}
+
+uint32_t RAIL_GetTune(RAIL_Handle_t railHandle){
+  (void) railHandle;
+  return rail_tune;
+}
+
+RAIL_Status_t RAIL_StartTxStream(RAIL_Handle_t railHandle, uint16_t channel, RAIL_StreamMode_t mode){
+  (void) railHandle;
+  if ((channel < 11) || (channel > 26) || (mode >= RAIL_STREAM_MODES_COUNT)) {
+    return RAIL_STATUS_INVALID_PARAMETER;
+  }
+  rail_streaming = true;
+  return RAIL_STATUS_NO_ERROR;
+}
+
+RAIL_Status_t RAIL_StopTxStream(RAIL_Handle_t railHandle){
+  (void) railHandle;
+  rail_streaming = false;
+  return RAIL_STATUS_NO_ERROR;
+}
+
+// Like the PA, out of range powers are clamped rather than refused
+RAIL_Status_t RAIL_SetTxPowerDbm(RAIL_Handle_t railHandle, RAIL_TxPower_t power){
+  (void) railHandle;
+  if (power > SIM_MAX_POWER_DDBM) {
+    power = SIM_MAX_POWER_DDBM;
+  } else if (power < SIM_MIN_POWER_DDBM) {
+    power = SIM_MIN_POWER_DDBM;
+  }
+  rail_power = power;
+  return RAIL_STATUS_NO_ERROR;
+}
+
+RAIL_TxPower_t RAIL_GetTxPowerDbm(RAIL_Handle_t railHandle){
+  (void) railHandle;
+  return rail_power;
+}
+
+/***************************************************************************//**
+ * Flash (MSC and SE). Writes can only clear bits, like NOR flash.
+ * CPC_SIM_FLASH_ERASE_US and CPC_SIM_FLASH_WORD_US add the time a page
+ * erase and a word write take on the chip (default 0).
+ ******************************************************************************/
+
+enum { FLASH_ERASE, FLASH_WORD };
+
+static void flash_delay(int op, uint32_t count){
+  static bool loaded = false;
+  static unsigned long us[2];
+
+  if (!loaded) {
+    const char *erase = getenv("CPC_SIM_FLASH_ERASE_US");
+    const char *word = getenv("CPC_SIM_FLASH_WORD_US");
+
+    us[FLASH_ERASE] = (erase != NULL) ? strtoul(erase, NULL, 0) : 0;
+    us[FLASH_WORD] = (word != NULL) ? strtoul(word, NULL, 0) : 0;
+    loaded = true;
+  }
+  if (us[op] > 0 && count > 0) {
+    unsigned long total = us[op] * count;
+    struct timespec ts = { (time_t) (total / 1000000), (long) (total % 1000000) * 1000 };
+
+    nanosleep(&ts, NULL);
+  }
+}
+
+void MSC_Init(void){
+}
+
+void MSC_Deinit(void){
+}
+
+MSC_Status_TypeDef MSC_WriteWord(uint32_t *address, void const *data, uint32_t numBytes){
+  uint32_t word;
+
+  if (((uintptr_t) address & 3u) || (numBytes & 3u)) {
+    return mscReturnUnaligned;
+  }
+  if (!in_userdata(address, numBytes)) {
+    return mscReturnInvalidAddr;
+  }
+  for (uint32_t i = 0; i < numBytes / 4; i++) {
+    memcpy(&word, (const uint8_t *) data + 4 * i, sizeof(word));
+    address[i] &= word;
+  }
+  flash_delay(FLASH_WORD, numBytes / 4);
+  return mscReturnOk;
+}
+
+MSC_Status_TypeDef MSC_ErasePage(uint32_t *startAddress){
+  if (startAddress != sim_userdata) {
+    return mscReturnInvalidAddr;
+  }
+  memset(sim_userdata, 0xFF, USERDATA_SIZE);
+  flash_delay(FLASH_ERASE, 1);
+  return mscReturnOk;
+}
+
+sl_status_t sl_se_get_se_version(sl_se_command_context_t *cmd_ctx, uint32_t *version){
+  (void) cmd_ctx;
+  *version = SIM_SE_VERSION;
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_se_write_user_data(sl_se_command_context_t *cmd_ctx, uint32_t offset, void *data, uint32_t num_bytes){
+  uint8_t *dest = (uint8_t *) sim_userdata + offset;
+  (void) cmd_ctx;
+
+  if ((offset & 3u) || (num_bytes & 3u) || !in_userdata(dest, num_bytes)) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+  // The SE refuses to program words that are not erased
+  for (uint32_t i = 0; i < num_bytes; i++) {
+    if (dest[i] != 0xFF) {
+      return SL_STATUS_FAIL;
+    }
+  }
+  memcpy(dest, data, num_bytes);
+  flash_delay(FLASH_WORD, num_bytes / 4);
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_se_erase_user_data(sl_se_command_context_t *cmd_ctx){
+  (void) cmd_ctx;
+  memset(sim_userdata, 0xFF, USERDATA_SIZE);
+  flash_delay(FLASH_ERASE, 1);
+  return SL_STATUS_OK;
+}
+
+/***************************************************************************//**
+ * Sleeptimer. Only used from the secondary thread, so no locking.
+ ******************************************************************************/
+
+#define SIM_SLEEPTIMER_HZ 32768
+
+static sl_sleeptimer_timer_handle_t *timers = NULL;
+
+static void unlink_timer(sl_sleeptimer_timer_handle_t *handle){
+  for (sl_sleeptimer_timer_handle_t **t = &timers; *t != NULL; t = &(*t)->next) {
+    if (*t == handle) {
+      *t = handle->next;
+      break;
+    }
+  }
+  handle->running = false;
+}
+
+sl_status_t sl_sleeptimer_start_timer_ms(sl_sleeptimer_timer_handle_t *handle,
+                                         uint32_t timeout_ms,
+                                         sl_sleeptimer_timer_callback_t callback,
+                                         void *callback_data,
+                                         uint8_t priority,
+                                         uint16_t option_flags){
+  (void) priority;
+  (void) option_flags;
+
+  if (handle->running) {
+    return SL_STATUS_NOT_READY; // as the real driver, stop it first
+  }
+  handle->callback = callback;
+  handle->callback_data = callback_data;
+  handle->expire_ns = sim_now_ns() + (uint64_t) timeout_ms * 1000000ull;
+  handle->running = true;
+  handle->next = timers;
+  timers = handle;
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_sleeptimer_stop_timer(sl_sleeptimer_timer_handle_t *handle){
+  if (!handle->running) {
+    return SL_STATUS_INVALID_STATE;
+  }
+  unlink_timer(handle);
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_sleeptimer_is_timer_running(const sl_sleeptimer_timer_handle_t *handle, bool *running){
+  *running = handle->running;
+  return SL_STATUS_OK;
+}
+
+uint64_t sl_sleeptimer_get_tick_count64(void){
+  uint64_t ns = sim_now_ns();
+
+  return (ns / 1000000000ull) * SIM_SLEEPTIMER_HZ + (ns % 1000000000ull) * SIM_SLEEPTIMER_HZ / 1000000000ull;
+}
+
+sl_status_t sl_sleeptimer_tick64_to_ms(uint64_t tick, uint64_t *ms){
+  *ms = tick * 1000 / SIM_SLEEPTIMER_HZ;
+  return SL_STATUS_OK;
+}
+
+uint32_t sl_sleeptimer_get_timer_frequency(void){
+  return SIM_SLEEPTIMER_HZ;
+}
+
+void sim_sleeptimer_run(uint64_t now_ns){
+  sl_sleeptimer_timer_handle_t *t = timers;
+
+  while (t != NULL) {
+    sl_sleeptimer_timer_handle_t *next = t->next;
+
+    if (t->expire_ns <= now_ns) {
+      unlink_timer(t);
+      t->callback(t, t->callback_data);
+      next = timers; // the callback may have changed the list
+    }
+    t = next;
+  }
+}
+
+uint64_t sim_sleeptimer_next_ns(void){
+  uint64_t next = UINT64_MAX;
+
+  for (sl_sleeptimer_timer_handle_t *t = timers; t != NULL; t = t->next) {
+    if (t->expire_ns < next) {
+      next = t->expire_ns;
+    }
+  }
+  return next;
+}
+
+/***************************************************************************//**
+ * Bootloader, device identity, GPIO and clocks
+ ******************************************************************************/
+
+uint32_t sim_firmware_app_version(void){
+  const char *version = getenv("CPC_SIM_APP_VERSION");
+
+  return ((version != NULL) && (*version != '\0')) ? (uint32_t) strtoul(version, NULL, 0) : SIM_APP_VERSION;
+}
+
+void sim_firmware_boot(void){
+  sl_app_properties.app.version = sim_firmware_app_version();
+}
+
+void bootloader_getInfo(BootloaderInformation_t *info){
+  info->type = SL_BOOTLOADER;
+  info->version = SIM_BOOTLOADER_VERSION;
+  info->capabilities = 0;
+}
+
+SYSTEM_PartFamily_TypeDef SYSTEM_GetFamily(void){
+  return systemPartFamilyMighty21;
+}
+
+uint64_t SYSTEM_GetUnique(void){
+  return SIM_UNIQUE_ID;
+}
+
+uint32_t SystemCoreClockGet(void){
+  return SIM_CORE_CLOCK_HZ;
+}
+
+CoreDebug_Type sim_core_debug;
+static DWT_Type sim_dwt_regs;
+
+DWT_Type *sim_dwt(void){
+  if (sim_dwt_regs.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+    uint64_t ns = sim_now_ns();
+
+    sim_dwt_regs.CYCCNT = (uint32_t) ((ns / 1000000000ull) * SIM_CORE_CLOCK_HZ
+                                      + (ns % 1000000000ull) * SIM_CORE_CLOCK_HZ / 1000000000ull);
+  }
+  return &sim_dwt_regs;
+}
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out){
+  (void) port;
+  (void) pin;
+  (void) mode;
+  (void) out;
+}
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable){
+  (void) clock;
+  (void) enable;
+}
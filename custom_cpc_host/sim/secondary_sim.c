@@ -0,0 +1,424 @@
+/***************************************************************************//**
+ * @file
+ * @brief secondary_sim.c
+ * Simulated CPC secondary core running the RCP custom endpoint code
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sl_cpc.h"
+#include "cpc_custom.h"
+#include "sim_link.h"
+
+struct sim_frame {
+  struct sim_frame *next;
+  uint64_t deliver_at_ns;
+  uint16_t len;
+  uint8_t data[];
+};
+
+struct sim_completion {
+  struct sim_completion *next;
+  void *buffer;
+  void *arg;
+};
+
+// Shared with host threads, guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct sim_frame *inbox_head = NULL;
+static struct sim_frame *inbox_tail = NULL;
+static bool connect_pending = false;
+static bool disconnect_pending = false;
+
+// Only used from the secondary thread
+static struct sim_frame *rx_head = NULL;
+static struct sim_frame *rx_tail = NULL;
+static struct sim_completion *completions = NULL;
+static sl_cpc_on_data_reception_t on_receive = NULL;
+static sl_cpc_on_write_completed_t on_write_completed = NULL;
+static sl_cpc_on_error_callback_t on_error = NULL;
+static sl_cpc_on_connect_callback_t on_connect = NULL;
+
+// Written by the secondary thread, read by host threads under lock
+static sl_cpc_endpoint_state_t endpoint_state = SL_CPC_STATE_FREED;
+static uint64_t loop_wakeups = 0;
+static uint64_t loop_runs = 0;
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_t secondary_thread;
+
+// Recursive lock backing CORE_ENTER_ATOMIC()
+static pthread_mutex_t core_lock;
+static pthread_once_t core_once = PTHREAD_ONCE_INIT;
+
+static void core_lock_init(void){
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&core_lock, &attr);
+}
+
+void sim_core_enter(void){
+  pthread_once(&core_once, core_lock_init);
+  pthread_mutex_lock(&core_lock);
+}
+
+void sim_core_exit(void){
+  pthread_mutex_unlock(&core_lock);
+}
+
+uint64_t sim_now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void set_state(sl_cpc_endpoint_state_t state){
+  pthread_mutex_lock(&lock);
+  endpoint_state = state;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+static void free_frames(struct sim_frame **head, struct sim_frame **tail){
+  while (*head != NULL) {
+    struct sim_frame *f = *head;
+    *head = f->next;
+    free(f);
+  }
+  *tail = NULL;
+}
+
+/***************************************************************************//**
+ * CPC secondary API
+ ******************************************************************************/
+
+sl_status_t sl_cpc_open_user_endpoint(sl_cpc_endpoint_handle_t *endpoint_handle,
+                                      sl_cpc_user_endpoint_id_t id,
+                                      uint8_t flags,
+                                      uint8_t tx_window_size){
+  (void) flags;
+  (void) tx_window_size;
+
+  endpoint_handle->ep = &endpoint_state;
+  endpoint_handle->id = (uint8_t) id;
+  if (endpoint_state != SL_CPC_STATE_FREED) {
+    return SL_STATUS_ALREADY_EXISTS;
+  }
+  set_state(SL_CPC_STATE_OPEN);
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_cpc_set_endpoint_option(sl_cpc_endpoint_handle_t *endpoint_handle,
+                                       sl_cpc_endpoint_option_t option,
+                                       void *value){
+  (void) endpoint_handle;
+
+  switch (option) {
+    case SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE:
+      on_receive = (sl_cpc_on_data_reception_t) value;
+      break;
+    case SL_CPC_ENDPOINT_ON_IFRAME_WRITE_COMPLETED:
+      on_write_completed = (sl_cpc_on_write_completed_t) value;
+      break;
+    case SL_CPC_ENDPOINT_ON_ERROR:
+      on_error = (sl_cpc_on_error_callback_t) value;
+      break;
+    case SL_CPC_ENDPOINT_ON_CONNECT:
+      on_connect = (sl_cpc_on_connect_callback_t) value;
+      break;
+    default:
+      return SL_STATUS_INVALID_PARAMETER;
+  }
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_cpc_close_endpoint(sl_cpc_endpoint_handle_t *endpoint_handle){
+  (void) endpoint_handle;
+
+  // Frames not yet read are lost, like on a real disconnect
+  free_frames(&rx_head, &rx_tail);
+  set_state(SL_CPC_STATE_FREED);
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_cpc_read(sl_cpc_endpoint_handle_t *endpoint_handle,
+                        void **data,
+                        uint16_t *data_length,
+                        uint32_t timeout,
+                        uint8_t flags){
+  struct sim_frame *f = rx_head;
+  (void) endpoint_handle;
+  (void) timeout;
+  (void) flags;
+
+  if (f == NULL) {
+    return SL_STATUS_EMPTY;
+  }
+  rx_head = f->next;
+  if (rx_head == NULL) {
+    rx_tail = NULL;
+  }
+  // The frame header is freed with the data in sl_cpc_free_rx_buffer()
+  *data = f->data;
+  *data_length = f->len;
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_cpc_free_rx_buffer(void *data){
+  free((uint8_t *) data - offsetof(struct sim_frame, data));
+  return SL_STATUS_OK;
+}
+
+sl_status_t sl_cpc_write(sl_cpc_endpoint_handle_t *endpoint_handle,
+                         void *data,
+                         uint16_t data_length,
+                         uint8_t flag,
+                         void *on_write_completed_arg){
+  struct sim_completion *c;
+  (void) endpoint_handle;
+  (void) flag;
+
+  if (endpoint_state != SL_CPC_STATE_CONNECTED) {
+    return SL_STATUS_INVALID_STATE;
+  }
+  c = malloc(sizeof(*c));
+  if (c == NULL) {
+    return SL_STATUS_ALLOCATION_FAILED;
+  }
+
+  sim_host_receive(data, data_length);
+
+  // Completion is reported later from the super loop, as on hardware
+  c->buffer = data;
+  c->arg = on_write_completed_arg;
+  c->next = completions;
+  completions = c;
+  return SL_STATUS_OK;
+}
+
+sl_cpc_endpoint_state_t sl_cpc_get_endpoint_state(sl_cpc_endpoint_handle_t *endpoint_handle){
+  (void) endpoint_handle;
+  return endpoint_state;
+}
+
+/***************************************************************************//**
+ * Secondary thread
+ ******************************************************************************/
+
+static void drop_completions(void){
+  while (completions != NULL) {
+    struct sim_completion *c = completions;
+    completions = c->next;
+    free(c);
+  }
+}
+
+static void run_completions(void){
+  struct sim_completion *list = completions;
+
+  completions = NULL;
+  while (list != NULL) {
+    struct sim_completion *c = list;
+    list = c->next;
+    if (on_write_completed != NULL) {
+      on_write_completed(SL_CPC_ENDPOINT_USER_ID_0, c->buffer, c->arg, SL_STATUS_OK);
+    }
+    free(c);
+  }
+}
+
+static void *secondary_main(void *arg){
+  (void) arg;
+
+  cpc_custom_init();
+
+  while (1) {
+    bool do_connect;
+    bool do_disconnect;
+    bool busy;
+    unsigned int received = 0;
+    uint64_t now = sim_now_ns();
+    uint64_t wake_at;
+
+    pthread_mutex_lock(&lock);
+    loop_wakeups++;
+    do_connect = connect_pending && (endpoint_state == SL_CPC_STATE_OPEN) && !disconnect_pending;
+    do_disconnect = disconnect_pending && (endpoint_state == SL_CPC_STATE_CONNECTED);
+    connect_pending &= !do_connect;
+    if (disconnect_pending) {
+      free_frames(&inbox_head, &inbox_tail);
+      disconnect_pending = false;
+      pthread_cond_broadcast(&cond);
+    }
+    if (do_disconnect) {
+      // Set under the lock, so a host reopening the endpoint waits for the
+      // RCP to reopen it
+      endpoint_state = SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE;
+    }
+    // Hand over frames whose link latency has elapsed
+    while ((inbox_head != NULL) && (inbox_head->deliver_at_ns <= now)) {
+      struct sim_frame *f = inbox_head;
+      inbox_head = f->next;
+      if (inbox_head == NULL) {
+        inbox_tail = NULL;
+      }
+      f->next = NULL;
+      if (rx_tail != NULL) {
+        rx_tail->next = f;
+      } else {
+        rx_head = f;
+      }
+      rx_tail = f;
+      received++;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (do_connect) {
+      set_state(SL_CPC_STATE_CONNECTED);
+      if (on_connect != NULL) {
+        on_connect(SL_CPC_ENDPOINT_USER_ID_0, NULL);
+      }
+    }
+    if (do_disconnect) {
+      // Writes not yet completed are dropped with the link, CPC never
+      // reports them
+      drop_completions();
+      if (on_error != NULL) {
+        on_error(SL_CPC_ENDPOINT_USER_ID_0, NULL);
+      }
+    }
+    while (received-- > 0) {
+      if (on_receive != NULL) {
+        on_receive(SL_CPC_ENDPOINT_USER_ID_0, NULL);
+      }
+    }
+    run_completions();
+    sim_sleeptimer_run(sim_now_ns());
+    busy = !cpc_custom_is_ok_to_sleep();
+    cpc_custom_process_action();
+
+    // Sleep until the next frame is due, an event arrives or a sleeptimer
+    // expires, like the EM2 sleep of the super loop
+    pthread_mutex_lock(&lock);
+    loop_runs += busy;
+    wake_at = sim_sleeptimer_next_ns();
+    if ((inbox_head != NULL) && (inbox_head->deliver_at_ns < wake_at)) {
+      wake_at = inbox_head->deliver_at_ns;
+    }
+    if (!connect_pending && !disconnect_pending && (completions == NULL) && cpc_custom_is_ok_to_sleep()) {
+      if (wake_at == UINT64_MAX) {
+        pthread_cond_wait(&cond, &lock);
+      } else {
+        struct timespec ts = { (time_t) (wake_at / 1000000000ull), (long) (wake_at % 1000000000ull) };
+        pthread_cond_timedwait(&cond, &lock, &ts);
+      }
+    }
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+static void start(void){
+  pthread_condattr_t attr;
+
+  // Waits use CLOCK_MONOTONIC deadlines
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond, &attr);
+
+  sim_firmware_boot();
+  pthread_create(&secondary_thread, NULL, secondary_main, NULL);
+  pthread_detach(secondary_thread);
+}
+
+void sim_secondary_start(void){
+  pthread_once(&start_once, start);
+}
+
+bool sim_secondary_wait_ready(uint64_t deadline_ns){
+  struct timespec ts = { (time_t) (deadline_ns / 1000000000ull), (long) (deadline_ns % 1000000000ull) };
+  bool ready;
+
+  pthread_mutex_lock(&lock);
+  // A disconnect still pending would drop the connection being opened
+  while ((disconnect_pending || ((endpoint_state != SL_CPC_STATE_OPEN) && (endpoint_state != SL_CPC_STATE_CONNECTED)))
+         && (pthread_cond_timedwait(&cond, &lock, &ts) == 0)) {
+  }
+  ready = !disconnect_pending && ((endpoint_state == SL_CPC_STATE_OPEN) || (endpoint_state == SL_CPC_STATE_CONNECTED));
+  pthread_mutex_unlock(&lock);
+  return ready;
+}
+
+void sim_secondary_counters(uint64_t *wakeups, uint64_t *runs){
+  pthread_mutex_lock(&lock);
+  *wakeups = loop_wakeups;
+  *runs = loop_runs;
+  pthread_mutex_unlock(&lock);
+}
+
+void sim_secondary_connect(void){
+  pthread_mutex_lock(&lock);
+  connect_pending = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+void sim_secondary_disconnect(void){
+  pthread_mutex_lock(&lock);
+  disconnect_pending = true;
+  connect_pending = false;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+void sim_secondary_receive(const uint8_t *frame, size_t len, uint64_t deliver_at_ns){
+  struct sim_frame *f = malloc(sizeof(*f) + len);
+
+  if (f == NULL) {
+    return; // lost on the link
+  }
+  f->next = NULL;
+  f->deliver_at_ns = deliver_at_ns;
+  f->len = (uint16_t) len;
+  memcpy(f->data, frame, len);
+
+  pthread_mutex_lock(&lock);
+  if (inbox_tail != NULL) {
+    inbox_tail->next = f;
+  } else {
+    inbox_head = f;
+  }
+  inbox_tail = f;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,87 @@
+/***************************************************************************//**
+ * @file
+ * @brief sim_link.h
+ * Interface between the simulated libcpc (host side) and the simulated secondary
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2024 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * SPDX-License-Identifier: Zlib
+ *
+ * The licensor of this software is Silicon Laboratories Inc.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ ******************************************************************************/
+
+#ifndef SIM_LINK_H_
+#define SIM_LINK_H_
+
+/*
+ * The simulator is split in two halves that are built against different
+ * sl_cpc.h headers, so they only share plain C types:
+ *
+ *  - libcpc_sim.c implements the libcpc host API used by custom_cpc_host
+ *    and applies the configured latency, jitter and drop rate.
+ *  - secondary_sim.c implements the CPC secondary API used by
+ *    RCP/cpc_custom.c and runs the RCP code in its own thread, like the
+ *    bare metal super loop.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t sim_now_ns(void);
+
+// Secondary side (secondary_sim.c)
+
+// Starts the secondary thread and runs cpc_custom_init() once
+void sim_secondary_start(void);
+
+// Waits until the RCP has opened its user endpoint. Returns false on timeout.
+bool sim_secondary_wait_ready(uint64_t deadline_ns);
+
+// Super loop passes since start, and those where cpc_custom_process_action()
+// had work (cpc_custom_signal() since the previous pass)
+void sim_secondary_counters(uint64_t *wakeups, uint64_t *runs);
+
+// Host endpoint connected / disconnected
+void sim_secondary_connect(void);
+void sim_secondary_disconnect(void);
+
+// Queues a host frame for the RCP, delivered at deliver_at_ns
+void sim_secondary_receive(const uint8_t *frame, size_t len, uint64_t deliver_at_ns);
+
+// Application version of the simulated firmware, CPC_SIM_APP_VERSION or
+// the built-in one (rcp_stubs.c). sim_firmware_boot() applies it.
+uint32_t sim_firmware_app_version(void);
+void sim_firmware_boot(void);
+
+// Sleeptimer (rcp_stubs.c): runs the callbacks of expired timers, and
+// returns the next expiry (UINT64_MAX if none)
+void sim_sleeptimer_run(uint64_t now_ns);
+uint64_t sim_sleeptimer_next_ns(void);
+
+// Host side (libcpc_sim.c)
+
+// Frame written by the RCP, called from the secondary thread
+void sim_host_receive(const uint8_t *frame, size_t len);
+
+#endif /* SIM_LINK_H_ */